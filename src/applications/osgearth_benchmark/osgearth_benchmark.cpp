@@ -0,0 +1,833 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osgDB/Registry>
+#include <osgEarth/Notify>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/ScreenSpaceLayout>
+#include <osgEarth/StringUtils>
+#include <osgEarth/VerticalDatum>
+#include <osgEarthUtil/HTM>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cfloat>
+#include <set>
+
+using namespace osgEarth;
+
+/**
+ * Headless micro-benchmarks for osgEarth's data-processing hot paths.
+ * Each benchmark runs an optimized algorithm against its reference
+ * implementation on synthetic data, and reports timings and the largest
+ * difference between the two results.
+ */
+
+#define LC "[osgearth_benchmark] "
+
+int
+usage(const std::string& msg)
+{
+    if ( !msg.empty() )
+        std::cout << msg << "\n\n";
+
+    std::cout
+        << "USAGE: osgearth_benchmark <benchmark> [options]\n"
+        << "\n"
+        << "    --elevation                     : ElevationLayerVector::populateHeightFieldAndNormalMap\n"
+        << "        [--layers <num>]            : number of elevation layers (default 3)\n"
+        << "        [--tiles <num>]             : number of tiles to build (default 64)\n"
+        << "        [--size <num>]              : posts per tile side (default 257)\n"
+        << "        [--no-normals]              : skip the normal map\n"
+        << "\n"
+        << "    --declutter                     : ScreenSpaceLayout decluttering (occupancy test)\n"
+        << "        [--labels <num>]            : number of labels per frame (default 20000)\n"
+        << "        [--frames <num>]            : number of frames (default 10)\n"
+        << "        [--viewport <w> <h>]        : window size in pixels (default 1920 1080)\n"
+        << "\n"
+        << "    --htm                           : HTMGroup loading (bulk load vs. one at a time)\n"
+        << "        [--objects <num>]           : number of point objects (default 200000)\n"
+        << "        [--max-objects <num>]       : maximum objects per cell (default 128)\n"
+        << "        [--remove <num>]            : objects to remove in one batch (default 10%)\n"
+        << "\n"
+        << "    --dxt                           : fastdxt texture compression throughput\n"
+        << "        [--size <num>]              : image size (default: 256, 512 and 1024)\n"
+        << "        [--iterations <num>]        : images to compress per test (default 20)\n"
+        << "        [--mipmaps]                 : also generate and compress the mipmaps\n"
+        << "\n"
+        << "    --heightfield                   : HeightFieldUtils resampling and normal maps\n"
+        << "        [--tiles <num>]             : number of tiles to process (default 100)\n"
+        << "        [--size <num>]              : posts per input tile side (default 257)\n"
+        << "        [--resample <num>]          : posts per side to resample to (default 129)\n"
+        << "\n"
+        << "    --vdatum                        : VerticalDatum heightfield conversion\n"
+        << "        [--datum <name>]            : vertical datum to convert from (default egm96)\n"
+        << "        [--tiles <num>]             : number of tiles to convert (default 100)\n"
+        << "        [--size <num>]              : posts per tile side (default 257)\n"
+        << std::endl;
+
+    return 0;
+}
+
+//..........................................................................
+
+namespace
+{
+    // Procedural elevation source; every other layer has square NODATA holes
+    // so that lower-priority layers have to fill in.
+    class SyntheticElevationSource : public TileSource
+    {
+    public:
+        SyntheticElevationSource(double scale, bool holes) :
+            TileSource(TileSourceOptions()), _scale(scale), _holes(holes) { }
+
+        Status initialize(const osgDB::Options* dbOptions)
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            return STATUS_OK;
+        }
+
+        CachePolicy getCachePolicyHint(const Profile* profile) const
+        {
+            return CachePolicy::NO_CACHE;
+        }
+
+        osg::HeightField* createHeightField(const TileKey& key, ProgressCallback* progress)
+        {
+            const GeoExtent& ex = key.getExtent();
+            unsigned size = getPixelsPerTile() + 1;
+            osg::HeightField* hf = HeightFieldUtils::createReferenceHeightField(ex, size, size, 0u);
+            for (unsigned r = 0; r < size; ++r)
+            {
+                double lat = ex.yMin() + ex.height() * (double)r / (double)(size-1);
+                for (unsigned c = 0; c < size; ++c)
+                {
+                    double lon = ex.xMin() + ex.width() * (double)c / (double)(size-1);
+                    bool hole = _holes && ((c/16 + r/16) % 4 == 0);
+                    hf->setHeight(c, r, hole ? NO_DATA_VALUE : (float)(_scale * (sin(lon*0.7) + cos(lat*1.3))));
+                }
+            }
+            return hf;
+        }
+
+    private:
+        double _scale;
+        bool   _holes;
+    };
+
+    // Runs "count" tiles through one of the two population methods and
+    // returns the elapsed time in seconds.
+    typedef bool (ElevationLayerVector::*PopulateMethod)(
+        osg::HeightField*, NormalMap*, const TileKey&, const Profile*, ElevationInterpolation, ProgressCallback*) const;
+
+    double
+    runElevation(const ElevationLayerVector& layers, PopulateMethod method, const std::vector<TileKey>& keys, unsigned size, bool normals,
+                 std::vector< osg::ref_ptr<osg::HeightField> >& output)
+    {
+        output.clear();
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        for (unsigned i = 0; i < keys.size(); ++i)
+        {
+            osg::ref_ptr<osg::HeightField> hf = HeightFieldUtils::createReferenceHeightField(keys[i].getExtent(), size, size, 0u);
+            osg::ref_ptr<NormalMap> normalMap = normals ? new NormalMap(size, size) : 0L;
+            (layers.*method)(hf.get(), normalMap.get(), keys[i], 0L, INTERP_BILINEAR, 0L);
+            output.push_back(hf.get());
+        }
+
+        return osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    }
+}
+
+int
+elevation( osg::ArgumentParser& args )
+{
+    unsigned numLayers = 3u, numTiles = 64u, size = 257u;
+    args.read("--layers", numLayers);
+    args.read("--tiles", numTiles);
+    args.read("--size", size);
+    bool normals = !args.read("--no-normals");
+
+    if ( numLayers == 0u || numTiles == 0u || size < 2u )
+        return usage("--layers and --tiles must be at least 1, and --size at least 2");
+
+    ElevationLayerVector layers;
+    for (unsigned i = 0; i < numLayers; ++i)
+    {
+        ElevationLayerOptions options(Stringify() << "synthetic" << i);
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        SyntheticElevationSource* source = new SyntheticElevationSource(1000.0 / (double)(i+1), (i%2) == 1);
+        source->open();
+        ElevationLayer* layer = new ElevationLayer(options, source);
+        if ( layer->open().isError() )
+            return usage(Stringify() << "Failed to open synthetic layer: " << layer->getStatus().message());
+        layers.push_back( layer );
+    }
+
+    // A block of adjacent tiles at a fixed LOD.
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    std::vector<TileKey> keys;
+    for (unsigned i = 0; i < numTiles; ++i)
+        keys.push_back( TileKey(8u, 100u + i%16u, 60u + i/16u, profile) );
+
+    // Warm up so that both runs see the same process state.
+    std::vector< osg::ref_ptr<osg::HeightField> > reference, optimized;
+    runElevation(layers, &ElevationLayerVector::populateHeightFieldAndNormalMap, std::vector<TileKey>(1, keys[0]), size, normals, optimized);
+
+    double referenceTime = runElevation(layers, &ElevationLayerVector::populateHeightFieldAndNormalMapPerPost, keys, size, normals, reference);
+    double optimizedTime = runElevation(layers, &ElevationLayerVector::populateHeightFieldAndNormalMap, keys, size, normals, optimized);
+
+    float maxError = 0.0f;
+    for (unsigned i = 0; i < keys.size(); ++i)
+    {
+        const osg::FloatArray* a = reference[i]->getFloatArray();
+        const osg::FloatArray* b = optimized[i]->getFloatArray();
+        for (unsigned j = 0; j < a->size(); ++j)
+            maxError = osg::maximum(maxError, fabsf((*a)[j] - (*b)[j]));
+    }
+
+    std::cout
+        << "Elevation: " << numLayers << " layers, " << numTiles << " tiles of " << size << "x" << size
+        << (normals ? " with normals" : "") << "\n"
+        << std::fixed << std::setprecision(3)
+        << "  per post : " << (1000.0*referenceTime/(double)numTiles) << " ms/tile\n"
+        << "  grid     : " << (1000.0*optimizedTime/(double)numTiles) << " ms/tile\n"
+        << "  speedup  : " << (optimizedTime > 0.0 ? referenceTime/optimizedTime : 0.0) << "x\n"
+        << std::setprecision(6)
+        << "  max diff : " << maxError << " m"
+        << std::endl;
+
+    return 0;
+}
+
+//..........................................................................
+
+namespace
+{
+    struct LabelBox
+    {
+        osg::BoundingBox _box;
+        const void*      _owner;
+    };
+
+    // Builds the window-space boxes of one frame's labels, already in
+    // priority order. Some labels hang partly off screen, and some pairs
+    // share an owner (like a label and its icon) to exercise the
+    // same-parent exemption.
+    void makeLabels(unsigned count, float width, float height, unsigned seed, std::vector<LabelBox>& labels)
+    {
+        srand(seed);
+        labels.resize(count);
+        for (unsigned i = 0; i < count; ++i)
+        {
+            float x = (float)(rand() % (int)(width  * 1.1f)) - width  * 0.05f;
+            float y = (float)(rand() % (int)(height * 1.1f)) - height * 0.05f;
+            float w = (float)(40 + rand() % 120);
+            float h = (float)(12 + rand() % 20);
+            labels[i]._box.set(floor(x), floor(y), 0.0f, ceil(x + w), ceil(y + h), 0.0f);
+            labels[i]._owner = (const void*)(size_t)(1u + i/2u);
+        }
+    }
+
+    // The original brute-force test: every label against every accepted box.
+    unsigned declutterBruteForce(const std::vector<LabelBox>& labels, std::vector<LabelBox>& used)
+    {
+        used.clear();
+        for (unsigned i = 0; i < labels.size(); ++i)
+        {
+            const osg::BoundingBox& box = labels[i]._box;
+            bool visible = true;
+            for (std::vector<LabelBox>::const_iterator j = used.begin(); j != used.end() && visible; ++j)
+            {
+                bool isClear =
+                    box.xMin() > j->_box.xMax() ||
+                    box.xMax() < j->_box.xMin() ||
+                    box.yMin() > j->_box.yMax() ||
+                    box.yMax() < j->_box.yMin();
+                if ( !isClear && labels[i]._owner != j->_owner )
+                    visible = false;
+            }
+            if ( visible )
+                used.push_back( labels[i] );
+        }
+        return used.size();
+    }
+
+    unsigned declutterGrid(const std::vector<LabelBox>& labels, float width, float height, ScreenSpaceOccupancyGrid& grid)
+    {
+        grid.reset(0.0f, 0.0f, width, height);
+        for (unsigned i = 0; i < labels.size(); ++i)
+        {
+            if ( !grid.intersects(labels[i]._box, labels[i]._owner) )
+                grid.insert(labels[i]._box, labels[i]._owner);
+        }
+        return grid.size();
+    }
+}
+
+int
+declutter( osg::ArgumentParser& args )
+{
+    unsigned numLabels = 20000u, numFrames = 10u;
+    float width = 1920.0f, height = 1080.0f;
+    args.read("--labels", numLabels);
+    args.read("--frames", numFrames);
+    args.read("--viewport", width, height);
+
+    if ( numFrames == 0u || width < 1.0f || height < 1.0f )
+        return usage("--frames must be at least 1, and the viewport at least 1x1");
+
+    std::vector< std::vector<LabelBox> > frames(numFrames);
+    for (unsigned f = 0; f < numFrames; ++f)
+        makeLabels(numLabels, width, height, 1000u + f, frames[f]);
+
+    std::vector<unsigned> referenceCount(numFrames), gridCount(numFrames);
+
+    std::vector<LabelBox> used;
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for (unsigned f = 0; f < numFrames; ++f)
+        referenceCount[f] = declutterBruteForce(frames[f], used);
+    double referenceTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    ScreenSpaceOccupancyGrid grid;
+    start = osg::Timer::instance()->tick();
+    for (unsigned f = 0; f < numFrames; ++f)
+        gridCount[f] = declutterGrid(frames[f], width, height, grid);
+    double gridTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    unsigned mismatches = 0u, visible = 0u;
+    for (unsigned f = 0; f < numFrames; ++f)
+    {
+        if ( referenceCount[f] != gridCount[f] )
+            ++mismatches;
+        visible += gridCount[f];
+    }
+
+    std::cout
+        << "Declutter: " << numLabels << " labels, " << numFrames << " frames, "
+        << width << "x" << height << " window\n"
+        << std::fixed << std::setprecision(3)
+        << "  brute force : " << (1000.0*referenceTime/(double)numFrames) << " ms/frame\n"
+        << "  grid        : " << (1000.0*gridTime/(double)numFrames) << " ms/frame\n"
+        << "  speedup     : " << (gridTime > 0.0 ? referenceTime/gridTime : 0.0) << "x\n"
+        << "  visible     : " << (visible/numFrames) << " labels/frame\n"
+        << "  mismatches  : " << mismatches << " frames"
+        << std::endl;
+
+    return mismatches == 0u ? 0 : 1;
+}
+
+//..........................................................................
+
+namespace
+{
+    // Point objects scattered over the globe, more densely in some places.
+    void makePointObjects(unsigned count, osg::NodeList& nodes)
+    {
+        srand(1234u);
+        nodes.reserve(count);
+        for (unsigned i = 0; i < count; ++i)
+        {
+            double lon = osg::DegreesToRadians(-180.0 + 360.0 * (double)rand() / (double)RAND_MAX);
+            double lat = osg::DegreesToRadians(-90.0 + 180.0 * (double)rand() / (double)RAND_MAX);
+            if ( i % 2u == 0u )
+                lat *= 0.25; // cluster half of them near the equator
+
+            osg::Vec3d p(cos(lat)*cos(lon), cos(lat)*sin(lon), sin(lat));
+
+            osg::Node* node = new osg::Node();
+            node->setInitialBound( osg::BoundingSphere(p * 6378137.0, 10.0f) );
+            nodes.push_back( node );
+        }
+    }
+
+    // Counts the cells of an HTM tree and how full its leaves are.
+    struct HTMStats : public osg::NodeVisitor
+    {
+        HTMStats() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _cells(0u), _leaves(0u), _objects(0u), _maxObjects(0u), _depth(0u), _maxDepth(0u) { }
+
+        void apply(osg::Group& group)
+        {
+            Util::HTMNode* cell = dynamic_cast<Util::HTMNode*>(&group);
+            if ( !cell )
+            {
+                traverse(group);
+                return;
+            }
+
+            ++_cells;
+            _maxDepth = osg::maximum(_maxDepth, _depth);
+            if ( cell->isLeaf() )
+            {
+                ++_leaves;
+                _objects += cell->getNumChildren();
+                _maxObjects = osg::maximum(_maxObjects, cell->getNumChildren());
+            }
+
+            ++_depth;
+            for (unsigned i = 0; i < cell->getNumChildren(); ++i)
+            {
+                if ( dynamic_cast<Util::HTMNode*>(cell->getChild(i)) )
+                    cell->getChild(i)->accept(*this);
+            }
+            --_depth;
+        }
+
+        unsigned _cells, _leaves, _objects, _maxObjects, _depth, _maxDepth;
+    };
+
+    Util::HTMGroup* createHTMGroup(unsigned maxObjects)
+    {
+        Util::HTMGroup* htm = new Util::HTMGroup();
+        htm->setDebug(false);
+        htm->setMaximumObjectsPerCell(maxObjects);
+        htm->setStoreObjectsInLeavesOnly(true);
+        return htm;
+    }
+
+    void printHTMStats(const std::string& name, double seconds, Util::HTMGroup* htm)
+    {
+        HTMStats stats;
+        htm->accept(stats);
+        std::cout
+            << "  " << name << std::fixed << std::setprecision(3) << seconds << " s, "
+            << stats._cells << " cells, depth " << stats._maxDepth << ", "
+            << std::setprecision(1) << (stats._leaves > 0u ? (double)stats._objects/(double)stats._leaves : 0.0)
+            << " avg / " << stats._maxObjects << " max objects per leaf\n";
+    }
+}
+
+int
+htm( osg::ArgumentParser& args )
+{
+    unsigned numObjects = 200000u, maxObjects = 128u, numRemove = ~0u;
+    args.read("--objects", numObjects);
+    args.read("--max-objects", maxObjects);
+    args.read("--remove", numRemove);
+
+    if ( numObjects == 0u || maxObjects == 0u )
+        return usage("--objects and --max-objects must be at least 1");
+
+    if ( numRemove == ~0u )
+        numRemove = numObjects / 10u;
+    numRemove = osg::minimum(numRemove, numObjects);
+
+    osg::NodeList nodes;
+    makePointObjects(numObjects, nodes);
+
+    std::cout << "HTM: " << numObjects << " objects, at most " << maxObjects << " per cell\n";
+
+    // one at a time:
+    osg::ref_ptr<Util::HTMGroup> single = createHTMGroup(maxObjects);
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < nodes.size(); ++i)
+        single->addChild( nodes[i].get() );
+    double singleTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    printHTMStats("addChild    : ", singleTime, single.get());
+    single = 0L;
+
+    // bulk:
+    osg::ref_ptr<Util::HTMGroup> bulk = createHTMGroup(maxObjects);
+    start = osg::Timer::instance()->tick();
+    bulk->addChildren( nodes );
+    double bulkTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    printHTMStats("addChildren : ", bulkTime, bulk.get());
+
+    // batch removal, then rebalance:
+    osg::NodeList removals;
+    for (unsigned i = 0; i < numRemove; ++i)
+        removals.push_back( nodes[(i * 7919u) % nodes.size()] );
+
+    start = osg::Timer::instance()->tick();
+    unsigned removed = bulk->removeChildren( removals );
+    double removeTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    start = osg::Timer::instance()->tick();
+    bulk->rebalance();
+    double rebalanceTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    printHTMStats("rebalance   : ", rebalanceTime, bulk.get());
+
+    unsigned remaining = bulk->getNumObjects();
+
+    std::cout
+        << std::fixed << std::setprecision(3)
+        << "  remove      : " << removed << " objects in " << removeTime << " s\n"
+        << "  speedup     : " << (bulkTime > 0.0 ? singleTime/bulkTime : 0.0) << "x\n"
+        << "  remaining   : " << remaining << " objects"
+        << std::endl;
+
+    // removal picks indices with a stride, so some may repeat:
+    std::set<osg::Node*> unique;
+    for (unsigned i = 0; i < removals.size(); ++i)
+        unique.insert( removals[i].get() );
+
+    return (removed == unique.size() && remaining == numObjects - unique.size()) ? 0 : 1;
+}
+
+//..........................................................................
+
+namespace
+{
+    // Aerial-looking test image: smooth gradients with per-pixel noise,
+    // and an alpha channel with soft-edged holes.
+    osg::Image* makeTestImage(unsigned size, GLenum pixelFormat, unsigned seed)
+    {
+        srand(seed);
+        osg::Image* image = new osg::Image();
+        image->allocateImage(size, size, 1, pixelFormat, GL_UNSIGNED_BYTE);
+        unsigned components = osg::Image::computeNumComponents(pixelFormat);
+        for (unsigned t = 0; t < size; ++t)
+        {
+            unsigned char* p = image->data(0, t);
+            for (unsigned s = 0; s < size; ++s, p += components)
+            {
+                int noise = rand() % 32;
+                p[0] = (unsigned char)((s * 255u / size + noise) % 256);
+                p[1] = (unsigned char)((t * 255u / size + noise) % 256);
+                p[2] = (unsigned char)(((s ^ t) & 0x7f) + noise);
+                if (components == 4u)
+                    p[3] = (unsigned char)(((s/32u + t/32u) % 3u == 0u) ? noise * 4 : 255);
+            }
+        }
+        return image;
+    }
+
+    // Compressed size of an image and its mipmaps, for checking the output
+    unsigned getExpectedSize(unsigned size, unsigned blockSize, bool mipmaps)
+    {
+        unsigned bytes = 0u;
+        for (unsigned s = size; ; s /= 2u)
+        {
+            unsigned blocks = (s + 3u) / 4u;
+            bytes += blocks * blocks * blockSize;
+            if ( !mipmaps || s == 1u )
+                break;
+        }
+        return bytes;
+    }
+}
+
+int
+dxt( osg::ArgumentParser& args )
+{
+    std::vector<unsigned> sizes;
+    unsigned size = 0u, iterations = 20u;
+    if ( args.read("--size", size) )
+        sizes.push_back( size );
+    else {
+        sizes.push_back( 256u );
+        sizes.push_back( 512u );
+        sizes.push_back( 1024u );
+    }
+    args.read("--iterations", iterations);
+    bool mipmaps = args.read("--mipmaps");
+
+    if ( iterations == 0u || sizes[0] == 0u || (sizes[0] & (sizes[0]-1u)) != 0u )
+        return usage("--iterations must be at least 1, and --size a power of two");
+
+    osgDB::ImageProcessor* processor = osgDB::Registry::instance()->getImageProcessorForExtension("fastdxt");
+    if ( !processor )
+        return usage("Failed to load the fastdxt image processor");
+
+    std::cout
+        << "DXT: " << iterations << " images per test" << (mipmaps ? " with mipmaps" : "")
+        << (::getenv("OSGEARTH_FASTDXT_SINGLE_THREADED") ? ", single threaded" : "") << "\n";
+
+    struct Format {
+        const char* _name;
+        GLenum      _pixelFormat;
+        osg::Texture::InternalFormatMode _mode;
+        unsigned    _blockSize;
+    };
+    const Format formats[2] = {
+        { "DXT1", GL_RGB,  osg::Texture::USE_S3TC_DXT1_COMPRESSION, 8u },
+        { "DXT5", GL_RGBA, osg::Texture::USE_S3TC_DXT5_COMPRESSION, 16u }
+    };
+
+    unsigned failures = 0u;
+    for (unsigned f = 0; f < 2u; ++f)
+    {
+        for (unsigned i = 0; i < sizes.size(); ++i)
+        {
+            // Compressing replaces the image data, so each pass needs fresh images.
+            std::vector< osg::ref_ptr<osg::Image> > images;
+            for (unsigned n = 0; n < iterations; ++n)
+                images.push_back( makeTestImage(sizes[i], formats[f]._pixelFormat, 100u + n) );
+
+            // warm up, so the first test doesn't pay to start the thread pool
+            osg::ref_ptr<osg::Image> warmup = makeTestImage(sizes[i], formats[f]._pixelFormat, 99u);
+            processor->compress(*warmup.get(), formats[f]._mode, mipmaps, true, osgDB::ImageProcessor::USE_CPU, osgDB::ImageProcessor::FASTEST);
+
+            double inputBytes = 0.0;
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            for (unsigned n = 0; n < iterations; ++n)
+            {
+                inputBytes += (double)images[n]->getTotalSizeInBytes();
+                processor->compress(*images[n].get(), formats[f]._mode, mipmaps, true, osgDB::ImageProcessor::USE_CPU, osgDB::ImageProcessor::FASTEST);
+            }
+            double seconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+            unsigned expected = getExpectedSize(sizes[i], formats[f]._blockSize, mipmaps);
+            for (unsigned n = 0; n < iterations; ++n)
+            {
+                if ( !images[n]->isCompressed() || images[n]->getTotalSizeInBytesIncludingMipmaps() != expected )
+                    ++failures;
+            }
+
+            std::cout
+                << "  " << formats[f]._name << " " << std::setw(4) << sizes[i] << "x" << std::setw(4) << std::left << sizes[i] << std::right << " : "
+                << std::fixed << std::setprecision(3) << (1000.0*seconds/(double)iterations) << " ms/image, "
+                << std::setprecision(1) << (seconds > 0.0 ? inputBytes/(1048576.0*seconds) : 0.0) << " MB/s\n";
+        }
+    }
+
+    std::cout << "  failures    : " << failures << " images" << std::endl;
+
+    return failures == 0u ? 0 : 1;
+}
+
+//..........................................................................
+
+namespace
+{
+    // Terrain for one tile of a 3x3 block, with square NO_DATA holes.
+    osg::HeightField* makeHeightField(const TileKey& key, unsigned size)
+    {
+        const GeoExtent& ex = key.getExtent();
+        osg::HeightField* hf = HeightFieldUtils::createReferenceHeightField(ex, size, size, 0u);
+        for (unsigned r = 0; r < size; ++r)
+        {
+            double lat = ex.yMin() + ex.height() * (double)r / (double)(size-1);
+            for (unsigned c = 0; c < size; ++c)
+            {
+                double lon = ex.xMin() + ex.width() * (double)c / (double)(size-1);
+                bool hole = ((c/16 + r/16) % 7 == 0);
+                hf->setHeight(c, r, hole ? NO_DATA_VALUE : (float)(1000.0 * (sin(lon*20.0) + cos(lat*30.0))));
+            }
+        }
+        return hf;
+    }
+
+    float maxHeightDiff(const osg::HeightField* a, const osg::HeightField* b)
+    {
+        float maxError = 0.0f;
+        const osg::FloatArray* fa = a->getFloatArray();
+        const osg::FloatArray* fb = b->getFloatArray();
+        for (unsigned i = 0; i < fa->size() && i < fb->size(); ++i)
+        {
+            if ( (*fa)[i] != NO_DATA_VALUE && (*fb)[i] != NO_DATA_VALUE )
+                maxError = osg::maximum(maxError, fabsf((*fa)[i] - (*fb)[i]));
+            else if ( (*fa)[i] != (*fb)[i] )
+                return FLT_MAX;
+        }
+        return fa->size() == fb->size() ? maxError : FLT_MAX;
+    }
+
+    void printHeightFieldResult(const std::string& name, double referenceTime, double gridTime, unsigned numTiles, float maxError, const char* units)
+    {
+        std::cout
+            << "  " << name << "\n"
+            << std::fixed << std::setprecision(3)
+            << "    per post : " << (1000.0*referenceTime/(double)numTiles) << " ms/tile\n"
+            << "    grid     : " << (1000.0*gridTime/(double)numTiles) << " ms/tile\n"
+            << "    speedup  : " << (gridTime > 0.0 ? referenceTime/gridTime : 0.0) << "x\n"
+            << std::setprecision(6)
+            << "    max diff : " << maxError << units << "\n";
+    }
+}
+
+int
+heightfield( osg::ArgumentParser& args )
+{
+    unsigned numTiles = 100u, size = 257u, resample = 129u;
+    args.read("--tiles", numTiles);
+    args.read("--size", size);
+    args.read("--resample", resample);
+
+    if ( numTiles == 0u || size < 2u || resample < 2u )
+        return usage("--tiles must be at least 1, and --size and --resample at least 2");
+
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    TileKey center(10, 600, 200, profile);
+
+    HeightFieldNeighborhood hood;
+    for (int y = -1; y <= 1; ++y)
+        for (int x = -1; x <= 1; ++x)
+            hood.setNeighbor(x, y, makeHeightField(center.createNeighborKey(x, y), size));
+
+    osg::HeightField* input = hood._center.get();
+    const GeoExtent& extent = center.getExtent();
+    GeoExtent childExtent = center.createChildKey(1).getExtent();
+
+    std::cout << "HeightField: " << numTiles << " tiles of " << size << "x" << size << "\n";
+
+    osg::ref_ptr<osg::HeightField> reference, grid;
+    float maxError = 0.0f;
+    bool mismatch = false;
+
+    // resampleHeightField
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < numTiles; ++i)
+        reference = HeightFieldUtils::resampleHeightFieldPerPost(input, extent, resample, resample, INTERP_BILINEAR);
+    double referenceTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < numTiles; ++i)
+        grid = HeightFieldUtils::resampleHeightField(input, extent, resample, resample, INTERP_BILINEAR);
+    double gridTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    maxError = maxHeightDiff(reference.get(), grid.get());
+    mismatch = mismatch || maxError == FLT_MAX;
+    printHeightFieldResult(Stringify() << "resampleHeightField to " << resample << "x" << resample, referenceTime, gridTime, numTiles, maxError, " m");
+
+    // createSubSample
+    start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < numTiles; ++i)
+        reference = HeightFieldUtils::createSubSamplePerPost(input, extent, childExtent, INTERP_BILINEAR);
+    referenceTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < numTiles; ++i)
+        grid = HeightFieldUtils::createSubSample(input, extent, childExtent, INTERP_BILINEAR);
+    gridTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    maxError = maxHeightDiff(reference.get(), grid.get());
+    mismatch = mismatch || maxError == FLT_MAX;
+    printHeightFieldResult("createSubSample of a child tile", referenceTime, gridTime, numTiles, maxError, " m");
+
+    // convertToNormalMap
+    osg::ref_ptr<NormalMap> referenceNormals, gridNormals;
+
+    start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < numTiles; ++i)
+        referenceNormals = HeightFieldUtils::convertToNormalMapPerPost(hood, profile->getSRS());
+    referenceTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    start = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < numTiles; ++i)
+        gridNormals = HeightFieldUtils::convertToNormalMap(hood, profile->getSRS());
+    gridTime = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    maxError = 0.0f;
+    for (unsigned t = 0; t < size; ++t)
+    {
+        for (unsigned s = 0; s < size; ++s)
+        {
+            if ( input->getHeight(s, t) != NO_DATA_VALUE )
+                maxError = osg::maximum(maxError, (referenceNormals->getNormal(s, t) - gridNormals->getNormal(s, t)).length());
+        }
+    }
+    printHeightFieldResult("convertToNormalMap", referenceTime, gridTime, numTiles, maxError, "");
+
+    std::cout << std::flush;
+
+    return mismatch ? 1 : 0;
+}
+
+//..........................................................................
+
+int
+vdatum( osg::ArgumentParser& args )
+{
+    std::string datumName = "egm96";
+    unsigned numTiles = 100u, size = 257u;
+    args.read("--datum", datumName);
+    args.read("--tiles", numTiles);
+    args.read("--size", size);
+
+    if ( numTiles == 0u || size < 2u )
+        return usage("--tiles must be at least 1 and --size at least 2");
+
+    const VerticalDatum* datum = VerticalDatum::get(datumName);
+    if ( !datum || !datum->getGeoid() )
+        return usage("Failed to load a geoid for vertical datum " + datumName);
+
+    // cycle through a row of 50 tiles, the way an elevation layer sees the
+    // same keys again as the terrain pages in and out
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    std::vector<TileKey> keys;
+    for (unsigned i = 0; i < numTiles; ++i)
+        keys.push_back(TileKey(8, 200 + (i % 50), 90, profile));
+
+    osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+    hf->allocate(size, size);
+
+    std::cout << "VerticalDatum: " << datum->getName() << " to HAE, "
+        << numTiles << " tiles of " << size << "x" << size << "\n";
+
+    double times[3];
+    for (unsigned method = 0; method < 3; ++method)
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for (unsigned i = 0; i < keys.size(); ++i)
+        {
+            hf->getFloatArray()->assign(size*size, 100.0f);
+            if ( method == 0 )
+                VerticalDatum::transformPerPost(datum, 0L, keys[i].getExtent(), hf.get());
+            else if ( method == 1 )
+                VerticalDatum::transform(datum, 0L, keys[i].getExtent(), hf.get());
+            else
+                VerticalDatum::transform(datum, 0L, keys[i], hf.get());
+        }
+        times[method] = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    }
+
+    const char* names[3] = { "per post  ", "grid      ", "tile cache" };
+    for (unsigned method = 0; method < 3; ++method)
+    {
+        std::cout
+            << "  " << names[method] << " : "
+            << std::fixed << std::setprecision(3)
+            << (1000.0*times[method]/(double)numTiles) << " ms/tile ("
+            << (times[method] > 0.0 ? times[0]/times[method] : 0.0) << "x)\n";
+    }
+
+    std::cout << std::flush;
+    return 0;
+}
+
+//..........................................................................
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser args(&argc,argv);
+
+    if ( args.read("--elevation") )
+        return elevation( args );
+    else if ( args.read("--declutter") )
+        return declutter( args );
+    else if ( args.read("--htm") )
+        return htm( args );
+    else if ( args.read("--dxt") )
+        return dxt( args );
+    else if ( args.read("--heightfield") )
+        return heightfield( args );
+    else if ( args.read("--vdatum") )
+        return vdatum( args );
+    else
+        return usage("");
+}
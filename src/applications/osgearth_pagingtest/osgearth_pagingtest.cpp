@@ -202,6 +202,11 @@ int main(int argc, char** argv)
         additive = true;
     }
 
+    bool async = arguments.read("--async");
+
+    int maxJobs = 4;
+    arguments.read("--max-jobs", maxJobs);
+
     bool spheres = false;
     if (arguments.read("--spheres"))
     {
@@ -231,6 +236,8 @@ int main(int argc, char** argv)
     {
         pager = new SimplePager( mapNode->getMap()->getProfile() );
         pager->setAdditive( additive );    
+        pager->setAsynchronous( async );
+        pager->setMaxConcurrentJobs( maxJobs );
         pager->build();    
         root->addChild( pager );
 
@@ -239,6 +246,8 @@ int main(int argc, char** argv)
     {
         pager = new BoxSimplePager( mapNode->getMap()->getProfile() );
         pager->setAdditive( additive );    
+        pager->setAsynchronous( async );
+        pager->setMaxConcurrentJobs( maxJobs );
         pager->build();    
         root->addChild( pager );
 
@@ -321,6 +330,8 @@ int main(int argc, char** argv)
             featurePager->setLODStyle(14, buildingStyle );
 
             featurePager->setAdditive( additive );    
+            featurePager->setAsynchronous( async );
+            featurePager->setMaxConcurrentJobs( maxJobs );
             featurePager->build();    
             root->addChild( featurePager );
 
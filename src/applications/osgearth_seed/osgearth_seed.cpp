@@ -35,6 +35,7 @@
 #include <osgEarth/ImageLayer>
 #include <osgEarth/ElevationLayer>
 #include <osgEarth/TileVisitor>
+#include <osgEarth/TileArchive>
 #include <osgEarth/FileUtils>
 
 #include <osgEarthFeatures/FeatureCursor>
@@ -53,6 +54,7 @@ using namespace osgEarth::Drivers;
 int list( osg::ArgumentParser& args );
 int seed( osg::ArgumentParser& args );
 int purge( osg::ArgumentParser& args );
+int archive( osg::ArgumentParser& args );
 int usage( const std::string& msg );
 int message( const std::string& msg );
 
@@ -68,6 +70,8 @@ int
         return list( args );
     else if ( args.read( "--purge" ) )
         return purge( args );        
+    else if ( args.read( "--archive" ) )
+        return archive( args );
     else
     return usage("");
 }
@@ -98,6 +102,13 @@ int
         << "        [--verbose]                     ; Displays progress of the seed operation" << std::endl
         << std::endl
         << "    --purge file.earth                  ; Purges a layer cache in a .earth file (interactive)" << std::endl
+        << std::endl
+        << "    --archive file.earth                ; Compacts the cached tiles of a .earth file into a read-only tile archive" << std::endl
+        << "        --out archive                   ; Archive file to create" << std::endl
+        << "        [--min-level level]             ; Lowest LOD level to archive (default=0)" << std::endl
+        << "        [--max-level level]             ; Highest LOD level to archive (default=20)" << std::endl
+        << "        [--page-size bytes]             ; Alignment of each tile in the archive (default=4096; 0=packed)" << std::endl
+        << "        [--verbose]                     ; Displays progress of the operation" << std::endl
         << std::endl;
 
     return -1;
@@ -592,4 +603,155 @@ purge( osg::ArgumentParser& args )
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Copies a layer's cached tiles into a tile archive, descending only
+ * into tiles whose parent was found in the cache.
+ */
+class ArchiveTileHandler : public TileHandler
+{
+public:
+    ArchiveTileHandler(TerrainLayer* layer, CacheBin* bin, TileArchiveWriter& writer, unsigned binIndex) :
+        _layer   ( layer ),
+        _bin     ( bin ),
+        _writer  ( writer ),
+        _binIndex( binIndex ),
+        _isImage ( dynamic_cast<ImageLayer*>(layer) != 0L ),
+        _count   ( 0u )
+    {
+        //nop
+    }
+
+    bool handleTile(const TileKey& key, const TileVisitor& tv)
+    {
+        std::string cacheKey = _layer->getCacheKey(key);
+
+        ReadResult rr = _isImage ?
+            _bin->readImage(cacheKey, 0L) :
+            _bin->readObject(cacheKey, 0L);
+
+        if ( rr.succeeded() )
+        {
+            if ( _writer.addObject(_binIndex, cacheKey, rr.getObject(), rr.metadata(), rr.lastModifiedTime()) )
+                ++_count;
+            else
+                OE_WARN << LC << _writer.getErrorMessage() << std::endl;
+            return true;
+        }
+
+        // nothing is cached above the layer's minimum level, so keep going.
+        return key.getLOD() < _layer->options().minLevel().getOrUse(0u);
+    }
+
+    bool hasData(const TileKey& key) const
+    {
+        return _layer->mayHaveData(key);
+    }
+
+    unsigned getCount() const { return _count; }
+
+private:
+    osg::ref_ptr<TerrainLayer> _layer;
+    osg::ref_ptr<CacheBin>     _bin;
+    TileArchiveWriter&         _writer;
+    unsigned                   _binIndex;
+    bool                       _isImage;
+    unsigned                   _count;
+};
+
+int
+archive( osg::ArgumentParser& args )
+{
+    std::string outFile;
+    if ( !args.read("--out", outFile) )
+        return usage( "Missing --out argument." );
+
+    int minLevel = -1;
+    while (args.read("--min-level", minLevel));
+
+    int maxLevel = -1;
+    while (args.read("--max-level", maxLevel));
+
+    unsigned pageSize = 4096u;
+    args.read("--page-size", pageSize);
+
+    bool verbose = args.read("--verbose");
+
+    // Only read from the existing cache; never go to the layer sources.
+    Registry::instance()->setOverrideCachePolicy( CachePolicy::CACHE_ONLY );
+
+    osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles( args );
+    if ( !node.valid() )
+        return usage( "Failed to read .earth file." );
+
+    MapNode* mapNode = MapNode::findMapNode( node.get() );
+    if ( !mapNode )
+        return usage( "Input file was not a .earth file" );
+
+    Map* map = mapNode->getMap();
+
+    if ( !map->getCache() )
+        return message( "Earth file does not contain a cache." );
+
+    TileArchiveWriter writer( outFile, pageSize );
+    if ( !writer.isOpen() )
+        return message( writer.getErrorMessage() );
+
+    TerrainLayerVector layers;
+    map->getLayers( layers );
+
+    for( TerrainLayerVector::iterator i = layers.begin(); i != layers.end(); ++i )
+    {
+        TerrainLayer* layer = i->get();
+
+        CacheSettings* cacheSettings = layer->getCacheSettings();
+        CacheBin* bin = cacheSettings ? cacheSettings->getCacheBin() : 0L;
+        if ( !bin )
+        {
+            std::cout << "Layer \"" << layer->getName() << "\": no cache, skipping" << std::endl;
+            continue;
+        }
+
+        bool useMFP =
+            layer->getProfile() &&
+            layer->getProfile()->getSRS()->isSphericalMercator() &&
+            mapNode->getMapNodeOptions().getTerrainOptions().enableMercatorFastPath() == true;
+
+        const Profile* cacheProfile = useMFP ? layer->getProfile() : map->getProfile();
+
+        unsigned binIndex = writer.addBin( bin->getID(), bin->readMetadata() );
+
+        // The layer needs its metadata record to open the cache in cache-only mode.
+        TerrainLayer::CacheBinMetadata* meta = layer->getCacheBinMetadata(cacheProfile);
+        if ( meta )
+        {
+            osg::ref_ptr<StringObject> temp = new StringObject( meta->getConfig().toJSON(false) );
+            writer.addObject( binIndex, layer->getMetadataKey(cacheProfile), temp.get(), Config(), DateTime().asTimeStamp() );
+        }
+
+        osg::ref_ptr<ArchiveTileHandler> handler = new ArchiveTileHandler( layer, bin, writer, binIndex );
+
+        osg::ref_ptr<TileVisitor> visitor = new TileVisitor();
+        visitor->setTileHandler( handler.get() );
+        visitor->setMinLevel( minLevel >= 0 ? minLevel : 0 );
+        visitor->setMaxLevel( maxLevel >= 0 ? maxLevel : 20 );
+        if ( verbose )
+            visitor->setProgressCallback( new ConsoleProgressCallback() );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        visitor->run( cacheProfile );
+        osg::Timer_t end = osg::Timer::instance()->tick();
+
+        std::cout << "Layer \"" << layer->getName() << "\": archived " << handler->getCount() << " tiles in "
+            << prettyPrintTime( osg::Timer::instance()->delta_s(start, end) ) << std::endl;
+    }
+
+    unsigned numRecords = writer.getNumRecords();
+
+    if ( !writer.finish() )
+        return message( writer.getErrorMessage() );
+
+    std::cout << "Wrote " << numRecords << " records to " << outFile << std::endl;
+    return 0;
+}
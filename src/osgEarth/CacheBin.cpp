@@ -217,19 +217,43 @@ namespace
      *
      * When you later go to read from the cache, the CacheBin must
      * be in the osgDB::Options used to invoke the read.
+     *
+     * The images are collected during the traversal and written to the
+     * bin in one batch by calling flush().
      */
     struct WriteExternalReferencesToCache : public osgEarth::TextureAndImageVisitor
     {
-        CacheBin*               _bin;
-        const osgDB::Options*   _writeOptions;
-        static Threading::Mutex _globalMutex;
+        CacheBin*                    _bin;
+        osg::ref_ptr<osgDB::Options> _writeOptions;
+        CacheBin::Records            _records;
+        static Threading::Mutex      _globalMutex;
 
         // constructor
         WriteExternalReferencesToCache(CacheBin* bin, const osgDB::Options* writeOptions)
-            : TextureAndImageVisitor(), _bin(bin), _writeOptions(writeOptions)
+            : TextureAndImageVisitor(), _bin(bin)
         {
             setTraversalMode( TRAVERSE_ALL_CHILDREN );
             setNodeMaskOverride( ~0L );
+
+            // The OSGB serializer won't actually write the image data without this:
+            _writeOptions = Registry::cloneOrCreateOptions(writeOptions);
+            _writeOptions->setPluginStringData("WriteImageHint", "IncludeData");
+        }
+
+        // writes all the collected images to the bin.
+        void flush()
+        {
+            if (_records.empty())
+                return;
+
+            OE_INFO << LC << "Writing " << _records.size() << " image(s) to the cache\n";
+
+            unsigned count = _bin->writeMany(_records, _writeOptions.get());
+            if (count < _records.size())
+            {
+                OE_WARN << LC << "...error, " << (_records.size()-count) << " write(s) failed!\n";
+            }
+            _records.clear();
         }
 
         void apply(osg::Texture& tex)
@@ -275,16 +299,8 @@ namespace
                     CacheBin::RecordStatus rs = _bin->getRecordStatus(cacheKey);
                     if (rs != CacheBin::STATUS_OK)
                     {
-                        // The OSGB serializer won't actually write the image data without this:
-                        osg::ref_ptr<osgDB::Options> dbo = Registry::cloneOrCreateOptions(_writeOptions);
-                        dbo->setPluginStringData("WriteImageHint", "IncludeData");
-
-                        OE_INFO << LC << "Writing image \"" << image.getFileName() << "\" to the cache\n";
-
-                        if (!_bin->write(cacheKey, &image, dbo.get()))
-                        {
-                            OE_WARN << LC << "...error, write failed!\n";
-                        }
+                        OE_DEBUG << LC << "Queueing image \"" << image.getFileName() << "\" for the cache\n";
+                        _records.push_back(CacheBin::Record(cacheKey, &image));
                     }
                     else
                     {
@@ -300,6 +316,39 @@ namespace
 }
 
 
+unsigned
+CacheBin::readMany(const std::vector<std::string>& keys,
+                   RecordType                      type,
+                   const osgDB::Options*           dbo,
+                   ReadResults&                    output)
+{
+    unsigned count = 0u;
+    output.resize(keys.size());
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        output[i] = type == RECORD_IMAGE ?
+            readImage(keys[i], dbo) :
+            readObject(keys[i], dbo);
+
+        if (output[i].succeeded())
+            ++count;
+    }
+    return count;
+}
+
+unsigned
+CacheBin::writeMany(const Records&        records,
+                    const osgDB::Options* dbo)
+{
+    unsigned count = 0u;
+    for(Records::const_iterator i = records.begin(); i != records.end(); ++i)
+    {
+        if (write(i->_key, i->_object.get(), i->_metadata, dbo))
+            ++count;
+    }
+    return count;
+}
+
 bool
 CacheBin::writeNode(const std::string&    key,
                     osg::Node*            node,
@@ -313,6 +362,7 @@ CacheBin::writeNode(const std::string&    key,
     // Write external refs (like texture images) to the cache bin
     WriteExternalReferencesToCache writeRefs(this, writeOptions);
     node->accept( writeRefs );
+    writeRefs.flush();
 
     // finally, write the graph to the bin:
     write(key, node, metadata, writeOptions);
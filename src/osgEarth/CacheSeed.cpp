@@ -45,6 +45,18 @@ bool CacheTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
     ImageLayer* imageLayer = dynamic_cast< ImageLayer* >( _layer.get() );
     ElevationLayer* elevationLayer = dynamic_cast< ElevationLayer* >( _layer.get() );    
 
+    // The visitor hands us siblings in order, so when we reach the first one,
+    // read all four from the cache in one batch. Tiles that are already cached
+    // then come out of the layer's memory cache.
+    if (key.getLOD() > 0 && key.getQuadrant() == 0)
+    {
+        TileKey parent = key.createParentKey();
+        std::vector<TileKey> siblings(4);
+        for (unsigned q = 0; q < 4; ++q)
+            siblings[q] = parent.createChildKey(q);
+        _layer->prefetch(siblings);
+    }
+
     // Just call createImage or createHeightField on the layer and the it will be cached!
     if (imageLayer)
     {                
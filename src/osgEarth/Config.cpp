@@ -38,6 +38,78 @@ Config::~Config()
 {
 }
 
+Config&
+Config::operator = ( const Config& rhs )
+{
+    if ( this != &rhs )
+    {
+        // copy first; rhs may live inside our own children.
+        Config temp( rhs );
+        _key.swap( temp._key );
+        _defaultValue.swap( temp._defaultValue );
+        _children = temp._children.get();
+        _referrer.swap( temp._referrer );
+        _isLocation = temp._isLocation;
+        _externalRef.swap( temp._externalRef );
+        _refMap.swap( temp._refMap );
+        _leaked = false;
+    }
+    return *this;
+}
+
+const ConfigSet&
+Config::emptyChildren()
+{
+    static const ConfigSet s_empty;
+    return s_empty;
+}
+
+Config::SharedChildren*
+Config::shareChildren() const
+{
+    if ( !_children.valid() )
+        return 0L;
+
+    // someone may be holding a mutable reference into our children,
+    // so a copy cannot share them.
+    if ( _leaked )
+        return new SharedChildren( *_children.get() );
+
+    return _children.get();
+}
+
+ConfigSet&
+Config::ownChildren()
+{
+    if ( !_children.valid() )
+        _children = new SharedChildren();
+    else if ( _children->referenceCount() > 1 )
+        _children = new SharedChildren( *_children.get() );
+
+    return _children->_list;
+}
+
+ConfigSet&
+Config::leakChildren()
+{
+    ConfigSet& list = ownChildren();
+    _leaked = true;
+    return list;
+}
+
+bool
+Config::needsReferrer() const
+{
+    if ( _referrer.empty() )
+        return true;
+
+    for( ConfigSet::const_iterator i = children().begin(); i != children().end(); ++i )
+        if ( i->needsReferrer() )
+            return true;
+
+    return false;
+}
+
 void
 Config::setReferrer( const std::string& referrer )
 {
@@ -66,26 +138,37 @@ Config::setReferrer( const std::string& referrer )
         _referrer = absReferrer;
     }
 
-    for( ConfigSet::iterator i = _children.begin(); i != _children.end(); i++ )
-    { 
-        i->setReferrer( absReferrer );
+    // Only touch the children if one of them changes, so that shared
+    // children stay shared.
+    const ConfigSet& kids = static_cast<const Config*>(this)->children();
+    bool update = false;
+    for( ConfigSet::const_iterator i = kids.begin(); i != kids.end() && !update; ++i )
+        update = i->needsReferrer();
+
+    if ( update )
+    {
+        ConfigSet& list = ownChildren();
+        for( ConfigSet::iterator i = list.begin(); i != list.end(); i++ )
+        { 
+            i->setReferrer( absReferrer );
+        }
     }
 }
 
 bool
 Config::fromXML( std::istream& in )
 {
-    osg::ref_ptr<XmlDocument> xml = XmlDocument::load( in );
-    if ( xml.valid() )
-        *this = xml->getConfig();
-    return xml.valid();
+    osg::ref_ptr<ConfigArena> arena = XmlDocument::loadConfig( in );
+    if ( arena.valid() )
+        *this = arena->root().toConfig();
+    return arena.valid();
 }
 
 #if 1
 const Config&
 Config::child( const std::string& childName ) const
 {
-    for( ConfigSet::const_iterator i = _children.begin(); i != _children.end(); i++ ) {
+    for( ConfigSet::const_iterator i = children().begin(); i != children().end(); i++ ) {
         if ( i->key() == childName )
             return *i;
     }
@@ -99,7 +182,7 @@ Config::child( const std::string& childName ) const
 Config
 Config::child( const std::string& childName ) const
 {
-    for( ConfigSet::const_iterator i = _children.begin(); i != _children.end(); i++ ) {
+    for( ConfigSet::const_iterator i = children().begin(); i != children().end(); i++ ) {
         if ( i->key() == childName )
             return *i;
     }
@@ -112,7 +195,7 @@ Config::child( const std::string& childName ) const
 const Config*
 Config::child_ptr( const std::string& childName ) const
 {
-    for( ConfigSet::const_iterator i = _children.begin(); i != _children.end(); i++ ) {
+    for( ConfigSet::const_iterator i = children().begin(); i != children().end(); i++ ) {
         if ( i->key() == childName )
             return &(*i);
     }
@@ -122,7 +205,11 @@ Config::child_ptr( const std::string& childName ) const
 Config*
 Config::mutable_child( const std::string& childName )
 {
-    for( ConfigSet::iterator i = _children.begin(); i != _children.end(); i++ ) {
+    if ( !hasChild(childName) )
+        return 0L;
+
+    ConfigSet& list = leakChildren();
+    for( ConfigSet::iterator i = list.begin(); i != list.end(); i++ ) {
         if ( i->key() == childName )
             return &(*i);
     }
@@ -133,12 +220,17 @@ Config::mutable_child( const std::string& childName )
 void
 Config::merge( const Config& rhs ) 
 {
+    // hold on to rhs's children in case rhs is this object.
+    osg::ref_ptr<SharedChildren> rhsChildren = rhs._children.get();
+    if ( !rhsChildren.valid() )
+        return;
+
     // remove any matching keys first; this will allow the addition of multi-key values
-    for( ConfigSet::const_iterator c = rhs._children.begin(); c != rhs._children.end(); ++c )
+    for( ConfigSet::const_iterator c = rhsChildren->_list.begin(); c != rhsChildren->_list.end(); ++c )
         remove( c->key() );
 
     // add in the new values.
-    for( ConfigSet::const_iterator c = rhs._children.begin(); c != rhs._children.end(); ++c )
+    for( ConfigSet::const_iterator c = rhsChildren->_list.begin(); c != rhsChildren->_list.end(); ++c )
         add( *c );
 }
 
@@ -148,11 +240,11 @@ Config::find( const std::string& key, bool checkMe ) const
     if ( checkMe && key == this->key() )
         return this;
 
-    for( ConfigSet::const_iterator c = _children.begin(); c != _children.end(); ++c )
+    for( ConfigSet::const_iterator c = children().begin(); c != children().end(); ++c )
         if ( key == c->key() )
             return &(*c);
 
-    for( ConfigSet::const_iterator c = _children.begin(); c != _children.end(); ++c )
+    for( ConfigSet::const_iterator c = children().begin(); c != children().end(); ++c )
     {
         const Config* r = c->find(key, false);
         if ( r ) return r;
@@ -167,11 +259,17 @@ Config::find( const std::string& key, bool checkMe )
     if ( checkMe && key == this->key() )
         return this;
 
-    for( ConfigSet::iterator c = _children.begin(); c != _children.end(); ++c )
+    // search first, so we only take ownership of the children on a hit.
+    if ( static_cast<const Config*>(this)->find(key, false) == 0L )
+        return 0L;
+
+    ConfigSet& list = leakChildren();
+
+    for( ConfigSet::iterator c = list.begin(); c != list.end(); ++c )
         if ( key == c->key() )
             return &(*c);
 
-    for( ConfigSet::iterator c = _children.begin(); c != _children.end(); ++c )
+    for( ConfigSet::iterator c = list.begin(); c != list.end(); ++c )
     {
         Config* r = c->find(key, false);
         if ( r ) return r;
@@ -303,7 +401,9 @@ namespace
         return value;
     }
 
-    void json2conf(const Json::Value& json, Config& conf, int depth)
+    // Converts JSON to Config, the inverse of conf2json, building the result
+    // in an arena.
+    void json2arena(const Json::Value& json, ConfigArena& arena, unsigned node, int depth)
     {
         if ( json.type() == Json::objectValue )
         {
@@ -317,60 +417,54 @@ namespace
                 {
                     if (depth == 0 && members.size() == 1)
                     {
-                        conf.key() = *i;
-                        json2conf(value, conf, depth+1);
+                        arena.setKey( node, *i );
+                        json2arena( value, arena, node, depth+1 );
                     }
                     else
                     {
-                        Config element( *i );
-                        json2conf( value, element, depth+1 );
-                        conf.add( element );
+                        unsigned element = arena.add( node, *i );
+                        json2arena( value, arena, element, depth+1 );
                     }
                 }
                 else if ( value.isArray() )
                 {
+                    std::string key;
                     if ( endsWith(*i, "__array__") )
-                    {
-                        std::string key = i->substr(0, i->length()-9);
-                        for( Json::Value::const_iterator j = value.begin(); j != value.end(); ++j )
-                        {
-                            Config child;
-                            json2conf( *j, child, depth+1 );
-                            conf.add( key, child );
-                        }
-                    }
+                        key = i->substr(0, i->length()-9);
                     else if ( endsWith(*i, "_$set") ) // backwards compatibility
+                        key = i->substr(0, i->length()-5);
+
+                    if ( !key.empty() )
                     {
-                        std::string key = i->substr(0, i->length()-5);
                         for( Json::Value::const_iterator j = value.begin(); j != value.end(); ++j )
                         {
-                            Config child;
-                            json2conf( *j, child, depth+1 );
-                            conf.add( key, child );
+                            unsigned child = arena.add( node, std::string() );
+                            json2arena( *j, arena, child, depth+1 );
+                            arena.setKey( child, key );
                         }
                     }
                     else
                     {
-                        Config element( *i );
-                        json2conf( value, element, depth+1 );
-                        conf.add( element );
+                        unsigned element = arena.add( node, *i );
+                        json2arena( value, arena, element, depth+1 );
                     }
                 }
                 else if ( (*i) == "$key" )
                 {
-                    conf.key() = value.asString();
+                    arena.setKey( node, value.asString() );
                 }
                 else if ( (*i) == "$value" )
                 {
-                    conf.value() = value.asString();
+                    arena.setValue( node, value.asString() );
                 }
                 else if ( (*i) == "$children" && value.isArray() )
                 {
-                    json2conf( value, conf, depth+1 );
+                    json2arena( value, arena, node, depth+1 );
                 }
                 else
                 {
-                    conf.add( *i, value.asString() );
+                    unsigned child = arena.add( node, *i );
+                    arena.setValue( child, value.asString() );
                 }
             }
         }
@@ -378,17 +472,30 @@ namespace
         {          
             for( Json::Value::const_iterator j = json.begin(); j != json.end(); ++j )
             {
-                Config child;
-                json2conf( *j, child, depth+1 );
-                if ( !child.empty() )
-                    conf.add( child );
+                unsigned child = arena.add( node, std::string() );
+                json2arena( *j, arena, child, depth+1 );
+                if ( arena.view(child).empty() )
+                    arena.removeLastChild( node );
             }
         }
         else if ( json.type() != Json::nullValue )
         {
-            conf.value() = json.asString();
+            arena.setValue( node, json.asString() );
         }
     }
+
+    bool parseJSON(const std::string& input, Json::Value& root)
+    {
+        Json::Reader reader;
+        if ( reader.parse( input, root ) )
+            return true;
+
+        OE_WARN 
+            << "JSON decoding error: "
+            << reader.getFormatedErrorMessages() 
+            << std::endl;
+        return false;
+    }
 }
 
 std::string
@@ -404,21 +511,19 @@ Config::toJSON( bool pretty ) const
 bool
 Config::fromJSON( const std::string& input )
 {
-    Json::Reader reader;
-    Json::Value root( Json::objectValue );
-    if ( reader.parse( input, root ) )
-    {
-        json2conf( root, *this, 0 );
-        return true;
-    }
-    else
-    {
-        OE_WARN 
-            << "JSON decoding error: "
-            << reader.getFormatedErrorMessages() 
-            << std::endl;
-    }
-    return false;
+    osg::ref_ptr<ConfigArena> arena = ConfigArena::readJSON( input );
+    if ( !arena.valid() )
+        return false;
+
+    ConfigView root = arena->root();
+    if ( !root.key().empty() )
+        _key = root.key();
+    if ( !root.value().empty() )
+        _defaultValue = root.value();
+    for( ConfigView c = root.firstChild(); c.valid(); c = c.nextSibling() )
+        add( c.toConfig() );
+
+    return true;
 }
 
 Config
@@ -441,3 +546,253 @@ Config::operator - ( const Config& rhs ) const
 
     return result;
 }
+
+//------------------------------------------------------------------------
+
+ConfigArena::ConfigArena()
+{
+    _empty = intern( std::string() );
+}
+
+const std::string*
+ConfigArena::intern( const std::string& value )
+{
+    return &( *_strings.insert(value).first );
+}
+
+unsigned
+ConfigArena::addRoot( const std::string& key )
+{
+    _nodes.clear();
+
+    Node root;
+    root._key         = intern( key );
+    root._value       = _empty;
+    root._referrer    = _empty;
+    root._externalRef = _empty;
+    root._firstChild  = NONE;
+    root._lastChild   = NONE;
+    root._next        = NONE;
+    _nodes.push_back( root );
+    return 0u;
+}
+
+unsigned
+ConfigArena::add( unsigned parent, const std::string& key )
+{
+    unsigned index = _nodes.size();
+
+    Node node;
+    node._key         = intern( key );
+    node._value       = _empty;
+    node._referrer    = _nodes[parent]._referrer;
+    node._externalRef = _empty;
+    node._firstChild  = NONE;
+    node._lastChild   = NONE;
+    node._next        = NONE;
+    _nodes.push_back( node );
+
+    Node& p = _nodes[parent];
+    if ( p._lastChild == NONE )
+        p._firstChild = index;
+    else
+        _nodes[p._lastChild]._next = index;
+    p._lastChild = index;
+
+    return index;
+}
+
+void
+ConfigArena::removeLastChild( unsigned parent )
+{
+    Node& p = _nodes[parent];
+    if ( p._lastChild == NONE )
+        return;
+
+    if ( p._firstChild == p._lastChild )
+    {
+        p._firstChild = NONE;
+        p._lastChild  = NONE;
+        return;
+    }
+
+    unsigned i = p._firstChild;
+    while( _nodes[i]._next != p._lastChild )
+        i = _nodes[i]._next;
+
+    _nodes[i]._next = NONE;
+    p._lastChild = i;
+}
+
+void
+ConfigArena::setKey( unsigned node, const std::string& key )
+{
+    _nodes[node]._key = intern( key );
+}
+
+void
+ConfigArena::setValue( unsigned node, const std::string& value )
+{
+    _nodes[node]._value = intern( value );
+}
+
+void
+ConfigArena::setReferrer( unsigned node, const std::string& referrer )
+{
+    _nodes[node]._referrer = intern( referrer );
+}
+
+void
+ConfigArena::setExternalRef( unsigned node, const std::string& externalRef )
+{
+    _nodes[node]._externalRef = intern( externalRef );
+}
+
+ConfigArena*
+ConfigArena::readJSON( const std::string& json )
+{
+    Json::Value root( Json::objectValue );
+    if ( !parseJSON(json, root) )
+        return 0L;
+
+    osg::ref_ptr<ConfigArena> arena = new ConfigArena();
+    unsigned node = arena->addRoot( std::string() );
+    json2arena( root, *arena.get(), node, 0 );
+    return arena.release();
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    const std::string s_emptyString;
+}
+
+#define NODE (_arena->_nodes[_index])
+
+const std::string&
+ConfigView::key() const
+{
+    return valid() ? *NODE._key : s_emptyString;
+}
+
+const std::string&
+ConfigView::value() const
+{
+    return valid() ? *NODE._value : s_emptyString;
+}
+
+const std::string&
+ConfigView::referrer() const
+{
+    return valid() ? *NODE._referrer : s_emptyString;
+}
+
+const std::string&
+ConfigView::externalRef() const
+{
+    return valid() ? *NODE._externalRef : s_emptyString;
+}
+
+bool
+ConfigView::empty() const
+{
+    return !valid() || (NODE._key->empty() && NODE._value->empty() && NODE._firstChild == ConfigArena::NONE);
+}
+
+ConfigView
+ConfigView::firstChild() const
+{
+    if ( !valid() || NODE._firstChild == ConfigArena::NONE )
+        return ConfigView();
+    return ConfigView( _arena, NODE._firstChild );
+}
+
+ConfigView
+ConfigView::nextSibling() const
+{
+    if ( !valid() || NODE._next == ConfigArena::NONE )
+        return ConfigView();
+    return ConfigView( _arena, NODE._next );
+}
+
+unsigned
+ConfigView::getNumChildren() const
+{
+    unsigned count = 0u;
+    for( ConfigView c = firstChild(); c.valid(); c = c.nextSibling() )
+        ++count;
+    return count;
+}
+
+bool
+ConfigView::hasChild( const std::string& key ) const
+{
+    return child(key).valid();
+}
+
+ConfigView
+ConfigView::child( const std::string& key ) const
+{
+    for( ConfigView c = firstChild(); c.valid(); c = c.nextSibling() )
+        if ( c.key() == key )
+            return c;
+    return ConfigView();
+}
+
+std::vector<ConfigView>
+ConfigView::children( const std::string& key ) const
+{
+    std::vector<ConfigView> result;
+    for( ConfigView c = firstChild(); c.valid(); c = c.nextSibling() )
+        if ( c.key() == key )
+            result.push_back( c );
+    return result;
+}
+
+std::string
+ConfigView::value( const std::string& key ) const
+{
+    std::string r = trim( child(key).value() );
+    if ( r.empty() && this->key() == key )
+        r = value();
+    return r;
+}
+
+Config
+ConfigView::toConfig() const
+{
+    Config output;
+    if ( valid() )
+        build( output, 0L, s_emptyString );
+    return output;
+}
+
+void
+ConfigView::build(Config& output, const std::string* parentReferrer, const std::string& parentAbsReferrer) const
+{
+    const ConfigArena::Node& node = NODE;
+
+    output._key          = *node._key;
+    output._defaultValue = *node._value;
+    output._externalRef  = *node._externalRef;
+
+    // Referrers only change at the top and at included documents, so only
+    // make them absolute there (see Config::setReferrer).
+    if ( node._referrer != parentReferrer && !node._referrer->empty() )
+        output.setReferrer( *node._referrer );
+    if ( output._referrer.empty() )
+        output._referrer = parentAbsReferrer;
+
+    if ( node._firstChild != ConfigArena::NONE )
+    {
+        ConfigSet& list = output.ownChildren();
+        for( ConfigView c = firstChild(); c.valid(); c = c.nextSibling() )
+        {
+            list.push_back( Config() );
+            c.build( list.back(), node._referrer, output._referrer );
+        }
+    }
+}
+
+#undef NODE
@@ -1119,7 +1119,7 @@ namespace
         {
             kids.add( dumpStateGraph(i->second.get()) );
         }
-        if ( !kids.children().empty() )
+        if ( !sg->_children.empty() )
             conf.add(kids);
 
         return conf;
@@ -1142,8 +1142,8 @@ CullDebugger::dumpRenderBin(osgUtil::RenderBin* bin) const
         sg.add( dumpStateGraph(*i) );
     }
 
-    if ( !sg.children().empty() )
-        conf.add(sg);
+    // (always has at least the NumChildren entry)
+    conf.add(sg);
 
     Config rb("_children");
     for(osgUtil::RenderBin::RenderBinList::const_iterator i = bin->getRenderBinList().begin(); i != bin->getRenderBinList().end(); ++i)
@@ -1151,7 +1151,7 @@ CullDebugger::dumpRenderBin(osgUtil::RenderBin* bin) const
         osgUtil::RenderBin* childBin = i->second.get();
         rb.add( dumpRenderBin(childBin) );
     }
-    if ( !rb.children().empty() )
+    if ( !bin->getRenderBinList().empty() )
         conf.add(rb);
 
     return conf;
@@ -23,6 +23,7 @@
 #include <osgEarth/MemCache>
 #include <osgEarth/Metrics>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TaskService>
 #include <osg/Version>
 #include <iterator>
 
@@ -279,7 +280,7 @@ ElevationLayer::createHeightFieldFromTileSource(const TileKey&    key,
                 VerticalDatum::transform(
                     getProfile()->getSRS()->getVerticalDatum(),    // from
                     key.getExtent().getSRS()->getVerticalDatum(),  // to
-                    key.getExtent(),
+                    key,
                     result.get() );
             }
         }
@@ -406,6 +407,19 @@ ElevationLayer::assembleHeightField(const TileKey& key,
     }
 }
 
+std::string
+ElevationLayer::getCacheKey(const TileKey& key) const
+{
+    // cache key combines the key with the full signature (incl vdatum)
+    return Stringify() << key.str() << "_" << key.getProfile()->getFullSignature();
+}
+
+bool
+ElevationLayer::prepareCachedObject(osg::Object* object) const
+{
+    return validateHeightField(dynamic_cast<osg::HeightField*>(object));
+}
+
 GeoHeightField
 ElevationLayer::createHeightField(const TileKey& key)
 {
@@ -439,7 +453,7 @@ ElevationLayer::createHeightField(const TileKey&    key,
     bool fromMemCache = false;
 
     // cache key combines the key with the full signature (incl vdatum)
-    std::string cacheKey = Stringify() << key.str() << "_" << key.getProfile()->getFullSignature();
+    std::string cacheKey = getCacheKey(key);
     const CachePolicy& policy = getCacheSettings()->cachePolicy().get();
 
     if ( _memCache.valid() )
@@ -684,8 +698,8 @@ namespace
         return normal;
     }
 
-    //! Creates a normal map for heightfield "hf" and stores it in the
-    //! pre-allocated NormalMap.
+    //! Creates a normal map for rows [firstRow, lastRow) of heightfield "hf" and stores it
+    //! in the pre-allocated NormalMap.
     //!
     //! "deltaLOD" holds the difference in LODs between the heightfield itself and the LOD
     //! from which the elevation value came. This will be positive when we had to "fall back" on 
@@ -698,12 +712,12 @@ namespace
     //! would be to sample the elevation data using a spline function instead of bilinear
     //! interpolation -- but we would need to do that to a separate heightfield (especially for
     //! normals) in order to maintain terrain correlation. Maybe someday.
-    void createNormalMap(const GeoExtent& extent, const osg::HeightField* hf, const osg::ShortArray* deltaLOD, NormalMap* normalMap)
+    void createNormalMap(const GeoExtent& extent, const osg::HeightField* hf, const osg::ShortArray* deltaLOD, NormalMap* normalMap, int firstRow, int lastRow)
     {
         int w = hf->getNumColumns();
         int h = hf->getNumRows();
 
-        for (int t = 0; t < (int)hf->getNumRows(); ++t)
+        for (int t = firstRow; t < lastRow; ++t)
         {
             for (int s = 0; s<(int)hf->getNumColumns(); ++s)
             {
@@ -765,6 +779,351 @@ namespace
             }
         }
     }
+
+    //! Collects the layers that can contribute to the tile, highest priority first.
+    //! Returns false if there is nothing to sample, or nothing but fallback data.
+    bool collectLayers(const ElevationLayerVector& layers,
+                       const osg::HeightField*     hf,
+                       const TileKey&              key,
+                       const TileKey&              keyToUse,
+                       LayerDataVector&            contenders,
+                       LayerDataVector&            offsets)
+    {
+        // Track the number of layers that would return fallback data.
+        unsigned numFallbackLayers = 0;
+
+        // Check them in reverse order since the highest priority is last.
+        for (int i = layers.size()-1; i>=0; --i)
+        {
+            ElevationLayer* layer = layers[i].get();
+
+            if ( layer->getEnabled() && layer->getVisible() )
+            {
+                // calculate the resolution-mapped key (adjusted for tile resolution differential).            
+                TileKey mappedKey = keyToUse.mapResolution(
+                    hf->getNumColumns(),
+                    layer->getTileSize() );
+
+                bool useLayer = true;
+                TileKey bestKey( mappedKey );
+
+                // Check whether the non-mapped key is valid according to the user's min/max level settings:
+                if ( !layer->isKeyInLegalRange(key) )
+                {
+                    useLayer = false;
+                }
+                
+                // Find the "best available" mapped key from the tile source:
+                else 
+                {
+                    bestKey = layer->getBestAvailableTileKey(mappedKey);
+                    if (bestKey.valid())
+                    {
+                        // If the bestKey is not the mappedKey, this layer is providing
+                        // fallback data (data at a lower resolution than requested)
+                        if ( mappedKey != bestKey )
+                        {
+                            numFallbackLayers++;
+                        }
+                    }
+                    else
+                    {
+                        useLayer = false;
+                    }
+                }
+
+                if ( useLayer )
+                {
+                    LayerDataVector& target = layer->isOffset() ? offsets : contenders;
+                    target.push_back(LayerData());
+                    LayerData& ld = target.back();
+                    ld.layer = layer;
+                    ld.key = bestKey;
+                    ld.index = i;
+                }
+            }
+        }
+
+        // nothing? bail out.
+        if ( contenders.empty() && offsets.empty() )
+        {
+            return false;
+        }
+
+        // if everything is fallback data, bail out.
+        if ( contenders.size() + offsets.size() == numFallbackLayers )
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    // Tiles with fewer posts than this are sampled on the calling thread;
+    // splitting them would cost more than it saves.
+    const unsigned MIN_POSTS_TO_SPLIT = 128u * 128u;
+    const unsigned MIN_ROWS_PER_CHUNK = 16u;
+
+    struct NormalMapJob : public ParallelRange::Job
+    {
+        const GeoExtent*        _extent;
+        const osg::HeightField* _hf;
+        const osg::ShortArray*  _deltaLOD;
+        NormalMap*              _normalMap;
+
+        void run(unsigned r0, unsigned r1, unsigned chunk)
+        {
+            createNormalMap(*_extent, _hf, _deltaLOD, _normalMap, (int)r0, (int)r1);
+        }
+    };
+
+    //! Positions of the output grid's columns (or rows) in the pixel space
+    //! of one source heightfield, with the bilinear neighbors and weights
+    //! HeightFieldUtils::getHeightAtPixel would use for them.
+    struct AxisSamples
+    {
+        std::vector<double> _pixel;
+        std::vector<int>    _min, _max;
+        std::vector<double> _w0, _w1;
+        std::vector<char>   _inside;
+
+        void compute(const std::vector<double>& coords, double origin, double interval, int numPixels)
+        {
+            unsigned num = coords.size();
+            _pixel.resize(num);
+            _min.resize(num);
+            _max.resize(num);
+            _w0.resize(num);
+            _w1.resize(num);
+
+            for (unsigned i = 0; i < num; ++i)
+            {
+                double p = osg::clampBetween( (coords[i] - origin) / interval, 0.0, (double)(numPixels-1) );
+                int lo = osg::maximum((int)floor(p), 0);
+                int hi = osg::maximum(osg::minimum((int)ceil(p), numPixels-1), 0);
+                if (lo > hi) lo = hi;
+
+                _pixel[i] = p;
+                _min[i]   = lo;
+                _max[i]   = hi;
+
+                // On an exact pixel, weight it fully so the general formula
+                // reduces to the exact and linear cases.
+                _w0[i] = lo == hi ? 1.0 : (double)hi - p;
+                _w1[i] = lo == hi ? 0.0 : p - (double)lo;
+            }
+        }
+    };
+
+    //! Samples one layer's heightfield into every post of the output grid
+    //! that still needs it.
+    struct LayerPass : public ParallelRange::Job
+    {
+        enum Mode
+        {
+            KERNEL,     // bilinear over the whole row; source has no NODATA
+            PIXEL,      // getHeightAtPixel per post, at precomputed pixel coordinates
+            LOCATION    // GeoHeightField::getElevation per post (different SRS)
+        };
+
+        Mode                    _mode;
+        bool                    _offset;
+        int                     _index;
+        short                   _deltaLOD;
+        ElevationInterpolation  _interpolation;
+
+        const osg::HeightField* _source;
+        const AxisSamples*      _cols;
+        const AxisSamples*      _rows;
+
+        const GeoHeightField*       _geo;
+        const SpatialReference*     _keySRS;
+        const std::vector<double>*  _xs;
+        const std::vector<double>*  _ys;
+
+        osg::HeightField*       _hf;
+        int*                    _resolved;
+        unsigned*               _rowUnresolved;
+        short*                  _lods;
+        std::vector<unsigned>   _numResolved;
+
+        void run(unsigned r0, unsigned r1, unsigned chunk)
+        {
+            unsigned numColumns = _hf->getNumColumns();
+            std::vector<float> row;
+            if (_mode == KERNEL)
+                row.resize(numColumns);
+
+            unsigned count = 0;
+
+            for (unsigned r = r0; r < r1; ++r)
+            {
+                if (!_offset && _rowUnresolved[r] == 0u)
+                    continue;
+                if (_mode != LOCATION && !_rows->_inside[r])
+                    continue;
+
+                if (_mode == KERNEL)
+                    sampleRow(r, &row[0]);
+
+                int*   resolved = _resolved + r*numColumns;
+                float* heights  = &(*_hf->getFloatArray())[r*numColumns];
+                short* lods     = _lods + r*numColumns;
+
+                for (unsigned c = 0; c < numColumns; ++c)
+                {
+                    // Only apply an offset layer if it sits on top of the resolved layer
+                    // (or if there was no resolved layer).
+                    if (_offset ? (resolved[c] >= 0 && _index < resolved[c]) : resolved[c] >= 0)
+                        continue;
+
+                    float elevation;
+                    if (_mode == KERNEL)
+                    {
+                        if (!_cols->_inside[c])
+                            continue;
+                        elevation = row[c];
+                    }
+                    else if (_mode == PIXEL)
+                    {
+                        if (!_cols->_inside[c])
+                            continue;
+                        elevation = HeightFieldUtils::getHeightAtPixel(
+                            _source, _cols->_pixel[c], _rows->_pixel[r], _interpolation);
+                    }
+                    else if (!_geo->getElevation(_keySRS, (*_xs)[c], (*_ys)[r], _interpolation, _keySRS, elevation))
+                    {
+                        continue;
+                    }
+
+                    if (elevation == NO_DATA_VALUE)
+                        continue;
+
+                    if (_offset)
+                    {
+                        heights[c] += elevation;
+                    }
+                    else
+                    {
+                        // remember the index so we can only apply offset layers that
+                        // sit on TOP of this layer.
+                        heights[c] = elevation;
+                        resolved[c] = _index;
+                        --_rowUnresolved[r];
+                        ++count;
+                    }
+
+                    lods[c] = _deltaLOD;
+                }
+            }
+
+            _numResolved[chunk] = count;
+        }
+
+        //! Bilinear samples for every column of row r. The loop has no branches
+        //! and reads contiguous tables, so the compiler can vectorize it.
+        void sampleRow(unsigned r, float* out) const
+        {
+            unsigned       numColumns = _hf->getNumColumns();
+            unsigned       sourceCols = _source->getNumColumns();
+            const float*   data       = &(*_source->getFloatArray())[0];
+            const float*   lower      = data + _rows->_min[r] * sourceCols;
+            const float*   upper      = data + _rows->_max[r] * sourceCols;
+            const int*     c0         = &_cols->_min[0];
+            const int*     c1         = &_cols->_max[0];
+            const double*  w0         = &_cols->_w0[0];
+            const double*  w1         = &_cols->_w1[0];
+            double         v0         = _rows->_w0[r];
+            double         v1         = _rows->_w1[r];
+
+            for (unsigned c = 0; c < numColumns; ++c)
+            {
+                double r1 = w0[c] * (double)lower[c0[c]] + w1[c] * (double)lower[c1[c]];
+                double r2 = w0[c] * (double)upper[c0[c]] + w1[c] * (double)upper[c1[c]];
+                out[c] = (float)(v0 * r1 + v1 * r2);
+            }
+        }
+    };
+
+    //! Whether a heightfield contains any NODATA values.
+    bool hasNoData(const osg::HeightField* hf)
+    {
+        const osg::FloatArray* heights = hf->getFloatArray();
+        for (osg::FloatArray::const_iterator i = heights->begin(); i != heights->end(); ++i)
+        {
+            if (*i == NO_DATA_VALUE)
+                return true;
+        }
+        return false;
+    }
+
+    //! Runs one layer's pass over the output grid and returns the number of
+    //! posts it resolved.
+    unsigned sampleLayer(LayerPass&                 pass,
+                         const GeoHeightField&      layerHF,
+                         const std::vector<double>& xs,
+                         const std::vector<double>& ys,
+                         unsigned                   numChunks)
+    {
+        const GeoExtent&        extent    = layerHF.getExtent();
+        const SpatialReference* extentSRS = extent.getSRS();
+        const osg::HeightField* source    = layerHF.getHeightField();
+
+        AxisSamples cols, rows;
+
+        // The grid can only be precomputed when the source needs no horizontal
+        // or vertical transformation; otherwise, sample post by post.
+        bool grid =
+            (extentSRS == pass._keySRS ||
+            (extentSRS->isEquivalentTo(pass._keySRS) && extentSRS->isVertEquivalentTo(pass._keySRS))) &&
+            source->getNumColumns() > 1 &&
+            source->getNumRows() > 1;
+
+        if (grid)
+        {
+            cols.compute(xs, extent.xMin(), extent.width()  / (double)(source->getNumColumns()-1), source->getNumColumns());
+            rows.compute(ys, extent.yMin(), extent.height() / (double)(source->getNumRows()-1),    source->getNumRows());
+
+            // GeoExtent::contains tests each axis separately, so testing each
+            // column against the center row (and vice versa) gives the same answer
+            // as testing every post.
+            double cx, cy;
+            extent.getCentroid(cx, cy);
+
+            cols._inside.resize(xs.size());
+            for (unsigned c = 0; c < xs.size(); ++c)
+                cols._inside[c] = extent.contains(xs[c], cy) ? 1 : 0;
+
+            rows._inside.resize(ys.size());
+            for (unsigned r = 0; r < ys.size(); ++r)
+                rows._inside[r] = extent.contains(cx, ys[r]) ? 1 : 0;
+
+            pass._mode =
+                pass._interpolation == INTERP_BILINEAR && !hasNoData(source) ? LayerPass::KERNEL :
+                LayerPass::PIXEL;
+        }
+        else
+        {
+            // SRS transforms are not guaranteed to be thread-safe.
+            pass._mode = LayerPass::LOCATION;
+            numChunks = 1u;
+        }
+
+        pass._source = source;
+        pass._cols   = &cols;
+        pass._rows   = &rows;
+        pass._geo    = &layerHF;
+        pass._xs     = &xs;
+        pass._ys     = &ys;
+        pass._numResolved.assign(numChunks, 0u);
+
+        ParallelRange::run(pass, ys.size(), numChunks);
+
+        unsigned count = 0;
+        for (unsigned i = 0; i < pass._numResolved.size(); ++i)
+            count += pass._numResolved[i];
+        return count;
+    }
 }
 
 bool
@@ -795,80 +1154,155 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
     LayerDataVector contenders;
     LayerDataVector offsets;
 
-    // Track the number of layers that would return fallback data.
-    unsigned numFallbackLayers = 0;
-
-    // Check them in reverse order since the highest priority is last.
-    for (int i = size()-1; i>=0; --i)
-    //for(ElevationLayerVector::const_reverse_iterator i = this->rbegin(); i != this->rend(); ++i)
+    if ( !collectLayers(*this, hf, key, keyToUse, contenders, offsets) )
     {
-        ElevationLayer* layer = (*this)[i].get(); //i->get();
+        return false;
+    }
 
-        if ( layer->getEnabled() && layer->getVisible() )
-        {
-            // calculate the resolution-mapped key (adjusted for tile resolution differential).            
-            TileKey mappedKey = keyToUse.mapResolution(
-                hf->getNumColumns(),
-                layer->getTileSize() );
+    // Sample the layers into our target. Rather than asking every layer about
+    // every post, this samples one layer at a time over the whole grid: the
+    // highest priority layer first, then each next layer only where the ones
+    // before it left NODATA. The result is the same as sampling post by post.
+    unsigned numColumns = hf->getNumColumns();
+    unsigned numRows    = hf->getNumRows();    
+    double   xmin       = key.getExtent().xMin();
+    double   ymin       = key.getExtent().yMin();
+    double   dx         = key.getExtent().width() / (double)(numColumns-1);
+    double   dy         = key.getExtent().height() / (double)(numRows-1);
 
-            bool useLayer = true;
-            TileKey bestKey( mappedKey );
+    std::vector<double> xs(numColumns), ys(numRows);
+    for (unsigned c = 0; c < numColumns; ++c)
+        xs[c] = xmin + (dx * (double)c);
+    for (unsigned r = 0; r < numRows; ++r)
+        ys[r] = ymin + (dy * (double)r);
 
-            // Check whether the non-mapped key is valid according to the user's min/max level settings:
-            if ( !layer->isKeyInLegalRange(key) )
-            {
-                useLayer = false;
-            }
-                
-            // Find the "best available" mapped key from the tile source:
-            else 
-            {
-                bestKey = layer->getBestAvailableTileKey(mappedKey);
-                if (bestKey.valid())
-                {
-                    // If the bestKey is not the mappedKey, this layer is providing
-                    // fallback data (data at a lower resolution than requested)
-                    if ( mappedKey != bestKey )
-                    {
-                        numFallbackLayers++;
-                    }
-                }
-                else
-                {
-                    useLayer = false;
-                }
-            }
+    const SpatialReference* keySRS = keyToUse.getProfile()->getSRS();
+
+    bool realData = false;
+
+    unsigned int total = numColumns * numRows;
+
+    // query resolution interval (x, y) of each sample.
+    osg::ref_ptr<osg::ShortArray> deltaLOD = new osg::ShortArray(total);
 
-            if ( useLayer )
+    // index of the layer that resolved each post, or -1 if none has yet.
+    std::vector<int> resolved(total, -1);
+    std::vector<unsigned> rowUnresolved(numRows, numColumns);
+    unsigned numUnresolved = total;
+
+    unsigned numChunks = total >= MIN_POSTS_TO_SPLIT ?
+        ParallelRange::getNumChunks(numRows, MIN_ROWS_PER_CHUNK) : 1u;
+
+    LayerPass pass;
+    pass._interpolation = interpolation;
+    pass._keySRS        = keySRS;
+    pass._hf            = hf;
+    pass._resolved      = &resolved[0];
+    pass._rowUnresolved = &rowUnresolved[0];
+    pass._lods          = &(*deltaLOD)[0];
+
+    for(unsigned i=0; i<contenders.size() && numUnresolved > 0u; ++i)
+    {
+        ElevationLayer* layer = contenders[i].layer.get();
+        const TileKey& contenderKey = contenders[i].key;
+
+        // We also fallback on parent layers to make sure that we have data at the location even if it's fallback.
+        TileKey actualKey = contenderKey;
+        GeoHeightField layerHF;
+        while (!layerHF.valid() && actualKey.valid() && layer->isKeyInLegalRange(actualKey))
+        {
+            layerHF = layer->createHeightField(actualKey, progress);
+            if (!layerHF.valid())
             {
-                if ( layer->isOffset() )
-                {
-                    offsets.push_back(LayerData());
-                    LayerData& ld = offsets.back();
-                    ld.layer = layer;
-                    ld.key = bestKey;
-                    ld.index = i;
-                }
-                else
-                {
-                    contenders.push_back(LayerData());
-                    LayerData& ld = contenders.back();
-                    ld.layer = layer;
-                    ld.key = bestKey;
-                    ld.index = i;
-                }
+                actualKey = actualKey.createParentKey();
             }
         }
+
+        if (!layerHF.valid())
+            continue;
+
+        // We only have real data if this is not a fallback heightfield.
+        if (actualKey == contenderKey)
+        {
+            realData = true;
+        }
+
+        pass._offset   = false;
+        pass._index    = contenders[i].index;
+        pass._deltaLOD = key.getLOD() - actualKey.getLOD();
+
+        numUnresolved -= sampleLayer(pass, layerHF, xs, ys, numChunks);
     }
 
-    // nothing? bail out.
-    if ( contenders.empty() && offsets.empty() )
+    for(int i=offsets.size()-1; i>=0; --i)
     {
+        // Skip the layer if every post was resolved by a layer above it.
+        bool needed = false;
+        for (unsigned p = 0; p < total && !needed; ++p)
+            needed = resolved[p] < 0 || offsets[i].index >= resolved[p];
+        if (!needed)
+            continue;
+
+        GeoHeightField layerHF = offsets[i].layer->createHeightField(offsets[i].key, progress);
+        if ( !layerHF.valid() )
+            continue;
+
+        // If we actually got a layer then we have real data
+        realData = true;
+
+        // Update the resolution tracker to account for the offset. Sadly this
+        // will wipe out the resolution of the actual data, and might result in 
+        // normal faceting. See the comments on "createNormalMap" for more info
+        pass._offset   = true;
+        pass._index    = offsets[i].index;
+        pass._deltaLOD = key.getLOD() - offsets[i].key.getLOD();
+
+        sampleLayer(pass, layerHF, xs, ys, numChunks);
+    }
+
+    if (normalMap)
+    {
+        NormalMapJob job;
+        job._extent    = &key.getExtent();
+        job._hf        = hf;
+        job._deltaLOD  = deltaLOD.get();
+        job._normalMap = normalMap;
+        ParallelRange::run(job, numRows, numChunks);
+    }
+
+    // Return whether or not we actually read any real data
+    return realData;
+}
+
+bool
+ElevationLayerVector::populateHeightFieldAndNormalMapPerPost(osg::HeightField*      hf,
+                                                             NormalMap*             normalMap,
+                                                             const TileKey&         key,
+                                                             const Profile*         haeProfile,
+                                                             ElevationInterpolation interpolation,
+                                                             ProgressCallback*      progress ) const
+{
+    // heightfield must already exist.
+    if ( !hf )
         return false;
+
+    METRIC_SCOPED("ElevationLayer.populateHeightFieldPerPost");
+
+    // if the caller provided an "HAE map profile", he wants an HAE elevation grid even if
+    // the map profile has a vertical datum. This is the usual case when building the 3D
+    // terrain, for example. Construct a temporary key that doesn't have the vertical
+    // datum info and use that to query the elevation data.
+    TileKey keyToUse = key;
+    if ( haeProfile )
+    {
+        keyToUse = TileKey(key.getLOD(), key.getTileX(), key.getTileY(), haeProfile );
     }
+    
+    // Collect the valid layers for this tile.
+    LayerDataVector contenders;
+    LayerDataVector offsets;
 
-    // if everything is fallback data, bail out.
-    if ( contenders.size() + offsets.size() == numFallbackLayers )
+    if ( !collectLayers(*this, hf, key, keyToUse, contenders, offsets) )
     {
         return false;
     }
@@ -1120,7 +1554,7 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
 
     if (normalMap)
     {
-        createNormalMap(key.getExtent(), hf, deltaLOD.get(), normalMap);
+        createNormalMap(key.getExtent(), hf, deltaLOD.get(), normalMap, 0, (int)hf->getNumRows());
     }
 
     // Return whether or not we actually read any real data
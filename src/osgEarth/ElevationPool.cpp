@@ -279,6 +279,23 @@ ElevationPool::clearImpl()
     _entries = 0u;
 }
 
+bool
+ElevationPool::getResidentTile(const TileKey& key, osg::ref_ptr<Tile>& output)
+{
+    Threading::ScopedMutexLock lock(_tilesMutex);
+
+    Tiles::iterator i = _tiles.find(key);
+    if (i == _tiles.end())
+        return false;
+
+    osg::ref_ptr<Tile> tile;
+    if (!i->second.lock(tile) || tile->_status != STATUS_AVAILABLE)
+        return false;
+
+    output = tile.get();
+    return true;
+}
+
 bool
 ElevationPool::getTile(const TileKey& key, MapFrame& frame, osg::ref_ptr<ElevationPool::Tile>& output)
 {
@@ -342,7 +359,8 @@ ElevationPool::createEnvelope(const SpatialReference* srs, unsigned lod)
 //........................................................................
 
 ElevationEnvelope::ElevationEnvelope() :
-_pool(0L)
+_pool(0L),
+_residentOnly(false)
 {
     //nop
 }
@@ -390,7 +408,20 @@ ElevationEnvelope::sample(double x, double y, float& out_elevation, float& out_r
         {
             TileKey key = _frame.getProfile()->createTileKey(p.x(), p.y(), _lod);
             osg::ref_ptr<ElevationPool::Tile> tile;
-            if (_pool && _pool->getTile(key, _frame, tile))
+
+            bool gotTile = false;
+            if (_pool && _residentOnly)
+            {
+                // settle for the best tile already loaded:
+                for (; key.valid() && !gotTile; key = key.createParentKey())
+                    gotTile = _pool->getResidentTile(key, tile);
+            }
+            else if (_pool)
+            {
+                gotTile = _pool->getTile(key, _frame, tile);
+            }
+
+            if (gotTile)
             {
                 // Got the new tile; put it in the query set:
                 _tiles.insert(tile.get());
@@ -451,7 +482,7 @@ ElevationEnvelope::getElevations(const std::vector<osg::Vec3d>& input,
             ++count;
     }
 
-    if (count < input.size())
+    if (count < input.size() && !_residentOnly)
     {
         OE_WARN << LC << "Issue: Envelope had failed samples" << std::endl;
         for (ElevationPool::QuerySet::const_iterator tile_ref = _tiles.begin(); tile_ref != _tiles.end(); ++tile_ref)
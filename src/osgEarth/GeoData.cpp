@@ -25,6 +25,8 @@
 #include <osgEarth/Cube>
 #include <osgEarth/VerticalDatum>
 #include <osgEarth/Terrain>
+#include <osgEarth/Containers>
+#include <osgEarth/TaskService>
 
 #include <osg/Notify>
 #include <osg/Timer>
@@ -1837,6 +1839,421 @@ namespace
     }    
 
 
+    //! Source-SRS coordinates of a coarse lattice of output pixel centers.
+    //! The coordinates of the pixels between lattice nodes are interpolated,
+    //! so only the nodes go through the (expensive) SRS transformation.
+    struct WarpGrid : public osg::Referenced
+    {
+        unsigned            _width, _height;  // output size in pixels
+        unsigned            _step;            // output pixels between nodes
+        unsigned            _cols, _rows;     // number of nodes
+        std::vector<double> _x, _y;           // node coordinates, row-major
+
+        // per output column: node to the left, and weight of the node to its right
+        std::vector<unsigned> _col0;
+        std::vector<double>   _colWeight;
+
+        bool                _valid;
+
+        //! Output pixel at node i (the last node sits on the last pixel)
+        static unsigned nodePixel(unsigned i, unsigned step, unsigned size)
+        {
+            return osg::minimum(i*step, size-1u);
+        }
+
+        bool build(const GeoExtent& dest, const SpatialReference* srcSRS, unsigned width, unsigned height, unsigned step)
+        {
+            _width  = width;
+            _height = height;
+            _step   = step;
+            _cols   = (width  - 1u + step - 1u) / step + 1u;
+            _rows   = (height - 1u + step - 1u) / step + 1u;
+
+            // Pixel centers, exactly as the per-pixel sampler computed them.
+            const double dx = dest.width() / (double)width;
+            const double dy = dest.height() / (double)height;
+
+            std::vector<osg::Vec3d> points;
+            points.reserve(_cols * _rows);
+            for (unsigned j = 0; j < _rows; ++j)
+            {
+                double y = dest.yMin() + .5 * dy + dy * (double)nodePixel(j, step, height);
+                for (unsigned i = 0; i < _cols; ++i)
+                {
+                    double x = dest.xMin() + .5 * dx + dx * (double)nodePixel(i, step, width);
+                    points.push_back(osg::Vec3d(x, y, 0.0));
+                }
+            }
+
+            _valid = dest.getSRS()->transform(points, srcSRS);
+            if (!_valid)
+                return false;
+
+            _x.resize(points.size());
+            _y.resize(points.size());
+            for (unsigned p = 0; p < points.size(); ++p)
+            {
+                _x[p] = points[p].x();
+                _y[p] = points[p].y();
+            }
+
+            _col0.resize(width);
+            _colWeight.resize(width);
+            for (unsigned c = 0; c < width; ++c)
+            {
+                unsigned i0 = osg::minimum(c / step, _cols - 1u);
+                unsigned i1 = osg::minimum(i0 + 1u, _cols - 1u);
+                unsigned p0 = nodePixel(i0, step, width), p1 = nodePixel(i1, step, width);
+                _col0[c] = i0;
+                _colWeight[c] = p1 > p0 ? (double)(c - p0) / (double)(p1 - p0) : 0.0;
+            }
+            return true;
+        }
+
+        //! Source coordinates of every pixel in output row r.
+        void getRow(unsigned r, double* x, double* y) const
+        {
+            unsigned j0 = osg::minimum(r / _step, _rows - 1u);
+            unsigned j1 = osg::minimum(j0 + 1u, _rows - 1u);
+            unsigned p0 = nodePixel(j0, _step, _height), p1 = nodePixel(j1, _step, _height);
+            double   v  = p1 > p0 ? (double)(r - p0) / (double)(p1 - p0) : 0.0;
+
+            // blend the two node rows bracketing r:
+            const double* x0 = &_x[j0*_cols];
+            const double* x1 = &_x[j1*_cols];
+            const double* y0 = &_y[j0*_cols];
+            const double* y1 = &_y[j1*_cols];
+
+            // then each pixel between the two nodes bracketing its column:
+            for (unsigned c = 0; c < _width; ++c)
+            {
+                unsigned i0 = _col0[c];
+                unsigned i1 = osg::minimum(i0 + 1u, _cols - 1u);
+                double   u  = _colWeight[c];
+                double xa = x0[i0] + (x1[i0] - x0[i0]) * v;
+                double xb = x0[i1] + (x1[i1] - x0[i1]) * v;
+                double ya = y0[i0] + (y1[i0] - y0[i0]) * v;
+                double yb = y0[i1] + (y1[i1] - y0[i1]) * v;
+                x[c] = xa + (xb - xa) * u;
+                y[c] = ya + (yb - ya) * u;
+            }
+        }
+
+        //! Checks the interpolation against the real transformation at the
+        //! center of every cell. The error must stay under 1/8 of an output
+        //! pixel, measured in source units.
+        bool isAccurate(const GeoExtent& dest, const SpatialReference* srcSRS) const
+        {
+            if (_step == 1u)
+                return true;
+
+            const double dx = dest.width() / (double)_width;
+            const double dy = dest.height() / (double)_height;
+
+            std::vector<unsigned>   cols, rows;
+            std::vector<osg::Vec3d> points;
+            for (unsigned j = 0; j+1 < _rows; ++j)
+            {
+                unsigned r = (nodePixel(j, _step, _height) + nodePixel(j+1, _step, _height)) / 2u;
+                for (unsigned i = 0; i+1 < _cols; ++i)
+                {
+                    unsigned c = (nodePixel(i, _step, _width) + nodePixel(i+1, _step, _width)) / 2u;
+                    cols.push_back(c);
+                    rows.push_back(r);
+                    points.push_back(osg::Vec3d(
+                        dest.xMin() + .5 * dx + dx * (double)c,
+                        dest.yMin() + .5 * dy + dy * (double)r,
+                        0.0));
+                }
+            }
+
+            if (points.empty())
+                return true;
+
+            if (!dest.getSRS()->transform(points, srcSRS))
+                return false;
+
+            std::vector<double> x(_width), y(_width);
+            unsigned lastRow = ~0u;
+            for (unsigned p = 0; p < points.size(); ++p)
+            {
+                unsigned c = cols[p], r = rows[p];
+                if (r != lastRow)
+                {
+                    getRow(r, &x[0], &y[0]);
+                    lastRow = r;
+                }
+
+                // size of one output pixel in source units around this cell:
+                unsigned i = osg::minimum(_col0[c], _cols - 2u);
+                unsigned j = osg::minimum(r / _step, _rows - 2u);
+                unsigned n = j*_cols + i;
+                double spanX = osg::Vec2d(_x[n+1] - _x[n], _y[n+1] - _y[n]).length() / (double)_step;
+                double spanY = osg::Vec2d(_x[n+_cols] - _x[n], _y[n+_cols] - _y[n]).length() / (double)_step;
+                double tolerance = 0.125 * osg::minimum(spanX, spanY);
+
+                double error = osg::Vec2d(x[c] - points[p].x(), y[c] - points[p].y()).length();
+                if (!(error <= tolerance))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    struct WarpGridKey
+    {
+        std::string _from, _to;
+        double      _xmin, _ymin, _xmax, _ymax;
+        unsigned    _width, _height;
+
+        bool operator < (const WarpGridKey& rhs) const
+        {
+            if (_width != rhs._width)   return _width < rhs._width;
+            if (_height != rhs._height) return _height < rhs._height;
+            if (_xmin != rhs._xmin)     return _xmin < rhs._xmin;
+            if (_ymin != rhs._ymin)     return _ymin < rhs._ymin;
+            if (_xmax != rhs._xmax)     return _xmax < rhs._xmax;
+            if (_ymax != rhs._ymax)     return _ymax < rhs._ymax;
+            int c = _from.compare(rhs._from);
+            if (c != 0) return c < 0;
+            return _to.compare(rhs._to) < 0;
+        }
+    };
+
+    typedef LRUCache<WarpGridKey, osg::ref_ptr<WarpGrid> > WarpGridCache;
+
+    // Reprojecting many images (layers, or source tiles) into the same
+    // destination tile reuses one grid.
+    WarpGridCache s_warpGridCache(true, 128u);
+
+    //! Gets (or builds and caches) the warp grid for the destination pixels.
+    //! Starts coarse and refines until the interpolation is accurate enough.
+    osg::ref_ptr<WarpGrid> getWarpGrid(const GeoExtent& dest, const SpatialReference* srcSRS, unsigned width, unsigned height)
+    {
+        WarpGridKey key;
+        key._from   = srcSRS->getKey().horizLower;
+        key._to     = dest.getSRS()->getKey().horizLower;
+        key._xmin   = dest.xMin();
+        key._ymin   = dest.yMin();
+        key._xmax   = dest.xMax();
+        key._ymax   = dest.yMax();
+        key._width  = width;
+        key._height = height;
+
+        WarpGridCache::Record record;
+        if (s_warpGridCache.get(key, record))
+            return record.value();
+
+        osg::ref_ptr<WarpGrid> grid = new WarpGrid();
+        for (unsigned step = 16u; step >= 1u; step /= 2u)
+        {
+            if (grid->build(dest, srcSRS, width, height, step) && grid->isAccurate(dest, srcSRS))
+                break;
+        }
+
+        s_warpGridCache.insert(key, grid);
+        return grid;
+    }
+
+    //! Samples the source image at pixel coordinates (px, py) the way the
+    //! per-pixel reprojection always has.
+    inline osg::Vec4 sampleColor(const ImageUtils::PixelReader& ia, const osg::Image* image, float px, float py, bool interpolate)
+    {
+        int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
+        int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
+
+        // TODO: consider this again later. Causes blockiness.
+        if ( !interpolate ) //! isSrcContiguous ) // non-contiguous space- use nearest neighbot
+        {
+            return ia(px_i, py_i);
+        }
+
+        // contiguous space - use bilinear sampling
+        int rowMin = osg::maximum((int)floor(py), 0);
+        int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
+        int colMin = osg::maximum((int)floor(px), 0);
+        int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
+
+        if (rowMin > rowMax) rowMin = rowMax;
+        if (colMin > colMax) colMin = colMax;
+
+        osg::Vec4 urColor = ia(colMax, rowMax);
+        osg::Vec4 llColor = ia(colMin, rowMin);
+        osg::Vec4 ulColor = ia(colMin, rowMax);
+        osg::Vec4 lrColor = ia(colMax, rowMin);
+
+        osg::Vec4 color(0,0,0,0);
+
+        //Check for exact value
+        if ((colMax == colMin) && (rowMax == rowMin))
+        {
+            color = ia(px_i, py_i);
+        }
+        else if (colMax == colMin)
+        {
+            //Linear interpolate vertically
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                color[i] = ((float)rowMax - py) * llColor[i] + (py - (float)rowMin) * ulColor[i];
+            }
+        }
+        else if (rowMax == rowMin)
+        {
+            //Linear interpolate horizontally
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                color[i] = ((float)colMax - px) * llColor[i] + (px - (float)colMin) * lrColor[i];
+            }
+        }
+        else
+        {
+            //Bilinear interpolate
+            float col1 = colMax - px, col2 = px - colMin;
+            float row1 = rowMax - py, row2 = py - rowMin;
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                float r1 = col1 * llColor[i] + col2 * lrColor[i];
+                float r2 = col1 * ulColor[i] + col2 * urColor[i];
+                color[i] = row1 * r1 + row2 * r2;
+            }
+        }
+
+        return color;
+    }
+
+    //! Fills a band of output rows from the source image.
+    struct WarpJob : public ParallelRange::Job
+    {
+        const osg::Image* _src;
+        osg::Image*       _dst;
+        const WarpGrid*   _grid;
+        const GeoExtent*  _srcExtent;
+        bool              _interpolate;
+
+        void run(unsigned r0, unsigned r1, unsigned chunk)
+        {
+            const osg::Image* image = _src;
+            const GeoExtent&  src_extent = *_srcExtent;
+            unsigned width = _grid->_width;
+
+            double xfac = (image->s() - 1) / src_extent.width();
+            double yfac = (image->t() - 1) / src_extent.height();
+
+            std::vector<double> srcX(width), srcY(width);
+            std::vector<float>  px(width), py(width);
+            std::vector<char>   inside(width);
+
+            // Fast path: 8-bit RGB(A) in and out (the common case for imagery).
+            bool fast =
+                image->getDataType() == GL_UNSIGNED_BYTE &&
+                (image->getPixelFormat() == GL_RGBA || image->getPixelFormat() == GL_RGB) &&
+                _dst->getPixelFormat() == image->getPixelFormat() &&
+                _dst->getDataType() == GL_UNSIGNED_BYTE;
+
+            ImageUtils::PixelReader ia(image);
+            ImageUtils::PixelWriter writer(_dst);
+
+            for (unsigned r = r0; r < r1; ++r)
+            {
+                _grid->getRow(r, &srcX[0], &srcY[0]);
+
+                // source pixel coordinates, and whether each one falls inside the source:
+                for (unsigned c = 0; c < width; ++c)
+                {
+                    double src_x = srcX[c], src_y = srcY[c];
+                    inside[c] = !( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() );
+                    px[c] = (src_x - src_extent.xMin()) * xfac;
+                    py[c] = (src_y - src_extent.yMin()) * yfac;
+                }
+
+                if (fast)
+                {
+                    sampleRowRGBA(r, &px[0], &py[0], &inside[0]);
+                }
+                else
+                {
+                    for (unsigned c = 0; c < width; ++c)
+                    {
+                        if (inside[c])
+                            writer(sampleColor(ia, image, px[c], py[c], _interpolate), c, r);
+                    }
+                }
+            }
+        }
+
+        //! Same math as sampleColor, on the raw bytes of a 3- or 4-channel image.
+        void sampleRowRGBA(unsigned r, const float* px, const float* py, const char* inside)
+        {
+            const osg::Image* image = _src;
+            unsigned numChannels = image->getPixelFormat() == GL_RGBA ? 4u : 3u;
+            unsigned width = _grid->_width;
+            int s = image->s(), t = image->t();
+
+            // byte-to-float the way PixelReader converts, and back the way PixelWriter does.
+            double scale = ImageUtils::isNormalized(image) ? 1.0/255.0 : 1.0;
+            double unscale = ImageUtils::isNormalized(_dst) ? 1.0/255.0 : 1.0;
+            float toFloat[256];
+            for (unsigned i = 0; i < 256u; ++i)
+                toFloat[i] = float(i) * scale;
+
+            const unsigned char* data = image->data();
+            unsigned rowBytes = image->getRowSizeInBytes();
+            unsigned char* out = _dst->data(0, r);
+
+            for (unsigned c = 0; c < width; ++c)
+            {
+                if (!inside[c])
+                    continue;
+
+                int colMin, colMax, rowMin, rowMax;
+                float col1, col2, row1, row2;
+
+                if (!_interpolate)
+                {
+                    colMin = colMax = osg::clampBetween( (int)osg::round(px[c]), 0, s-1 );
+                    rowMin = rowMax = osg::clampBetween( (int)osg::round(py[c]), 0, t-1 );
+                    col1 = row1 = 1.0f;
+                    col2 = row2 = 0.0f;
+                }
+                else
+                {
+                    rowMin = osg::maximum((int)floor(py[c]), 0);
+                    rowMax = osg::maximum(osg::minimum((int)ceil(py[c]), t-1), 0);
+                    colMin = osg::maximum((int)floor(px[c]), 0);
+                    colMax = osg::maximum(osg::minimum((int)ceil(px[c]), s-1), 0);
+
+                    if (rowMin > rowMax) rowMin = rowMax;
+                    if (colMin > colMax) colMin = colMax;
+
+                    // On an exact pixel (or row, or column), weight it fully so that the
+                    // bilinear formula reduces to the exact and linear cases.
+                    col1 = colMax == colMin ? 1.0f : (float)colMax - px[c];
+                    col2 = colMax == colMin ? 0.0f : px[c] - (float)colMin;
+                    row1 = rowMax == rowMin ? 1.0f : (float)rowMax - py[c];
+                    row2 = rowMax == rowMin ? 0.0f : py[c] - (float)rowMin;
+                }
+
+                const unsigned char* ll = data + rowMin*rowBytes + colMin*numChannels;
+                const unsigned char* lr = data + rowMin*rowBytes + colMax*numChannels;
+                const unsigned char* ul = data + rowMax*rowBytes + colMin*numChannels;
+                const unsigned char* ur = data + rowMax*rowBytes + colMax*numChannels;
+                unsigned char* o = out + c*numChannels;
+
+                for (unsigned i = 0; i < numChannels; ++i)
+                {
+                    float r1 = col1 * toFloat[ll[i]] + col2 * toFloat[lr[i]];
+                    float r2 = col1 * toFloat[ul[i]] + col2 * toFloat[ur[i]];
+                    o[i] = (unsigned char)( (row1 * r1 + row2 * r2) / unscale );
+                }
+            }
+        }
+    };
+
+    // Below this many output pixels, warping on the calling thread is faster
+    // than handing bands off to the thread pool.
+    const unsigned MIN_PIXELS_TO_SPLIT = 128u * 128u;
+    const unsigned MIN_ROWS_PER_BAND   = 16u;
+
     osg::Image* manualReproject(
         const osg::Image* image, 
         const GeoExtent&  src_extent, 
@@ -1854,7 +2271,6 @@ namespace
         }
 
         osg::Image *result = new osg::Image();
-        //result->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
         result->allocateImage(width, height, 1, image->getPixelFormat(), image->getDataType()); //GL_UNSIGNED_BYTE);
         result->setInternalTextureFormat(image->getInternalTextureFormat());
         ImageUtils::markAsUnNormalized(result, ImageUtils::isUnNormalized(image));
@@ -1862,155 +2278,23 @@ namespace
         //Initialize the image to be completely transparent/black
         memset(result->data(), 0, result->getImageSizeInBytes());
 
-        //ImageUtils::PixelReader ra(result);
-        ImageUtils::PixelWriter writer(result);
-        const double dx = dest_extent.width() / (double)width;
-        const double dy = dest_extent.height() / (double)height;
-
-        // offset the sample points by 1/2 a pixel so we are sampling "pixel center".
-        // (This is especially useful in the UnifiedCubeProfile since it nullifes the chances for
-        // edge ambiguity.)
-
-        unsigned int numPixels = width * height;
-
-        // Start by creating a sample grid over the destination
-        // extent. These will be the source coordinates. Then, reproject
-        // the sample grid into the source coordinate system.
-        double *srcPointsX = new double[numPixels * 2];
-        double *srcPointsY = srcPointsX + numPixels;
-
-        dest_extent.getSRS()->transformExtentPoints(
-            src_extent.getSRS(),
-            dest_extent.xMin() + .5 * dx, dest_extent.yMin() + .5 * dy,
-            dest_extent.xMax() - .5 * dx, dest_extent.yMax() - .5 * dy,
-            srcPointsX, srcPointsY, width, height);
-
-        // Next, go through the source-SRS sample grid, read the color at each point from the source image,
-        // and write it to the corresponding pixel in the destination image.
-        int pixel = 0;
-        ImageUtils::PixelReader ia(image);
-        double xfac = (image->s() - 1) / src_extent.width();
-        double yfac = (image->t() - 1) / src_extent.height();
-        for (unsigned int c = 0; c < width; ++c)
-        {
-            for (unsigned int r = 0; r < height; ++r)
-            {   
-                double src_x = srcPointsX[pixel];
-                double src_y = srcPointsY[pixel];
-
-                if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
-                {
-                    //If the sample point is outside of the bound of the source extent, increment the pixel and keep looping through.
-                    //OE_WARN << LC << "ERROR: sample point out of bounds: " << src_x << ", " << src_y << std::endl;
-                    pixel++;
-                    continue;
-                }
-
-                float px = (src_x - src_extent.xMin()) * xfac;
-                float py = (src_y - src_extent.yMin()) * yfac;
+        // The source coordinates of each output pixel center come from a
+        // (cached) warp grid. If the transformation fails, the result stays empty.
+        osg::ref_ptr<WarpGrid> grid = getWarpGrid(dest_extent, src_extent.getSRS(), width, height);
+        if ( !grid->_valid )
+            return result;
 
-                int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
-                int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
+        WarpJob job;
+        job._src         = image;
+        job._dst         = result;
+        job._grid        = grid.get();
+        job._srcExtent   = &src_extent;
+        job._interpolate = interpolate;
 
-                osg::Vec4 color(0,0,0,0);
-
-                // TODO: consider this again later. Causes blockiness.
-                if ( !interpolate ) //! isSrcContiguous ) // non-contiguous space- use nearest neighbot
-                {
-                    color = ia(px_i, py_i);
-                }
-
-                else // contiguous space - use bilinear sampling
-                {
-                    int rowMin = osg::maximum((int)floor(py), 0);
-                    int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
-                    int colMin = osg::maximum((int)floor(px), 0);
-                    int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
-
-                    if (rowMin > rowMax) rowMin = rowMax;
-                    if (colMin > colMax) colMin = colMax;
-
-                    osg::Vec4 urColor = ia(colMax, rowMax);
-                    osg::Vec4 llColor = ia(colMin, rowMin);
-                    osg::Vec4 ulColor = ia(colMin, rowMax);
-                    osg::Vec4 lrColor = ia(colMax, rowMin);
-
-                    /*Average Interpolation*/
-                    /*double x_rem = px - (int)px;
-                    double y_rem = py - (int)py;
-
-                    double w00 = (1.0 - y_rem) * (1.0 - x_rem);
-                    double w01 = (1.0 - y_rem) * x_rem;
-                    double w10 = y_rem * (1.0 - x_rem);
-                    double w11 = y_rem * x_rem;
-                    double wsum = w00 + w01 + w10 + w11;
-                    wsum = 1.0/wsum;
-
-                    color.r() = (w00 * llColor.r() + w01 * lrColor.r() + w10 * ulColor.r() + w11 * urColor.r()) * wsum;
-                    color.g() = (w00 * llColor.g() + w01 * lrColor.g() + w10 * ulColor.g() + w11 * urColor.g()) * wsum;
-                    color.b() = (w00 * llColor.b() + w01 * lrColor.b() + w10 * ulColor.b() + w11 * urColor.b()) * wsum;
-                    color.a() = (w00 * llColor.a() + w01 * lrColor.a() + w10 * ulColor.a() + w11 * urColor.a()) * wsum;*/
-
-                    /*Nearest Neighbor Interpolation*/
-                    /*if (px_i >= 0 && px_i < image->s() &&
-                    py_i >= 0 && py_i < image->t())
-                    {
-                    //OE_NOTICE << "[osgEarth::GeoData] Sampling pixel " << px << "," << py << std::endl;
-                    color = ImageUtils::getColor(image, px_i, py_i);
-                    }
-                    else
-                    {
-                    OE_NOTICE << "[osgEarth::GeoData] Pixel out of range " << px_i << "," << py_i << "  image is " << image->s() << "x" << image->t() << std::endl;
-                    }*/
-
-                    /*Bilinear interpolation*/
-                    //Check for exact value
-                    if ((colMax == colMin) && (rowMax == rowMin))
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Exact value" << std::endl;
-                        color = ia(px_i, py_i);
-                    }
-                    else if (colMax == colMin)
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Vertically" << std::endl;
-                        //Linear interpolate vertically
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            color[i] = ((float)rowMax - py) * llColor[i] + (py - (float)rowMin) * ulColor[i];
-                        }
-                    }
-                    else if (rowMax == rowMin)
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Horizontally" << std::endl;
-                        //Linear interpolate horizontally
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            color[i] = ((float)colMax - px) * llColor[i] + (px - (float)colMin) * lrColor[i];
-                        }
-                    }
-                    else
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Bilinear" << std::endl;
-                        //Bilinear interpolate
-                        float col1 = colMax - px, col2 = px - colMin;
-                        float row1 = rowMax - py, row2 = py - rowMin;
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            float r1 = col1 * llColor[i] + col2 * lrColor[i];
-                            float r2 = col1 * ulColor[i] + col2 * urColor[i];
-
-                            //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
-                            color[i] = row1 * r1 + row2 * r2;
-                        }
-                    }
-                }
-
-                writer(color, c, r);
-                pixel++;
-            }
-        }
+        unsigned numBands = width*height >= MIN_PIXELS_TO_SPLIT ?
+            ParallelRange::getNumChunks(height, MIN_ROWS_PER_BAND) : 1u;
 
-        delete[] srcPointsX;
+        ParallelRange::run(job, height, numBands);
 
         return result;
     }
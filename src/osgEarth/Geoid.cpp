@@ -19,11 +19,72 @@
 
 #include <osgEarth/Geoid>
 #include <osgEarth/HeightFieldUtils>
+#include <algorithm>
+#include <vector>
 
 #define LC "[Geoid] "
 
 using namespace osgEarth;
 
+namespace
+{
+    // Bracketing geoid posts and bilinear weights along one axis of a grid
+    // query, computed like getHeightAtNormalizedLocation does per point.
+    struct Axis
+    {
+        std::vector<int>           _i0, _i1;
+        std::vector<double>        _w0, _w1;
+        std::vector<unsigned char> _inside;
+
+        void build(double start, double interval, unsigned count, double min, double max, unsigned numPosts)
+        {
+            _i0.resize(count); _i1.resize(count);
+            _w0.resize(count); _w1.resize(count);
+            _inside.resize(count);
+
+            for (unsigned i = 0; i < count; ++i)
+            {
+                double v = start + interval*(double)i;
+                _inside[i] = v >= min && v <= max;
+
+                double p = osg::clampBetween((v-min)/(max-min), 0.0, 1.0) * (double)(numPosts-1);
+                int i0 = osg::maximum((int)floor(p), 0);
+                int i1 = osg::maximum(osg::minimum((int)ceil(p), (int)numPosts-1), 0);
+                if (i0 > i1) i0 = i1;
+                _i0[i] = i0;
+                _i1[i] = i1;
+                _w0[i] = i1 > i0 ? (double)i1 - p : 1.0;
+                _w1[i] = i1 > i0 ? p - (double)i0 : 0.0;
+            }
+        }
+    };
+
+    // One geoid row, interpolated across at every output column
+    struct RowPass
+    {
+        int                 _row;
+        std::vector<double> _h;
+        bool                _noData;
+
+        RowPass() : _row(-1), _noData(false) { }
+
+        void compute(const osg::HeightField* hf, int row, const Axis& cols)
+        {
+            const float* in = &hf->getFloatArray()->front() + row*hf->getNumColumns();
+            unsigned n = cols._i0.size();
+            _h.resize(n);
+            _row = row;
+            _noData = false;
+            for (unsigned x = 0; x < n; ++x)
+            {
+                float a = in[cols._i0[x]], b = in[cols._i1[x]];
+                _noData = _noData || a == NO_DATA_VALUE || b == NO_DATA_VALUE;
+                _h[x] = cols._w0[x]*(double)a + cols._w1[x]*(double)b;
+            }
+        }
+    };
+}
+
 
 Geoid::Geoid() :
 _units( Units::METERS ),
@@ -91,6 +152,73 @@ Geoid::getHeight(double lat_deg, double lon_deg, const ElevationInterpolation& i
     return result;
 }
 
+void
+Geoid::getHeights(double   west,
+                  double   south,
+                  double   xInterval,
+                  double   yInterval,
+                  unsigned numCols,
+                  unsigned numRows,
+                  float*   output) const
+{
+    if ( !_valid )
+    {
+        std::fill(output, output + numCols*numRows, 0.0f);
+        return;
+    }
+
+    Axis cols, rows;
+    cols.build(west, xInterval, numCols, _bounds.xMin(), _bounds.xMax(), _hf->getNumColumns());
+    rows.build(south, yInterval, numRows, _bounds.yMin(), _bounds.yMax(), _hf->getNumRows());
+
+    // consecutive output rows usually fall between the same two geoid rows,
+    // so keep the last two horizontal passes around
+    RowPass passes[2];
+
+    for (unsigned y = 0; y < numRows; ++y)
+    {
+        float* out = output + y*numCols;
+
+        if ( !rows._inside[y] )
+        {
+            std::fill(out, out + numCols, 0.0f);
+            continue;
+        }
+
+        int r0 = rows._i0[y], r1 = rows._i1[y];
+        RowPass* p0 = passes[0]._row == r0 ? &passes[0] : passes[1]._row == r0 ? &passes[1] : 0L;
+        RowPass* p1 = passes[0]._row == r1 ? &passes[0] : passes[1]._row == r1 ? &passes[1] : 0L;
+        if ( !p0 )
+        {
+            p0 = p1 == &passes[0] ? &passes[1] : &passes[0];
+            p0->compute(_hf.get(), r0, cols);
+            if ( r1 == r0 ) p1 = p0;
+        }
+        if ( !p1 )
+        {
+            p1 = p0 == &passes[0] ? &passes[1] : &passes[0];
+            p1->compute(_hf.get(), r1, cols);
+        }
+
+        double w0 = rows._w0[y], w1 = rows._w1[y];
+        for (unsigned x = 0; x < numCols; ++x)
+        {
+            out[x] = cols._inside[x] ? (float)(w0*p0->_h[x] + w1*p1->_h[x]) : 0.0f;
+        }
+
+        // a geoid with holes needs the per-point sample substitution
+        if ( p0->_noData || p1->_noData )
+        {
+            double lat = south + yInterval*(double)y;
+            for (unsigned x = 0; x < numCols; ++x)
+            {
+                if ( cols._inside[x] )
+                    out[x] = getHeight(lat, west + xInterval*(double)x, INTERP_BILINEAR);
+            }
+        }
+    }
+}
+
 bool
 Geoid::isEquivalentTo( const Geoid& rhs ) const
 {
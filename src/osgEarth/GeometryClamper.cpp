@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/GeometryClamper>
+#include <osgEarth/ElevationPool>
 
 #include <osgUtil/IntersectionVisitor>
 
@@ -24,12 +25,56 @@
 #include <osg/Geometry>
 #include <osg/UserDataContainer>
 
+#include <cmath>
+
 #define LC "[GeometryClamper] "
 
 using namespace osgEarth;
 
 #define ZOFFSETS_NAME "GeometryClamper::zOffsets"
 
+// Finest LOD at which the index groups vertices
+#define MAX_INDEX_LOD 18u
+
+// Number of line segments to intersect with a tile in one traversal
+#define INTERSECTION_BATCH_SIZE 256u
+
+namespace
+{
+    // Collects the geometries under a node along with their local-to-world matrices.
+    struct CollectGeometry : public osg::NodeVisitor
+    {
+        std::vector< std::pair<osg::Geometry*, osg::Matrixd> > _results;
+        osg::fast_back_stack<osg::Matrixd> _matrixStack;
+
+        CollectGeometry() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+        {
+            setNodeMaskOverride(~0);
+        }
+
+        void apply(osg::Transform& xform)
+        {
+            osg::Matrixd matrix;
+            if ( !_matrixStack.empty() ) matrix = _matrixStack.back();
+            xform.computeLocalToWorldMatrix( matrix, this );
+            _matrixStack.push_back( matrix );
+            traverse(xform);
+            _matrixStack.pop_back();
+        }
+
+        void apply(osg::Drawable& drawable)
+        {
+            osg::Geometry* geom = drawable.asGeometry();
+            if (geom && dynamic_cast<osg::Vec3Array*>(geom->getVertexArray()))
+            {
+                _results.push_back(std::make_pair(
+                    geom,
+                    _matrixStack.empty() ? osg::Matrixd() : _matrixStack.back()));
+            }
+        }
+    };
+}
+
 //-----------------------------------------------------------------------
 
 GeometryClamper::GeometryClamper() :
@@ -169,19 +214,369 @@ GeometryClamper::apply(osg::Drawable& drawable)
 
     if ( geomDirty )
     {
-        geom->dirtyBound();
-        if ( geom->getUseVertexBufferObjects() )
+        dirty( geom );
+
+        OE_DEBUG << LC << "clamped " << count << " verts." << std::endl;
+    }
+}
+
+void
+GeometryClamper::dirty(osg::Geometry* geom)
+{
+    osg::Array* verts = geom->getVertexArray();
+
+    geom->dirtyBound();
+    if ( geom->getUseVertexBufferObjects() )
+    {
+        verts->getVertexBufferObject()->setUsage( GL_DYNAMIC_DRAW_ARB );
+        verts->dirty();
+    }
+    else
+    {
+        geom->dirtyDisplayList();
+    }
+}
+
+void
+GeometryClamper::setElevationPool(ElevationPool* pool)
+{
+    _pool = pool;
+}
+
+GeometryClamper::Index*
+GeometryClamper::buildIndex(osg::Node* node, const Profile* profile)
+{
+    if ( !node || !profile || !_terrainSRS.valid() )
+        return 0L;
+
+    osg::ref_ptr<Index> index = new Index();
+    index->_profile = profile;
+
+    CollectGeometry collect;
+    node->accept( collect );
+
+    const SpatialReference* profileSRS = profile->getSRS();
+    bool sameSRS = profileSRS->isHorizEquivalentTo( _terrainSRS.get() );
+    bool isGeocentric = _terrainSRS->isGeographic();
+    const osg::EllipsoidModel* em = _terrainSRS->getEllipsoid();
+
+    osg::BoundingBoxd bounds;
+
+    index->_targets.resize( collect._results.size() );
+
+    for(unsigned t=0; t<collect._results.size(); ++t)
+    {
+        osg::Geometry* geom = collect._results[t].first;
+        Index::Target& target = index->_targets[t];
+        target._geom = geom;
+        target._local2world = collect._results[t].second;
+        target._world2local.invert( target._local2world );
+
+        const osg::Vec3Array* verts = static_cast<const osg::Vec3Array*>(geom->getVertexArray());
+
+        // heights to preserve; reuse the ones a previous clamp recorded.
+        osg::FloatArray* zOffsets = 0L;
+        if ( _preserveZ )
         {
-            verts->getVertexBufferObject()->setUsage( GL_DYNAMIC_DRAW_ARB );
-            verts->dirty();
+            osg::UserDataContainer* udc = geom->getOrCreateUserDataContainer();
+            unsigned n = udc->getUserObjectIndex( ZOFFSETS_NAME );
+            if ( n < udc->getNumUserObjects() )
+                zOffsets = dynamic_cast<osg::FloatArray*>(udc->getUserObject(n));
+            if ( zOffsets && zOffsets->size() != verts->size() )
+                zOffsets = 0L;
+
+            if ( !zOffsets )
+            {
+                zOffsets = new osg::FloatArray();
+                zOffsets->setName( ZOFFSETS_NAME );
+                zOffsets->reserve( verts->size() );
+                for(unsigned k=0; k<verts->size(); ++k)
+                {
+                    osg::Vec3d vw = osg::Vec3d((*verts)[k]) * target._local2world;
+                    double lat, lon, hae;
+                    if ( isGeocentric )
+                        em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, hae);
+                    else
+                        hae = vw.z();
+                    zOffsets->push_back( hae );
+                }
+                if ( n < udc->getNumUserObjects() )
+                    udc->removeUserObject( n );
+                udc->addUserObject( zOffsets );
+            }
         }
-        else
+
+        target._coords.resize( verts->size() );
+        target._keyCoords.resize( verts->size() );
+
+        for(unsigned k=0; k<verts->size(); ++k)
         {
-            geom->dirtyDisplayList();
+            osg::Vec3d vw = osg::Vec3d((*verts)[k]) * target._local2world;
+
+            osg::Vec3d local;
+            _terrainSRS->transformFromWorld( vw, local );
+            local.z() = zOffsets ? (*zOffsets)[k] : 0.0;
+            target._coords[k] = local;
+
+            osg::Vec3d keyCoord = local;
+            if ( !sameSRS )
+                _terrainSRS->transform2D( local.x(), local.y(), profileSRS, keyCoord.x(), keyCoord.y() );
+            target._keyCoords[k].set( keyCoord.x(), keyCoord.y() );
+
+            bounds.expandBy( keyCoord.x(), keyCoord.y(), 0.0 );
         }
 
-        OE_DEBUG << LC << "clamped " << count << " verts." << std::endl;
+        index->_numVertices += verts->size();
+    }
+
+    if ( index->_numVertices == 0u )
+        return index.release();
+
+    // Pick a LOD that puts a few dozen vertices in each bucket, assuming
+    // they are spread over the bounds.
+    double size = osg::maximum( bounds.xMax()-bounds.xMin(), bounds.yMax()-bounds.yMin() );
+    double cellsPerSide = osg::clampBetween( sqrt((double)index->_numVertices / 64.0), 1.0, 1024.0 );
+    double targetSize = size / cellsPerSide;
+
+    index->_lod = 0u;
+    for( ; index->_lod < MAX_INDEX_LOD; ++index->_lod )
+    {
+        double w, h;
+        profile->getTileDimensions( index->_lod, w, h );
+        if ( osg::maximum(w, h) <= targetSize )
+            break;
+    }
+
+    // Bucket the vertices, merging runs of consecutive vertices in the same tile:
+    for(unsigned t=0; t<index->_targets.size(); ++t)
+    {
+        const Index::Target& target = index->_targets[t];
+        Index::Ranges* ranges = 0L;
+        TileKey current;
+
+        for(unsigned k=0; k<target._keyCoords.size(); ++k)
+        {
+            TileKey key = profile->createTileKey( target._keyCoords[k].x(), target._keyCoords[k].y(), index->_lod );
+            if ( !key.valid() )
+            {
+                ranges = 0L;
+                continue;
+            }
+
+            if ( ranges && key == current )
+            {
+                ranges->back()._end = k+1;
+            }
+            else
+            {
+                current = key;
+                ranges = &index->_buckets[key];
+                Index::Range range;
+                range._target = t;
+                range._begin  = k;
+                range._end    = k+1;
+                ranges->push_back( range );
+            }
+        }
     }
+
+    OE_DEBUG << LC << "Indexed " << index->_numVertices << " verts in "
+        << index->_buckets.size() << " tiles at LOD " << index->_lod << std::endl;
+
+    return index.release();
+}
+
+unsigned
+GeometryClamper::clamp(Index* index, const TileKey& key, osg::Node* tile)
+{
+    if ( !index || !key.valid() || !_terrainSRS.valid() || !index->_profile.valid() )
+        return 0u;
+
+    // Find the vertices inside the tile, per target:
+    std::vector< std::vector<unsigned> > hits( index->_targets.size() );
+    unsigned numHits = 0u;
+
+    if ( key.getLOD() >= index->_lod )
+    {
+        // the tile is inside one bucket; test the bucket's vertices against its extent.
+        Index::Buckets::const_iterator bucket = index->_buckets.find( key.createAncestorKey(index->_lod) );
+        if ( bucket == index->_buckets.end() )
+            return 0u;
+
+        const GeoExtent& extent = key.getExtent();
+
+        for(Index::Ranges::const_iterator r = bucket->second.begin(); r != bucket->second.end(); ++r)
+        {
+            const std::vector<osg::Vec2d>& keyCoords = index->_targets[r->_target]._keyCoords;
+            for(unsigned k = r->_begin; k < r->_end; ++k)
+            {
+                if ( extent.contains(keyCoords[k].x(), keyCoords[k].y()) )
+                {
+                    hits[r->_target].push_back( k );
+                    ++numHits;
+                }
+            }
+        }
+    }
+    else
+    {
+        // the tile spans many buckets; take all of the ones under it.
+        for(Index::Buckets::const_iterator bucket = index->_buckets.begin(); bucket != index->_buckets.end(); ++bucket)
+        {
+            if ( bucket->first.createAncestorKey(key.getLOD()) == key )
+            {
+                for(Index::Ranges::const_iterator r = bucket->second.begin(); r != bucket->second.end(); ++r)
+                {
+                    for(unsigned k = r->_begin; k < r->_end; ++k)
+                        hits[r->_target].push_back( k );
+                    numHits += r->_end - r->_begin;
+                }
+            }
+        }
+    }
+
+    if ( numHits == 0u )
+        return 0u;
+
+    const osg::EllipsoidModel* em = _terrainSRS->getEllipsoid();
+    bool isGeocentric = _terrainSRS->isGeographic();
+    unsigned count = 0u;
+
+    osg::ref_ptr<ElevationPool> pool;
+    if ( _pool.lock(pool) )
+    {
+        // Sample the elevation data already loaded, all at once. This runs
+        // during the update traversal, so it must not wait on reads:
+        osg::ref_ptr<ElevationEnvelope> envelope = pool->createEnvelope( _terrainSRS.get(), key.getLOD() );
+        envelope->setResidentOnly( true );
+
+        std::vector<osg::Vec3d> points;
+        points.reserve( numHits );
+        for(unsigned t=0; t<hits.size(); ++t)
+            for(unsigned i=0; i<hits[t].size(); ++i)
+                points.push_back( index->_targets[t]._coords[hits[t][i]] );
+
+        std::vector<float> elevations;
+        envelope->getElevations( points, elevations );
+
+        // vertices with no loaded data, left for the tile intersection
+        std::vector< std::vector<unsigned> > misses( hits.size() );
+
+        unsigned p = 0u;
+        for(unsigned t=0; t<hits.size(); ++t)
+        {
+            if ( hits[t].empty() )
+                continue;
+
+            Index::Target& target = index->_targets[t];
+            osg::Vec3Array* verts = static_cast<osg::Vec3Array*>(target._geom->getVertexArray());
+            bool geomDirty = false;
+
+            for(unsigned i=0; i<hits[t].size(); ++i, ++p)
+            {
+                float elevation = elevations[p];
+                if ( elevation == NO_DATA_VALUE )
+                {
+                    misses[t].push_back( hits[t][i] );
+                    continue;
+                }
+
+                const osg::Vec3d& coord = target._coords[hits[t][i]];
+
+                double z = elevation;
+                if ( _scale != 1.0 )
+                    z += z * _scale;
+                z += _offset;
+                if ( _preserveZ )
+                    z += coord.z();
+
+                osg::Vec3d world;
+                _terrainSRS->transformToWorld( osg::Vec3d(coord.x(), coord.y(), z), world );
+                (*verts)[hits[t][i]] = world * target._world2local;
+                geomDirty = true;
+                ++count;
+            }
+
+            if ( geomDirty )
+                dirty( target._geom.get() );
+        }
+
+        hits.swap( misses );
+    }
+
+    if ( tile )
+    {
+        double r = std::min( em->getRadiusEquator(), em->getRadiusPolar() );
+
+        for(unsigned t=0; t<hits.size(); ++t)
+        {
+            Index::Target& target = index->_targets[t];
+            osg::Vec3Array* verts = static_cast<osg::Vec3Array*>(target._geom->getVertexArray());
+            bool geomDirty = false;
+
+            // Intersect the vertices with the tile in batches, one traversal per batch:
+            for(unsigned first=0; first<hits[t].size(); first += INTERSECTION_BATCH_SIZE)
+            {
+                unsigned last = osg::minimum( first + INTERSECTION_BATCH_SIZE, (unsigned)hits[t].size() );
+
+                osg::ref_ptr<osgUtil::IntersectorGroup> group = new osgUtil::IntersectorGroup();
+                std::vector<osg::Vec3d> msl( last-first ), up( last-first, osg::Vec3d(0,0,1) );
+
+                for(unsigned i=first; i<last; ++i)
+                {
+                    const osg::Vec3d& coord = target._coords[hits[t][i]];
+                    osg::Vec3d& base = msl[i-first];
+                    _terrainSRS->transformToWorld( osg::Vec3d(coord.x(), coord.y(), 0.0), base );
+                    if ( isGeocentric )
+                        up[i-first] = em->computeLocalUpVector( base.x(), base.y(), base.z() );
+
+                    osgUtil::LineSegmentIntersector* lsi = new osgUtil::LineSegmentIntersector(
+                        base + up[i-first]*r*_scale,
+                        base - up[i-first]*r );
+                    lsi->setIntersectionLimit( lsi->LIMIT_NEAREST );
+                    group->addIntersector( lsi );
+                }
+
+                osgUtil::IntersectionVisitor iv( group.get() );
+                tile->accept( iv );
+
+                osgUtil::IntersectorGroup::Intersectors& lsis = group->getIntersectors();
+                for(unsigned i=first; i<last; ++i)
+                {
+                    osgUtil::LineSegmentIntersector* lsi = static_cast<osgUtil::LineSegmentIntersector*>(lsis[i-first].get());
+                    if ( !lsi->containsIntersections() )
+                        continue;
+
+                    const osg::Vec3d& n_vector = up[i-first];
+                    osg::Vec3d fw = lsi->getFirstIntersection().getWorldIntersectPoint();
+                    if ( _scale != 1.0 )
+                    {
+                        osg::Vec3d delta = fw - msl[i-first];
+                        fw += delta*_scale;
+                    }
+                    if ( _offset != 0.0 )
+                    {
+                        fw += n_vector*_offset;
+                    }
+                    if ( _preserveZ )
+                    {
+                        fw += n_vector * target._coords[hits[t][i]].z();
+                    }
+
+                    (*verts)[hits[t][i]] = fw * target._world2local;
+                    geomDirty = true;
+                    ++count;
+                }
+            }
+
+            if ( geomDirty )
+                dirty( target._geom.get() );
+        }
+    }
+
+    OE_DEBUG << LC << "Tile " << key.str() << ": clamped " << count << " of " << numHits << " verts." << std::endl;
+
+    return count;
 }
 
 
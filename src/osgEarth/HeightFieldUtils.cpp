@@ -24,9 +24,160 @@
 #include <osgEarth/CullingUtils>
 #include <osgEarth/ImageUtils>
 #include <osg/Notify>
+#include <algorithm>
+#include <vector>
 
 using namespace osgEarth;
 
+namespace
+{
+    // Where each output post samples the input along one axis. Built once
+    // per resample with the same index math getHeightAtPixel uses, so the
+    // per-post work reduces to two lookups and a lerp.
+    struct SampleTable
+    {
+        std::vector<double>   _pixel;    // fractional input coordinate
+        std::vector<unsigned> _i0, _i1;  // bracketing input posts
+        std::vector<float>    _w;        // weight of _i1
+        std::vector<unsigned> _nearest;
+
+        void reserve(unsigned n)
+        {
+            _pixel.reserve(n); _i0.reserve(n); _i1.reserve(n); _w.reserve(n); _nearest.reserve(n);
+        }
+
+        void push(double p, unsigned numPosts)
+        {
+            int i0 = osg::maximum((int)floor(p), 0);
+            int i1 = osg::maximum(osg::minimum((int)ceil(p), (int)numPosts-1), 0);
+            if (i0 > i1) i0 = i1;
+            _pixel.push_back(p);
+            _i0.push_back(i0);
+            _i1.push_back(i1);
+            _w.push_back(i1 > i0 ? (float)(p - (double)i0) : 0.0f);
+            _nearest.push_back((unsigned)osg::round(p));
+        }
+
+        unsigned size() const { return _i0.size(); }
+    };
+
+    // One input row, interpolated horizontally at every output column
+    struct RowPass
+    {
+        int                        _row;
+        std::vector<float>         _a, _b, _h;
+        std::vector<unsigned char> _noData;  // either sample was NO_DATA
+        bool                       _anyNoData;
+
+        RowPass() : _row(-1), _anyNoData(false) { }
+
+        void compute(const float* input, int row, const SampleTable& cols)
+        {
+            unsigned n = cols.size();
+            _a.resize(n); _b.resize(n); _h.resize(n); _noData.resize(n);
+            _row = row;
+
+            // gather, then run the arithmetic over contiguous arrays so the
+            // compiler can vectorize it
+            for (unsigned x = 0; x < n; ++x)
+            {
+                _a[x] = input[cols._i0[x]];
+                _b[x] = input[cols._i1[x]];
+            }
+
+            const float* a = &_a[0];
+            const float* b = &_b[0];
+            const float* w = &cols._w[0];
+            float* h = &_h[0];
+            unsigned char* noData = &_noData[0];
+            unsigned char any = 0;
+            for (unsigned x = 0; x < n; ++x)
+            {
+                h[x] = a[x] + w[x]*(b[x]-a[x]);
+                noData[x] = (unsigned char)((a[x] == NO_DATA_VALUE) | (b[x] == NO_DATA_VALUE));
+                any |= noData[x];
+            }
+            _anyNoData = any != 0;
+        }
+    };
+
+    /**
+     * Resamples a heightfield at a grid of input pixel coordinates (cols x rows)
+     * into "output", which must already have that size.
+     *
+     * Bilinear interpolation is separable: each input row is interpolated across
+     * once (and reused by consecutive output rows), then each output row is a lerp
+     * between two such passes. Posts whose samples include NO_DATA go through
+     * getHeightAtPixel instead, which substitutes valid neighbors exactly as
+     * before.
+     */
+    void resampleGrid(const osg::HeightField* input,
+                      const SampleTable&      cols,
+                      const SampleTable&      rows,
+                      osg::HeightField*       output,
+                      ElevationInterpolation  interp)
+    {
+        const float* in = &input->getFloatArray()->front();
+        float* out = &output->getFloatArray()->front();
+        unsigned inStride = input->getNumColumns();
+        unsigned numCols = cols.size();
+
+        if (interp == INTERP_NEAREST)
+        {
+            for (unsigned y = 0; y < rows.size(); ++y)
+            {
+                const float* inRow = in + rows._nearest[y]*inStride;
+                float* outRow = out + y*numCols;
+                for (unsigned x = 0; x < numCols; ++x)
+                    outRow[x] = inRow[cols._nearest[x]];
+            }
+            return;
+        }
+
+        RowPass passes[2];
+
+        for (unsigned y = 0; y < rows.size(); ++y)
+        {
+            int r0 = rows._i0[y], r1 = rows._i1[y];
+
+            const RowPass* p0 = passes[0]._row == r0 ? &passes[0] : passes[1]._row == r0 ? &passes[1] : 0L;
+            const RowPass* p1 = passes[0]._row == r1 ? &passes[0] : passes[1]._row == r1 ? &passes[1] : 0L;
+            if (!p0)
+            {
+                RowPass* slot = p1 == &passes[0] ? &passes[1] : &passes[0];
+                slot->compute(in + r0*inStride, r0, cols);
+                p0 = slot;
+                if (r1 == r0) p1 = p0;
+            }
+            if (!p1)
+            {
+                RowPass* slot = p0 == &passes[0] ? &passes[1] : &passes[0];
+                slot->compute(in + r1*inStride, r1, cols);
+                p1 = slot;
+            }
+
+            const float* h0 = &p0->_h[0];
+            const float* h1 = &p1->_h[0];
+            float wy = rows._w[y];
+            float* outRow = out + y*numCols;
+
+            for (unsigned x = 0; x < numCols; ++x)
+            {
+                outRow[x] = h0[x] + wy*(h1[x]-h0[x]);
+            }
+
+            if (p0->_anyNoData || p1->_anyNoData)
+            {
+                for (unsigned x = 0; x < numCols; ++x)
+                {
+                    if (p0->_noData[x] || p1->_noData[x])
+                        outRow[x] = HeightFieldUtils::getHeightAtPixel(input, cols._pixel[x], rows._pixel[y], INTERP_BILINEAR);
+                }
+            }
+        }
+    }
+}
+
 
 bool
 HeightFieldUtils::validateSamples(float &a, float &b, float &c, float &d)
@@ -421,6 +572,58 @@ HeightFieldUtils::createSubSample(const osg::HeightField* input,
                                   const GeoExtent& inputEx, 
                                   const GeoExtent& outputEx,
                                   osgEarth::ElevationInterpolation interpolation)
+{
+    if ( interpolation != INTERP_BILINEAR && interpolation != INTERP_NEAREST )
+        return createSubSamplePerPost( input, inputEx, outputEx, interpolation );
+
+    double div = outputEx.width()/inputEx.width();
+    if ( div >= 1.0f )
+        return 0L;
+
+    int numCols = input->getNumColumns();
+    int numRows = input->getNumRows();
+
+    double xInterval = inputEx.width()  / (double)(input->getNumColumns()-1);
+    double yInterval = inputEx.height()  / (double)(input->getNumRows()-1);
+    double dx = div * xInterval;
+    double dy = div * yInterval;
+
+    osg::HeightField* dest = new osg::HeightField();
+    dest->allocate( numCols, numRows );
+    dest->setXInterval( dx );
+    dest->setYInterval( dy );
+    dest->setBorderWidth( input->getBorderWidth() );
+
+    // copy over the skirt height, adjusting it for relative tile size.
+    dest->setSkirtHeight( input->getSkirtHeight() * div );
+
+    // step through the output extent the same way getHeightAtLocation would:
+    SampleTable cols, rows;
+    cols.reserve( numCols );
+    rows.reserve( numRows );
+
+    double x, y;
+    int col, row;
+
+    for( x = outputEx.xMin(), col=0; col < numCols; x += dx, col++ )
+        cols.push( osg::clampBetween( (x - inputEx.xMin()) / xInterval, 0.0, (double)(numCols-1) ), numCols );
+
+    for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
+        rows.push( osg::clampBetween( (y - inputEx.yMin()) / yInterval, 0.0, (double)(numRows-1) ), numRows );
+
+    resampleGrid( input, cols, rows, dest, interpolation );
+
+    osg::Vec3d orig( outputEx.xMin(), outputEx.yMin(), input->getOrigin().z() );
+    dest->setOrigin( orig );
+
+    return dest;
+}
+
+osg::HeightField*
+HeightFieldUtils::createSubSamplePerPost(const osg::HeightField* input,
+                                         const GeoExtent& inputEx, 
+                                         const GeoExtent& outputEx,
+                                         osgEarth::ElevationInterpolation interpolation)
 {
     double div = outputEx.width()/inputEx.width();
     if ( div >= 1.0f )
@@ -468,6 +671,57 @@ HeightFieldUtils::resampleHeightField(osg::HeightField*      input,
                                       int                    newColumns, 
                                       int                    newRows,
                                       ElevationInterpolation interp)
+{
+    if ( interp != INTERP_BILINEAR && interp != INTERP_NEAREST )
+        return resampleHeightFieldPerPost( input, extent, newColumns, newRows, interp );
+
+    if ( newColumns <= 1 && newRows <= 1 )
+        return 0L;
+
+    if ( newColumns == input->getNumColumns() && newRows == (int)input->getNumRows() )
+        return input;
+
+    double spanX = extent.width();
+    double spanY = extent.height();
+    const osg::Vec3& origin = input->getOrigin();
+
+    double stepX = spanX/(double)(newColumns-1);
+    double stepY = spanY/(double)(newRows-1);
+
+    osg::HeightField* output = new osg::HeightField();
+    output->allocate( newColumns, newRows );
+    output->setXInterval( stepX );
+    output->setYInterval( stepY );
+    output->setOrigin( origin );
+
+    // same coordinates as getHeightAtNormalizedLocation:
+    SampleTable cols, rows;
+    cols.reserve( newColumns );
+    rows.reserve( newRows );
+
+    for( int x = 0; x < newColumns; ++x )
+    {
+        double nx = (double)x / (double)(newColumns-1);
+        cols.push( osg::clampBetween(nx, 0.0, 1.0) * (double)(input->getNumColumns() - 1), input->getNumColumns() );
+    }
+
+    for( int y = 0; y < newRows; ++y )
+    {
+        double ny = (double)y / (double)(newRows-1);
+        rows.push( osg::clampBetween(ny, 0.0, 1.0) * (double)(input->getNumRows() - 1), input->getNumRows() );
+    }
+
+    resampleGrid( input, cols, rows, output, interp );
+
+    return output;
+}
+
+osg::HeightField*
+HeightFieldUtils::resampleHeightFieldPerPost(osg::HeightField*      input,
+                                             const GeoExtent&       extent,
+                                             int                    newColumns, 
+                                             int                    newRows,
+                                             ElevationInterpolation interp)
 {
     if ( newColumns <= 1 && newRows <= 1 )
         return 0L;
@@ -695,6 +949,129 @@ HeightFieldUtils::convertToNormalMap(const HeightFieldNeighborhood& hood,
     const osg::HeightField* hf = hood._center.get();
     if ( !hf )
         return 0L;
+
+    int numCols = (int)hf->getNumColumns();
+    int numRows = (int)hf->getNumRows();
+
+    NormalMap* normalMap = new NormalMap(numCols, numRows);
+
+    double xcells = (double)(numCols-1);
+    double ycells = (double)(numRows-1);
+    double xres = 1.0/xcells;
+    double yres = 1.0/ycells;
+
+    // north-south interval in meters:
+    double mPerDegAtEquator = (hoodSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI)/360.0;
+    double tIntervalMeters = 
+        hoodSRS->isGeographic() ? hf->getYInterval() * mPerDegAtEquator :
+        hf->getYInterval();
+
+    const float* heights = &hf->getFloatArray()->front();
+
+    // Neighbor heights for one row; NO_DATA_VALUE where there is none.
+    // Interior neighbors are plain posts of this heightfield; only the
+    // perimeter needs to look into the neighborhood.
+    std::vector<float> west(numCols), east(numCols), south(numCols), north(numCols);
+
+    for(int t=0; t<numRows; ++t)
+    {
+        // east-west interval in meters (changes for each row):
+        double lat = hf->getOrigin().y() + hf->getYInterval()*(double)t;
+        double sIntervalMeters =
+            hoodSRS->isGeographic() ? hf->getXInterval() * mPerDegAtEquator * cos(osg::DegreesToRadians(lat)) :
+            hf->getXInterval();
+
+        const float* row = heights + t*numCols;
+        double ny = yres*(double)t;
+
+        for(int s=1; s<numCols-1; ++s)
+        {
+            west[s] = row[s-1];
+            east[s] = row[s+1];
+        }
+
+        if ( !getHeightAtNormalizedLocation(hood, -xres, ny, west[0]) )
+            west[0] = NO_DATA_VALUE;
+        if ( !getHeightAtNormalizedLocation(hood, xres*(double)(numCols-1) + xres, ny, east[numCols-1]) )
+            east[numCols-1] = NO_DATA_VALUE;
+        if ( numCols > 1 )
+        {
+            if ( !getHeightAtNormalizedLocation(hood, xres, ny, east[0]) )
+                east[0] = NO_DATA_VALUE;
+            if ( !getHeightAtNormalizedLocation(hood, xres*(double)(numCols-1) - xres, ny, west[numCols-1]) )
+                west[numCols-1] = NO_DATA_VALUE;
+        }
+
+        if ( t > 0 && t < numRows-1 )
+        {
+            std::copy( row - numCols, row, south.begin() );
+            std::copy( row + numCols, row + 2*numCols, north.begin() );
+        }
+        else
+        {
+            for(int s=0; s<numCols; ++s)
+            {
+                double nx = xres*(double)s;
+                if ( !getHeightAtNormalizedLocation(hood, nx, ny-yres, south[s]) )
+                    south[s] = NO_DATA_VALUE;
+                if ( !getHeightAtNormalizedLocation(hood, nx, ny+yres, north[s]) )
+                    north[s] = NO_DATA_VALUE;
+            }
+        }
+
+        // Same math as convertToNormalMapPerPost, with the cross product
+        // expanded: (east-west) is (a,0,b) and (north-south) is (0,c,d).
+        float sInterval = (float)sIntervalMeters;
+        float tInterval = (float)tIntervalMeters;
+        float sCurv = (float)(1.0/(sIntervalMeters*sIntervalMeters));
+        float tCurv = (float)(1.0/(tIntervalMeters*tIntervalMeters));
+
+        for(int s=0; s<numCols; ++s)
+        {
+            float h = row[s];
+
+            bool hasWest  = west[s]  != NO_DATA_VALUE;
+            bool hasEast  = east[s]  != NO_DATA_VALUE;
+            bool hasSouth = south[s] != NO_DATA_VALUE;
+            bool hasNorth = north[s] != NO_DATA_VALUE;
+
+            float wz = hasWest  ? west[s]  : h;
+            float ez = hasEast  ? east[s]  : h;
+            float sz = hasSouth ? south[s] : h;
+            float nz = hasNorth ? north[s] : h;
+
+            float a = (hasEast ? sInterval : 0.0f) + (hasWest ? sInterval : 0.0f);
+            float c = (hasNorth ? tInterval : 0.0f) + (hasSouth ? tInterval : 0.0f);
+
+            // account for degenerate vectors
+            if ( a == 0.0f ) a = sInterval;
+            if ( c == 0.0f ) c = tInterval;
+
+            float b = ez - wz;
+            float d = nz - sz;
+
+            osg::Vec3f n( -b*c, -a*d, a*c );
+            n.normalize();
+
+            // curvature (2nd derivative of elevation)
+            float D = (0.5f*(wz+ez) - h) * sCurv;
+            float E = (0.5f*(sz+nz) - h) * tCurv;
+            float curvature = osg::clampBetween(-2.0f*(D+E)*100.0f, -1.0f, 1.0f);
+
+            normalMap->set(s, t, n, curvature);
+        }
+    }
+
+    return normalMap;
+}
+
+NormalMap*
+HeightFieldUtils::convertToNormalMapPerPost(const HeightFieldNeighborhood& hood,
+                                            const SpatialReference*        hoodSRS)
+{
+    const osg::HeightField* hf = hood._center.get();
+    if ( !hf )
+        return 0L;
     
     NormalMap* normalMap = new NormalMap(hf->getNumColumns(), hf->getNumRows());
 
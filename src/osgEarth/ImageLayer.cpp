@@ -472,6 +472,17 @@ ImageLayer::getOrCreatePreCacheOp()
     return _preCacheOp.get();
 }
 
+bool
+ImageLayer::prepareCachedObject(osg::Object* object) const
+{
+    osg::Image* image = dynamic_cast<osg::Image*>(object);
+    if ( !image )
+        return false;
+
+    ImageUtils::fixInternalFormat( image );
+    return true;
+}
+
 GeoImage
 ImageLayer::createImage(const TileKey&    key,
                         ProgressCallback* progress)
@@ -590,7 +601,7 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
         << key.getExtent().toString() << std::endl;
 
     // the cache key combines the Key and the horizontal profile.
-    std::string cacheKey = Stringify() << key.str() << "_" << key.getProfile()->getHorizSignature();
+    std::string cacheKey = getCacheKey(key);
     const CachePolicy& policy = getCacheSettings()->cachePolicy().get();
     
     // Check the layer L2 cache first
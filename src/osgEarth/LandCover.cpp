@@ -19,6 +19,8 @@
 #include <osgEarth/LandCover>
 #include <osgEarth/XmlUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/GeoCommon>
 
 #define LC "[LandCover] "
 
@@ -313,3 +315,156 @@ _optionsConcrete(options)
     init();
 }
 
+
+//...................................................................
+
+#undef  LC
+#define LC "[LandCoverLookupTable] "
+
+namespace
+{
+    // Converts a float pixel value to a coverage code.
+    inline int floatToCode(float value)
+    {
+        if (value == NO_DATA_VALUE || value < 0.0f)
+            return -1;
+        // normalized values are byte codes scaled to [0..1)
+        return value < 1.0f ? (int)(value*255.0f) : (int)value;
+    }
+
+    // Reads the first component of each pixel in a row of type T.
+    template<typename T>
+    void readIntegerRow(const unsigned char* row, unsigned stride, int count, int* codes)
+    {
+        for (int s = 0; s < count; ++s)
+            codes[s] = (int)*reinterpret_cast<const T*>(row + s*stride);
+    }
+
+    // Whether the first component of the pixel format is the red/luminance channel.
+    bool firstComponentIsRed(GLenum format)
+    {
+        return
+            format == GL_LUMINANCE ||
+            format == GL_LUMINANCE_ALPHA ||
+            format == GL_RED ||
+            format == GL_RGB ||
+            format == GL_RGBA;
+    }
+}
+
+LandCoverLookupTable::LandCoverLookupTable() :
+_table(1, -1),
+_size(0u)
+{
+    //nop
+}
+
+void
+LandCoverLookupTable::set(int code, int classValue)
+{
+    if (code < 0)
+        return;
+
+    if ((unsigned)code >= _size)
+    {
+        _size = code+1;
+        _table.resize(_size+1, -1);
+        _table[_size] = -1;
+    }
+    _table[code] = classValue;
+}
+
+void
+LandCoverLookupTable::compile(const LandCoverCoverageLayer* coverage)
+{
+    _table.assign(1, -1);
+    _size = 0u;
+
+    if (!coverage) {
+        OE_WARN << LC << "ILLEGAL: no coverage layer to compile\n";
+        return;
+    }
+    if (!coverage->getDictionary()) {
+        OE_WARN << LC << "ILLEGAL: coverage dictionary not set\n";
+        return;
+    }
+
+    int highestValue = -1;
+    for (LandCoverValueMappingVector::const_iterator k = coverage->getMappings().begin();
+        k != coverage->getMappings().end();
+        ++k)
+    {
+        highestValue = osg::maximum(highestValue, k->get()->getValue());
+    }
+
+    // size it once, then fill it in:
+    _size = (unsigned)(highestValue+1);
+    _table.assign(_size+1, -1);
+
+    for (LandCoverValueMappingVector::const_iterator k = coverage->getMappings().begin();
+        k != coverage->getMappings().end();
+        ++k)
+    {
+        const LandCoverValueMapping* mapping = k->get();
+        const LandCoverClass* lcClass = coverage->getDictionary()->getClassByName(mapping->getLandCoverClassName());
+        if (lcClass && mapping->getValue() >= 0)
+        {
+            _table[mapping->getValue()] = lcClass->getValue();
+        }
+    }
+}
+
+void
+LandCoverLookupTable::reclassify(const int* codes, unsigned count, int* classValues) const
+{
+    // Clamp every code into [0..size] (negative codes wrap to large unsigned
+    // values) so the gather needs no branch; entry [size] holds -1.
+    const int* table = &_table[0];
+    const unsigned size = _size;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned index = osg::minimum((unsigned)codes[i], size);
+        classValues[i] = table[index];
+    }
+}
+
+void
+LandCoverLookupTable::readCodes(const osg::Image* image, int t, int* codes)
+{
+    const int count = image->s();
+    const unsigned stride = image->getPixelSizeInBits() / 8u;
+    const unsigned char* row = image->data(0, t);
+
+    if (firstComponentIsRed(image->getPixelFormat()))
+    {
+        switch (image->getDataType())
+        {
+        case GL_UNSIGNED_BYTE:
+            readIntegerRow<GLubyte>(row, stride, count, codes);
+            return;
+        case GL_BYTE:
+            readIntegerRow<GLbyte>(row, stride, count, codes);
+            return;
+        case GL_UNSIGNED_SHORT:
+            readIntegerRow<GLushort>(row, stride, count, codes);
+            return;
+        case GL_SHORT:
+            readIntegerRow<GLshort>(row, stride, count, codes);
+            return;
+        case GL_INT:
+            readIntegerRow<GLint>(row, stride, count, codes);
+            return;
+        case GL_FLOAT:
+            for (int s = 0; s < count; ++s)
+                codes[s] = floatToCode(*reinterpret_cast<const float*>(row + s*stride));
+            return;
+        default:
+            break;
+        }
+    }
+
+    // anything else goes through the generic reader.
+    ImageUtils::PixelReader read(image);
+    for (int s = 0; s < count; ++s)
+        codes[s] = floatToCode(read(s, t).r());
+}
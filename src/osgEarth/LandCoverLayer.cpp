@@ -79,25 +79,27 @@ namespace
     }
 
     
-    typedef std::vector<int> CodeMap;
-
+    // One coverage layer's contribution to a land cover tile.
     struct ILayer 
     {
         GeoImage  image;
-        float     scale;
-        osg::Vec2 bias;
+        bool      loaded;
         bool      valid;
         float     warp;
-        ImageUtils::PixelReader* read;
-        unsigned* codeTable;
-        unsigned loads;
-
-        ILayer() : valid(true), read(0L), scale(1.0f), warp(0.0f), loads(0) { }
+        osg::Vec2d scale;
+        osg::Vec2d bias;
+        std::vector<int> columns;   // source column for each output column (image width = outside)
+        std::vector<int> codes;     // raw codes of one source row, plus a -1 sentinel
+        int       codesRow;         // source row held in "codes"
+        std::vector<int> gathered;  // codes for each output column
+        std::vector<int> classes;   // class values for each output column
 
-        ~ILayer() { if (read) delete read; }
+        ILayer() : loaded(false), valid(false), warp(0.0f), codesRow(-1) { }
 
-        void load(const TileKey& key, LandCoverCoverageLayer* sourceLayer, ProgressCallback* progress)
+        void load(const TileKey& key, LandCoverCoverageLayer* sourceLayer, int tileSize, ProgressCallback* progress)
         {
+            loaded = true;
+
             if (sourceLayer->getEnabled() && 
                 sourceLayer->isKeyInLegalRange(key) &&
                 sourceLayer->mayHaveDataInExtent(key.getExtent()))
@@ -118,60 +120,61 @@ namespace
 
             if ( valid )
             {
-                scale = key.getExtent().width() / image.getExtent().width();
-                bias.x() = (key.getExtent().xMin() - image.getExtent().xMin()) / image.getExtent().width();
-                bias.y() = (key.getExtent().yMin() - image.getExtent().yMin()) / image.getExtent().height();
-
-                read = new ImageUtils::PixelReader(image.getImage());
+                scale.set(
+                    key.getExtent().width() / image.getExtent().width(),
+                    key.getExtent().height() / image.getExtent().height());
+                bias.set(
+                    (key.getExtent().xMin() - image.getExtent().xMin()) / image.getExtent().width(),
+                    (key.getExtent().yMin() - image.getExtent().yMin()) / image.getExtent().height());
+
+                // Precompute the source column of every output column once so each
+                // row is a plain gather. Coverage data cannot be interpolated, so
+                // this is a nearest-neighbor (truncating) lookup.
+                int width = image.getImage()->s();
+                columns.resize(tileSize);
+                for (int s = 0; s < tileSize; ++s)
+                {
+                    double u = scale.x() * ((double)s / (double)(tileSize-1)) + bias.x();
+                    columns[s] = u >= 0.0 && u <= 1.0 ? (int)(u * (double)(width-1)) : width;
+                }
 
-                // cannot interpolate coverage data:
-                read->setBilinear( false );
+                codes.assign(width+1, -1);
+                gathered.resize(tileSize);
+                classes.resize(tileSize);
 
                 warp = sourceLayer->options().warp().get();
             }
         }
-    };
 
-    // Constructs a code map (int to int) for a coverage layer. We will use this
-    // code map to map coverage layer codes to dictionary codes.
-    void buildCodeMap(const LandCoverCoverageLayer* coverage, CodeMap& codemap)
-    {
-        if (!coverage) {
-            OE_WARN << LC << "ILLEGAL: coverage not passed to buildCodeMap\n";
-            return;
-        }
-        if (!coverage->getDictionary()) {
-            OE_WARN << LC << "ILLEGAL: coverage dictionary not set in buildCodeMap\n";
-            return;
-        }
-
-        int highestValue = 0;
-
-        for (LandCoverValueMappingVector::const_iterator k = coverage->getMappings().begin();
-            k != coverage->getMappings().end();
-            ++k)
+        // Computes the class values of output row t into "classes".
+        void reclassifyRow(int t, int tileSize, const LandCoverLookupTable& table)
         {
-            const LandCoverValueMapping* mapping = k->get();
-            int value = mapping->getValue();
-            if (value > highestValue)
-                highestValue = value;
-        }
+            double v = scale.y() * ((double)t / (double)(tileSize-1)) + bias.y();
+            if (v < 0.0 || v > 1.0)
+            {
+                classes.assign(tileSize, -1);
+                return;
+            }
 
-        codemap.assign(highestValue+1, -1);
+            const osg::Image* source = image.getImage();
+            int sourceRow = (int)(v * (double)(source->t()-1));
 
-        for (LandCoverValueMappingVector::const_iterator k = coverage->getMappings().begin();
-            k != coverage->getMappings().end();
-            ++k)
-        {
-            const LandCoverValueMapping* mapping = k->get();
-            int value = mapping->getValue();
-            const LandCoverClass* lcClass = coverage->getDictionary()->getClassByName(mapping->getLandCoverClassName());
-            if (lcClass)
+            // upsampled tiles reuse the same source row many times:
+            if (sourceRow != codesRow)
             {
-                codemap[value] = lcClass->getValue();
+                LandCoverLookupTable::readCodes(source, sourceRow, &codes[0]);
+                codesRow = sourceRow;
             }
+
+            const int* rowCodes = &codes[0];
+            const int* cols = &columns[0];
+            int* out = &gathered[0];
+            for (int s = 0; s < tileSize; ++s)
+                out[s] = rowCodes[cols[s]];
+
+            table.reclassify(&gathered[0], tileSize, &classes[0]);
         }
-    }
+    };
 
     typedef std::vector<osg::ref_ptr<LandCoverCoverageLayer> > LandCoverCoverageLayerVector;
 
@@ -200,8 +203,8 @@ namespace
         // image layers, one per data source
         LandCoverCoverageLayerVector _coverages;
 
-        // code maps (vector index is the source code; value is the destination code)
-        std::vector<CodeMap> _codemaps;
+        // compiled code-to-class tables, one per coverage
+        std::vector< osg::ref_ptr<LandCoverLookupTable> > _lookupTables;
 
         // todo
         std::vector<float> _warps;
@@ -251,7 +254,7 @@ namespace
             if (s.isOK())
             {
                 _coverages.push_back(layer);
-                _codemaps.resize(_codemaps.size()+1);
+                _lookupTables.push_back(new LandCoverLookupTable());
                 OE_INFO << LC << "Opened coverage \"" << layer->getName() << "\"\n";
             }
             else
@@ -278,7 +281,7 @@ namespace
         for (unsigned i = 0; i<_coverages.size(); ++i)
         {
             _coverages[i]->setDictionary(lcd);
-            buildCodeMap(_coverages[i].get(), _codemaps[i]);
+            _lookupTables[i]->compile(_coverages[i].get());
         }
     }
     
@@ -296,98 +299,64 @@ namespace
         osg::ref_ptr<osg::Image> out = new osg::Image();
         ImageUtils::markAsUnNormalized(out.get(), true);
 
-        // Allocate a suitable format:
-        GLint internalFormat = GL_LUMINANCE32F_ARB;
-
         int tilesize = getPixelsPerTile();
 
         out->allocateImage(tilesize, tilesize, 1, GL_RGB, GL_FLOAT);
-        out->setInternalTextureFormat(internalFormat);
-
-        osg::Vec2 cov;    // coverage coordinates
-
-        ImageUtils::PixelWriter write( out.get() );
-
-        float du = 1.0f / (float)(out->s()-1);
-        float dv = 1.0f / (float)(out->t()-1);
+        out->setInternalTextureFormat(GL_LUMINANCE32F_ARB);
 
-        osg::Vec4 nodata;
-        if (internalFormat == GL_LUMINANCE16F_ARB)
-            nodata.set(-32768, -32768, -32768, -32768);
-        else
-            nodata.set(NO_DATA_VALUE, NO_DATA_VALUE, NO_DATA_VALUE, NO_DATA_VALUE);
+        const float nodata = NO_DATA_VALUE;
 
         unsigned pixelsWritten = 0u;
 
-        for(float u=0.0f; u<=1.0f; u+=du)
+        // Whether each pixel of the current row still needs a value
+        std::vector<unsigned char> pending(tilesize);
+
+        // Build the tile a row at a time. Each row composites the coverages
+        // top-down: a pixel takes its value from the highest layer that maps
+        // it to a class. Lower layers are only loaded if a pixel needs them.
+        for(int t=0; t<tilesize; ++t)
         {
-            for(float v=0.0f; v<=1.0f; v+=dv)
-            {
-                bool wrotePixel = false;
-                for(int L = layers.size()-1; L >= 0 && !wrotePixel; --L)
-                {
-                    if (progress && progress->isCanceled())
-                        return 0L;
+            float* row = reinterpret_cast<float*>(out->data(0, t));
+            pending.assign(tilesize, 1u);
+            int remaining = tilesize;
 
-                    ILayer& layer = layers[L];
-                    if ( !layer.valid )
-                        continue;
+            for(int L = layers.size()-1; L >= 0 && remaining > 0; --L)
+            {
+                if (progress && progress->isCanceled())
+                    return 0L;
 
-                    if ( !layer.image.valid() )
-                        layer.load(key, _coverages[L].get(), progress);
+                ILayer& layer = layers[L];
+                if ( !layer.loaded )
+                    layer.load(key, _coverages[L].get(), tilesize, progress);
 
-                    if (!layer.valid)
-                        continue;
+                if ( !layer.valid )
+                    continue;
 
-                    osg::Vec2 cov(layer.scale*u + layer.bias.x(), layer.scale*v + layer.bias.y());
+                layer.reclassifyRow(t, tilesize, *_lookupTables[L].get());
 
-                    if ( cov.x() >= 0.0f && cov.x() <= 1.0f && cov.y() >= 0.0f && cov.y() <= 1.0f )
+                const int* classes = &layer.classes[0];
+                for(int s=0; s<tilesize; ++s)
+                {
+                    if (pending[s] && classes[s] >= 0)
                     {
-                        osg::Vec4 texel = (*layer.read)(cov.x(), cov.y());
-
-                        if ( texel.r() != NO_DATA_VALUE )
-                        {
-                            // store the warp factor in the green channel
-                            texel.g() = layer.warp;
-
-                            // store the layer index in the blue channel
-                            texel.b() = (float)L;
-
-                            if (texel.r() < 1.0f)
-                            {
-                                // normalized code; convert
-                                int code = (int)(texel.r()*255.0f);
-                                if (code < _codemaps[L].size())
-                                {
-                                    int value = _codemaps[L][code];
-                                    if (value >= 0)
-                                    {
-                                        texel.r() = (float)value;
-                                        write.f(texel, u, v);
-                                        wrotePixel = true;
-                                        pixelsWritten++;
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                // unnormalized
-                                int code = (int)texel.r();
-                                if (code < _codemaps[L].size() && _codemaps[L][code] >= 0)
-                                {
-                                    texel.r() = (float)_codemaps[L][code];
-                                    write.f(texel, u, v);
-                                    wrotePixel = true;
-                                    pixelsWritten++;
-                                }
-                            }
-                        }
+                        // class value in red, warp factor in green, layer index in blue
+                        row[3*s+0] = (float)classes[s];
+                        row[3*s+1] = layer.warp;
+                        row[3*s+2] = (float)L;
+                        pending[s] = 0u;
+                        --remaining;
                     }
                 }
+            }
 
-                if ( !wrotePixel )
+            pixelsWritten += tilesize - remaining;
+
+            if (remaining > 0)
+            {
+                for(int s=0; s<tilesize; ++s)
                 {
-                    write.f(nodata, u, v);
+                    if (pending[s])
+                        row[3*s+0] = row[3*s+1] = row[3*s+2] = nodata;
                 }
             }
         }
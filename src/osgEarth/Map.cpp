@@ -24,8 +24,10 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/URI>
 #include <osgEarth/ElevationPool>
+#include <osgEarth/TaskService>
 #include <osgEarth/Utils>
 #include <iterator>
+#include <algorithm>
 
 using namespace osgEarth;
 
@@ -260,59 +262,83 @@ Map::endUpdate()
 }
 
 void
-Map::addLayer(Layer* layer)
+Map::prepareLayer(Layer* layer)
+{
+    // Pass along the Read Options (including the cache settings, etc.) to the layer:
+    layer->setReadOptions(_readOptions.get());
+    
+    // If this is a terrain layer, tell it about the Map profile.
+    TerrainLayer* terrainLayer = dynamic_cast<TerrainLayer*>(layer);
+    if (terrainLayer && _profile.valid())
+    {
+        terrainLayer->setTargetProfileHint( _profile.get() );
+    }            
+}
+
+unsigned
+Map::addOpenedLayer(Layer* layer, unsigned index)
 {
-    osgEarth::Registry::instance()->clearBlacklist();
-    if ( layer )
+    if (layer->getEnabled())
     {
-        if (layer->getEnabled())
+        // If this is an elevation layer, install a callback so we know when
+        // it's visibility changes:
+        ElevationLayer* elevationLayer = dynamic_cast<ElevationLayer*>(layer);
+        if (elevationLayer)
         {
-            // Pass along the Read Options (including the cache settings, etc.) to the layer:
-            layer->setReadOptions(_readOptions.get());
-            
-            // If this is a terrain layer, tell it about the Map profile.
-            TerrainLayer* terrainLayer = dynamic_cast<TerrainLayer*>(layer);
-            if (terrainLayer && _profile.valid())
-            {
-                terrainLayer->setTargetProfileHint( _profile.get() );
-            }            
+            elevationLayer->addCallback(_elevationLayerCB.get());
 
-            // Attempt to open the layer. Don't check the status here.
-            layer->open();
-
-            // If this is an elevation layer, install a callback so we know when
-            // it's visibility changes:
-            ElevationLayer* elevationLayer = dynamic_cast<ElevationLayer*>(layer);
-            if (elevationLayer)
-            {
-                elevationLayer->addCallback(_elevationLayerCB.get());
-
-                // invalidate the elevation pool
-                getElevationPool()->clear();
-            }
+            // invalidate the elevation pool
+            getElevationPool()->clear();
         }
+    }
 
-        int newRevision;
-        unsigned index = -1;
+    int newRevision;
 
-        // Add the layer to our stack.
-        {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+    // Add the layer to our stack.
+    {
+        Threading::ScopedWriteLock lock( _mapDataMutex );
 
-            _layers.push_back( layer );
+        if (index >= _layers.size())
+        {
+            _layers.push_back(layer);
             index = _layers.size() - 1;
-            newRevision = ++_dataModelRevision;
         }
+        else
+        {
+            _layers.insert( _layers.begin() + index, layer );
+        }
+
+        newRevision = ++_dataModelRevision;
+    }
 
-        // tell the layer it was just added.
-        layer->addedToMap(this);
+    // tell the layer it was just added.
+    layer->addedToMap(this);
 
-        // a separate block b/c we don't need the mutex
-        for( MapCallbackList::iterator i = _mapCallbacks.begin(); i != _mapCallbacks.end(); i++ )
+    // a separate block b/c we don't need the mutex
+    for( MapCallbackList::iterator i = _mapCallbacks.begin(); i != _mapCallbacks.end(); i++ )
+    {
+        i->get()->onMapModelChanged(MapModelChange(
+            MapModelChange::ADD_LAYER, newRevision, layer, index));
+    }
+
+    return index;
+}
+
+void
+Map::addLayer(Layer* layer)
+{
+    osgEarth::Registry::instance()->clearBlacklist();
+    if ( layer )
+    {
+        if (layer->getEnabled())
         {
-            i->get()->onMapModelChanged(MapModelChange(
-                MapModelChange::ADD_LAYER, newRevision, layer, index));
+            prepareLayer(layer);
+
+            // Attempt to open the layer. Don't check the status here.
+            layer->open();
         }
+
+        addOpenedLayer(layer, ~0u);
     }
 }
 
@@ -324,58 +350,230 @@ Map::insertLayer(Layer* layer, unsigned index)
     {
         if (layer->getEnabled())
         {
-            // Pass along the Read Options (including the cache settings, etc.) to the layer:
-            layer->setReadOptions(_readOptions.get());
-            
-            // If this is a terrain layer, tell it about the Map profile.
-            TerrainLayer* terrainLayer = dynamic_cast<TerrainLayer*>(layer);
-            if (terrainLayer && _profile.valid())
-            {
-                terrainLayer->setTargetProfileHint( _profile.get() );
-            }            
+            prepareLayer(layer);
 
             // Attempt to open the layer. Don't check the status here.
             layer->open();
+        }
 
-            // If this is an elevation layer, install a callback so we know when
-            // it's visibility changes:
-            ElevationLayer* elevationLayer = dynamic_cast<ElevationLayer*>(layer);
-            if (elevationLayer)
-            {
-                elevationLayer->addCallback(_elevationLayerCB.get());
+        addOpenedLayer(layer, index);
+    }
+}
 
-                // invalidate the elevation pool
-                getElevationPool()->clear();
-            }
+namespace
+{
+    // Pool shared by all maps for opening layers. Opening a layer is mostly
+    // spent waiting on I/O, so it gets its own threads instead of competing
+    // with the CPU-bound pools in the TaskServiceManager.
+    TaskService* getLayerOpenService(unsigned numThreads)
+    {
+        static Threading::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        Threading::ScopedMutexLock lock(s_mutex);
+        if (!s_service.valid())
+            s_service = new TaskService("osgEarth.Map.openLayers", numThreads);
+        else if (s_service->getNumThreads() < (int)numThreads)
+            s_service->setNumThreads(numThreads);
+        return s_service.get();
+    }
+
+    // Opens one layer of a group.
+    struct OpenLayer
+    {
+        osg::ref_ptr<Layer> _layer;
+        void execute() { _layer->open(); }
+    };
+}
+
+void
+Map::addLayers(const LayerVector& layers)
+{
+    unsigned numThreads = _mapOptions.layerOpenThreads().get();
+
+    // One at a time, each layer is in the Map before the next one opens.
+    if (numThreads <= 1u)
+    {
+        for (LayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i)
+        {
+            if (i->valid())
+                addLayer(i->get());
+        }
+        return;
+    }
+
+    osgEarth::Registry::instance()->clearBlacklist();
+
+    LayerVector layersToOpen;
+    for (LayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i)
+    {
+        if (i->valid() && i->get()->getEnabled())
+        {
+            prepareLayer(i->get());
+            layersToOpen.push_back(i->get());
         }
+    }
 
-        int newRevision;
+    // Open all the layers at once and wait for them. Don't check the status here.
+    if (layersToOpen.size() > 1)
+    {
+        TaskService* service = getLayerOpenService(numThreads);
 
-        // Add the layer to our stack.
+        Threading::MultiEvent done(layersToOpen.size());
+        for (unsigned i = 0; i < layersToOpen.size(); ++i)
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            ParallelTask<OpenLayer>* task = new ParallelTask<OpenLayer>(&done);
+            task->_layer = layersToOpen[i].get();
+            service->add(task);
+        }
+        done.wait();
+    }
+    else if (layersToOpen.size() == 1)
+    {
+        layersToOpen.front()->open();
+    }
+
+    for (LayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i)
+    {
+        if (i->valid())
+            addOpenedLayer(i->get(), ~0u);
+    }
+}
 
-            if (index >= _layers.size())
-                _layers.push_back(layer);
-            else
-                _layers.insert( _layers.begin() + index, layer );
+/**
+ * One call to addLayersAsync. Layers are opened in parallel on the pool and
+ * handed to the Map strictly in order by addPendingLayers.
+ */
+struct Map::AddLayersOperation : public osg::Referenced
+{
+    LayerVector                         _layers;
+    std::vector<bool>                   _opened;
+    unsigned                            _next;
+    bool                                _finished;
+    osg::ref_ptr<AddLayersCallback>     _callback;
+    Threading::Mutex                    _mutex;
 
-            newRevision = ++_dataModelRevision;
+    struct OpenTask : public TaskRequest
+    {
+        osg::ref_ptr<AddLayersOperation> _op;
+        unsigned                         _index;
+
+        void operator()(ProgressCallback* progress)
+        {
+            Layer* layer = _op->_layers[_index].get();
+            if (layer->getEnabled())
+                layer->open();
+
+            Threading::ScopedMutexLock lock(_op->_mutex);
+            _op->_opened[_index] = true;
         }
+    };
 
-        // tell the layer it was just added.
-        layer->addedToMap(this);
+    // Takes the next run of opened layers. Returns true the one time the
+    // last layer is taken.
+    bool takeOpened(LayerVector& output)
+    {
+        Threading::ScopedMutexLock lock(_mutex);
 
-        // a separate block b/c we don't need the mutex
-        for( MapCallbackList::iterator i = _mapCallbacks.begin(); i != _mapCallbacks.end(); i++ )
+        while (_next < _layers.size() && _opened[_next])
+            output.push_back(_layers[_next++].get());
+
+        if (_next == _layers.size() && !_finished)
+        {
+            _finished = true;
+            return true;
+        }
+        return false;
+    }
+};
+
+void
+Map::addLayersAsync(const LayerVector& layers, AddLayersCallback* callback)
+{
+    osgEarth::Registry::instance()->clearBlacklist();
+
+    osg::ref_ptr<AddLayersOperation> op = new AddLayersOperation();
+    op->_next = 0u;
+    op->_finished = false;
+    op->_callback = callback;
+
+    for (LayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i)
+    {
+        if (i->valid())
         {
-            //i->get()->onMapModelChanged( MapModelChange(
-            //    MapModelChange::ADD_IMAGE_LAYER, newRevision, layer, index) );
+            if (i->get()->getEnabled())
+                prepareLayer(i->get());
+            op->_layers.push_back(i->get());
+        }
+    }
 
-            i->get()->onMapModelChanged(MapModelChange(
-                MapModelChange::ADD_LAYER, newRevision, layer, index));
+    if (op->_layers.empty())
+    {
+        if (callback)
+            callback->onComplete(this);
+        return;
+    }
+
+    op->_opened.resize(op->_layers.size(), false);
+
+    {
+        Threading::ScopedMutexLock lock(_pendingAddsMutex);
+        _pendingAdds.push_back(op.get());
+    }
+
+    TaskService* service = getLayerOpenService(osg::maximum(_mapOptions.layerOpenThreads().get(), 1u));
+
+    for (unsigned i = 0; i < op->_layers.size(); ++i)
+    {
+        AddLayersOperation::OpenTask* task = new AddLayersOperation::OpenTask();
+        task->_op = op.get();
+        task->_index = i;
+        service->add(task);
+    }
+}
+
+unsigned
+Map::addPendingLayers()
+{
+    std::vector< osg::ref_ptr<osg::Referenced> > pending;
+    {
+        Threading::ScopedMutexLock lock(_pendingAddsMutex);
+        if (_pendingAdds.empty())
+            return 0u;
+        pending = _pendingAdds;
+    }
+
+    unsigned count = 0u;
+
+    // callbacks run without holding the lock, so they may start new groups
+    for (unsigned p = 0; p < pending.size(); ++p)
+    {
+        AddLayersOperation* op = static_cast<AddLayersOperation*>(pending[p].get());
+
+        LayerVector layers;
+        bool finished = op->takeOpened(layers);
+
+        for (LayerVector::const_iterator i = layers.begin(); i != layers.end(); ++i)
+        {
+            unsigned index = addOpenedLayer(i->get(), ~0u);
+            if (op->_callback.valid())
+                op->_callback->onLayerAdded(i->get(), index);
+            ++count;
+        }
+
+        if (finished)
+        {
+            {
+                Threading::ScopedMutexLock lock(_pendingAddsMutex);
+                _pendingAdds.erase(std::find(_pendingAdds.begin(), _pendingAdds.end(), pending[p]));
+            }
+
+            if (op->_callback.valid())
+                op->_callback->onComplete(this);
         }
     }
+
+    return count;
 }
 
 void
@@ -580,8 +778,7 @@ Map::setLayersFromMap(const Map* map)
     {
         LayerVector layers;
         map->getLayers(layers);
-        for (LayerVector::iterator i = layers.begin(); i != layers.end(); ++i)
-            addLayer(i->get());
+        addLayers(layers);
     }
 }
 
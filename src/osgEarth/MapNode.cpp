@@ -413,6 +413,9 @@ MapNode::init()
     // register for event traversals so we can deal with blacklisted filenames
     ADJUST_EVENT_TRAV_COUNT( this, 1 );
 
+    // register for update traversals so we can add layers opened by Map::addLayersAsync
+    ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+
     // remove the temporary reference.
     this->unref_nodelete();
 }
@@ -798,6 +801,13 @@ MapNode::traverse( osg::NodeVisitor& nv )
 
     else
     {
+        // add layers that finished opening in the background, while nothing
+        // else is touching the scene graph:
+        if ( nv.getVisitorType() == nv.UPDATE_VISITOR && _map.valid() )
+        {
+            _map->addPendingLayers();
+        }
+
         if (dynamic_cast<osgUtil::BaseOptimizerVisitor*>(&nv) == 0L)
             osg::Group::traverse( nv );
     }
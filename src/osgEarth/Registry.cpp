@@ -94,7 +94,10 @@ _devicePixelRatio(1.0f)
     _shaderLib = new ShaderFactory();
 
     // shader generator used internally by osgEarth. Can be replaced.
+    // Its program cache lets every graph it processes (models loaded by the
+    // pager in particular) reuse shaders generated for the same state.
     _shaderGen = new ShaderGenerator();
+    _shaderGen->setUseProgramCache( true );
 
     // thread pool for general use
     _taskServiceManager = new TaskServiceManager();
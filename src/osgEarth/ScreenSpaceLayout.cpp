@@ -129,8 +129,6 @@ namespace
 
     typedef std::map<const osg::Drawable*, DrawableInfo> DrawableMemory;
     
-    typedef std::pair<const osg::Node*, osg::BoundingBox> RenderLeafBox;
-
     // Data structure stored one-per-View.
     struct PerCamInfo
     {
@@ -142,7 +140,7 @@ namespace
         // re-usable structures (to avoid unnecessary re-allocation)
         osgUtil::RenderBin::RenderLeafList _passed;
         osgUtil::RenderBin::RenderLeafList _failed;
-        std::vector<RenderLeafBox>         _used;
+        ScreenSpaceOccupancyGrid           _used;
 
         // time stamp of the previous pass, for calculating animation speed
         osg::Timer_t _lastTimeStamp;
@@ -195,6 +193,128 @@ ScreenSpaceLayoutOptions::getConfig() const
 
 //----------------------------------------------------------------------------
 
+ScreenSpaceOccupancyGrid::ScreenSpaceOccupancyGrid(float cellSize) :
+_cellSize( osg::maximum(cellSize, 1.0f) ),
+_xmin    ( 0.0f ),
+_ymin    ( 0.0f ),
+_numCols ( 1 ),
+_numRows ( 1 )
+{
+    _cells.resize(1);
+}
+
+void
+ScreenSpaceOccupancyGrid::reset(float xmin, float ymin, float xmax, float ymax)
+{
+    _xmin = xmin;
+    _ymin = ymin;
+
+    int numCols = osg::maximum( (int)ceil((xmax - xmin) / _cellSize), 1 );
+    int numRows = osg::maximum( (int)ceil((ymax - ymin) / _cellSize), 1 );
+
+    if ( numCols != _numCols || numRows != _numRows )
+    {
+        _numCols = numCols;
+        _numRows = numRows;
+        _cells.clear();
+        _cells.resize( _numCols * _numRows );
+    }
+
+    clear();
+}
+
+void
+ScreenSpaceOccupancyGrid::clear()
+{
+    // keep the cells' capacity; the next frame will likely need it again.
+    _boxes.clear();
+    for( unsigned i=0; i<_cells.size(); ++i )
+        _cells[i].clear();
+}
+
+namespace
+{
+    // Cell index of a coordinate. The clamp happens in floating point, before
+    // the cast, since converting an out-of-range double to int is undefined.
+    inline int clampedCell(double v, double vmin, double cellSize, int numCells)
+    {
+        double c = floor((v - vmin) / cellSize);
+        if ( !(c > 0.0) ) return 0;
+        if ( c >= (double)(numCells-1) ) return numCells-1;
+        return (int)c;
+    }
+}
+
+void
+ScreenSpaceOccupancyGrid::getCellRange(const osg::BoundingBox& box, int& c0, int& r0, int& c1, int& r1) const
+{
+    // A NaN coordinate overlaps everything (every comparison fails), so test it everywhere.
+    if ( osg::isNaN(box.xMin()) || osg::isNaN(box.xMax()) || osg::isNaN(box.yMin()) || osg::isNaN(box.yMax()) )
+    {
+        c0 = r0 = 0;
+        c1 = _numCols-1;
+        r1 = _numRows-1;
+        return;
+    }
+
+    // Anything beyond the edges lands in the border cells.
+    c0 = clampedCell( box.xMin(), _xmin, _cellSize, _numCols );
+    c1 = clampedCell( box.xMax(), _xmin, _cellSize, _numCols );
+    r0 = clampedCell( box.yMin(), _ymin, _cellSize, _numRows );
+    r1 = clampedCell( box.yMax(), _ymin, _cellSize, _numRows );
+
+    if ( c0 > c1 ) std::swap(c0, c1);
+    if ( r0 > r1 ) std::swap(r0, r1);
+}
+
+bool
+ScreenSpaceOccupancyGrid::intersects(const osg::BoundingBox& box, const void* owner) const
+{
+    int c0, r0, c1, r1;
+    getCellRange(box, c0, r0, c1, r1);
+
+    for( int r = r0; r <= r1; ++r )
+    {
+        for( int c = c0; c <= c1; ++c )
+        {
+            const std::vector<unsigned>& cell = _cells[r*_numCols + c];
+            for( std::vector<unsigned>::const_iterator i = cell.begin(); i != cell.end(); ++i )
+            {
+                const Entry& entry = _boxes[*i];
+
+                // only need a 2D test since we're in window space
+                bool isClear =
+                    box.xMin() > entry._box.xMax() ||
+                    box.xMax() < entry._box.xMin() ||
+                    box.yMin() > entry._box.yMax() ||
+                    box.yMax() < entry._box.yMin();
+
+                if ( !isClear && owner != entry._owner )
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+void
+ScreenSpaceOccupancyGrid::insert(const osg::BoundingBox& box, const void* owner)
+{
+    unsigned index = _boxes.size();
+    _boxes.push_back( Entry() );
+    _boxes.back()._box = box;
+    _boxes.back()._owner = owner;
+
+    int c0, r0, c1, r1;
+    getCellRange(box, c0, r0, c1, r1);
+
+    for( int r = r0; r <= r1; ++r )
+        for( int c = c0; c <= c1; ++c )
+            _cells[r*_numCols + c].push_back( index );
+}
+
+//----------------------------------------------------------------------------
+
 template<typename T>
 struct LCGIterator
 {
@@ -304,7 +424,6 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
         // Reset the local re-usable containers
         local._passed.clear();          // drawables that pass occlusion test
         local._failed.clear();          // drawables that fail occlusion test
-        local._used.clear();            // list of occupied bounding boxes in screen space
 
         // compute a window matrix so we can do window-space culling. If this is an RTT camera
         // with a reference camera attachment, we actually want to declutter in the window-space
@@ -316,6 +435,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
         osg::Vec3f  refCamScale(1.0f, 1.0f, 1.0f);
         osg::Matrix refCamScaleMat;
         osg::Matrix refWindowMatrix = windowMatrix;
+        const osg::Viewport* refViewport = vp;
 
         // If the camera is actually an RTT slave camera, it's our picker, and we need to
         // adjust the scale to match it.
@@ -330,8 +450,14 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             refCamScale.set( vp->width() / refVP->width(), vp->height() / refVP->height(), 1.0 );
             refCamScaleMat.makeScale( refCamScale );
             refWindowMatrix = refVP->computeWindowMatrix();
+            refViewport = refVP;
         }
 
+        // list of occupied bounding boxes in (reference) window space
+        local._used.reset(
+            refViewport->x(), refViewport->y(),
+            refViewport->x() + refViewport->width(), refViewport->y() + refViewport->height() );
+
         // Track the parent nodes of drawables that are obscured (and culled). Drawables
         // with the same parent node (typically a Geode) are considered to be grouped and
         // will be culled as a group.
@@ -474,24 +600,11 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 else
                 {
                     // weed out any drawables that are obscured by closer drawables.
-                    // TODO: think about a more efficient algorithm - right now we are just using
-                    // brute force to compare all bbox's
-                    for( std::vector<RenderLeafBox>::const_iterator j = local._used.begin(); j != local._used.end(); ++j )
+                    // if there's an overlap (and the conflict isn't from the same drawable
+                    // parent, which is acceptable), then the leaf is culled.
+                    if ( local._used.intersects(box, drawableParent) )
                     {
-                        // only need a 2D test since we're in clip space
-                        bool isClear =
-                            box.xMin() > j->second.xMax() ||
-                            box.xMax() < j->second.xMin() ||
-                            box.yMin() > j->second.yMax() ||
-                            box.yMax() < j->second.yMin();
-
-                        // if there's an overlap (and the conflict isn't from the same drawable
-                        // parent, which is acceptable), then the leaf is culled.
-                        if ( !isClear && drawableParent != j->first )
-                        {
-                            visible = false;
-                            break;
-                        }
+                        visible = false;
                     }
                 }
             }
@@ -500,7 +613,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             {
                 // passed the test, so add the leaf's bbox to the "used" list, and add the leaf
                 // to the final draw list.
-                local._used.push_back( std::make_pair(drawableParent, box) );
+                local._used.insert( box, drawableParent );
                 local._passed.push_back( leaf );
             }
 
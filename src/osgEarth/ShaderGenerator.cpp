@@ -27,6 +27,7 @@
 #include <osgEarth/URI>
 #include <osgEarth/Lighting>
 #include <osgEarth/VirtualProgram>
+#include <osgEarth/TaskService>
 
 #include <osg/Drawable>
 #include <osg/Geode>
@@ -51,6 +52,7 @@
 #include <osgDB/ReadFile>
 #include <osgText/Text>
 #include <osgSim/LightPointNode>
+#include <iomanip>
 
 #define LC "[ShaderGenerator] "
 
@@ -62,6 +64,9 @@
 // profile, and if so, promote that VP to the Geode's state set.
 #define PROMOTE_EQUIVALENT_DRAWABLE_VP_TO_GEODE 1
 
+// Number of state signatures whose generated shaders are kept for reuse
+#define PROGRAM_CACHE_SIZE 512
+
 using namespace osgEarth;
 
 //------------------------------------------------------------------------
@@ -347,6 +352,14 @@ ShaderGenerator::GenBuffers::requireVersion(unsigned glslVersion, unsigned glesV
 }
 
 
+//...........................................................................
+
+ShaderGenerator::ProgramCache::ProgramCache() :
+_lru( true, PROGRAM_CACHE_SIZE )
+{
+    //nop
+}
+
 //...........................................................................
 
 ShaderGenerator::ShaderGenerator()
@@ -357,13 +370,24 @@ ShaderGenerator::ShaderGenerator()
     _state = new StateEx();
     _active = true;
     _duplicateSharedSubgraphs = false;
+    _useProgramCache = false;
+    _parallelGeneration = true;
+    _programCache = new ProgramCache();
+    _collecting = false;
 }
 
 ShaderGenerator::ShaderGenerator(const ShaderGenerator& rhs, const osg::CopyOp& copy) :
 osg::NodeVisitor         (rhs, copy),
 _active                  (rhs._active),
-_duplicateSharedSubgraphs(rhs._duplicateSharedSubgraphs)
+_duplicateSharedSubgraphs(rhs._duplicateSharedSubgraphs),
+_acceptCallbacks         (rhs._acceptCallbacks),
+_useProgramCache         (rhs._useProgramCache),
+_parallelGeneration      (rhs._parallelGeneration),
+_programCache            (rhs._programCache),
+_collecting              (false)
 {
+    // note: copies share the program cache, so every run() through the
+    // Registry's proxy reuses what earlier runs generated.
     _state = new StateEx();
 }
 
@@ -389,10 +413,25 @@ ShaderGenerator::setDuplicateSharedSubgraphs(bool value)
     _duplicateSharedSubgraphs = value;
 }
 
+void
+ShaderGenerator::setUseProgramCache(bool value)
+{
+    _useProgramCache = value;
+}
+
+void
+ShaderGenerator::setParallelGeneration(bool value)
+{
+    _parallelGeneration = value;
+}
+
 void
 ShaderGenerator::addAcceptCallback(AcceptCallback* cb)
 {
     _acceptCallbacks.push_back( cb );
+
+    // cached results may include attributes this callback rejects.
+    _programCache = new ProgramCache();
 }
 
 bool
@@ -419,6 +458,18 @@ ShaderGenerator::run(osg::Node*         graph,
 {
     if ( graph )
     {
+        if ( _useProgramCache )
+        {
+            // first pass: collect the unique states that have no shaders
+            // in the cache yet, and generate them all in parallel.
+            _collecting = true;
+            graph->accept( *this );
+            _collecting = false;
+            _drawablesVisited.clear();
+
+            generatePendingStates();
+        }
+
         // generate shaders:
         graph->accept( *this );
 
@@ -713,10 +764,13 @@ ShaderGenerator::apply(osg::ClipNode& node)
     if ( ignore(&node) )
         return;
 
-    osg::StateSet* stateSet = cloneOrCreateStateSet(&node);
-    VirtualProgram* vp = VirtualProgram::getOrCreate(stateSet);
-    if ( vp->referenceCount() == 1 ) vp->setName( _name );
-    vp->setFunction( "oe_sg_set_clipvertex", s_clip_source, ShaderComp::LOCATION_VERTEX_VIEW, 0.95f );
+    if ( !_collecting )
+    {
+        osg::StateSet* stateSet = cloneOrCreateStateSet(&node);
+        VirtualProgram* vp = VirtualProgram::getOrCreate(stateSet);
+        if ( vp->referenceCount() == 1 ) vp->setName( _name );
+        vp->setFunction( "oe_sg_set_clipvertex", s_clip_source, ShaderComp::LOCATION_VERTEX_VIEW, 0.95f );
+    }
 
     apply( static_cast<osg::Group&>(node) );
 }
@@ -765,7 +819,7 @@ bool
 ShaderGenerator::processText(const osg::StateSet* ss, osg::ref_ptr<osg::StateSet>& replacement)
 {
     // do nothing if there's no GLSL support
-    if ( !_active )
+    if ( !_active || _collecting )
         return false;
 
     // Capture the active current state:
@@ -833,6 +887,27 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
     if ( dynamic_cast<osg::Program*>(program) != 0L )
         return false;
 
+    // A stateset with its own VP gets a clone of that VP, so it cannot
+    // share generated shaders with anything else.
+    bool useCache = _useProgramCache && VirtualProgram::get(original) == 0L;
+
+    if ( _collecting )
+    {
+        if ( useCache )
+        {
+            std::string signature;
+            getStateSignature( current.get(), signature );
+            if ( _pending.find(signature) == _pending.end() && !_programCache->_lru.has(signature) )
+                _pending[signature] = current.get();
+        }
+        return false;
+    }
+
+    if ( useCache )
+    {
+        return processGeometryUsingCache( original, current.get(), replacement );
+    }
+
     // Copy or create a new stateset (that we may or may not use depending on
     // what we find). Never modify an existing stateset!
     osg::ref_ptr<osg::StateSet> newStateSet =
@@ -845,8 +920,6 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
     // we'll set this to true if the new stateset goes into effect and
     // needs to be returned.
     bool needNewStateSet = false;
-    bool needVertexFunction = false;
-    bool needFragmentFunction = false;
     
     // give the VP a name if it needs one.
     if ( vp->getName().empty() )
@@ -862,10 +935,211 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
         osg::StateAttribute::GLModeValue value = current->getMode(GL_LIGHTING);
         newStateSet->setDefine(OE_LIGHTING_DEFINE, value);
     }
-    
+
+    if ( generateShaders(current.get(), newStateSet.get(), vp.get()) )
+    {
+        needNewStateSet = true;
+    }
+
+    if ( needNewStateSet )
+    {
+        replacement = newStateSet.get();
+    }
+    return replacement.valid();
+}
+
+
+bool
+ShaderGenerator::processGeometryUsingCache(const osg::StateSet*         original,
+                                           osg::StateSet*               current,
+                                           osg::ref_ptr<osg::StateSet>& replacement)
+{
+    std::string signature;
+    getStateSignature( current, signature );
+
+    osg::ref_ptr<GeneratedState> generated;
+    LRUCache<std::string, osg::ref_ptr<GeneratedState> >::Record record;
+    if ( _programCache->_lru.get(signature, record) )
+    {
+        generated = record.value().get();
+    }
+    else
+    {
+        // not collected (or since evicted); generate it here.
+        generated = generateState( current );
+        _programCache->_lru.insert( signature, generated.get() );
+    }
+
+    // Never modify an existing stateset!
+    osg::ref_ptr<osg::StateSet> newStateSet =
+        original ? osg::clone(original, osg::CopyOp::SHALLOW_COPY) :
+        new osg::StateSet();
+
+    bool needNewStateSet = false;
+
+    // Lighting is per-stateset; see processGeometry.
+    if ( original && original->getMode(GL_LIGHTING) != osg::StateAttribute::INHERIT )
+    {
+        needNewStateSet = true;
+        osg::StateAttribute::GLModeValue value = current->getMode(GL_LIGHTING);
+        newStateSet->setDefine(OE_LIGHTING_DEFINE, value);
+    }
+
+    // Install the shared VP and its uniforms.
+    if ( generated->_stateSet.valid() )
+    {
+        needNewStateSet = true;
+        newStateSet->merge( *generated->_stateSet.get() );
+    }
+
+    if ( needNewStateSet )
+    {
+        replacement = newStateSet.get();
+    }
+    return replacement.valid();
+}
+
+
+ShaderGenerator::GeneratedState*
+ShaderGenerator::generateState(osg::StateSet* current)
+{
+    osg::ref_ptr<GeneratedState> generated = new GeneratedState();
+
+    osg::ref_ptr<osg::StateSet> stateSet = new osg::StateSet();
+    VirtualProgram* vp = VirtualProgram::getOrCreate( stateSet.get() );
+    vp->setName( _name );
+
+    if ( generateShaders(current, stateSet.get(), vp) )
+    {
+        generated->_stateSet = stateSet.get();
+    }
+
+    return generated.release();
+}
+
+
+struct ShaderGenerator::GenerateStatesJob : public ParallelRange::Job
+{
+    ShaderGenerator*                              _generator;
+    std::vector<osg::ref_ptr<osg::StateSet> >&    _states;
+    std::vector<osg::ref_ptr<GeneratedState> >&   _results;
+
+    GenerateStatesJob(ShaderGenerator*                            generator,
+                      std::vector<osg::ref_ptr<osg::StateSet> >&  states,
+                      std::vector<osg::ref_ptr<GeneratedState> >& results) :
+        _generator(generator), _states(states), _results(results) { }
+
+    void run(unsigned begin, unsigned end, unsigned chunk)
+    {
+        for(unsigned i=begin; i<end; ++i)
+        {
+            _results[i] = _generator->generateState( _states[i].get() );
+        }
+    }
+};
+
+
+void
+ShaderGenerator::generatePendingStates()
+{
+    if ( _pending.empty() )
+        return;
+
+    std::vector<std::string>                   signatures;
+    std::vector<osg::ref_ptr<osg::StateSet> >  states;
+    std::vector<osg::ref_ptr<GeneratedState> > results( _pending.size() );
+
+    signatures.reserve( _pending.size() );
+    states.reserve( _pending.size() );
+    for(PendingStates::const_iterator i = _pending.begin(); i != _pending.end(); ++i)
+    {
+        signatures.push_back( i->first );
+        states.push_back( i->second.get() );
+    }
+    _pending.clear();
+
+    GenerateStatesJob job( this, states, results );
+    unsigned numItems = states.size();
+    if ( _parallelGeneration )
+        ParallelRange::run( job, numItems, ParallelRange::getNumChunks(numItems, 1u) );
+    else
+        job.run( 0u, numItems, 0u );
+
+    for(unsigned i=0; i<numItems; ++i)
+    {
+        _programCache->_lru.insert( signatures[i], results[i].get() );
+    }
+
+    OE_DEBUG << LC << "Generated shaders for " << numItems << " unique states" << std::endl;
+}
+
+
+void
+ShaderGenerator::getStateSignature(osg::StateSet* current, std::string& signature) const
+{
+    // Everything generateShaders reads from the captured state. Values that
+    // end up in uniforms are included too, since the uniforms are shared.
+    std::stringstream buf;
+    buf << std::setprecision(17);
+
+    int numUnits = osg::minimum(
+        (int)current->getTextureAttributeList().size(),
+        Registry::capabilities().getMaxGPUTextureUnits() );
+
+    for( int unit = 0; unit < numUnits; ++unit )
+    {
+        osg::Texture* tex = dynamic_cast<osg::Texture*>( current->getTextureAttribute(unit, osg::StateAttribute::TEXTURE) );
+
+        if (accept(tex) && !ImageUtils::isFloatingPointInternalFormat(tex->getInternalFormat()))
+        {
+            buf << unit << ":" << tex->className();
+
+            osg::TexGen* texgen = dynamic_cast<osg::TexGen*>(current->getTextureAttribute(unit, osg::StateAttribute::TEXGEN));
+            if ( accept(texgen) )
+                buf << ",g" << (int)texgen->getMode();
+
+            osg::TexEnv* texenv = dynamic_cast<osg::TexEnv*>(current->getTextureAttribute(unit, osg::StateAttribute::TEXENV));
+            if ( accept(texenv) )
+            {
+                buf << ",e" << (int)texenv->getMode();
+                if ( texenv->getMode() == osg::TexEnv::BLEND )
+                {
+                    const osg::Vec4& c = texenv->getColor();
+                    buf << "(" << c.r() << " " << c.g() << " " << c.b() << " " << c.a() << ")";
+                }
+            }
+
+            osg::TexMat* texmat = dynamic_cast<osg::TexMat*>(current->getTextureAttribute(unit, osg::StateAttribute::TEXMAT));
+            if ( accept(texmat) )
+            {
+                const osg::Matrix::value_type* m = texmat->getMatrix().ptr();
+                buf << ",m(";
+                for(unsigned i=0; i<16; ++i)
+                    buf << m[i] << " ";
+                buf << ")";
+            }
+
+            if ( current->getTextureAttribute(unit, osg::StateAttribute::POINTSPRITE) )
+                buf << ",s";
+
+            buf << ";";
+        }
+    }
+
+    signature = buf.str();
+}
+
+
+bool
+ShaderGenerator::generateShaders(osg::StateSet*  current,
+                                 osg::StateSet*  stateSet,
+                                 VirtualProgram* vp)
+{
+    bool generated = false;
+
     // start generating the shader source.
     GenBuffers buf;
-    buf._stateSet = newStateSet.get();
+    buf._stateSet = stateSet;
 
     // if the stateset changes any texture attributes, we need a new virtual program:
     if (current->getTextureAttributeList().size() > 0)
@@ -894,7 +1168,7 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
                 
                 if ( apply(tex, texgen, texenv, texmat, sprite, unit, buf) == true )
                 {
-                    needNewStateSet = true;
+                    generated = true;
                 }
             }
         }
@@ -904,10 +1178,10 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
     osg::StateSet::AttributeList& attrs = current->getAttributeList();
     if ( apply(attrs, buf) )
     {
-        needNewStateSet = true;
+        generated = true;
     }
 
-    if ( needNewStateSet )
+    if ( generated )
     {
         std::string version = GLSL_VERSION_STR;
 
@@ -964,11 +1238,7 @@ ShaderGenerator::processGeometry(const osg::StateSet*         original,
         }
     }
 
-    if ( needNewStateSet )
-    {
-        replacement = newStateSet.get();
-    }
-    return replacement.valid();
+    return generated;
 }
 
 
@@ -20,6 +20,17 @@
 #include <osg/NodeVisitor>
 #include <osg/Geode>
 #include <osg/BufferIndexBinding>
+#include <osg/Material>
+#include <osg/Texture>
+#include <osg/BlendFunc>
+#include <osg/Depth>
+#include <osg/LineWidth>
+#include <osg/LineStipple>
+#include <osg/Point>
+#include <osg/PolygonOffset>
+#include <osg/PolygonMode>
+#include <osg/CullFace>
+#include <cstring>
 
 #define LC "[StateSetCache] "
 
@@ -33,6 +44,165 @@ using namespace osgEarth;
 
 namespace
 {
+    /**
+     * FNV-1a accumulator for structural hashes. Only data that the OSG
+     * compare() methods also look at may go into a hash, so that equal
+     * objects always hash the same.
+     */
+    struct Hasher
+    {
+        unsigned _h;
+
+        Hasher() : _h(2166136261u) { }
+
+        Hasher& add(unsigned v)
+        {
+            for(unsigned i=0; i<4; ++i, v >>= 8)
+            {
+                _h ^= (v & 0xff);
+                _h *= 16777619u;
+            }
+            return *this;
+        }
+
+        Hasher& add(float v)
+        {
+            // +0 and -0 compare equal, so they must hash the same.
+            if ( v == 0.0f ) v = 0.0f;
+            unsigned u;
+            ::memcpy( &u, &v, sizeof(u) );
+            return add( u );
+        }
+
+        Hasher& add(const osg::Vec4& v)
+        {
+            return add(v.r()).add(v.g()).add(v.b()).add(v.a());
+        }
+
+        Hasher& add(const std::string& v)
+        {
+            for(std::string::const_iterator c = v.begin(); c != v.end(); ++c)
+            {
+                _h ^= (unsigned char)(*c);
+                _h *= 16777619u;
+            }
+            return add( (unsigned)v.size() );
+        }
+
+        Hasher& add(const char* v)
+        {
+            for( ; v && *v; ++v)
+            {
+                _h ^= (unsigned char)(*v);
+                _h *= 16777619u;
+            }
+            return *this;
+        }
+    };
+
+    // Contents of the attribute types that commonly appear in generated
+    // geometry. Any other type hashes by class alone and relies on compare()
+    // within its bucket.
+    void hashContents(const osg::StateAttribute* attr, Hasher& h)
+    {
+        if ( const osg::Texture* tex = dynamic_cast<const osg::Texture*>(attr) )
+        {
+            h.add( (unsigned)tex->getFilter(osg::Texture::MIN_FILTER) );
+            h.add( (unsigned)tex->getFilter(osg::Texture::MAG_FILTER) );
+            h.add( (unsigned)tex->getWrap(osg::Texture::WRAP_S) );
+            h.add( (unsigned)tex->getWrap(osg::Texture::WRAP_T) );
+            h.add( (unsigned)tex->getWrap(osg::Texture::WRAP_R) );
+            for(unsigned i=0; i<tex->getNumImages(); ++i)
+            {
+                const osg::Image* image = tex->getImage(i);
+                if ( image )
+                    h.add( (unsigned)image->s() ).add( (unsigned)image->t() ).add( (unsigned)image->r() );
+            }
+        }
+        else if ( const osg::Material* m = dynamic_cast<const osg::Material*>(attr) )
+        {
+            h.add( (unsigned)m->getColorMode() );
+            h.add( m->getAmbient(osg::Material::FRONT) );
+            h.add( m->getDiffuse(osg::Material::FRONT) );
+            h.add( m->getSpecular(osg::Material::FRONT) );
+            h.add( m->getEmission(osg::Material::FRONT) );
+            h.add( m->getShininess(osg::Material::FRONT) );
+        }
+        else if ( const osg::LineWidth* lw = dynamic_cast<const osg::LineWidth*>(attr) )
+        {
+            h.add( lw->getWidth() );
+        }
+        else if ( const osg::LineStipple* ls = dynamic_cast<const osg::LineStipple*>(attr) )
+        {
+            h.add( (unsigned)ls->getFactor() ).add( (unsigned)ls->getPattern() );
+        }
+        else if ( const osg::Point* p = dynamic_cast<const osg::Point*>(attr) )
+        {
+            h.add( p->getSize() );
+        }
+        else if ( const osg::BlendFunc* bf = dynamic_cast<const osg::BlendFunc*>(attr) )
+        {
+            h.add( (unsigned)bf->getSource() ).add( (unsigned)bf->getDestination() );
+            h.add( (unsigned)bf->getSourceAlpha() ).add( (unsigned)bf->getDestinationAlpha() );
+        }
+        else if ( const osg::Depth* d = dynamic_cast<const osg::Depth*>(attr) )
+        {
+            h.add( (unsigned)d->getFunction() ).add( (unsigned)(d->getWriteMask() ? 1 : 0) );
+        }
+        else if ( const osg::PolygonOffset* po = dynamic_cast<const osg::PolygonOffset*>(attr) )
+        {
+            h.add( po->getFactor() ).add( po->getUnits() );
+        }
+        else if ( const osg::PolygonMode* pm = dynamic_cast<const osg::PolygonMode*>(attr) )
+        {
+            h.add( (unsigned)pm->getMode(osg::PolygonMode::FRONT) );
+            h.add( (unsigned)pm->getMode(osg::PolygonMode::BACK) );
+        }
+        else if ( const osg::CullFace* cf = dynamic_cast<const osg::CullFace*>(attr) )
+        {
+            h.add( (unsigned)cf->getMode() );
+        }
+    }
+
+    void hashAttribute(const osg::StateAttribute* attr, Hasher& h)
+    {
+        if ( !attr )
+        {
+            h.add( 0u );
+            return;
+        }
+        h.add( attr->libraryName() );
+        h.add( attr->className() );
+        h.add( (unsigned)attr->getType() );
+        h.add( attr->getMember() );
+        hashContents( attr, h );
+    }
+
+    void hashModes(const osg::StateSet::ModeList& modes, Hasher& h)
+    {
+        h.add( (unsigned)modes.size() );
+        for( osg::StateSet::ModeList::const_iterator i = modes.begin(); i != modes.end(); ++i )
+        {
+            h.add( (unsigned)i->first ).add( (unsigned)i->second );
+        }
+    }
+
+    void hashAttributes(const osg::StateSet::AttributeList& attrs, Hasher& h)
+    {
+        h.add( (unsigned)attrs.size() );
+        for( osg::StateSet::AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            hashAttribute( i->second.first.get(), h );
+            h.add( (unsigned)i->second.second );
+        }
+    }
+
+    unsigned getShard(unsigned hash, unsigned numShards)
+    {
+        // the whole hash keys the tables; use the high bits to pick a shard.
+        return (hash >> 16) % numShards;
+    }
+
     bool isEligible(osg::StateAttribute* attr)
     {
         if ( !attr )
@@ -244,31 +414,40 @@ namespace
 
 //------------------------------------------------------------------------
 
+StateSetCache::Stats::Stats() :
+_stateSetHits       ( 0u ),
+_stateSetMisses     ( 0u ),
+_stateSetsIneligible( 0u ),
+_uniqueStateSets    ( 0u ),
+_attrHits           ( 0u ),
+_attrMisses         ( 0u ),
+_attrsIneligible    ( 0u ),
+_uniqueAttrs        ( 0u )
+{
+    //nop
+}
+
+//------------------------------------------------------------------------
+
 StateSetCache::StateSetCache() :
-_pruneCount       ( 0 ),
-_maxSize          ( DEFAULT_PRUNE_ACCESS_COUNT ),
-_attrShareAttempts( 0 ),
-_attrsIneligible  ( 0 ),
-_attrShareHits    ( 0 ),
-_attrShareMisses  ( 0 )
+_maxSize( DEFAULT_PRUNE_ACCESS_COUNT )
 {
     //nop
 }
 
 StateSetCache::~StateSetCache()
 {
-    Threading::ScopedMutexLock lock( _mutex );
-    prune();
+    for(unsigned i=0; i<NUM_SHARDS; ++i)
+    {
+        Threading::ScopedMutexLock lock( _attrShards[i]._mutex );
+        prune( _attrShards[i] );
+    }
 }
 
 void
 StateSetCache::setMaxSize(unsigned value)
 {
     _maxSize = value;
-    {
-        Threading::ScopedMutexLock lock( _mutex );
-        pruneIfNecessary();
-    }
 }
 
 void
@@ -318,51 +497,98 @@ StateSetCache::eligible(osg::StateAttribute* attr) const
 }
 
 
+unsigned
+StateSetCache::hash(const osg::StateSet* stateSet)
+{
+    Hasher h;
+    if ( !stateSet )
+        return h._h;
+
+    hashModes( stateSet->getModeList(), h );
+    hashAttributes( stateSet->getAttributeList(), h );
+
+    const osg::StateSet::TextureModeList& texModes = stateSet->getTextureModeList();
+    h.add( (unsigned)texModes.size() );
+    for( osg::StateSet::TextureModeList::const_iterator i = texModes.begin(); i != texModes.end(); ++i )
+        hashModes( *i, h );
+
+    const osg::StateSet::TextureAttributeList& texAttrs = stateSet->getTextureAttributeList();
+    h.add( (unsigned)texAttrs.size() );
+    for( osg::StateSet::TextureAttributeList::const_iterator i = texAttrs.begin(); i != texAttrs.end(); ++i )
+        hashAttributes( *i, h );
+
+    // uniform values may legally differ in ways compare() treats as equal,
+    // so only the names and override flags go in.
+    const osg::StateSet::UniformList& uniforms = stateSet->getUniformList();
+    h.add( (unsigned)uniforms.size() );
+    for( osg::StateSet::UniformList::const_iterator i = uniforms.begin(); i != uniforms.end(); ++i )
+        h.add( i->first ).add( (unsigned)i->second.second );
+
+    h.add( (unsigned)stateSet->getRenderingHint() );
+    h.add( (unsigned)stateSet->getRenderBinMode() );
+
+    // compare() ignores the bin number and name when the mode is INHERIT
+    if ( stateSet->getRenderBinMode() != osg::StateSet::INHERIT_RENDERBIN_DETAILS )
+    {
+        h.add( (unsigned)stateSet->getBinNumber() );
+        h.add( stateSet->getBinName() );
+    }
+
+    return h._h;
+}
+
+
+unsigned
+StateSetCache::hash(const osg::StateAttribute* attr)
+{
+    Hasher h;
+    hashAttribute( attr, h );
+    return h._h;
+}
+
+
 bool
 StateSetCache::share(osg::ref_ptr<osg::StateSet>& input,
                      osg::ref_ptr<osg::StateSet>& output,
                      bool                         checkEligible)
 {
-    bool shared     = false;
-    //bool shareattrs = true;
-
-    if ( !checkEligible || eligible(input.get()) )
+    if ( !input.valid() || (checkEligible && !eligible(input.get())) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
+        ++_stateSetsIneligible;
+        output = input.get();
+        return false;
+    }
 
-        pruneIfNecessary();
+    // hash outside the lock; the input is not yet shared with anyone.
+    unsigned key = hash( input.get() );
+    Shard<osg::StateSet>& shard = _stateSetShards[getShard(key, NUM_SHARDS)];
 
-        //shareattrs = false;
+    Threading::ScopedMutexLock lock( shard._mutex );
 
-        std::pair<StateSetSet::iterator,bool> result = _stateSetCache.insert( input );
-        if ( result.second )
-        {
-            // first use
-            output = input.get();
-            //shareattrs = true;
-            shared = false;
-        }
-        else
+    if ( ++shard._pruneCount >= _maxSize )
+    {
+        prune( shard );
+        shard._pruneCount = 0u;
+    }
+
+    typedef Shard<osg::StateSet>::Table Table;
+    std::pair<Table::iterator, Table::iterator> range = shard._table.equal_range( key );
+    for(Table::iterator i = range.first; i != range.second; ++i)
+    {
+        if ( i->second.get() == input.get() || i->second->compare(*input.get(), true) == 0 )
         {
             // found a share!
-            output = result.first->get();
-            shared = true;
+            output = i->second.get();
+            ++_stateSetHits;
+            return true;
         }
     }
-    else
-    {
-        output = input.get();
-        shared = false;
-    }
 
-    // OBE.
-    //if ( shareattrs )
-    //{
-    //    ShareStateAttributes sa(this);
-    //    sa.applyStateSet( input.get() );
-    //}
-
-    return shared;
+    // first use
+    shard._table.insert( range.second, Table::value_type(key, input.get()) );
+    output = input.get();
+    ++_stateSetMisses;
+    return false;
 }
 
 
@@ -372,64 +598,58 @@ StateSetCache::share(osg::ref_ptr<osg::StateAttribute>& input,
                      osg::ref_ptr<osg::StateAttribute>& output,
                      bool                               checkEligible)
 {
-    _attrShareAttempts++;
-
-    if ( !checkEligible || eligible(input.get()) )
+    if ( !input.valid() || (checkEligible && !eligible(input.get())) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
+        ++_attrsIneligible;
+        output = input.get();
+        return false;
+    }
 
-        pruneIfNecessary();
+    unsigned key = hash( input.get() );
+    Shard<osg::StateAttribute>& shard = _attrShards[getShard(key, NUM_SHARDS)];
 
-        std::pair<StateAttributeSet::iterator,bool> result = _stateAttributeCache.insert( input );
-        if ( result.second )
-        {
-            // first use
-            output = input.get();
-            _attrShareMisses++;
-            return false;
-        }
-        else
+    Threading::ScopedMutexLock lock( shard._mutex );
+
+    if ( ++shard._pruneCount >= _maxSize )
+    {
+        prune( shard );
+        shard._pruneCount = 0u;
+    }
+
+    typedef Shard<osg::StateAttribute>::Table Table;
+    std::pair<Table::iterator, Table::iterator> range = shard._table.equal_range( key );
+    for(Table::iterator i = range.first; i != range.second; ++i)
+    {
+        if ( i->second.get() == input.get() || i->second->compare(*input.get()) == 0 )
         {
             // found a share!
-            output = result.first->get();
-            _attrShareHits++;
+            output = i->second.get();
+            ++_attrHits;
             return true;
         }
     }
-    else
-    {
-        _attrsIneligible++;
-        output = input.get();
-        return false;
-    }
-}
 
-void
-StateSetCache::pruneIfNecessary()
-{
-    // assume an exclusve mutex is taken
-    if ( _pruneCount++ >= _maxSize )
-    {
-        prune();
-        _pruneCount = 0;
-    }
+    // first use
+    shard._table.insert( range.second, Table::value_type(key, input.get()) );
+    output = input.get();
+    ++_attrMisses;
+    return false;
 }
 
 void
-StateSetCache::prune()
+StateSetCache::prune(Shard<osg::StateSet>& shard)
 {
-    // assume an exclusive mutex is taken.
-
-    unsigned ss_count = 0, sa_count = 0;
+    // assume the shard's mutex is taken.
+    unsigned count = 0;
 
-    for( StateSetSet::iterator i = _stateSetCache.begin(); i != _stateSetCache.end(); )
+    for( Shard<osg::StateSet>::Table::iterator i = shard._table.begin(); i != shard._table.end(); )
     {
-        if ( i->get()->referenceCount() <= 1 )
+        if ( i->second->referenceCount() <= 1 )
         {
             // do not call releaseGLObjects since the attrs themselves might still be shared
             // TODO: review this.
-            _stateSetCache.erase( i++ );
-            ss_count++;
+            shard._table.erase( i++ );
+            count++;
         }
         else
         {
@@ -437,13 +657,22 @@ StateSetCache::prune()
         }
     }
 
-    for( StateAttributeSet::iterator i = _stateAttributeCache.begin(); i != _stateAttributeCache.end(); )
+    OE_DEBUG << LC << "Pruned " << count << " statesets" << std::endl;
+}
+
+void
+StateSetCache::prune(Shard<osg::StateAttribute>& shard)
+{
+    // assume the shard's mutex is taken.
+    unsigned count = 0;
+
+    for( Shard<osg::StateAttribute>::Table::iterator i = shard._table.begin(); i != shard._table.end(); )
     {
-        if ( i->get()->referenceCount() <= 1 )
+        if ( i->second->referenceCount() <= 1 )
         {
-            i->get()->releaseGLObjects( 0L );
-            _stateAttributeCache.erase( i++ );
-            sa_count++;
+            i->second->releaseGLObjects( 0L );
+            shard._table.erase( i++ );
+            count++;
         }
         else
         {
@@ -451,27 +680,85 @@ StateSetCache::prune()
         }
     }
 
-    OE_DEBUG << LC << "Pruned " << sa_count << " attributes, " << ss_count << " statesets" << std::endl;
+    OE_DEBUG << LC << "Pruned " << count << " attributes" << std::endl;
+}
+
+unsigned
+StateSetCache::size() const
+{
+    unsigned total = 0u;
+    for(unsigned i=0; i<NUM_SHARDS; ++i)
+    {
+        Threading::ScopedMutexLock lock( _stateSetShards[i]._mutex );
+        total += _stateSetShards[i]._table.size();
+    }
+    return total;
 }
 
 void
 StateSetCache::clear()
 {
-    Threading::ScopedMutexLock lock( _mutex );
+    for(unsigned i=0; i<NUM_SHARDS; ++i)
+    {
+        {
+            Threading::ScopedMutexLock lock( _attrShards[i]._mutex );
+            _attrShards[i]._table.clear();
+        }
+        {
+            Threading::ScopedMutexLock lock( _stateSetShards[i]._mutex );
+            _stateSetShards[i]._table.clear();
+        }
+    }
+}
 
-    _stateAttributeCache.clear();
-    _stateSetCache.clear();
+StateSetCache::Stats
+StateSetCache::getStats() const
+{
+    Stats stats;
+    stats._stateSetHits        = _stateSetHits;
+    stats._stateSetMisses      = _stateSetMisses;
+    stats._stateSetsIneligible = _stateSetsIneligible;
+    stats._attrHits            = _attrHits;
+    stats._attrMisses          = _attrMisses;
+    stats._attrsIneligible     = _attrsIneligible;
+
+    for(unsigned i=0; i<NUM_SHARDS; ++i)
+    {
+        {
+            Threading::ScopedMutexLock lock( _attrShards[i]._mutex );
+            stats._uniqueAttrs += _attrShards[i]._table.size();
+        }
+        {
+            Threading::ScopedMutexLock lock( _stateSetShards[i]._mutex );
+            stats._uniqueStateSets += _stateSetShards[i]._table.size();
+        }
+    }
+    return stats;
 }
 
+void
+StateSetCache::resetStats()
+{
+    _stateSetHits.exchange( 0u );
+    _stateSetMisses.exchange( 0u );
+    _stateSetsIneligible.exchange( 0u );
+    _attrHits.exchange( 0u );
+    _attrMisses.exchange( 0u );
+    _attrsIneligible.exchange( 0u );
+}
 
 void
 StateSetCache::dumpStats()
 {
-    Threading::ScopedMutexLock lock( _mutex );
+    Stats stats = getStats();
 
     OE_NOTICE << LC << "StateSetCache Dump:" << std::endl
-        << "    attr attempts     = " << _attrShareAttempts << std::endl
-        << "    ineligibles attrs = " << _attrsIneligible << std::endl
-        << "    attr share hits   = " << _attrShareHits << std::endl
-        << "    attr share misses = " << _attrShareMisses << std::endl;
+        << "    stateset hits      = " << stats._stateSetHits << std::endl
+        << "    stateset misses    = " << stats._stateSetMisses << std::endl
+        << "    ineligible sets    = " << stats._stateSetsIneligible << std::endl
+        << "    unique statesets   = " << stats._uniqueStateSets << std::endl
+        << "    attr share hits    = " << stats._attrHits << std::endl
+        << "    attr share misses  = " << stats._attrMisses << std::endl
+        << "    ineligibles attrs  = " << stats._attrsIneligible << std::endl
+        << "    unique attrs       = " << stats._uniqueAttrs << std::endl;
 }
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/TaskService>
+#include <osgEarth/Registry>
 #include <osg/Notify>
 #include <osg/Math>
 
@@ -572,3 +573,75 @@ TaskServiceManager::reallocate( int numThreads )
         _numThreads += threads;
     }
 }
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    struct RangeChunk
+    {
+        ParallelRange::Job* _job;
+        unsigned            _begin, _end, _chunk;
+        void execute() { _job->run(_begin, _end, _chunk); }
+    };
+
+    Mutex s_rangeServiceMutex;
+    UID   s_rangeServiceUID = -1;
+
+    TaskService* getRangeService()
+    {
+        TaskServiceManager* manager = Registry::instance()->getTaskServiceManager();
+        ScopedLock<Mutex> lock( s_rangeServiceMutex );
+        if ( s_rangeServiceUID < 0 )
+        {
+            s_rangeServiceUID = Registry::instance()->createUID();
+            manager->add( s_rangeServiceUID )->setName( "ParallelRange" );
+        }
+        return manager->get( s_rangeServiceUID );
+    }
+}
+
+unsigned
+ParallelRange::getNumChunks(unsigned numItems, unsigned minItemsPerChunk)
+{
+    minItemsPerChunk = osg::maximum(minItemsPerChunk, 1u);
+    if ( numItems < 2u*minItemsPerChunk )
+        return 1u;
+
+    TaskService* service = getRangeService();
+    if ( !service )
+        return 1u;
+
+    // the calling thread takes one of the chunks itself.
+    unsigned numChunks = 1u + (unsigned)osg::maximum(service->getNumThreads(), 0);
+    return osg::minimum(numChunks, numItems / minItemsPerChunk);
+}
+
+void
+ParallelRange::run(Job& job, unsigned numItems, unsigned numChunks)
+{
+    if ( numChunks <= 1u || numItems <= 1u )
+    {
+        job.run(0u, numItems, 0u);
+        return;
+    }
+
+    numChunks = osg::minimum(numChunks, numItems);
+    unsigned itemsPerChunk = (numItems + numChunks - 1u) / numChunks;
+
+    TaskService* service = getRangeService();
+    Threading::MultiEvent done( numChunks - 1u );
+
+    for( unsigned i = 1u; i < numChunks; ++i )
+    {
+        ParallelTask<RangeChunk>* task = new ParallelTask<RangeChunk>( &done );
+        task->_job   = &job;
+        task->_begin = osg::minimum(i * itemsPerChunk, numItems);
+        task->_end   = osg::minimum(task->_begin + itemsPerChunk, numItems);
+        task->_chunk = i;
+        service->add( task );
+    }
+
+    job.run(0u, osg::minimum(itemsPerChunk, numItems), 0u);
+    done.wait();
+}
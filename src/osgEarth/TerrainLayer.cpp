@@ -501,6 +501,66 @@ TerrainLayer::getMetadataKey(const Profile* profile) const
         return "_metadata";
 }
 
+std::string
+TerrainLayer::getCacheKey(const TileKey& key) const
+{
+    // the cache key combines the Key and the horizontal profile.
+    return Stringify() << key.str() << "_" << key.getProfile()->getHorizSignature();
+}
+
+unsigned
+TerrainLayer::prefetch(const std::vector<TileKey>& keys)
+{
+    if ( !_memCache.valid() || keys.empty() )
+        return 0u;
+
+    const CachePolicy& policy = getCacheSettings()->cachePolicy().get();
+    if ( !policy.isCacheReadable() )
+        return 0u;
+
+    CacheBin* cacheBin = getCacheBin( keys.front().getProfile() );
+    if ( !cacheBin )
+        return 0u;
+
+    CacheBin* memBin = _memCache->getOrCreateDefaultBin();
+
+    // only fetch what's not already in memory.
+    std::vector<std::string> cacheKeys;
+    cacheKeys.reserve( keys.size() );
+    for(std::vector<TileKey>::const_iterator i = keys.begin(); i != keys.end(); ++i)
+    {
+        if ( i->valid() && isKeyInLegalRange(*i) )
+        {
+            std::string cacheKey = getCacheKey(*i);
+            if ( memBin->getRecordStatus(cacheKey) != CacheBin::STATUS_OK )
+                cacheKeys.push_back( cacheKey );
+        }
+    }
+
+    if ( cacheKeys.empty() )
+        return 0u;
+
+    CacheBin::ReadResults results;
+    cacheBin->readMany( cacheKeys, getCacheRecordType(), 0L, results );
+
+    unsigned count = 0u;
+    for(unsigned i=0; i<results.size(); ++i)
+    {
+        ReadResult& r = results[i];
+        if ( r.succeeded() &&
+             !policy.isExpired(r.lastModifiedTime()) &&
+             prepareCachedObject(r.getObject()) )
+        {
+            memBin->write( cacheKeys[i], r.getObject(), 0L );
+            ++count;
+        }
+    }
+
+    OE_DEBUG << LC << "Prefetched " << count << " of " << keys.size() << " tiles\n";
+
+    return count;
+}
+
 CacheBin*
 TerrainLayer::getCacheBin(const Profile* profile)
 {
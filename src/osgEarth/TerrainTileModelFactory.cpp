@@ -120,6 +120,8 @@ TerrainTileModelFactory::addColorLayers(TerrainTileModel* model,
 
                 else
                 {
+                    prefetchSiblings( imageLayer, key );
+
                     GeoImage geoImage = imageLayer->createImage( key, progress );
            
                     if ( geoImage.valid() )
@@ -318,6 +320,15 @@ TerrainTileModelFactory::addElevation(TerrainTileModel*            model,
     const osgEarth::ElevationInterpolation& interp =
         frame.getMapOptions().elevationInterpolation().get();
 
+    // Batch-read the sibling tiles from each layer's cache.
+    ElevationLayerVector elevationLayers;
+    frame.getLayers(elevationLayers);
+    for(ElevationLayerVector::const_iterator i = elevationLayers.begin(); i != elevationLayers.end(); ++i)
+    {
+        if (i->get()->getEnabled())
+            prefetchSiblings(i->get(), key);
+    }
+
     // Request a heightfield from the map.
     osg::ref_ptr<osg::HeightField> mainHF;
     osg::ref_ptr<NormalMap> normalMap;
@@ -416,6 +427,25 @@ TerrainTileModelFactory::addNormalMap(TerrainTileModel* model,
         progress->stats()["fetch_normalmap_time"] += OE_STOP_TIMER(fetch_normalmap);
 }
 
+void
+TerrainTileModelFactory::prefetchSiblings(TerrainLayer*  layer,
+                                          const TileKey& key)
+{
+    // Only quadrant 0 issues the batch, so each parent costs one batched
+    // read. That is not always a saving: quadrant 0 need not be built
+    // first, since siblings are built on separate threads; and on a cold
+    // cache the batch misses all four and siblings 1-3 then miss again.
+    if (key.getLOD() == 0 || key.getQuadrant() != 0)
+        return;
+
+    TileKey parent = key.createParentKey();
+    std::vector<TileKey> siblings(4);
+    for (unsigned q = 0; q < 4; ++q)
+        siblings[q] = parent.createChildKey(q);
+
+    layer->prefetch(siblings);
+}
+
 bool
 TerrainTileModelFactory::getOrCreateHeightField(const MapFrame&                 frame,
                                                 const TileKey&                  key,
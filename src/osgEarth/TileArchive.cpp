@@ -0,0 +1,780 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TileArchive>
+#include <osgEarth/StringUtils>
+#include <osgEarth/Notify>
+#include <osg/Image>
+#include <osg/Node>
+#include <osgDB/Registry>
+#include <osgDB/ReaderWriter>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#define LC "[TileArchive] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // On-disk structures. All are multiples of 8 bytes so they stay
+    // naturally aligned when laid out back to back.
+
+    const char     ARCHIVE_MAGIC[8] = { 'O','E','T','A','R','C','H','\0' };
+    const uint32_t ARCHIVE_VERSION  = 1;
+    const uint32_t ARCHIVE_BOM      = 0x01020304;
+
+    struct FileHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t pageSize;
+        uint32_t numBins;
+        uint64_t numRecords;
+        uint64_t binTableOffset;
+        uint64_t indexOffset;
+        uint64_t stringsOffset;
+        uint64_t stringsSize;
+        uint64_t fileSize;
+    };
+
+    struct BinEntry
+    {
+        uint32_t idOffset;      // into the string pool
+        uint32_t idSize;
+        uint32_t metaOffset;
+        uint32_t metaSize;
+        uint64_t firstRecord;   // into the index
+        uint64_t numRecords;
+    };
+
+    struct IndexEntry
+    {
+        uint64_t sortKey;
+        uint64_t dataOffset;    // from the start of the file
+        uint32_t dataSize;
+        uint32_t keyOffset;     // into the string pool
+        uint32_t keySize;
+        uint32_t metaOffset;
+        uint32_t metaSize;
+        uint32_t reserved;
+        int64_t  lastModified;
+    };
+
+    // sort keys in [LOD_SHIFT..63] hold the LOD; the value 63 marks non-tile keys.
+    const unsigned LOD_SHIFT  = 58u;
+    const uint64_t LOD_OTHER  = 63u;
+    const uint64_t ORDER_MASK = (((uint64_t)1) << LOD_SHIFT) - 1u;
+    const uint32_t MAX_TILE_XY = 1u << 29;
+
+    inline uint64_t spreadBits(uint32_t v)
+    {
+        uint64_t x = v;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x <<  8)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+        x = (x | (x <<  2)) & 0x3333333333333333ULL;
+        x = (x | (x <<  1)) & 0x5555555555555555ULL;
+        return x;
+    }
+
+    // FNV-1a
+    inline uint64_t hash64(const std::string& s)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+        {
+            h ^= (unsigned char)(*i);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // Parses a leading unsigned decimal number, advancing "pos".
+    inline bool parseNumber(const std::string& s, std::string::size_type& pos, uint32_t& out)
+    {
+        std::string::size_type start = pos;
+        uint64_t value = 0;
+        while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9' && pos - start < 10)
+        {
+            value = value*10u + (s[pos] - '0');
+            ++pos;
+        }
+        if (pos == start || value > 0xFFFFFFFFULL)
+            return false;
+        out = (uint32_t)value;
+        return true;
+    }
+
+    // Parses keys that start with "lod/x/y" (TileKey::str()).
+    bool parseTileKey(const std::string& key, uint32_t& lod, uint32_t& x, uint32_t& y)
+    {
+        std::string::size_type pos = 0;
+        if (!parseNumber(key, pos, lod) || pos >= key.size() || key[pos++] != '/')
+            return false;
+        if (!parseNumber(key, pos, x) || pos >= key.size() || key[pos++] != '/')
+            return false;
+        if (!parseNumber(key, pos, y))
+            return false;
+        // the next character, if any, must not continue the number
+        return pos == key.size() || key[pos] < '0' || key[pos] > '9';
+    }
+
+    struct SortKeyLess
+    {
+        bool operator()(const IndexEntry& lhs, uint64_t rhs) const { return lhs.sortKey < rhs; }
+        bool operator()(uint64_t lhs, const IndexEntry& rhs) const { return lhs < rhs.sortKey; }
+    };
+}
+
+//------------------------------------------------------------------------
+
+uint64_t
+TileArchive::morton(uint32_t x, uint32_t y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+uint64_t
+TileArchive::getSortKey(const std::string& key)
+{
+    uint32_t lod, x, y;
+    if (parseTileKey(key, lod, x, y) && lod < LOD_OTHER && x < MAX_TILE_XY && y < MAX_TILE_XY)
+    {
+        return (((uint64_t)lod) << LOD_SHIFT) | morton(x, y);
+    }
+    else
+    {
+        return (LOD_OTHER << LOD_SHIFT) | (hash64(key) & ORDER_MASK);
+    }
+}
+
+TileArchive::TileArchive() :
+_base   ( 0L ),
+_size   ( 0u ),
+_numBins( 0u ),
+_bins   ( 0L ),
+_index  ( 0L ),
+_strings( 0L )
+#ifdef _WIN32
+,_file   ( 0L ),
+_mapping( 0L )
+#endif
+{
+    //nop
+}
+
+TileArchive::~TileArchive()
+{
+    unmap();
+}
+
+TileArchive*
+TileArchive::open(const std::string& filename)
+{
+    osg::ref_ptr<TileArchive> archive = new TileArchive();
+
+    if ( !archive->map(filename) )
+        return 0L;
+
+    if ( !archive->validate() )
+        return 0L;
+
+    OE_INFO << LC << "Opened \"" << filename << "\" (" << archive->getNumBins() << " bins, "
+        << (archive->getFileSize()/1048576u) << " MB)" << std::endl;
+
+    return archive.release();
+}
+
+bool
+TileArchive::map(const std::string& filename)
+{
+    _filename = filename;
+
+#ifdef _WIN32
+    HANDLE file = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0L, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, 0L);
+    if ( file == INVALID_HANDLE_VALUE )
+    {
+        OE_WARN << LC << "Cannot open \"" << filename << "\"" << std::endl;
+        return false;
+    }
+    _file = file;
+
+    LARGE_INTEGER size;
+    if ( !::GetFileSizeEx(file, &size) || size.QuadPart == 0 )
+    {
+        OE_WARN << LC << "Cannot read the size of \"" << filename << "\"" << std::endl;
+        return false;
+    }
+    _size = (uint64_t)size.QuadPart;
+
+    HANDLE mapping = ::CreateFileMappingA(file, 0L, PAGE_READONLY, 0, 0, 0L);
+    if ( mapping == 0L )
+    {
+        OE_WARN << LC << "Cannot map \"" << filename << "\"" << std::endl;
+        return false;
+    }
+    _mapping = mapping;
+
+    _base = (const char*)::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if ( _base == 0L )
+    {
+        OE_WARN << LC << "Cannot map \"" << filename << "\"" << std::endl;
+        return false;
+    }
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if ( fd < 0 )
+    {
+        OE_WARN << LC << "Cannot open \"" << filename << "\"" << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if ( ::fstat(fd, &st) != 0 || st.st_size == 0 )
+    {
+        OE_WARN << LC << "Cannot read the size of \"" << filename << "\"" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    _size = (uint64_t)st.st_size;
+
+    void* ptr = ::mmap(0L, (size_t)_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    // the mapping holds its own reference to the file.
+    ::close(fd);
+
+    if ( ptr == MAP_FAILED )
+    {
+        OE_WARN << LC << "Cannot map \"" << filename << "\"" << std::endl;
+        return false;
+    }
+    _base = (const char*)ptr;
+
+#  ifdef MADV_RANDOM
+    // tile access is scattered; don't waste I/O on read-ahead.
+    ::madvise(ptr, (size_t)_size, MADV_RANDOM);
+#  endif
+#endif
+
+    return true;
+}
+
+void
+TileArchive::unmap()
+{
+#ifdef _WIN32
+    if ( _base )
+        ::UnmapViewOfFile(_base);
+    if ( _mapping )
+        ::CloseHandle((HANDLE)_mapping);
+    if ( _file )
+        ::CloseHandle((HANDLE)_file);
+    _mapping = 0L;
+    _file = 0L;
+#else
+    if ( _base )
+        ::munmap((void*)_base, (size_t)_size);
+#endif
+    _base = 0L;
+    _size = 0u;
+}
+
+bool
+TileArchive::validate()
+{
+    // Check everything up front so that lookups can trust the file.
+    if ( _size < sizeof(FileHeader) )
+    {
+        OE_WARN << LC << "\"" << _filename << "\" is too small to be a tile archive" << std::endl;
+        return false;
+    }
+
+    const FileHeader& header = *(const FileHeader*)_base;
+
+    if ( ::memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 )
+    {
+        OE_WARN << LC << "\"" << _filename << "\" is not a tile archive, or was not finished" << std::endl;
+        return false;
+    }
+
+    if ( header.byteOrder != ARCHIVE_BOM )
+    {
+        OE_WARN << LC << "\"" << _filename << "\" was written on a machine with a different byte order" << std::endl;
+        return false;
+    }
+
+    if ( header.version != ARCHIVE_VERSION )
+    {
+        OE_WARN << LC << "\"" << _filename << "\" has unsupported version " << header.version << std::endl;
+        return false;
+    }
+
+    uint64_t binTableSize = (uint64_t)header.numBins * sizeof(BinEntry);
+    uint64_t indexSize    = header.numRecords * sizeof(IndexEntry);
+
+    bool ok =
+        header.fileSize == _size &&
+        header.binTableOffset % 8u == 0u &&
+        header.indexOffset % 8u == 0u &&
+        header.binTableOffset + binTableSize <= _size &&
+        header.indexOffset + indexSize <= _size &&
+        header.stringsOffset + header.stringsSize <= _size &&
+        header.stringsSize <= 0xFFFFFFFFULL;
+
+    if ( !ok )
+    {
+        OE_WARN << LC << "\"" << _filename << "\" is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    _numBins = header.numBins;
+    _bins    = _base + header.binTableOffset;
+    _index   = _base + header.indexOffset;
+    _strings = _base + header.stringsOffset;
+
+    const BinEntry*   bins    = (const BinEntry*)_bins;
+    const IndexEntry* index   = (const IndexEntry*)_index;
+    uint64_t          strSize = header.stringsSize;
+
+    for(unsigned b = 0; b < _numBins && ok; ++b)
+    {
+        const BinEntry& bin = bins[b];
+        ok =
+            (uint64_t)bin.idOffset + bin.idSize <= strSize &&
+            (uint64_t)bin.metaOffset + bin.metaSize <= strSize &&
+            bin.firstRecord + bin.numRecords <= header.numRecords;
+
+        for(uint64_t r = bin.firstRecord; ok && r < bin.firstRecord + bin.numRecords; ++r)
+        {
+            const IndexEntry& e = index[r];
+            ok =
+                e.dataOffset + e.dataSize <= _size &&
+                (uint64_t)e.keyOffset + e.keySize <= strSize &&
+                (uint64_t)e.metaOffset + e.metaSize <= strSize &&
+                (r == bin.firstRecord || index[r-1].sortKey <= e.sortKey);
+        }
+    }
+
+    if ( !ok )
+    {
+        OE_WARN << LC << "\"" << _filename << "\" has a corrupt index" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int
+TileArchive::findBin(const std::string& binID) const
+{
+    const BinEntry* bins = (const BinEntry*)_bins;
+    for(unsigned b = 0; b < _numBins; ++b)
+    {
+        if (bins[b].idSize == binID.size() &&
+            ::memcmp(_strings + bins[b].idOffset, binID.data(), binID.size()) == 0)
+        {
+            return (int)b;
+        }
+    }
+    return -1;
+}
+
+std::string
+TileArchive::getBinID(unsigned bin) const
+{
+    if ( bin >= _numBins )
+        return std::string();
+
+    const BinEntry& b = ((const BinEntry*)_bins)[bin];
+    return std::string(_strings + b.idOffset, b.idSize);
+}
+
+Config
+TileArchive::getBinMetadata(unsigned bin) const
+{
+    Config conf;
+    if ( bin < _numBins )
+    {
+        const BinEntry& b = ((const BinEntry*)_bins)[bin];
+        if ( b.metaSize > 0 )
+            conf.fromJSON( std::string(_strings + b.metaOffset, b.metaSize) );
+    }
+    return conf;
+}
+
+unsigned
+TileArchive::getNumRecords(unsigned bin) const
+{
+    return bin < _numBins ? (unsigned)((const BinEntry*)_bins)[bin].numRecords : 0u;
+}
+
+bool
+TileArchive::find(unsigned bin, const std::string& key, Record& output) const
+{
+    if ( bin >= _numBins )
+        return false;
+
+    const BinEntry&   b     = ((const BinEntry*)_bins)[bin];
+    const IndexEntry* first = ((const IndexEntry*)_index) + b.firstRecord;
+    const IndexEntry* last  = first + b.numRecords;
+
+    uint64_t sortKey = getSortKey(key);
+
+    // Distinct keys can share a sort key (hash collisions), so compare
+    // the full key across the run of equal sort keys.
+    for(const IndexEntry* i = std::lower_bound(first, last, sortKey, SortKeyLess());
+        i != last && i->sortKey == sortKey;
+        ++i)
+    {
+        if (i->keySize == key.size() &&
+            ::memcmp(_strings + i->keyOffset, key.data(), key.size()) == 0)
+        {
+            output._data         = _base + i->dataOffset;
+            output._size         = i->dataSize;
+            output._meta         = _strings + i->metaOffset;
+            output._metaSize     = i->metaSize;
+            output._lastModified = (TimeStamp)i->lastModified;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------
+
+#undef  LC
+#define LC "[TileArchiveWriter] "
+
+namespace
+{
+    struct EntryLess
+    {
+        template<typename T>
+        bool operator()(const T& lhs, const T& rhs) const
+        {
+            if ( lhs._sortKey != rhs._sortKey ) return lhs._sortKey < rhs._sortKey;
+            if ( lhs._key != rhs._key ) return lhs._key < rhs._key;
+            return lhs._order > rhs._order; // newest first, so it survives de-duplication
+        }
+    };
+
+    struct EntrySameKey
+    {
+        template<typename T>
+        bool operator()(const T& lhs, const T& rhs) const
+        {
+            return lhs._sortKey == rhs._sortKey && lhs._key == rhs._key;
+        }
+    };
+
+    // Appends a string to the pool and returns its offset.
+    bool addString(std::string& pool, const std::string& value, uint32_t& offset, uint32_t& size)
+    {
+        if ( (uint64_t)pool.size() + value.size() > 0xFFFFFFFFULL )
+            return false;
+        offset = (uint32_t)pool.size();
+        size = (uint32_t)value.size();
+        pool.append(value);
+        return true;
+    }
+}
+
+TileArchiveWriter::TileArchiveWriter(const std::string& filename, unsigned pageSize) :
+_filename( filename ),
+_pageSize( pageSize > 1u ? pageSize : 1u ),
+_offset  ( 0u ),
+_numAdded( 0u )
+{
+    _out.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if ( _out.is_open() )
+    {
+        // Reserve the header page. It stays zeroed (and therefore invalid)
+        // until finish() succeeds.
+        std::string header( std::max((size_t)_pageSize, sizeof(FileHeader)), '\0' );
+        _out.write( header.data(), header.size() );
+        _offset = header.size();
+    }
+    else
+    {
+        _error = Stringify() << "Cannot create \"" << filename << "\"";
+    }
+}
+
+TileArchiveWriter::~TileArchiveWriter()
+{
+    if ( _out.is_open() )
+        _out.close();
+}
+
+bool
+TileArchiveWriter::isOpen() const
+{
+    return _out.is_open() && _out.good();
+}
+
+bool
+TileArchiveWriter::pad(uint64_t alignment)
+{
+    static const char zeros[4096] = { 0 };
+
+    uint64_t target = ((_offset + alignment - 1u) / alignment) * alignment;
+
+    while ( _offset < target )
+    {
+        uint64_t n = std::min(target - _offset, (uint64_t)sizeof(zeros));
+        _out.write(zeros, (std::streamsize)n);
+        _offset += n;
+    }
+    return _out.good();
+}
+
+unsigned
+TileArchiveWriter::addBin(const std::string& binID, const Config& metadata)
+{
+    for(unsigned i = 0; i < _bins.size(); ++i)
+    {
+        if ( _bins[i]._id == binID )
+            return i;
+    }
+
+    _bins.push_back( Bin() );
+    _bins.back()._id = binID;
+    if ( !metadata.empty() )
+        _bins.back()._meta = metadata.toJSON(false);
+    return _bins.size()-1;
+}
+
+void
+TileArchiveWriter::setBinMetadata(unsigned bin, const Config& metadata)
+{
+    if ( bin < _bins.size() )
+        _bins[bin]._meta = metadata.empty() ? std::string() : metadata.toJSON(false);
+}
+
+bool
+TileArchiveWriter::addRecord(unsigned           bin,
+                             const std::string& key,
+                             const char*        data,
+                             unsigned           size,
+                             const Config&      metadata,
+                             TimeStamp          lastModified)
+{
+    if ( !isOpen() || bin >= _bins.size() )
+        return false;
+
+    if ( !pad(_pageSize) )
+    {
+        _error = "Write failed";
+        return false;
+    }
+
+    Entry entry;
+    entry._sortKey      = TileArchive::getSortKey(key);
+    entry._key          = key;
+    entry._offset       = _offset;
+    entry._size         = size;
+    entry._lastModified = lastModified;
+    entry._order        = _numAdded++;
+    if ( !metadata.empty() )
+        entry._meta = metadata.toJSON(false);
+
+    _out.write(data, size);
+    _offset += size;
+
+    if ( !_out.good() )
+    {
+        _error = "Write failed";
+        return false;
+    }
+
+    _bins[bin]._entries.push_back( entry );
+    return true;
+}
+
+bool
+TileArchiveWriter::addObject(unsigned              bin,
+                             const std::string&    key,
+                             const osg::Object*    object,
+                             const Config&         metadata,
+                             TimeStamp             lastModified,
+                             const osgDB::Options* writeOptions)
+{
+    if ( !object )
+        return false;
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    if ( !rw )
+    {
+        _error = "No osgb ReaderWriter";
+        return false;
+    }
+
+    std::stringstream buf;
+    osgDB::ReaderWriter::WriteResult r;
+
+    if ( dynamic_cast<const osg::Image*>(object) )
+        r = rw->writeImage( *static_cast<const osg::Image*>(object), buf, writeOptions );
+    else if ( dynamic_cast<const osg::Node*>(object) )
+        r = rw->writeNode( *static_cast<const osg::Node*>(object), buf, writeOptions );
+    else
+        r = rw->writeObject( *object, buf, writeOptions );
+
+    if ( !r.success() )
+    {
+        _error = Stringify() << "Failed to serialize \"" << key << "\": " << r.message();
+        return false;
+    }
+
+    std::string data = buf.str();
+    return addRecord(bin, key, data.data(), data.size(), metadata, lastModified);
+}
+
+unsigned
+TileArchiveWriter::getNumRecords() const
+{
+    unsigned count = 0u;
+    for(unsigned i = 0; i < _bins.size(); ++i)
+        count += _bins[i]._entries.size();
+    return count;
+}
+
+bool
+TileArchiveWriter::finish()
+{
+    if ( !isOpen() )
+    {
+        if ( _error.empty() )
+            _error = "Archive is not open";
+        return false;
+    }
+
+    std::string              pool;
+    std::vector<BinEntry>    binTable(_bins.size());
+    std::vector<IndexEntry>  index;
+    index.reserve( getNumRecords() );
+
+    for(unsigned b = 0; b < _bins.size(); ++b)
+    {
+        Bin& bin = _bins[b];
+
+        // order the index for binary search, keeping only the newest of
+        // any duplicate keys.
+        std::sort( bin._entries.begin(), bin._entries.end(), EntryLess() );
+        bin._entries.erase(
+            std::unique( bin._entries.begin(), bin._entries.end(), EntrySameKey() ),
+            bin._entries.end() );
+
+        BinEntry& be = binTable[b];
+        ::memset(&be, 0, sizeof(BinEntry));
+        be.firstRecord = index.size();
+        be.numRecords  = bin._entries.size();
+
+        bool ok =
+            addString(pool, bin._id, be.idOffset, be.idSize) &&
+            addString(pool, bin._meta, be.metaOffset, be.metaSize);
+
+        for(std::vector<Entry>::const_iterator e = bin._entries.begin(); ok && e != bin._entries.end(); ++e)
+        {
+            IndexEntry ie;
+            ::memset(&ie, 0, sizeof(IndexEntry));
+            ie.sortKey      = e->_sortKey;
+            ie.dataOffset   = e->_offset;
+            ie.dataSize     = e->_size;
+            ie.lastModified = (int64_t)e->_lastModified;
+
+            ok =
+                addString(pool, e->_key, ie.keyOffset, ie.keySize) &&
+                addString(pool, e->_meta, ie.metaOffset, ie.metaSize);
+
+            index.push_back( ie );
+        }
+
+        if ( !ok )
+        {
+            _error = "String pool exceeds 4GB";
+            _out.close();
+            return false;
+        }
+
+        // release memory as we go
+        std::vector<Entry>().swap( bin._entries );
+    }
+
+    FileHeader header;
+    ::memset(&header, 0, sizeof(FileHeader));
+    ::memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version    = ARCHIVE_VERSION;
+    header.byteOrder  = ARCHIVE_BOM;
+    header.pageSize   = _pageSize;
+    header.numBins    = binTable.size();
+    header.numRecords = index.size();
+
+    pad(8u);
+    header.binTableOffset = _offset;
+    if ( !binTable.empty() )
+        _out.write( (const char*)&binTable[0], binTable.size()*sizeof(BinEntry) );
+    _offset += binTable.size()*sizeof(BinEntry);
+
+    header.indexOffset = _offset;
+    if ( !index.empty() )
+        _out.write( (const char*)&index[0], index.size()*sizeof(IndexEntry) );
+    _offset += index.size()*sizeof(IndexEntry);
+
+    header.stringsOffset = _offset;
+    header.stringsSize   = pool.size();
+    _out.write( pool.data(), pool.size() );
+    _offset += pool.size();
+
+    header.fileSize = _offset;
+
+    // the header goes in last, so an interrupted build is never mistaken
+    // for a valid archive.
+    _out.seekp(0);
+    _out.write( (const char*)&header, sizeof(FileHeader) );
+    _out.flush();
+
+    bool ok = _out.good();
+    _out.close();
+
+    if ( !ok )
+    {
+        _error = Stringify() << "Failed to write \"" << _filename << "\"";
+        return false;
+    }
+
+    OE_INFO << LC << "Wrote " << header.numRecords << " records in " << header.numBins
+        << " bins to \"" << _filename << "\"" << std::endl;
+
+    return true;
+}
@@ -21,10 +21,13 @@
 #include <osgEarth/StringUtils>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/GeoData>
+#include <osgEarth/TileKey>
 
 #include <osgDB/ReadFile>
 #include <osgDB/ReaderWriter>
 
+#include <typeinfo>
+
 using namespace osgEarth;
 
 #undef  LC
@@ -37,6 +40,64 @@ namespace
     typedef std::map<std::string, osg::ref_ptr<VerticalDatum> > VDatumCache;
     VDatumCache      _vdatumCache;
     Threading::Mutex _vdataCacheMutex;
+
+    // number of tile grids each datum keeps geoid heights for
+    const unsigned GEOID_HEIGHTS_CACHE_SIZE = 128u;
+
+    // The geodetic grid that a heightfield's posts sample over an extent.
+    void getGeodeticGrid(const GeoExtent& extent, unsigned cols, unsigned rows,
+                         double& west, double& south, double& xstep, double& ystep)
+    {
+        osg::Vec3d sw(extent.west(), extent.south(), 0.0);
+        osg::Vec3d ne(extent.east(), extent.north(), 0.0);
+
+        xstep = std::abs(extent.east() - extent.west()) / double(cols-1);
+        ystep = std::abs(extent.north() - extent.south()) / double(rows-1);
+
+        if ( !extent.getSRS()->isGeographic() )
+        {
+            const SpatialReference* geoSRS = extent.getSRS()->getGeographicSRS();
+            extent.getSRS()->transform(sw, geoSRS, sw);
+            extent.getSRS()->transform(ne, geoSRS, ne);
+            xstep = (ne.x()-sw.x()) / double(cols-1);
+            ystep = (ne.y()-sw.y()) / double(rows-1);
+        }
+
+        west = sw.x();
+        south = sw.y();
+    }
+
+    // Whether the grid transforms can stand in for msl2hae/hae2msl.
+    bool canUseGeoidHeights(const VerticalDatum* from, const VerticalDatum* to)
+    {
+        return (!from || from->usesGeoidHeights()) && (!to || to->usesGeoidHeights());
+    }
+
+    // Applies precomputed geoid heights (either may be null for no geoid),
+    // in the same order of operations as the per-point transform.
+    void applyGeoidHeights(const VerticalDatum* from, const float* fromHeights,
+                           const VerticalDatum* to,   const float* toHeights,
+                           osg::HeightField* hf)
+    {
+        Units fromUnits = from ? from->getUnits() : Units::METERS;
+        Units toUnits = to ? to->getUnits() : Units::METERS;
+        bool convertUnits = fromUnits != toUnits;
+
+        osg::FloatArray* heights = hf->getFloatArray();
+        unsigned count = heights->size();
+        for (unsigned i = 0; i < count; ++i)
+        {
+            float& h = (*heights)[i];
+            if (h != NO_DATA_VALUE)
+            {
+                double z = h;
+                if (fromHeights) z += fromHeights[i];
+                if (convertUnits) z = fromUnits.convertTo(toUnits, z);
+                if (toHeights) z -= toHeights[i];
+                h = float(z);
+            }
+        }
+    }
 } 
 
 VerticalDatum*
@@ -72,7 +133,8 @@ VerticalDatum::VerticalDatum(const std::string& name,
 _name      ( name ),
 _initString( initString ),
 _geoid     ( geoid ),
-_units     ( Units::METERS )
+_units     ( Units::METERS ),
+_geoidHeights( true, GEOID_HEIGHTS_CACHE_SIZE )
 {
     if ( _geoid.valid() )
         _units = _geoid->getUnits();
@@ -81,7 +143,8 @@ _units     ( Units::METERS )
 VerticalDatum::VerticalDatum( const Units& units ) :
 _name      ( units.getName() ),
 _initString( units.getName() ),
-_units     ( units )
+_units     ( units ),
+_geoidHeights( true, GEOID_HEIGHTS_CACHE_SIZE )
 {
     //nop
 }
@@ -136,6 +199,107 @@ VerticalDatum::transform(const VerticalDatum* from,
     if ( from == to )
         return true;
 
+    if ( !canUseGeoidHeights(from, to) )
+        return transformPerPost(from, to, extent, hf);
+
+    unsigned cols = hf->getNumColumns();
+    unsigned rows = hf->getNumRows();
+
+    double west, south, xstep, ystep;
+    getGeodeticGrid(extent, cols, rows, west, south, xstep, ystep);
+
+    std::vector<float> fromHeights, toHeights;
+
+    if ( from && from->getGeoid() )
+    {
+        fromHeights.resize(cols*rows);
+        from->getGeoid()->getHeights(west, south, xstep, ystep, cols, rows, &fromHeights[0]);
+    }
+
+    if ( to && to->getGeoid() )
+    {
+        toHeights.resize(cols*rows);
+        to->getGeoid()->getHeights(west, south, xstep, ystep, cols, rows, &toHeights[0]);
+    }
+
+    applyGeoidHeights(
+        from, fromHeights.empty() ? 0L : &fromHeights[0],
+        to,   toHeights.empty()   ? 0L : &toHeights[0],
+        hf);
+
+    return true;
+}
+
+bool
+VerticalDatum::transform(const VerticalDatum* from,
+                         const VerticalDatum* to,
+                         const TileKey&       key,
+                         osg::HeightField*    hf )
+{
+    if ( from == to )
+        return true;
+
+    if ( !canUseGeoidHeights(from, to) )
+        return transformPerPost(from, to, key.getExtent(), hf);
+
+    unsigned cols = hf->getNumColumns();
+    unsigned rows = hf->getNumRows();
+
+    osg::ref_ptr<osg::FloatArray> fromHeights, toHeights;
+    if ( from )
+        from->getGeoidHeights(key, cols, rows, fromHeights);
+    if ( to )
+        to->getGeoidHeights(key, cols, rows, toHeights);
+
+    applyGeoidHeights(
+        from, fromHeights.valid() ? &fromHeights->front() : 0L,
+        to,   toHeights.valid()   ? &toHeights->front()   : 0L,
+        hf);
+
+    return true;
+}
+
+bool
+VerticalDatum::getGeoidHeights(const TileKey&                 key,
+                               unsigned                       numCols,
+                               unsigned                       numRows,
+                               osg::ref_ptr<osg::FloatArray>& output) const
+{
+    if ( !_geoid.valid() || !key.valid() )
+        return false;
+
+    // the geoid never changes, so a tile's heights only depend on the key
+    // and the grid size.
+    std::string cacheKey = Stringify()
+        << key.str() << ":" << numCols << "x" << numRows
+        << ":" << key.getProfile()->getHorizSignature();
+
+    GeoidHeightsCache::Record record;
+    if ( _geoidHeights.get(cacheKey, record) )
+    {
+        output = record.value().get();
+        return true;
+    }
+
+    double west, south, xstep, ystep;
+    getGeodeticGrid(key.getExtent(), numCols, numRows, west, south, xstep, ystep);
+
+    output = new osg::FloatArray(numCols*numRows);
+    _geoid->getHeights(west, south, xstep, ystep, numCols, numRows, &output->front());
+
+    _geoidHeights.insert(cacheKey, output.get());
+    return true;
+}
+
+bool
+VerticalDatum::transformPerPost(const VerticalDatum* from,
+                                const VerticalDatum* to,
+                                const GeoExtent&     extent,
+                                osg::HeightField*    hf )
+{
+    if ( from == to )
+        return true;
+
     unsigned cols = hf->getNumColumns();
     unsigned rows = hf->getNumRows();
     
@@ -183,6 +347,13 @@ VerticalDatum::hae2msl( double lat_deg, double lon_deg, double hae ) const
     return _geoid.valid() ? hae - _geoid->getHeight(lat_deg, lon_deg, INTERP_BILINEAR) : hae;
 }
 
+bool
+VerticalDatum::usesGeoidHeights() const
+{
+    // a subclass might override msl2hae or hae2msl
+    return typeid(*this) == typeid(VerticalDatum);
+}
+
 bool 
 VerticalDatum::isEquivalentTo( const VerticalDatum* rhs ) const
 {
@@ -24,6 +24,7 @@
 #include <osgEarth/ShaderUtils>
 #include <osgEarth/StringUtils>
 #include <osgEarth/Containers>
+#include <osgEarth/Metrics>
 #include <osg/Shader>
 #include <osg/Program>
 #include <osg/State>
@@ -33,6 +34,7 @@
 #include <osg/GLExtensions>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <OpenThreads/Thread>
 
 #define LC "[VirtualProgram] "
@@ -79,6 +81,55 @@ namespace
         }
         return false;
     }
+
+    /** Hash of a program key (the addresses of its shaders). */
+    uint64_t hashProgramKey(const ProgramKey& key)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for(ProgramKey::const_iterator i = key.begin(); i != key.end(); ++i)
+        {
+            uint64_t ptr = (uint64_t)(size_t)(i->get());
+            for(unsigned b = 0; b < 8; ++b, ptr >>= 8)
+            {
+                hash ^= (ptr & 0xff);
+                hash *= 1099511628211ULL;
+            }
+        }
+        return hash ^ (uint64_t)key.size();
+    }
+
+    bool lessByHash(const VirtualProgram::ProgramSnapshot::Slot& lhs, const VirtualProgram::ProgramSnapshot::Slot& rhs)
+    {
+        return lhs._hash < rhs._hash;
+    }
+
+    /** Program cache statistics for all VPs, reported through Metrics once per frame. */
+    struct ProgramCacheStats
+    {
+        OpenThreads::Atomic _hits;       // found in the context's snapshot
+        OpenThreads::Atomic _lockedHits; // found in the cache after locking
+        OpenThreads::Atomic _builds;     // not found; built a new program
+        OpenThreads::Atomic _links;      // programs linked
+        OpenThreads::Atomic _frame;
+
+        void report(unsigned frameNumber)
+        {
+            if ( _frame.exchange(frameNumber) != frameNumber )
+            {
+                double hits    = (double)_hits.exchange(0);
+                double locked  = (double)_lockedHits.exchange(0);
+                double builds  = (double)_builds.exchange(0);
+                double lookups = hits + locked + builds;
+
+                Metrics::counter("VirtualProgram",
+                    "Cache hit rate", lookups > 0.0 ? 100.0*hits/lookups : 100.0,
+                    "Locked lookups", locked,
+                    "Builds", builds);
+                Metrics::counter("VirtualProgram", "Links", (double)_links.exchange(0));
+            }
+        }
+    };
+    ProgramCacheStats s_programCacheStats;
 }
 
 //------------------------------------------------------------------------
@@ -775,6 +826,8 @@ _isAbstract        ( false )
     _apply.resize(MAX_CONTEXTS);
 #endif
 
+    _contextSnapshots.resize(MAX_CONTEXTS);
+
 #ifdef USE_STACK_MEMORY
     _vpStackMemory._item.resize(MAX_CONTEXTS);
 #endif
@@ -805,6 +858,8 @@ _isAbstract        ( rhs._isAbstract )
     _apply.resize(MAX_CONTEXTS);
 #endif
 
+    _contextSnapshots.resize(MAX_CONTEXTS);
+
 #ifdef USE_STACK_MEMORY
     _vpStackMemory._item.resize(MAX_CONTEXTS);
 #endif
@@ -914,7 +969,7 @@ VirtualProgram::resizeGLObjectBuffers(unsigned maxSize)
 
     for (ProgramMap::iterator i = _programCache.begin(); i != _programCache.end(); ++i)
     {
-        i->second._program->resizeGLObjectBuffers(maxSize);
+        i->second->_program->resizeGLObjectBuffers(maxSize);
     }
 
     // Resize shaders in the PolyShader
@@ -942,10 +997,11 @@ VirtualProgram::releaseGLObjects(osg::State* state) const
     for (ProgramMap::const_iterator i = _programCache.begin(); i != _programCache.end(); ++i)
     {
         //if ( i->second->referenceCount() == 1 )
-            i->second._program->releaseGLObjects(state);
+            i->second->_program->releaseGLObjects(state);
     }
 
     _programCache.clear();
+    publishProgramCache();
 
     _programCacheMutex.unlock();
 }
@@ -1207,6 +1263,7 @@ VirtualProgram::setInheritShaders( bool value )
         {
             _programCacheMutex.lock();
             _programCache.clear();
+            publishProgramCache();
             _programCacheMutex.unlock();
         }
 
@@ -1282,6 +1339,11 @@ VirtualProgram::apply( osg::State& state ) const
     // exclude shaders based on any condition.
     bool acceptCallbacksVary = _acceptCallbacksVaryPerFrame;
 
+    // program cache statistics, only gathered when someone is listening.
+    bool collectStats = Metrics::enabled();
+    if ( collectStats && state.getFrameStamp() )
+        s_programCacheStats.report( state.getFrameStamp()->getFrameNumber() );
+
     if ( !program.valid() )
     {
 #ifdef PREALLOCATE_APPLY_VARS
@@ -1347,11 +1409,30 @@ VirtualProgram::apply( osg::State& state ) const
         // current frame number, for shader program expiry.
         unsigned frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0;
 
-        // look up the program:
+        // look up the program. Each context searches its own snapshot of the
+        // cache without locking, and only locks to pick up a new snapshot after
+        // the cache changes.
         {
-            _programCacheMutex.lock();
-            const_cast<VirtualProgram*>(this)->readProgramCache(local.programKey, frameNumber, program);
-            _programCacheMutex.unlock();
+            ContextSnapshot& cs = _contextSnapshots[contextID];
+            if ( cs._version != (unsigned)_programCacheVersion )
+            {
+                Threading::ScopedMutexLock lock(_programCacheMutex);
+                cs._snapshot = _programSnapshot.get();
+                cs._version  = _programCacheVersion;
+            }
+
+            ProgramEntry* entry = cs._snapshot.valid() ? cs._snapshot->find(hashProgramKey(local.programKey), local.programKey) : 0L;
+            if ( entry )
+            {
+                // only write when it changes, so draw threads sharing this
+                // entry don't fight over it every apply.
+                if ( (unsigned)entry->_frameLastUsed != frameNumber )
+                    entry->_frameLastUsed.exchange(frameNumber);
+                program = entry->_program.get();
+
+                if ( collectStats )
+                    ++s_programCacheStats._hits;
+            }
         }
 
         // if not found, lock and build it:
@@ -1368,8 +1449,16 @@ VirtualProgram::apply( osg::State& state ) const
 
                 // double-check: look again to negate race conditions
                 const_cast<VirtualProgram*>(this)->readProgramCache(local.programKey, frameNumber, program);
-                if ( !program.valid() )
+                if ( program.valid() )
+                {
+                    if ( collectStats )
+                        ++s_programCacheStats._lockedHits;
+                }
+                else
                 {
+                    if ( collectStats )
+                        ++s_programCacheStats._builds;
+
                     local.programKey.clear();
 
                     //OE_NOTICE << LC << "Building new Program for VP " << getName() << std::endl;
@@ -1417,12 +1506,17 @@ VirtualProgram::apply( osg::State& state ) const
                     Registry::programSharedRepo()->share( program );
 
                     // finally, put own new program in the cache.
-                    ProgramEntry& pe = _programCache[local.programKey];
-                    pe._program = program.get();
-                    pe._frameLastUsed = frameNumber;
+                    ProgramEntry* pe = new ProgramEntry();
+                    pe->_program = program.get();
+                    pe->_frameLastUsed.exchange(frameNumber);
+                    pe->_hash = hashProgramKey(local.programKey);
+                    _programCache[local.programKey] = pe;
 
                     // purge expired programs.
                     const_cast<VirtualProgram*>(this)->removeExpiredProgramsFromCache(state, frameNumber);
+
+                    // let the draw threads see the new program.
+                    publishProgramCache();
                 }
             }
         }
@@ -1484,8 +1578,13 @@ VirtualProgram::apply( osg::State& state ) const
         if ( useProgram )
         {
             if( pcp->needsLink() )
+            {
                 program->compileGLObjects( state );
 
+                if ( collectStats )
+                    ++s_programCacheStats._links;
+            }
+
             if( pcp->isLinked() )
             {
                 if( osg::isNotifyEnabled(osg::INFO) )
@@ -1523,11 +1622,11 @@ VirtualProgram::removeExpiredProgramsFromCache(osg::State& state, unsigned frame
         // ASSUME a mutex lock on the cache.
         for(ProgramMap::iterator k=_programCache.begin(); k!=_programCache.end(); )
         {
-            if ( frameNumber - k->second._frameLastUsed > 2 )
+            if ( frameNumber - (unsigned)k->second->_frameLastUsed > 2 )
             {
-                if ( k->second._program->referenceCount() == 1 )
+                if ( k->second->_program->referenceCount() == 1 )
                 {
-                    k->second._program->releaseGLObjects(&state);
+                    k->second->_program->releaseGLObjects(&state);
                 }
                 k = _programCache.erase(k);
             }
@@ -1547,12 +1646,48 @@ VirtualProgram::readProgramCache(const ProgramKey& vec, unsigned frameNumber, os
     if ( p != _programCache.end() )
     {
         // update as current..
-        p->second._frameLastUsed = frameNumber;
-        program = p->second._program.get();
+        p->second->_frameLastUsed.exchange(frameNumber);
+        program = p->second->_program.get();
     }
     return program.valid();
 }
 
+void
+VirtualProgram::publishProgramCache() const
+{
+    osg::ref_ptr<ProgramSnapshot> snapshot = new ProgramSnapshot();
+    snapshot->_slots.resize( _programCache.size() );
+    unsigned n = 0u;
+    for(ProgramMap::const_iterator i = _programCache.begin(); i != _programCache.end(); ++i, ++n)
+    {
+        ProgramSnapshot::Slot& slot = snapshot->_slots[n];
+        slot._hash  = i->second->_hash;
+        slot._key   = i->first;
+        slot._entry = i->second.get();
+    }
+    std::sort( snapshot->_slots.begin(), snapshot->_slots.end(), lessByHash );
+
+    _programSnapshot = snapshot.get();
+    ++_programCacheVersion;
+}
+
+VirtualProgram::ProgramEntry*
+VirtualProgram::ProgramSnapshot::find(uint64_t hash, const ProgramKey& key) const
+{
+    Slot probe;
+    probe._hash = hash;
+
+    // the hash only narrows the search; different keys can share one.
+    for(std::vector<Slot>::const_iterator i = std::lower_bound(_slots.begin(), _slots.end(), probe, lessByHash);
+        i != _slots.end() && i->_hash == hash;
+        ++i)
+    {
+        if ( i->_key == key )
+            return i->_entry.get();
+    }
+    return 0L;
+}
+
 
 bool
 VirtualProgram::checkSharing()
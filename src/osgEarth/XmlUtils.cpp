@@ -416,6 +416,102 @@ namespace
         //Now, replace the <!DOCTYPE> element with whitespace
         xmlStr.erase(startIndex, endIndex - startIndex + 1);
     }
+
+    bool
+    parseDocument(std::istream& in, const URIContext& uriContext, TiXmlDocument& xmlDoc)
+    {
+        //Read the entire document into a string
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        std::string xmlStr;
+        xmlStr = buffer.str();
+
+        removeDocType( xmlStr );
+        //OE_NOTICE << xmlStr;
+
+        xmlDoc.Parse(xmlStr.c_str());    
+
+        if ( xmlDoc.Error() )
+        {
+            std::stringstream buf;
+            buf << xmlDoc.ErrorDesc() << " (row " << xmlDoc.ErrorRow() << ", col " << xmlDoc.ErrorCol() << ")";
+            std::string str;
+            str = buf.str();
+            OE_WARN << "Error in XML document: " << str << std::endl;
+            if ( !uriContext.referrer().empty() )
+                OE_WARN << uriContext.referrer() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Arena version of processNode + XmlElement::getConfig: attributes first
+    // (in name order), then child elements, then the element's trimmed text
+    // as its value. Returns the new node.
+    unsigned processNode(ConfigArena& arena, unsigned parent, const TiXmlElement* element, const std::string* referrer =0L)
+    {
+        std::string tag = osgEarth::toLower(element->Value());
+
+        if ( tag == "xi:include" )
+        {
+            const char* hrefAttr = element->Attribute("href");
+            std::string href = hrefAttr ? hrefAttr : "";
+            if ( href.empty() )
+            {
+                OE_WARN << "Missing href with xi:include" << std::endl;
+                return arena.add( parent, std::string() );
+            }
+
+            URIContext uriContext( arena.view(parent).referrer() );
+            URI uri(href, uriContext);
+            std::string fullURI = uri.full();
+            OE_INFO << "Loading href from " << fullURI << std::endl;
+
+            ReadResult r = uri.readString();
+            if ( r.succeeded() )
+            {
+                std::stringstream buf( r.getString() );
+                TiXmlDocument includeDoc;
+                if ( parseDocument(buf, URIContext(fullURI), includeDoc) && includeDoc.RootElement() )
+                {
+                    unsigned node = processNode( arena, parent, includeDoc.RootElement(), &fullURI );
+                    arena.setExternalRef( node, href );
+                    return node;
+                }
+            }
+
+            OE_WARN << "Failed to load xi:include from " << fullURI << std::endl;
+            return arena.add( parent, std::string() );
+        }
+
+        unsigned node = arena.add( parent, tag );
+        if ( referrer )
+            arena.setReferrer( node, *referrer );
+
+        XmlAttributes attrs;
+        for( const TiXmlAttribute* attr = element->FirstAttribute(); attr; attr = attr->Next() )
+        {
+            attrs[osgEarth::toLower(attr->Name())] = attr->Value();
+        }
+        for( XmlAttributes::const_iterator a = attrs.begin(); a != attrs.end(); ++a )
+        {
+            unsigned child = arena.add( node, a->first );
+            arena.setValue( child, a->second );
+        }
+
+        std::string text;
+        for( const TiXmlNode* child = element->FirstChild(); child; child = child->NextSibling() )
+        {
+            if ( child->Type() == TiXmlNode::TINYXML_ELEMENT )
+                processNode( arena, node, child->ToElement() );
+            else if ( child->Type() == TiXmlNode::TINYXML_TEXT )
+                text += child->Value();
+        }
+        if ( !text.empty() )
+            arena.setValue( node, trim(text) );
+
+        return node;
+    }
 }
 
 
@@ -450,30 +546,9 @@ XmlDocument::load( std::istream& in, const URIContext& uriContext )
 {
     TiXmlDocument xmlDoc;
 
-    //Read the entire document into a string
-    std::stringstream buffer;
-    buffer << in.rdbuf();
-    std::string xmlStr;
-    xmlStr = buffer.str();
-
-    removeDocType( xmlStr );
-    //OE_NOTICE << xmlStr;
-
     XmlDocument* doc = NULL;
-    xmlDoc.Parse(xmlStr.c_str());    
-
-    if ( xmlDoc.Error() )
-    {
-        std::stringstream buf;
-        buf << xmlDoc.ErrorDesc() << " (row " << xmlDoc.ErrorRow() << ", col " << xmlDoc.ErrorCol() << ")";
-        std::string str;
-        str = buf.str();
-        OE_WARN << "Error in XML document: " << str << std::endl;
-        if ( !uriContext.referrer().empty() )
-            OE_WARN << uriContext.referrer() << std::endl;
-    }
 
-    if ( !xmlDoc.Error() && xmlDoc.RootElement() )
+    if ( parseDocument(in, uriContext, xmlDoc) && xmlDoc.RootElement() )
     {
         doc = new XmlDocument();
         processNode( doc,  xmlDoc.RootElement() );
@@ -482,6 +557,35 @@ XmlDocument::load( std::istream& in, const URIContext& uriContext )
     return doc;    
 }
 
+ConfigArena*
+XmlDocument::loadConfig( const URI& uri, const osgDB::Options* dbOptions )
+{
+    ReadResult r = uri.readString( dbOptions );
+    if ( r.succeeded() )
+    {
+        std::stringstream buf( r.getString() );
+        URIContext context( uri.full() );
+        return loadConfig( buf, context );
+    }
+
+    return 0L;
+}
+
+ConfigArena*
+XmlDocument::loadConfig( std::istream& in, const URIContext& uriContext )
+{
+    TiXmlDocument xmlDoc;
+
+    if ( !parseDocument(in, uriContext, xmlDoc) || !xmlDoc.RootElement() )
+        return 0L;
+
+    osg::ref_ptr<ConfigArena> arena = new ConfigArena();
+    unsigned root = arena->addRoot( "Document" );
+    arena->setReferrer( root, URI("", uriContext).full() );
+    processNode( *arena.get(), root, xmlDoc.RootElement() );
+    return arena.release();
+}
+
 Config
 XmlDocument::getConfig() const
 {
@@ -58,7 +58,9 @@ AnnotationNode(),
 _options           ( options ),
 _needsRebuild      ( true ),
 _styleSheet        ( styleSheet ),
-_clampDirty        (false)
+_clampDirty        (false),
+_clampAll          (false),
+_clampToElevationPool(false)
 {
     _features.push_back( feature );
 
@@ -79,7 +81,9 @@ AnnotationNode(),
 _options        ( options ),
 _needsRebuild   ( true ),
 _styleSheet     ( styleSheet ),
-_clampDirty     ( false )
+_clampDirty     ( false ),
+_clampAll       ( false ),
+_clampToElevationPool( false )
 {
     _features.insert( _features.end(), features.begin(), features.end() );
     setStyle( style );
@@ -94,7 +98,9 @@ AnnotationNode(),
 _options           ( options ),
 _needsRebuild      ( true ),
 _styleSheet        ( styleSheet ),
-_clampDirty        (false)
+_clampDirty        (false),
+_clampAll          (false),
+_clampToElevationPool(false)
 {
     _features.push_back( feature );
 
@@ -118,7 +124,9 @@ AnnotationNode(),
 _options        ( options ),
 _needsRebuild   ( true ),
 _styleSheet     ( styleSheet ),
-_clampDirty     ( false )
+_clampDirty     ( false ),
+_clampAll       ( false ),
+_clampToElevationPool( false )
 {
     _features.insert( _features.end(), features.begin(), features.end() );
     FeatureNode::setMapNode( mapNode );
@@ -133,6 +141,9 @@ FeatureNode::build()
 
     _attachPoint = 0L;
 
+    // the geometry is about to change, so the vertex index is stale.
+    _clampIndex = 0L;
+
     // if there is existing geometry, kill it
     this->removeChildren( 0, this->getNumChildren() );
 
@@ -333,51 +344,80 @@ FeatureNode::onTileAdded(const TileKey&          key,
                          osg::Node*              graph,
                          TerrainCallbackContext& context)
 {
-    if (!_clampDirty)
+    if (key.valid())
     {
-        bool needsClamp;
+        osg::Polytope tope;
+        key.getExtent().createPolytope(tope);
+        if (!tope.contains(this->getBound()))
+            return;
 
-        if (key.valid())
-        {
-            osg::Polytope tope;
-            key.getExtent().createPolytope(tope);
-            needsClamp = tope.contains(this->getBound());
-        }
-        else
-        {
-            // without a valid tilekey we don't know the extent of the change,
-            // so clamping is required.
-            needsClamp = true;
-        }
+        // remember the tile so the update traversal can re-clamp just
+        // the vertices that fall inside it.
+        if (!_clampAll)
+            _pendingTiles.push_back(std::make_pair(key, osg::observer_ptr<osg::Node>(graph)));
+    }
+    else
+    {
+        // without a valid tilekey we don't know the extent of the change,
+        // so clamping everything is required.
+        _clampAll = true;
+        _pendingTiles.clear();
+    }
 
-        if (needsClamp)
-        {
-            _clampDirty = true;
-            ADJUST_UPDATE_TRAV_COUNT(this, +1);
-            //clamp(graph, context.getTerrain());
-        }
+    if (!_clampDirty)
+    {
+        _clampDirty = true;
+        ADJUST_UPDATE_TRAV_COUNT(this, +1);
     }
 }
 
+bool
+FeatureNode::setupClamper(GeometryClamper& clamper, const Terrain* terrain) const
+{
+    if ( !terrain )
+        return false;
+
+    const AltitudeSymbol* alt = getStyle().get<AltitudeSymbol>();
+    if (alt && alt->technique() != alt->TECHNIQUE_SCENE)
+        return false;
+
+    bool relative = alt && alt->clamping() == alt->CLAMP_RELATIVE_TO_TERRAIN && alt->technique() == alt->TECHNIQUE_SCENE;
+    float offset = alt ? alt->verticalOffset()->eval() : 0.0f;
+
+    clamper.setTerrainSRS( terrain->getSRS() );
+    clamper.setPreserveZ( relative );
+    clamper.setOffset( offset );
+    return true;
+}
+
 void
 FeatureNode::clamp(osg::Node* graph, const Terrain* terrain)
 {
-    if ( terrain && graph )
+    GeometryClamper clamper;
+    if ( graph && setupClamper(clamper, terrain) )
     {
-        const AltitudeSymbol* alt = getStyle().get<AltitudeSymbol>();
-        if (alt && alt->technique() != alt->TECHNIQUE_SCENE)
-            return;
-
-        bool relative = alt && alt->clamping() == alt->CLAMP_RELATIVE_TO_TERRAIN && alt->technique() == alt->TECHNIQUE_SCENE;
-        float offset = alt ? alt->verticalOffset()->eval() : 0.0f;
-
-        GeometryClamper clamper;
         clamper.setTerrainPatch( graph );
-        clamper.setTerrainSRS( terrain->getSRS() );
-        clamper.setPreserveZ( relative );
-        clamper.setOffset( offset );
 
         this->accept( clamper );
+
+        // index the clamped vertices by tile for the incremental updates:
+        if ( getMapNode() )
+            _clampIndex = clamper.buildIndex( this, getMapNode()->getMap()->getProfile() );
+    }
+}
+
+void
+FeatureNode::clampTile(const TileKey& key, osg::Node* tile, const Terrain* terrain)
+{
+    GeometryClamper clamper;
+    if ( setupClamper(clamper, terrain) )
+    {
+        // Intersect the tile's own geometry, like the full clamp does, unless
+        // asked to sample the elevation data the pool already holds.
+        if ( _clampToElevationPool && getMapNode() )
+            clamper.setElevationPool( getMapNode()->getMap()->getElevationPool() );
+
+        clamper.clamp( _clampIndex.get(), key, tile );
     }
 }
 
@@ -390,7 +430,24 @@ FeatureNode::traverse(osg::NodeVisitor& nv)
         {
             osg::ref_ptr<Terrain> terrain = getMapNode()->getTerrain();
             if (terrain.valid())
-                clamp(terrain->getGraph(), terrain.get());
+            {
+                if (_clampAll || !_clampIndex.valid())
+                {
+                    clamp(terrain->getGraph(), terrain.get());
+                }
+                else
+                {
+                    for (PendingTiles::iterator i = _pendingTiles.begin(); i != _pendingTiles.end(); ++i)
+                    {
+                        osg::ref_ptr<osg::Node> tile;
+                        i->second.lock(tile);
+                        clampTile(i->first, tile.get(), terrain.get());
+                    }
+                }
+            }
+
+            _pendingTiles.clear();
+            _clampAll = false;
 
             ADJUST_UPDATE_TRAV_COUNT(this, -1);
             _clampDirty = false;
@@ -409,7 +466,9 @@ FeatureNode::FeatureNode(MapNode*              mapNode,
                          const Config&         conf,
                          const osgDB::Options* dbOptions ) :
 AnnotationNode(conf),
-_clampDirty(false)
+_clampDirty(false),
+_clampAll(false),
+_clampToElevationPool(false)
 {
     osg::ref_ptr<Geometry> geom;
     if ( conf.hasChild("geometry") )
@@ -0,0 +1,904 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthAnnotation/TrackLayer>
+#include <osgEarth/Map>
+#include <osgEarth/Registry>
+#include <osgEarth/Horizon>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/VirtualProgram>
+#include <osgEarth/Lighting>
+#include <osgUtil/CullVisitor>
+#include <osgText/String>
+#include <osg/TextureBuffer>
+#include <osg/BlendFunc>
+#include <osg/Depth>
+#include <cmath>
+#include <cfloat>
+
+#define LC "[TrackLayer] "
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+using namespace osgEarth::Symbology;
+
+REGISTER_OSGEARTH_LAYER(tracks, TrackLayer);
+
+// Texture image units. The layer draws outside the terrain, so it
+// doesn't need to reserve them.
+#define TRACKS_UNIT  1
+#define GLYPHS_UNIT  2
+#define ICONS_UNIT   3
+#define ATLAS_UNIT   4
+
+// Icons are resampled to this size so they fit in one texture array
+#define ICON_RESOLUTION  64
+
+// Glyphs are rasterized at this size into an atlas of this size
+#define GLYPH_RESOLUTION 32
+#define ATLAS_SIZE       1024
+
+// Visible tracks may extend this far outside the view (in NDC) and still draw
+#define CULL_MARGIN 1.1
+
+namespace
+{
+    // Shared by the icon and label shaders: corner of the quad for each of
+    // the 6 vertices (LL, LR, UL, UL, LR, UR), and the conversion of a
+    // pixel offset to a view space offset at the anchor's depth.
+    const char* quadFunctions =
+        "const vec2 oe_tracks_corners[6] = vec2[6]( \n"
+        "    vec2(0,0), vec2(1,0), vec2(0,1), \n"
+        "    vec2(0,1), vec2(1,0), vec2(1,1) ); \n"
+
+        "uniform vec2 oe_ViewportSize; \n"
+
+        "vec2 oe_tracks_pixelsToView(in vec2 pixels, in vec4 anchorView) \n"
+        "{ \n"
+        "    float w = (gl_ProjectionMatrix * anchorView).w; \n"
+        "    return pixels * 2.0 * w / (oe_ViewportSize * vec2(gl_ProjectionMatrix[0][0], gl_ProjectionMatrix[1][1])); \n"
+        "} \n";
+
+    // One icon per instance, rotated to the track's heading. Track texels:
+    // [view position, icon index], [cos, sin of the screen rotation].
+    const char* iconVS =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform samplerBuffer oe_tracks_data; \n"
+        "uniform float oe_tracks_iconSize; \n"
+        "out vec3 oe_tracks_iconCoord; \n"
+
+        "%QUAD_FUNCTIONS%"
+
+        "void oe_tracks_icon_vertex(inout vec4 vertexView) \n"
+        "{ \n"
+        "    vec4 posIcon  = texelFetch(oe_tracks_data, gl_InstanceID*2); \n"
+        "    vec4 rotation = texelFetch(oe_tracks_data, gl_InstanceID*2+1); \n"
+        "    vec2 corner = oe_tracks_corners[gl_VertexID]; \n"
+        "    vec2 offset = posIcon.w >= 0.0 ? (corner-0.5)*oe_tracks_iconSize : vec2(0.0); \n"
+        "    offset = vec2( \n"
+        "        offset.x*rotation.x - offset.y*rotation.y, \n"
+        "        offset.x*rotation.y + offset.y*rotation.x ); \n"
+        "    vertexView = vec4(posIcon.xyz, 1.0); \n"
+        "    vertexView.xy += oe_tracks_pixelsToView(offset, vertexView); \n"
+        "    oe_tracks_iconCoord = vec3(corner, posIcon.w); \n"
+        "} \n";
+
+    const char* iconFS =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform sampler2DArray oe_tracks_icons; \n"
+        "in vec3 oe_tracks_iconCoord; \n"
+
+        "void oe_tracks_icon_fragment(inout vec4 color) \n"
+        "{ \n"
+        "    color = texture(oe_tracks_icons, oe_tracks_iconCoord); \n"
+        "} \n";
+
+    // One glyph per instance. Glyph texels: [pixel offset x, y, track index,
+    // scale], [atlas rectangle], [color].
+    const char* labelVS =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform samplerBuffer oe_tracks_data; \n"
+        "uniform samplerBuffer oe_tracks_glyphs; \n"
+        "uniform sampler2D oe_tracks_atlas; \n"
+        "out vec2 oe_tracks_glyphCoord; \n"
+        "flat out vec4 oe_tracks_glyphColor; \n"
+
+        "%QUAD_FUNCTIONS%"
+
+        "void oe_tracks_label_vertex(inout vec4 vertexView) \n"
+        "{ \n"
+        "    vec4 offset = texelFetch(oe_tracks_glyphs, gl_InstanceID*3); \n"
+        "    vec4 uv     = texelFetch(oe_tracks_glyphs, gl_InstanceID*3+1); \n"
+        "    oe_tracks_glyphColor = texelFetch(oe_tracks_glyphs, gl_InstanceID*3+2); \n"
+        "    vec4 pos = texelFetch(oe_tracks_data, int(offset.z)*2); \n"
+        "    vec2 corner = oe_tracks_corners[gl_VertexID]; \n"
+        "    vec2 size = (uv.zw - uv.xy) * vec2(textureSize(oe_tracks_atlas, 0)) * offset.w; \n"
+        "    vertexView = vec4(pos.xyz, 1.0); \n"
+        "    vertexView.xy += oe_tracks_pixelsToView(offset.xy + corner*size, vertexView); \n"
+        "    oe_tracks_glyphCoord = mix(uv.xy, uv.zw, corner); \n"
+        "} \n";
+
+    const char* labelFS =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform sampler2D oe_tracks_atlas; \n"
+        "in vec2 oe_tracks_glyphCoord; \n"
+        "flat in vec4 oe_tracks_glyphColor; \n"
+
+        "void oe_tracks_label_fragment(inout vec4 color) \n"
+        "{ \n"
+        "    float coverage = texture(oe_tracks_atlas, oe_tracks_glyphCoord).a; \n"
+        "    color = vec4(oe_tracks_glyphColor.rgb, oe_tracks_glyphColor.a * coverage); \n"
+        "} \n";
+
+    std::string withQuadFunctions(const char* source)
+    {
+        std::string result(source);
+        replaceIn(result, "%QUAD_FUNCTIONS%", quadFunctions);
+        return result;
+    }
+
+    // Draws N camera-facing quads (6 vertices each) in one instanced call;
+    // the vertex shader builds everything from the texture buffers. The
+    // bound is the view-space box of the visible tracks, so near/far
+    // computation still works.
+    class InstancedQuads : public osg::Drawable
+    {
+    public:
+        META_Object(osgEarthAnnotation, InstancedQuads);
+
+        InstancedQuads() : _numInstances(0u)
+        {
+            setUseDisplayList(false);
+            setDataVariance(osg::Object::DYNAMIC);
+            setCullingActive(false);
+        }
+
+        InstancedQuads(const InstancedQuads& rhs, const osg::CopyOp& op) :
+            osg::Drawable(rhs, op), _numInstances(0u) { }
+
+        unsigned _numInstances;
+        osg::BoundingBox _viewBounds;
+
+        osg::BoundingBox computeBoundingBox() const
+        {
+            return _viewBounds;
+        }
+
+        void drawImplementation(osg::RenderInfo& ri) const
+        {
+            if (_numInstances == 0u)
+                return;
+
+            osg::State& state = *ri.getState();
+
+            // no vertex attributes; the shader generates everything.
+            state.lazyDisablingOfVertexAttributes();
+            state.applyDisablingOfVertexAttributes();
+
+            state.glDrawArraysInstanced(GL_TRIANGLES, 0, 6, _numInstances);
+        }
+    };
+
+    // Scene graph hook: culls and queues the layer's tracks for each camera.
+    class TrackLayerNode : public osg::Node
+    {
+    public:
+        TrackLayerNode(TrackLayer* layer) : _layer(layer)
+        {
+            setCullingActive(false);
+        }
+
+        void traverse(osg::NodeVisitor& nv)
+        {
+            if (nv.getVisitorType() == nv.CULL_VISITOR)
+            {
+                osg::ref_ptr<TrackLayer> layer;
+                if (_layer.lock(layer))
+                    layer->cull(static_cast<osgUtil::CullVisitor*>(&nv));
+            }
+        }
+
+    protected:
+        osg::observer_ptr<TrackLayer> _layer;
+    };
+
+    osg::TextureBuffer* createTextureBuffer(osg::Image* image)
+    {
+        osg::TextureBuffer* tbo = new osg::TextureBuffer();
+        tbo->setImage(image);
+        tbo->setInternalFormat(GL_RGBA32F_ARB);
+        tbo->setUnRefImageDataAfterApply(false);
+        return tbo;
+    }
+
+    // Grows a texture buffer image to hold at least the number of texels.
+    osg::Vec4f* reserveTexels(osg::Image* image, unsigned texels)
+    {
+        if ((unsigned)image->s() < texels || image->data() == 0L)
+        {
+            unsigned size = osg::maximum(1024u, (unsigned)image->s());
+            while (size < texels)
+                size *= 2u;
+            image->allocateImage(size, 1, 1, GL_RGBA, GL_FLOAT);
+            image->setInternalTextureFormat(GL_RGBA32F_ARB);
+        }
+        return reinterpret_cast<osg::Vec4f*>(image->data());
+    }
+}
+
+//........................................................................
+
+// Per-camera results of the cull pass; the camera's draw reads them.
+class TrackLayer::CameraData : public osg::Referenced
+{
+public:
+    CameraData(osg::StateSet* iconStateSet, osg::StateSet* labelStateSet)
+    {
+        _tracks = new osg::Image();
+        _glyphs = new osg::Image();
+        reserveTexels(_tracks.get(), 1u);
+        reserveTexels(_glyphs.get(), 1u);
+
+        _stateSet = new osg::StateSet();
+        _stateSet->setTextureAttribute(TRACKS_UNIT, createTextureBuffer(_tracks.get()));
+        _stateSet->setTextureAttribute(GLYPHS_UNIT, createTextureBuffer(_glyphs.get()));
+
+        _icons = new InstancedQuads();
+        _icons->setStateSet(iconStateSet);
+
+        _labels = new InstancedQuads();
+        _labels->setStateSet(labelStateSet);
+    }
+
+    osg::ref_ptr<osg::StateSet>   _stateSet;
+    osg::ref_ptr<osg::Image>      _tracks;
+    osg::ref_ptr<osg::Image>      _glyphs;
+    osg::ref_ptr<InstancedQuads>  _icons;
+    osg::ref_ptr<InstancedQuads>  _labels;
+
+    // scratch space for the cull passes, by slot
+    std::vector<float>    _vx, _vy, _vz;
+    std::vector<unsigned> _visible;
+};
+
+//........................................................................
+
+TrackLayer::TrackLayer() :
+VisibleLayer(&_optionsConcrete),
+_options(&_optionsConcrete)
+{
+    init();
+}
+
+TrackLayer::TrackLayer(const TrackLayerOptions& options) :
+VisibleLayer(&_optionsConcrete),
+_options(&_optionsConcrete),
+_optionsConcrete(options)
+{
+    init();
+}
+
+TrackLayer::~TrackLayer()
+{
+    //nop
+}
+
+void
+TrackLayer::init()
+{
+    VisibleLayer::init();
+
+    _mapSRS = SpatialReference::get("wgs84");
+    _identity = new osg::RefMatrix();
+    _numIcons = 0u;
+    _atlasX = 0;
+    _atlasY = 0;
+    _atlasRowHeight = 0;
+
+    // icons:
+    _iconTex = new osg::Texture2DArray();
+    _iconTex->setTextureSize(ICON_RESOLUTION, ICON_RESOLUTION, 0);
+    _iconTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+    _iconTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+    _iconTex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    _iconTex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+    _iconTex->setUnRefImageDataAfterApply(false);
+
+    _iconStateSet = new osg::StateSet();
+    VirtualProgram* iconVP = VirtualProgram::getOrCreate(_iconStateSet.get());
+    iconVP->setName("TrackLayer icons");
+    iconVP->setFunction("oe_tracks_icon_vertex", withQuadFunctions(iconVS), ShaderComp::LOCATION_VERTEX_VIEW);
+    iconVP->setFunction("oe_tracks_icon_fragment", iconFS, ShaderComp::LOCATION_FRAGMENT_COLORING);
+
+    // labels:
+    _atlas = new osg::Image();
+    _atlas->allocateImage(ATLAS_SIZE, ATLAS_SIZE, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    _atlas->setInternalTextureFormat(GL_RGBA8);
+    ::memset(_atlas->data(), 0, _atlas->getTotalSizeInBytes());
+
+    _atlasTex = new osg::Texture2D(_atlas.get());
+    _atlasTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+    _atlasTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+    _atlasTex->setResizeNonPowerOfTwoHint(false);
+    _atlasTex->setUnRefImageDataAfterApply(false);
+
+    _labelStateSet = new osg::StateSet();
+    VirtualProgram* labelVP = VirtualProgram::getOrCreate(_labelStateSet.get());
+    labelVP->setName("TrackLayer labels");
+    labelVP->setFunction("oe_tracks_label_vertex", withQuadFunctions(labelVS), ShaderComp::LOCATION_VERTEX_VIEW);
+    labelVP->setFunction("oe_tracks_label_fragment", labelFS, ShaderComp::LOCATION_FRAGMENT_COLORING);
+
+    _font = options().font().isSet() ?
+        osgText::readRefFontFile(options().font().get()) :
+        Registry::instance()->getDefaultFont();
+}
+
+void
+TrackLayer::addedToMap(const Map* map)
+{
+    if (map && map->getSRS())
+    {
+        _mapSRS = map->getSRS();
+
+        std::vector<unsigned> all(_ids.size());
+        for (unsigned i = 0; i < all.size(); ++i)
+            all[i] = i;
+        toWorld(all);
+    }
+}
+
+osg::Node*
+TrackLayer::getOrCreateNode()
+{
+    if (_node.valid() == false)
+    {
+        _node = new TrackLayerNode(this);
+
+        osg::StateSet* ss = _node->getOrCreateStateSet();
+        ss->setTextureAttribute(ICONS_UNIT, _iconTex.get());
+        ss->setTextureAttribute(ATLAS_UNIT, _atlasTex.get());
+        ss->addUniform(new osg::Uniform("oe_tracks_data", TRACKS_UNIT));
+        ss->addUniform(new osg::Uniform("oe_tracks_glyphs", GLYPHS_UNIT));
+        ss->addUniform(new osg::Uniform("oe_tracks_icons", ICONS_UNIT));
+        ss->addUniform(new osg::Uniform("oe_tracks_atlas", ATLAS_UNIT));
+        ss->addUniform(new osg::Uniform("oe_tracks_iconSize", options().iconSize().get()));
+
+        // same as TrackNode: always on top, no lighting, blended.
+        ss->setAttributeAndModes(new osg::Depth(osg::Depth::ALWAYS, 0, 1, false), 1);
+        ss->setAttributeAndModes(new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA), 1);
+        ss->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+        ss->setDefine(OE_LIGHTING_DEFINE, osg::StateAttribute::OFF);
+    }
+
+    return _node.get();
+}
+
+int
+TrackLayer::addIcon(const osg::Image* image)
+{
+    if (!image)
+        return -1;
+
+    osg::ref_ptr<osg::Image> rgba = ImageUtils::convertToRGBA8(image);
+    osg::ref_ptr<osg::Image> icon;
+    if (!rgba.valid() || !ImageUtils::resizeImage(rgba.get(), ICON_RESOLUTION, ICON_RESOLUTION, icon))
+    {
+        OE_WARN << LC << "Failed to add icon " << image->getFileName() << std::endl;
+        return -1;
+    }
+
+    int index = _numIcons++;
+    _iconTex->setTextureDepth(_numIcons);
+    _iconTex->setImage(index, icon.get());
+    _iconTex->dirtyTextureObject();
+    return index;
+}
+
+int
+TrackLayer::addField(const TextSymbol* symbol)
+{
+    Field field;
+    field._offset.set(0.0f, 0.0f);
+    field._size = 16.0f;
+    field._color.set(1.0f, 1.0f, 1.0f, 1.0f);
+
+    if (symbol)
+    {
+        if (symbol->pixelOffset().isSet())
+            field._offset.set(symbol->pixelOffset()->x(), symbol->pixelOffset()->y());
+        if (symbol->size().isSet())
+            field._size = symbol->size()->eval();
+        if (symbol->fill().isSet())
+            field._color = symbol->fill()->color();
+    }
+
+    _fields.push_back(field);
+    return _fields.size()-1;
+}
+
+unsigned
+TrackLayer::addTrack(int icon)
+{
+    unsigned id;
+    if (!_freeIDs.empty())
+    {
+        id = _freeIDs.back();
+        _freeIDs.pop_back();
+    }
+    else
+    {
+        id = _slots.size();
+        _slots.push_back(-1);
+    }
+
+    unsigned slot = _ids.size();
+    _slots[id] = slot;
+    _ids.push_back(id);
+
+    _lon.push_back(0.0);
+    _lat.push_back(0.0);
+    _alt.push_back(0.0);
+    _heading.push_back(0.0f);
+    _icon.push_back(icon < (int)_numIcons ? icon : -1);
+    _x.push_back(0.0);
+    _y.push_back(0.0);
+    _z.push_back(0.0);
+    _nx.push_back(0.0f);
+    _ny.push_back(0.0f);
+    _nz.push_back(1.0f);
+    _text.push_back(StringVector());
+    _labels.push_back(LabelGlyphs());
+
+    toWorld(std::vector<unsigned>(1, slot));
+
+    return id;
+}
+
+void
+TrackLayer::moveSlot(unsigned from, unsigned to)
+{
+    _ids[to] = _ids[from];
+    _slots[_ids[to]] = to;
+    _lon[to] = _lon[from];
+    _lat[to] = _lat[from];
+    _alt[to] = _alt[from];
+    _heading[to] = _heading[from];
+    _icon[to] = _icon[from];
+    _x[to] = _x[from];
+    _y[to] = _y[from];
+    _z[to] = _z[from];
+    _nx[to] = _nx[from];
+    _ny[to] = _ny[from];
+    _nz[to] = _nz[from];
+    _text[to].swap(_text[from]);
+    _labels[to].swap(_labels[from]);
+}
+
+void
+TrackLayer::removeTrack(unsigned track)
+{
+    if (track >= _slots.size() || _slots[track] < 0)
+        return;
+
+    // keep the arrays dense: move the last track into the hole.
+    unsigned slot = _slots[track];
+    unsigned last = _ids.size()-1;
+    if (slot != last)
+        moveSlot(last, slot);
+
+    _slots[track] = -1;
+    _freeIDs.push_back(track);
+
+    _ids.pop_back();
+    _lon.pop_back();
+    _lat.pop_back();
+    _alt.pop_back();
+    _heading.pop_back();
+    _icon.pop_back();
+    _x.pop_back();
+    _y.pop_back();
+    _z.pop_back();
+    _nx.pop_back();
+    _ny.pop_back();
+    _nz.pop_back();
+    _text.pop_back();
+    _labels.pop_back();
+}
+
+void
+TrackLayer::update(const Update* updates, unsigned count)
+{
+    std::vector<unsigned> slots;
+    slots.reserve(count);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const Update& u = updates[i];
+        if (u._track >= _slots.size() || _slots[u._track] < 0)
+            continue;
+
+        unsigned slot = _slots[u._track];
+        _lon[slot] = u._lon;
+        _lat[slot] = u._lat;
+        _alt[slot] = u._alt;
+        _heading[slot] = u._heading;
+        slots.push_back(slot);
+    }
+
+    toWorld(slots);
+}
+
+void
+TrackLayer::toWorld(const std::vector<unsigned>& slots)
+{
+    if (slots.empty())
+        return;
+
+    if (_mapSRS->isGeographic())
+    {
+        // Geodetic to ECEF, with the north vector, in one pass.
+        const osg::EllipsoidModel* em = _mapSRS->getEllipsoid();
+        const double a = em->getRadiusEquator();
+        const double b = em->getRadiusPolar();
+        const double e2 = 1.0 - (b*b)/(a*a);
+
+        for (unsigned i = 0; i < slots.size(); ++i)
+        {
+            unsigned s = slots[i];
+            double lat = osg::DegreesToRadians(_lat[s]);
+            double lon = osg::DegreesToRadians(_lon[s]);
+            double sinLat = sin(lat), cosLat = cos(lat);
+            double sinLon = sin(lon), cosLon = cos(lon);
+            double N = a / sqrt(1.0 - e2*sinLat*sinLat);
+            double h = _alt[s];
+
+            _x[s] = (N + h) * cosLat * cosLon;
+            _y[s] = (N + h) * cosLat * sinLon;
+            _z[s] = (N*(1.0-e2) + h) * sinLat;
+
+            _nx[s] = -sinLat * cosLon;
+            _ny[s] = -sinLat * sinLon;
+            _nz[s] = cosLat;
+        }
+    }
+    else
+    {
+        // Projected map: north is +Y.
+        std::vector<osg::Vec3d> points(slots.size());
+        for (unsigned i = 0; i < slots.size(); ++i)
+            points[i].set(_lon[slots[i]], _lat[slots[i]], _alt[slots[i]]);
+
+        _mapSRS->getGeographicSRS()->transform(points, _mapSRS.get());
+
+        for (unsigned i = 0; i < slots.size(); ++i)
+        {
+            unsigned s = slots[i];
+            _x[s] = points[i].x();
+            _y[s] = points[i].y();
+            _z[s] = points[i].z();
+            _nx[s] = 0.0f;
+            _ny[s] = 1.0f;
+            _nz[s] = 0.0f;
+        }
+    }
+}
+
+bool
+TrackLayer::getWorldPosition(unsigned track, osg::Vec3d& out) const
+{
+    if (track >= _slots.size() || _slots[track] < 0)
+        return false;
+
+    unsigned slot = _slots[track];
+    out.set(_x[slot], _y[slot], _z[slot]);
+    return true;
+}
+
+void
+TrackLayer::setIcon(unsigned track, int icon)
+{
+    if (track < _slots.size() && _slots[track] >= 0)
+    {
+        _icon[_slots[track]] = icon < (int)_numIcons ? icon : -1;
+    }
+}
+
+void
+TrackLayer::setFieldValue(unsigned track, int field, const std::string& value)
+{
+    if (track >= _slots.size() || _slots[track] < 0 || field < 0 || field >= (int)_fields.size())
+        return;
+
+    unsigned slot = _slots[track];
+    StringVector& text = _text[slot];
+    if (text.size() < _fields.size())
+        text.resize(_fields.size());
+
+    if (text[field] != value)
+    {
+        text[field] = value;
+        layout(slot);
+    }
+}
+
+void
+TrackLayer::layout(unsigned slot)
+{
+    LabelGlyphs& glyphs = _labels[slot];
+    glyphs.clear();
+
+    const StringVector& text = _text[slot];
+    for (unsigned f = 0; f < text.size(); ++f)
+    {
+        const Field& field = _fields[f];
+        float pen = field._offset.x();
+
+        osgText::String codes(text[f], osgText::String::ENCODING_UTF8);
+        for (unsigned c = 0; c < codes.size(); ++c)
+        {
+            const AtlasGlyph* ag = getAtlasGlyph(codes[c]);
+            if (!ag)
+                continue;
+
+            if (ag->_uv.z() > ag->_uv.x())
+            {
+                LabelGlyph g;
+                g._x = pen + ag->_bearing.x() * field._size;
+                g._y = field._offset.y() + ag->_bearing.y() * field._size;
+                g._scale = field._size / (float)GLYPH_RESOLUTION;
+                g._uv = ag->_uv;
+                g._color = field._color;
+                glyphs.push_back(g);
+            }
+
+            pen += ag->_advance * field._size;
+        }
+    }
+}
+
+const TrackLayer::AtlasGlyph*
+TrackLayer::getAtlasGlyph(unsigned code)
+{
+    std::map<unsigned, AtlasGlyph>::const_iterator i = _atlasGlyphs.find(code);
+    if (i != _atlasGlyphs.end())
+        return &i->second;
+
+    if (!_font.valid())
+        return 0L;
+
+    osgText::Glyph* glyph = _font->getGlyph(osgText::FontResolution(GLYPH_RESOLUTION, GLYPH_RESOLUTION), code);
+    if (!glyph)
+        return 0L;
+
+    AtlasGlyph& ag = _atlasGlyphs[code];
+    ag._bearing = glyph->getHorizontalBearing();
+    ag._advance = glyph->getHorizontalAdvance();
+    ag._uv.set(0, 0, 0, 0);
+
+    int w = glyph->s(), h = glyph->t();
+    if (w <= 0 || h <= 0 || glyph->data() == 0L)
+        return &ag; // whitespace
+
+    // shelf packing, with a pixel of padding so the glyphs don't bleed.
+    if (_atlasX + w + 1 > ATLAS_SIZE)
+    {
+        _atlasX = 0;
+        _atlasY += _atlasRowHeight + 1;
+        _atlasRowHeight = 0;
+    }
+    if (_atlasY + h + 1 > ATLAS_SIZE)
+    {
+        OE_WARN << LC << "Glyph atlas is full; some characters will not appear" << std::endl;
+        return &ag;
+    }
+
+    bool alphaOnly =
+        glyph->getPixelFormat() == GL_ALPHA ||
+        glyph->getPixelFormat() == GL_LUMINANCE_ALPHA;
+
+    ImageUtils::PixelReader read(glyph);
+    for (int t = 0; t < h; ++t)
+    {
+        GLubyte* ptr = _atlas->data(_atlasX, _atlasY + t);
+        for (int s = 0; s < w; ++s)
+        {
+            osg::Vec4f value = read(s, t);
+            float coverage = alphaOnly ? value.a() : value.r();
+            *ptr++ = 255;
+            *ptr++ = 255;
+            *ptr++ = 255;
+            *ptr++ = (GLubyte)(osg::clampBetween(coverage, 0.0f, 1.0f) * 255.0f);
+        }
+    }
+    _atlas->dirty();
+
+    ag._uv.set(
+        (float)_atlasX / (float)ATLAS_SIZE,
+        (float)_atlasY / (float)ATLAS_SIZE,
+        (float)(_atlasX + w) / (float)ATLAS_SIZE,
+        (float)(_atlasY + h) / (float)ATLAS_SIZE);
+
+    _atlasX += w + 1;
+    _atlasRowHeight = osg::maximum(_atlasRowHeight, h);
+
+    return &ag;
+}
+
+void
+TrackLayer::cull(osgUtil::CullVisitor* cv)
+{
+    const unsigned n = _ids.size();
+    if (n == 0u)
+        return;
+
+    const osg::Camera* camera = cv->getCurrentCamera();
+    CameraData* cd = _cameraData.get(camera);
+    if (!cd)
+        cd = _cameraData.getOrCreate(camera, new CameraData(_iconStateSet.get(), _labelStateSet.get()));
+
+    const osg::Matrixd& mv = *cv->getModelViewMatrix();
+    const osg::Matrixd& proj = *cv->getProjectionMatrix();
+
+    // Pass 1: world to view space, for every track.
+    cd->_vx.resize(n);
+    cd->_vy.resize(n);
+    cd->_vz.resize(n);
+    {
+        const double
+            m00 = mv(0,0), m01 = mv(0,1), m02 = mv(0,2),
+            m10 = mv(1,0), m11 = mv(1,1), m12 = mv(1,2),
+            m20 = mv(2,0), m21 = mv(2,1), m22 = mv(2,2),
+            m30 = mv(3,0), m31 = mv(3,1), m32 = mv(3,2);
+
+        const double* x = &_x[0];
+        const double* y = &_y[0];
+        const double* z = &_z[0];
+        float* vx = &cd->_vx[0];
+        float* vy = &cd->_vy[0];
+        float* vz = &cd->_vz[0];
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            vx[i] = (float)(x[i]*m00 + y[i]*m10 + z[i]*m20 + m30);
+            vy[i] = (float)(x[i]*m01 + y[i]*m11 + z[i]*m21 + m31);
+            vz[i] = (float)(x[i]*m02 + y[i]*m12 + z[i]*m22 + m32);
+        }
+    }
+
+    // Pass 2: range and frustum tests, collecting the survivors.
+    cd->_visible.clear();
+    {
+        const float
+            p00 = proj(0,0), p10 = proj(1,0), p20 = proj(2,0), p30 = proj(3,0),
+            p01 = proj(0,1), p11 = proj(1,1), p21 = proj(2,1), p31 = proj(3,1),
+            p03 = proj(0,3), p13 = proj(1,3), p23 = proj(2,3), p33 = proj(3,3);
+
+        const float maxRange2 = options().maxRange().isSet() ?
+            options().maxRange().get() * options().maxRange().get() : FLT_MAX;
+        const float margin = CULL_MARGIN;
+
+        const float* vx = &cd->_vx[0];
+        const float* vy = &cd->_vy[0];
+        const float* vz = &cd->_vz[0];
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            float cx = vx[i]*p00 + vy[i]*p10 + vz[i]*p20 + p30;
+            float cy = vx[i]*p01 + vy[i]*p11 + vz[i]*p21 + p31;
+            float cw = vx[i]*p03 + vy[i]*p13 + vz[i]*p23 + p33;
+            float range2 = vx[i]*vx[i] + vy[i]*vy[i] + vz[i]*vz[i];
+
+            bool visible =
+                cw > 0.0f &&
+                fabs(cx) <= cw*margin &&
+                fabs(cy) <= cw*margin &&
+                range2 <= maxRange2;
+
+            if (visible)
+                cd->_visible.push_back(i);
+        }
+    }
+
+    // Pass 3: horizon test on the survivors (geocentric maps only).
+    if (_mapSRS->isGeographic() && !cd->_visible.empty())
+    {
+        Horizon horizon(_mapSRS.get());
+        horizon.setEye(osg::Vec3d(cv->getEyePoint()));
+
+        unsigned kept = 0u;
+        for (unsigned i = 0; i < cd->_visible.size(); ++i)
+        {
+            unsigned s = cd->_visible[i];
+            if (horizon.isVisible(osg::Vec3d(_x[s], _y[s], _z[s])))
+                cd->_visible[kept++] = s;
+        }
+        cd->_visible.resize(kept);
+    }
+
+    const unsigned numVisible = cd->_visible.size();
+    if (numVisible == 0u)
+        return;
+
+    // Pass 4: pack the visible tracks and their label glyphs.
+    unsigned numGlyphs = 0u;
+    for (unsigned i = 0; i < numVisible; ++i)
+        numGlyphs += _labels[cd->_visible[i]].size();
+
+    osg::Vec4f* tracks = reserveTexels(cd->_tracks.get(), numVisible*2);
+    osg::Vec4f* glyphs = numGlyphs > 0u ? reserveTexels(cd->_glyphs.get(), numGlyphs*3) : 0L;
+
+    osg::BoundingBox bounds;
+    unsigned g = 0u;
+
+    for (unsigned i = 0; i < numVisible; ++i)
+    {
+        unsigned s = cd->_visible[i];
+        osg::Vec3f view(cd->_vx[s], cd->_vy[s], cd->_vz[s]);
+        bounds.expandBy(view);
+
+        // screen angle of north at the track, less the heading:
+        float nx = _nx[s]*mv(0,0) + _ny[s]*mv(1,0) + _nz[s]*mv(2,0);
+        float ny = _nx[s]*mv(0,1) + _ny[s]*mv(1,1) + _nz[s]*mv(2,1);
+        float angle = atan2(ny, nx) - osg::PI_2 - osg::DegreesToRadians(_heading[s]);
+
+        tracks[i*2].set(view.x(), view.y(), view.z(), (float)_icon[s]);
+        tracks[i*2+1].set(cos(angle), sin(angle), 0.0f, 0.0f);
+
+        const LabelGlyphs& label = _labels[s];
+        for (LabelGlyphs::const_iterator j = label.begin(); j != label.end(); ++j, ++g)
+        {
+            glyphs[g*3].set(j->_x, j->_y, (float)i, j->_scale);
+            glyphs[g*3+1] = j->_uv;
+            glyphs[g*3+2] = j->_color;
+        }
+    }
+
+    cd->_tracks->dirty();
+    if (numGlyphs > 0u)
+        cd->_glyphs->dirty();
+
+    cd->_icons->_numInstances = numVisible;
+    cd->_icons->_viewBounds = bounds;
+    cd->_icons->dirtyBound();
+
+    cd->_labels->_numInstances = numGlyphs;
+    cd->_labels->_viewBounds = bounds;
+    cd->_labels->dirtyBound();
+
+    // The positions are already in view space.
+    cv->pushStateSet(cd->_stateSet.get());
+    cv->pushModelViewMatrix(_identity.get(), osg::Transform::ABSOLUTE_RF);
+
+    cd->_icons->accept(*cv);
+    if (numGlyphs > 0u)
+        cd->_labels->accept(*cv);
+
+    cv->popModelViewMatrix();
+    cv->popStateSet();
+}
@@ -28,6 +28,9 @@
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Containers>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -44,6 +47,15 @@
 
 #define LC "[AGGLite] "
 
+// Smallest band of image rows worth rasterizing on another thread
+#define MIN_ROWS_PER_BAND 64u
+
+// Largest metatile, in quadtree levels (16x16 tiles)
+#define MAX_METATILE_LEVELS 4u
+
+// Rendered metatiles to keep while waiting for their tiles to be requested
+#define MAX_CACHED_METATILES 8u
+
 using namespace osgEarth;
 using namespace osgEarth::Features;
 using namespace osgEarth::Symbology;
@@ -109,29 +121,193 @@ public:
     struct RenderFrame {
         double xmin, ymin;
         double xf, yf;
+        double row;     // first image row of the band being rendered
     };
 
+    // A cropped geometry, ready to rasterize
+    struct RenderItem {
+        osg::ref_ptr<Geometry> geometry;
+        osg::Vec4f color;
+        float      value;
+        bool       coverage;
+        double     ymin, ymax;   // image rows it touches
+    };
+    typedef std::vector<RenderItem> RenderItems;
+
+    // Rasterizes all the items into a band of image rows. Bands don't
+    // share any pixels, so they can render at the same time, each with
+    // its own rasterizer.
+    struct RasterizeJob : public ParallelRange::Job
+    {
+        AGGLiteRasterizerTileSource* source;
+        const RenderItems*           items;
+        RenderFrame                  frame;
+        osg::Image*                  image;
+        double                       gamma;
+
+        void run(unsigned begin, unsigned end, unsigned chunk)
+        {
+            agg::rendering_buffer rbuf( image->data(0, begin), image->s(), end-begin, image->s()*4 );
+
+            agg::rasterizer ras;
+            ras.gamma(gamma);
+            ras.filling_rule(agg::fill_even_odd);
+
+            RenderFrame band = frame;
+            band.row = (double)begin;
+
+            for(RenderItems::const_iterator i = items->begin(); i != items->end(); ++i)
+            {
+                if ( i->ymax < (double)begin || i->ymin > (double)end )
+                    continue;
+
+                if ( i->coverage )
+                    source->rasterizeCoverage(i->geometry.get(), i->value, band, ras, rbuf);
+                else
+                    source->rasterize(i->geometry.get(), i->color, band, ras, rbuf);
+            }
+        }
+    };
+
+    // An NxN block of tiles rendered in one pass
+    struct Metatile : public osg::Referenced
+    {
+        Metatile() : numServed(0u) { }
+        osg::ref_ptr<osg::Image> image;
+        Threading::Event         ready;
+        unsigned                 numServed;
+    };
+    typedef LRUCache<TileKey, osg::ref_ptr<Metatile> > MetatileCache;
+
 public:
     AGGLiteRasterizerTileSource( const TileSourceOptions& options ) : FeatureTileSource( options ),
-        _options( options )
+        _options( options ),
+        _metatileLevels( 0u ),
+        _metatiles( MAX_CACHED_METATILES )
     {
-        //nop
+        for(unsigned n = _options.metatileSize().get(); n > 1u && _metatileLevels < MAX_METATILE_LEVELS; n >>= 1)
+            ++_metatileLevels;
     }
 
     //override
     osg::Image* allocateImage()
     {
-        osg::Image* image = 0L;
+        return createEmptyImage( getPixelsPerTile() );
+    }
+
+    osg::Image* createEmptyImage(unsigned size)
+    {
+        osg::Image* image = new osg::Image();
         if ( _options.coverage() == true )
         {
-            image = new osg::Image();
-            image->allocateImage(getPixelsPerTile(), getPixelsPerTile(), 1, GL_LUMINANCE, GL_FLOAT);
+            image->allocateImage(size, size, 1, GL_LUMINANCE, GL_FLOAT);
             image->setInternalTextureFormat(GL_LUMINANCE32F_ARB);
             ImageUtils::markAsUnNormalized(image, true);
         }
+        else
+        {
+            image->allocateImage(size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        }
         return image;
     }
 
+    //override
+    osg::Image* createImage(const TileKey& key, ProgressCallback* progress)
+    {
+        // Tiled sources already deliver features cut to each tile, so there's
+        // nothing to share between neighbors.
+        if ( _metatileLevels == 0u ||
+             key.getLOD() == 0u ||
+             !getFeatureSource() ||
+             !getFeatureSource()->getFeatureProfile() ||
+             getFeatureSource()->getFeatureProfile()->getTiled() )
+        {
+            return FeatureTileSource::createImage( key, progress );
+        }
+
+        // The metatile is an ancestor of the key, so its extent is exactly the
+        // union of the NxN tiles under it.
+        unsigned levels = osg::minimum( _metatileLevels, key.getLOD() );
+        unsigned numTiles = 1u << levels;
+        TileKey metaKey = key.createAncestorKey( key.getLOD() - levels );
+
+        // Find the metatile, or claim the job of rendering it:
+        osg::ref_ptr<Metatile> metatile;
+        bool render = false;
+        {
+            Threading::ScopedMutexLock lock( _metatilesMutex );
+            MetatileCache::Record record;
+            if ( _metatiles.get(metaKey, record) )
+            {
+                metatile = record.value();
+            }
+            else
+            {
+                metatile = new Metatile();
+                _metatiles.insert( metaKey, metatile.get() );
+                render = true;
+            }
+        }
+
+        if ( render )
+        {
+            osg::ref_ptr<osg::Image> image = createEmptyImage( getPixelsPerTile() * numTiles );
+            bool ok = renderImage( metaKey, image.get(), progress );
+
+            // don't keep a partial render around:
+            if ( ok && !(progress && progress->isCanceled()) )
+                metatile->image = image.get();
+            else
+                releaseMetatile( metaKey, metatile.get() );
+
+            metatile->ready.set();
+        }
+        else
+        {
+            metatile->ready.wait();
+        }
+
+        if ( !metatile->image.valid() )
+        {
+            return FeatureTileSource::createImage( key, progress );
+        }
+
+        // Cut this tile out of the metatile. Tile rows run north to south,
+        // image rows south to north.
+        unsigned size = getPixelsPerTile();
+        unsigned col = key.getTileX() - (metaKey.getTileX() << levels);
+        unsigned row = numTiles - 1u - (key.getTileY() - (metaKey.getTileY() << levels));
+
+        osg::ref_ptr<osg::Image> image = createEmptyImage( size );
+        unsigned rowBytes = size * (image->getPixelSizeInBits() / 8u);
+        for(unsigned t = 0; t < size; ++t)
+        {
+            memcpy( image->data(0, t), metatile->image->data(col*size, row*size + t), rowBytes );
+        }
+
+        // After the last of its tiles goes out the metatile is no longer needed.
+        bool done = false;
+        {
+            Threading::ScopedMutexLock lock( _metatilesMutex );
+            done = (++metatile->numServed == numTiles*numTiles);
+        }
+        if ( done )
+        {
+            releaseMetatile( metaKey, metatile.get() );
+        }
+
+        return image.release();
+    }
+
+    // Removes a metatile from the cache, unless it has already been replaced.
+    void releaseMetatile(const TileKey& metaKey, Metatile* metatile)
+    {
+        Threading::ScopedMutexLock lock( _metatilesMutex );
+        MetatileCache::Record record;
+        if ( _metatiles.get(metaKey, record) && record.value() == metatile )
+            _metatiles.erase( metaKey );
+    }
+
     //override
     bool preProcess(osg::Image* image, osg::Referenced* buildData)
     {
@@ -215,6 +391,7 @@ public:
         frame.ymin = imageExtent.yMin();
         frame.xf   = (double)image->s() / imageExtent.width();
         frame.yf   = (double)image->t() / imageExtent.height();
+        frame.row  = 0.0;
 
         if ( lines.size() > 0 )
         {
@@ -304,20 +481,6 @@ public:
         FilterContext polysContext = xform.push( polygons, context );
         FilterContext linesContext = xform.push( lines, context );
 
-        // set up the AGG renderer:
-        agg::rendering_buffer rbuf( image->data(), image->s(), image->t(), image->s()*4 );
-
-        // Create the renderer and the rasterizer
-        agg::rasterizer ras;
-
-        // Setup the rasterizer
-        if ( _options.coverage() == true )
-            ras.gamma(1.0);
-        else
-            ras.gamma(_options.gamma().get());
-
-        ras.filling_rule(agg::fill_even_odd);
-
         // construct an extent for cropping the geometry to our tile.
         // extend just outside the actual extents so we don't get edge artifacts:
         GeoExtent cropExtent = GeoExtent(imageExtent);
@@ -354,61 +517,79 @@ public:
         if (covsym && covsym->valueExpression().isSet())
             covValue = covsym->valueExpression().get();
 
-        // render the polygons
+        // crop everything to the tile and resolve its color or value:
+        RenderItems items;
+
         for(FeatureList::iterator i = polygons.begin(); i != polygons.end(); i++)
         {
             Feature*  feature  = i->get();
             Geometry* geometry = feature->getGeometry();
 
-            osg::ref_ptr<Geometry> croppedGeometry;
-            if ( geometry->crop( cropPoly.get(), croppedGeometry ) )
+            RenderItem item;
+            if ( geometry->crop( cropPoly.get(), item.geometry ) )
             {
                 const PolygonSymbol* poly =
                     feature->style().isSet() && feature->style()->has<PolygonSymbol>() ? feature->style()->get<PolygonSymbol>() :
                     masterPoly;
 
-                if ( _options.coverage() == true && covValue.isSet() )
-                {
-                    float value = (float)feature->eval(covValue.mutable_value(), &context);
-                    rasterizeCoverage(croppedGeometry.get(), value, frame, ras, rbuf);
-                }
+                item.coverage = _options.coverage() == true && covValue.isSet();
+                if ( item.coverage )
+                    item.value = (float)feature->eval(covValue.mutable_value(), &context);
                 else
-                {
-                    osg::Vec4f color = poly->fill()->color();
-                    rasterize(croppedGeometry.get(), color, frame, ras, rbuf);
-                }
-                
+                    item.color = poly->fill()->color();
+
+                addRenderItem( item, frame, items );
             }
         }
 
-        // render the lines
         for(FeatureList::iterator i = lines.begin(); i != lines.end(); i++)
         {
             Feature*  feature  = i->get();
             Geometry* geometry = feature->getGeometry();
 
-            osg::ref_ptr<Geometry> croppedGeometry;
-            if ( geometry->crop( cropPoly.get(), croppedGeometry ) )
+            RenderItem item;
+            if ( geometry->crop( cropPoly.get(), item.geometry ) )
             {
                 const LineSymbol* line =
                     feature->style().isSet() && feature->style()->has<LineSymbol>() ? feature->style()->get<LineSymbol>() :
                     masterLine;
 
-                if ( _options.coverage() == true && covValue.isSet() )
-                {
-                    float value = (float)feature->eval(covValue.mutable_value(), &context);
-                    rasterizeCoverage(croppedGeometry.get(), value, frame, ras, rbuf);
-                }
+                item.coverage = _options.coverage() == true && covValue.isSet();
+                if ( item.coverage )
+                    item.value = (float)feature->eval(covValue.mutable_value(), &context);
                 else
-                {   osg::Vec4f color = line ? static_cast<osg::Vec4>(line->stroke()->color()) : osg::Vec4(1,1,1,1);
-                    rasterize(croppedGeometry.get(), color, frame, ras, rbuf);
-                }
+                    item.color = line ? static_cast<osg::Vec4>(line->stroke()->color()) : osg::Vec4(1,1,1,1);
+
+                addRenderItem( item, frame, items );
             }
         }
 
+        // render the polygons, then the lines, in bands of rows:
+        if ( !items.empty() )
+        {
+            RasterizeJob job;
+            job.source = this;
+            job.items  = &items;
+            job.frame  = frame;
+            job.image  = image;
+            job.gamma  = _options.coverage() == true ? 1.0 : _options.gamma().get();
+
+            unsigned numBands = ParallelRange::getNumChunks( image->t(), MIN_ROWS_PER_BAND );
+            ParallelRange::run( job, image->t(), numBands );
+        }
+
         return true;
     }
 
+    // Records the rows a cropped geometry covers, so bands can skip it
+    void addRenderItem(RenderItem& item, const RenderFrame& frame, RenderItems& items)
+    {
+        Bounds bounds = item.geometry->getBounds();
+        item.ymin = frame.yf*(bounds.yMin()-frame.ymin) - 1.0;
+        item.ymax = frame.yf*(bounds.yMax()-frame.ymin) + 1.0;
+        items.push_back( item );
+    }
+
     //override
     bool postProcess( osg::Image* image, osg::Referenced* data )
     {
@@ -442,7 +623,7 @@ public:
             {
                 const osg::Vec3d& p0 = *p;
                 double x0 = frame.xf*(p0.x()-frame.xmin);
-                double y0 = frame.yf*(p0.y()-frame.ymin);
+                double y0 = frame.yf*(p0.y()-frame.ymin) - frame.row;
 
                 if ( p == g->begin() )
                     ras.move_to_d( x0, y0 );
@@ -469,7 +650,7 @@ public:
             {
                 const osg::Vec3d& p0 = *p;
                 double x0 = frame.xf*(p0.x()-frame.xmin);
-                double y0 = frame.yf*(p0.y()-frame.ymin);
+                double y0 = frame.yf*(p0.y()-frame.ymin) - frame.row;
 
                 if ( p == g->begin() )
                     ras.move_to_d( x0, y0 );
@@ -492,6 +673,10 @@ public:
 private:
     const AGGLiteOptions _options;
     std::string _configPath;
+
+    unsigned         _metatileLevels;
+    MetatileCache    _metatiles;
+    Threading::Mutex _metatilesMutex;
 };
 
 
@@ -0,0 +1,353 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "ArchiveCache"
+#include <osgEarth/Cache>
+#include <osgEarth/TileArchive>
+#include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/URI>
+#include <osgEarth/Registry>
+#include <osgDB/Registry>
+#include <osgDB/ReaderWriter>
+#include <osgDB/ObjectWrapper>
+#include <osgDB/FileNameUtils>
+#include <streambuf>
+#include <istream>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+#define OSG_FORMAT "osgb"
+
+namespace
+{
+    /**
+     * Read-only input buffer over a block of memory, so records can be
+     * deserialized straight out of the mapped archive without a copy.
+     */
+    class MemoryStreamBuffer : public std::streambuf
+    {
+    public:
+        MemoryStreamBuffer(const char* data, unsigned size)
+        {
+            char* p = const_cast<char*>(data);
+            setg(p, p, p + size);
+        }
+
+    protected:
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode)
+        {
+            char* target =
+                dir == std::ios_base::beg ? eback() + off :
+                dir == std::ios_base::cur ? gptr()  + off :
+                                            egptr() + off;
+            if ( target < eback() || target > egptr() )
+                return pos_type(off_type(-1));
+            setg(eback(), target, egptr());
+            return pos_type(target - eback());
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+        {
+            return seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+    };
+
+    /** 
+     * Read-only cache backed by a memory-mapped tile archive.
+     */
+    class ArchiveCache : public Cache
+    {
+    public:
+        ArchiveCache() { } // unused
+        ArchiveCache( const ArchiveCache& rhs, const osg::CopyOp& op ) { } // unused
+        META_Object( osgEarth, ArchiveCache );
+
+        /**
+         * Constructs a new archive cache.
+         * @param options Options structure that comes from a serialized description of 
+         *        the object.
+         */
+        ArchiveCache( const CacheOptions& options );
+
+    public: // Cache interface
+
+        CacheBin* addBin( const std::string& binID );
+
+        CacheBin* getOrCreateDefaultBin();
+
+        off_t getApproximateSize() const;
+
+    protected:
+
+        osg::ref_ptr<TileArchive> _archive;
+    };
+
+    /** 
+     * Cache bin implementation for an ArchiveCache. Lookups go straight to the
+     * shared, immutable archive, so the bin holds no locks.
+    */
+    class ArchiveCacheBin : public CacheBin
+    {
+    public:
+        ArchiveCacheBin( const std::string& name, TileArchive* archive );
+
+    public: // CacheBin interface
+
+        ReadResult readObject(const std::string& key, const osgDB::Options* dbo);
+
+        ReadResult readImage(const std::string& key, const osgDB::Options* dbo);
+
+        ReadResult readString(const std::string& key, const osgDB::Options* dbo);
+
+        bool write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* dbo);
+
+        bool remove(const std::string& key);
+
+        bool touch(const std::string& key);
+
+        RecordStatus getRecordStatus(const std::string& key);
+
+        Config readMetadata();
+
+        std::string getHashedKey(const std::string& key) const { return key; }
+
+    protected:
+
+        // adapter base for all the osg read functions...
+        struct Reader {
+            osgDB::ReaderWriter*   _rw;
+            const osgDB::Options*  _op;
+            Reader(osgDB::ReaderWriter* rw, const osgDB::Options* op) : _rw(rw), _op(op) { }
+            virtual osgDB::ReaderWriter::ReadResult read(std::istream& in) const = 0;
+        };
+        struct ImageReader : public Reader {
+            ImageReader(osgDB::ReaderWriter* rw, const osgDB::Options* op) : Reader(rw, op) { }
+            osgDB::ReaderWriter::ReadResult read(std::istream& in) const { return _rw->readImage(in, _op); }
+        };
+        struct ObjectReader : public Reader {
+            ObjectReader(osgDB::ReaderWriter* rw, const osgDB::Options* op) : Reader(rw, op) { }
+            osgDB::ReaderWriter::ReadResult read(std::istream& in) const { return _rw->readObject(in, _op); }
+        };
+
+        ReadResult read(const std::string& key, const Reader& reader);
+
+        osg::ref_ptr<TileArchive>         _archive;
+        int                               _bin;
+        osg::ref_ptr<osgDB::ReaderWriter> _rw;
+    };
+}
+
+//------------------------------------------------------------------------
+
+#undef  LC
+#define LC "[ArchiveCache] "
+
+namespace
+{
+    ArchiveCache::ArchiveCache( const CacheOptions& options ) :
+    Cache( options )
+    {
+        // Force OSG to initialize the image wrapper. Failure to do this can result
+        // in a race condition within OSG when the cache is accessed from multiple threads.
+        osgDB::ObjectWrapperManager* owm = osgDB::Registry::instance()->getObjectWrapperManager();
+        owm->findWrapper("osg::Image");
+        owm->findWrapper("osg::HeightField");
+
+        ArchiveCacheOptions aco( options );
+
+        if ( !aco.path().isSet() )
+        {
+            const char* cachePath = ::getenv(OSGEARTH_ENV_CACHE_PATH);
+            if ( cachePath )
+                aco.path() = cachePath;
+        }
+
+        if ( aco.path().isSet() )
+        {
+            std::string path = URI( *aco.path(), options.referrer() ).full();
+            _archive = TileArchive::open( path );
+        }
+
+        if ( !_archive.valid() )
+        {
+            OE_WARN << LC << "No valid tile archive; cache disabled" << std::endl;
+            _ok = false;
+        }
+    }
+
+    CacheBin*
+    ArchiveCache::addBin( const std::string& name )
+    {
+        return _archive.valid() ?
+            _bins.getOrCreate( name, new ArchiveCacheBin( name, _archive.get() ) ) :
+            0L;
+    }
+
+    CacheBin*
+    ArchiveCache::getOrCreateDefaultBin()
+    {
+        if ( !_archive.valid() )
+            return 0L;
+
+        static Threading::Mutex s_defaultBinMutex;
+        if ( !_defaultBin.valid() )
+        {
+            Threading::ScopedMutexLock lock( s_defaultBinMutex );
+            if ( !_defaultBin.valid() ) // double-check
+            {
+                _defaultBin = new ArchiveCacheBin( "__default", _archive.get() );
+            }
+        }
+        return _defaultBin.get();
+    }
+
+    off_t
+    ArchiveCache::getApproximateSize() const
+    {
+        return _archive.valid() ? (off_t)_archive->getFileSize() : 0;
+    }
+
+    //------------------------------------------------------------------------
+
+#undef  LC
+#define LC "[ArchiveCacheBin] "
+
+    ArchiveCacheBin::ArchiveCacheBin( const std::string& binID, TileArchive* archive ) :
+    CacheBin( binID ),
+    _archive( archive )
+    {
+        _bin = archive->findBin( binID );
+        _rw = osgDB::Registry::instance()->getReaderWriterForExtension( OSG_FORMAT );
+
+        if ( _bin < 0 )
+        {
+            // Not an error; the layer simply wasn't archived.
+            OE_INFO << LC << "Bin \"" << binID << "\" is not in the archive" << std::endl;
+        }
+    }
+
+    ReadResult
+    ArchiveCacheBin::read( const std::string& key, const Reader& reader )
+    {
+        TileArchive::Record record;
+        if ( _bin < 0 || !_archive->find(_bin, key, record) )
+            return ReadResult( ReadResult::RESULT_NOT_FOUND );
+
+        MemoryStreamBuffer buffer( record._data, record._size );
+        std::istream in( &buffer );
+
+        osgDB::ReaderWriter::ReadResult r = reader.read( in );
+        if ( !r.success() )
+        {
+            OE_WARN << LC << "Failed to read \"" << key << "\" from bin \"" << getID() << "\": " << r.message() << std::endl;
+            return ReadResult( ReadResult::RESULT_READER_ERROR );
+        }
+
+        Config meta;
+        if ( record._metaSize > 0 )
+            meta.fromJSON( std::string(record._meta, record._metaSize) );
+
+        ReadResult rr( r.getObject(), meta );
+        rr.setLastModifiedTime( record._lastModified );
+        return rr;
+    }
+
+    ReadResult
+    ArchiveCacheBin::readImage( const std::string& key, const osgDB::Options* dbo )
+    {
+        return read( key, ImageReader(_rw.get(), dbo) );
+    }
+
+    ReadResult
+    ArchiveCacheBin::readObject( const std::string& key, const osgDB::Options* dbo )
+    {
+        return read( key, ObjectReader(_rw.get(), dbo) );
+    }
+
+    ReadResult
+    ArchiveCacheBin::readString( const std::string& key, const osgDB::Options* dbo )
+    {
+        ReadResult r = readObject( key, dbo );
+        if ( r.succeeded() && !r.get<StringObject>() )
+            return ReadResult();
+        return r;
+    }
+
+    bool
+    ArchiveCacheBin::write( const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* dbo )
+    {
+        // the archive is immutable.
+        return false;
+    }
+
+    bool
+    ArchiveCacheBin::remove( const std::string& key )
+    {
+        return false;
+    }
+
+    bool
+    ArchiveCacheBin::touch( const std::string& key )
+    {
+        return false;
+    }
+
+    CacheBin::RecordStatus
+    ArchiveCacheBin::getRecordStatus( const std::string& key )
+    {
+        TileArchive::Record record;
+        return _bin >= 0 && _archive->find(_bin, key, record) ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+
+    Config
+    ArchiveCacheBin::readMetadata()
+    {
+        return _bin >= 0 ? _archive->getBinMetadata(_bin) : Config();
+    }
+}
+
+//------------------------------------------------------------------------
+
+/**
+ * Driver for a read-only cache backed by a memory-mapped tile archive.
+ */
+class ArchiveCacheDriver : public CacheDriver
+{
+public:
+    ArchiveCacheDriver()
+    {
+        supportsExtension( "osgearth_cache_archive", "Tile archive cache for osgEarth" );
+    }
+
+    virtual const char* className() const
+    {
+        return "Tile archive cache for osgEarth";
+    }
+
+    virtual ReadResult readObject(const std::string& file_name, const Options* options) const
+    {
+        if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( file_name )))
+            return ReadResult::FILE_NOT_HANDLED;
+
+        return ReadResult( new ArchiveCache( getCacheOptions(options) ) );
+    }
+};
+
+REGISTER_OSGPLUGIN(osgearth_cache_archive, ArchiveCacheDriver)
@@ -95,6 +95,10 @@ namespace
 
         bool write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* dbo);
 
+        unsigned readMany(const std::vector<std::string>& keys, RecordType type, const osgDB::Options* dbo, ReadResults& output);
+
+        unsigned writeMany(const Records& records, const osgDB::Options* dbo);
+
         bool remove(const std::string& key);
 
         bool touch(const std::string& key);
@@ -118,6 +122,10 @@ namespace
 
         const osgDB::Options* mergeOptions(const osgDB::Options* in);
 
+        ReadResult readUnlocked(const std::string& key, RecordType type, const osgDB::Options* dbo);
+
+        bool writeUnlocked(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* dbo, std::string& message);
+
         bool                              _ok;
         bool                              _binPathExists;
         std::string                       _metaPath;       // full path to the bin's metadata file
@@ -338,11 +346,8 @@ namespace
     }
 
     ReadResult
-    FileSystemCacheBin::readImage(const std::string& key, const osgDB::Options* readOptions)
+    FileSystemCacheBin::readUnlocked(const std::string& key, RecordType type, const osgDB::Options* dbo)
     {
-        if ( !binValidForReading() ) 
-            return ReadResult(ReadResult::RESULT_NOT_FOUND);
-
         // mangle "key" into a legal path name
         URI fileURI( getHashedKey(key), _metaPath );
         std::string path = fileURI.full() + OSG_EXT;
@@ -350,65 +355,70 @@ namespace
         if ( !osgDB::fileExists(path) )
             return ReadResult( ReadResult::RESULT_NOT_FOUND );
 
-        osgEarth::TimeStamp timeStamp = osgEarth::getLastModifiedTime(path);     
-
-        osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(readOptions);
+        osgEarth::TimeStamp timeStamp = osgEarth::getLastModifiedTime(path);
 
-        osgDB::ReaderWriter::ReadResult r;
-        {
-            ScopedReadLock lock(_mutex);
+        osgDB::ReaderWriter::ReadResult r = type == RECORD_IMAGE ?
+            _rw->readImage( path, dbo ) :
+            _rw->readObject( path, dbo );
 
-            r = _rw->readImage( path, dbo.get() );
-            if ( !r.success() )
-                return ReadResult();
+        if ( !r.success() )
+            return ReadResult();
 
-            // read metadata
-            Config meta;
-            std::string metafile = fileURI.full() + ".meta";
-            if ( osgDB::fileExists(metafile) )
-                readMeta( metafile, meta );
+        // read metadata
+        Config meta;
+        std::string metafile = fileURI.full() + ".meta";
+        if ( osgDB::fileExists(metafile) )
+            readMeta( metafile, meta );
 
-            ReadResult rr( r.getImage(), meta );
-            rr.setLastModifiedTime(timeStamp);
-            return rr;            
-        }
+        ReadResult rr( r.getObject(), meta );
+        rr.setLastModifiedTime(timeStamp);
+        return rr;
     }
 
     ReadResult
-    FileSystemCacheBin::readObject(const std::string& key, const osgDB::Options* readOptions)
+    FileSystemCacheBin::readImage(const std::string& key, const osgDB::Options* readOptions)
     {
         if ( !binValidForReading() ) 
             return ReadResult(ReadResult::RESULT_NOT_FOUND);
 
-        // mangle "key" into a legal path name
-        URI fileURI( getHashedKey(key), _metaPath );
-        std::string path = fileURI.full() + OSG_EXT;
+        osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(readOptions);
 
-        if ( !osgDB::fileExists(path) )
-            return ReadResult( ReadResult::RESULT_NOT_FOUND );
+        ScopedReadLock lock(_mutex);
+        return readUnlocked(key, RECORD_IMAGE, dbo.get());
+    }
 
-        osgEarth::TimeStamp timeStamp = osgEarth::getLastModifiedTime(path);
+    ReadResult
+    FileSystemCacheBin::readObject(const std::string& key, const osgDB::Options* readOptions)
+    {
+        if ( !binValidForReading() ) 
+            return ReadResult(ReadResult::RESULT_NOT_FOUND);
 
         osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(readOptions);
 
-        osgDB::ReaderWriter::ReadResult r;
-        {
-            ScopedReadLock lock(_mutex);
+        ScopedReadLock lock(_mutex);
+        return readUnlocked(key, RECORD_OBJECT, dbo.get());
+    }
 
-            r = _rw->readObject( path, dbo.get() );
-            if ( !r.success() )
-                return ReadResult();
+    unsigned
+    FileSystemCacheBin::readMany(const std::vector<std::string>& keys, RecordType type, const osgDB::Options* readOptions, ReadResults& output)
+    {
+        output.assign(keys.size(), ReadResult(ReadResult::RESULT_NOT_FOUND));
+
+        if ( !binValidForReading() || keys.empty() ) 
+            return 0u;
 
-            // read metadata
-            Config meta;
-            std::string metafile = fileURI.full() + ".meta";
-            if ( osgDB::fileExists(metafile) )
-                readMeta( metafile, meta );
+        // merge the options and take the lock once for the whole batch.
+        osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(readOptions);
 
-            ReadResult rr( r.getObject(), meta );
-            rr.setLastModifiedTime(timeStamp);
-            return rr;            
+        unsigned count = 0u;
+        ScopedReadLock lock(_mutex);
+        for(unsigned i=0; i<keys.size(); ++i)
+        {
+            output[i] = readUnlocked(keys[i], type, dbo.get());
+            if ( output[i].succeeded() )
+                ++count;
         }
+        return count;
     }
 
     ReadResult
@@ -429,52 +439,38 @@ namespace
     }
 
     bool
-    FileSystemCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+    FileSystemCacheBin::writeUnlocked(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* dbo, std::string& message)
     {
-        if ( !binValidForWriting() || !object ) 
-            return false;
-
         // convert the key into a legal filename:
         URI fileURI( getHashedKey(key), _metaPath );
-        
-        osgDB::ReaderWriter::WriteResult r;
 
-        bool objWriteOK = false;
-        {
-            // prevent cache contention:
-            ScopedWriteLock lock(_mutex);
+        // make a home for it..
+        if ( !osgDB::fileExists( osgDB::getFilePath(fileURI.full()) ) )
+            osgEarth::makeDirectoryForFile( fileURI.full() );
 
-            // make a home for it..
-            if ( !osgDB::fileExists( osgDB::getFilePath(fileURI.full()) ) )
-                osgEarth::makeDirectoryForFile( fileURI.full() );
+        osgDB::ReaderWriter::WriteResult r;
+        std::string filename = fileURI.full() + OSG_EXT;
 
-            osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(writeOptions);
+        if ( dynamic_cast<const osg::Image*>(object) )
+        {
+            r = _rw->writeImage( *static_cast<const osg::Image*>(object), filename, dbo );
+        }
+        else if ( dynamic_cast<const osg::Node*>(object) )
+        {
+            r = _rw->writeNode(*static_cast<const osg::Node*>(object), filename, dbo);
+        }
+        else
+        {
+            r = _rw->writeObject(*object, filename, dbo);
+        }
 
-            if ( dynamic_cast<const osg::Image*>(object) )
-            {
-                std::string filename = fileURI.full() + OSG_EXT;
-                r = _rw->writeImage( *static_cast<const osg::Image*>(object), filename, dbo.get() );
-                objWriteOK = r.success();
-            }
-            else if ( dynamic_cast<const osg::Node*>(object) )
-            {
-                std::string filename = fileURI.full() + OSG_EXT;
-                r = _rw->writeNode(*static_cast<const osg::Node*>(object), filename, dbo.get());
-                objWriteOK = r.success();
-            }
-            else
-            {
-                std::string filename = fileURI.full() + OSG_EXT;
-                r = _rw->writeObject(*object, filename, dbo.get());
-                objWriteOK = r.success();
-            }
+        bool objWriteOK = r.success();
 
-            // write metadata
-            if ( !meta.empty() && objWriteOK )
-            {
-                std::string metaname = fileURI.full() + ".meta";
-                writeMeta( metaname, meta );
-            }
+        // write metadata
+        if ( !meta.empty() && objWriteOK )
+        {
+            std::string metaname = fileURI.full() + ".meta";
+            writeMeta( metaname, meta );
         }
 
         if ( objWriteOK )
@@ -482,14 +478,68 @@ namespace
             OE_DEBUG << LC << "Wrote \"" << key << "\" to cache bin [" << getID() << "] path=" << fileURI.full() << "." << OSG_EXT << std::endl;
         }
         else
+        {
+            message = r.message();
+        }
+
+        return objWriteOK;
+    }
+
+    bool
+    FileSystemCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+    {
+        if ( !binValidForWriting() || !object ) 
+            return false;
+
+        std::string message;
+        bool objWriteOK = false;
+        {
+            osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(writeOptions);
+
+            // prevent cache contention:
+            ScopedWriteLock lock(_mutex);
+            objWriteOK = writeUnlocked(key, object, meta, dbo.get(), message);
+        }
+
+        if ( !objWriteOK )
         {
             OE_WARN << LC << "FAILED to write \"" << key << "\" to cache bin " << getID()
-                << "; msg = \"" << r.message() << "\"" << std::endl;
+                << "; msg = \"" << message << "\"" << std::endl;
         }
 
         return objWriteOK;
     }
 
+    unsigned
+    FileSystemCacheBin::writeMany(const Records& records, const osgDB::Options* writeOptions)
+    {
+        if ( !binValidForWriting() || records.empty() ) 
+            return 0u;
+
+        // merge the options and take the lock once for the whole batch.
+        osg::ref_ptr<const osgDB::Options> dbo = mergeOptions(writeOptions);
+
+        unsigned count = 0u;
+        ScopedWriteLock lock(_mutex);
+        for(Records::const_iterator i = records.begin(); i != records.end(); ++i)
+        {
+            if ( !i->_object.valid() )
+                continue;
+
+            std::string message;
+            if ( writeUnlocked(i->_key, i->_object.get(), i->_metadata, dbo.get(), message) )
+            {
+                ++count;
+            }
+            else
+            {
+                OE_WARN << LC << "FAILED to write \"" << i->_key << "\" to cache bin " << getID()
+                    << "; msg = \"" << message << "\"" << std::endl;
+            }
+        }
+        return count;
+    }
+
     CacheBin::RecordStatus
     FileSystemCacheBin::getRecordStatus(const std::string& key)
     {
@@ -17,12 +17,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include "LevelDBCacheBin"
+#include "Purger"
 #include <osgEarth/Cache>
 #include <osgEarth/Registry>
 #include <osgEarth/Random>
 #include <osgDB/Registry>
 #include <leveldb/write_batch.h>
 #include <string>
+#include <map>
 
 using namespace osgEarth;
 using namespace osgEarth::Threading;
@@ -77,6 +79,7 @@ namespace
 #define OE_TEST OE_NOTICE
 
 #define TIME_FIELD "leveldb.time"
+#define SIZE_FIELD "leveldb.size"
 
 
 LevelDBCacheBin::LevelDBCacheBin(const std::string& binID,
@@ -253,31 +256,37 @@ LevelDBCacheBin::read(const std::string& key, const Reader& reader)
 
     ++_tracker->reads;
 
-    Config metadata;
     leveldb::Status status;
     leveldb::ReadOptions ro;
 
     // first read the metadata record.
     std::string metavalue;
-    status = _db->Get( ro, metaKey(key), &metavalue );
-    TimeStamp lastModified = (TimeStamp)0;
-    if ( status.ok() )
-    {        
-        decodeMeta(metavalue, metadata);
-        DateTime t( metadata.value(TIME_FIELD));
-        lastModified = t.asTimeStamp();
-    }
+    bool hasMeta = _db->Get( ro, metaKey(key), &metavalue ).ok();
         
     // next read the data record.
-    std::string datakey = dataKey(key);
     std::string datavalue;
-    status = _db->Get( ro, datakey, &datavalue );
+    status = _db->Get( ro, dataKey(key), &datavalue );
     if ( !status.ok() )
     {
         // main record not found for some reason.
         return ReadResult(ReadResult::RESULT_NOT_FOUND);
     }
 
+    return decode(key, hasMeta ? &metavalue : 0L, datavalue, reader);
+}
+
+ReadResult
+LevelDBCacheBin::decode(const std::string& key, const std::string* metavalue, std::string& datavalue, const Reader& reader)
+{
+    Config metadata;
+    TimeStamp lastModified = (TimeStamp)0;
+    if ( metavalue )
+    {        
+        decodeMeta(*metavalue, metadata);
+        DateTime t( metadata.value(TIME_FIELD));
+        lastModified = t.asTimeStamp();
+    }
+
     // blend the data string
     if ( _tracker->seed().isSet() )
         unblend(datavalue, _tracker->seed().value());
@@ -301,12 +310,14 @@ LevelDBCacheBin::read(const std::string& key, const Reader& reader)
         OE_NOTICE << LC << "Bin " << getID() << ": read (" << key << ")\n";
     }
 
-    // if there's a size limit, we need to 'touch' the record.
-    if ( _tracker->hasSizeLimit() )
+    // if there's a size limit, we need to 'touch' the record. In async mode
+    // the purger thread applies it later so the read never waits on a write.
+    if ( _tracker->isTouchOnRead() )
     {
-        // Room for optimization here since we already have the 
-        // meta/time records around.
-        touch( key );
+        if ( _tracker->isAsyncPurge() )
+            _tracker->queueTouch( binDataKeyTuple(key) );
+        else
+            touch( key );
     }
 
     ++_tracker->hits;
@@ -315,6 +326,81 @@ LevelDBCacheBin::read(const std::string& key, const Reader& reader)
     return rr;
 }
 
+unsigned
+LevelDBCacheBin::readMany(const std::vector<std::string>& keys,
+                          RecordType                      type,
+                          const osgDB::Options*           readOptions,
+                          ReadResults&                    output)
+{
+    output.assign(keys.size(), ReadResult(ReadResult::RESULT_NOT_FOUND));
+
+    if ( !binValidForReading() || keys.empty() )
+        return 0u;
+
+    ImageReader  imageReader (_rw.get(), readOptions);
+    ObjectReader objectReader(_rw.get(), readOptions);
+    const Reader& reader = type == RECORD_IMAGE ? 
+        static_cast<const Reader&>(imageReader) :
+        static_cast<const Reader&>(objectReader);
+
+    // LevelDB has no multi-get, so visit the keys in sorted order with a single
+    // iterator over a consistent snapshot. Each seek then moves forward through
+    // the table instead of starting a new lookup.
+    std::map<std::string, unsigned> sorted;
+    for(unsigned i=0; i<keys.size(); ++i)
+        sorted[keys[i]] = i;
+
+    leveldb::ReadOptions ro;
+    ro.snapshot = _db->GetSnapshot();
+    leveldb::Iterator* it = _db->NewIterator(ro);
+
+    std::vector<std::string> metavalues(keys.size());
+    std::vector<bool>        hasMeta(keys.size(), false);
+    for(std::map<std::string, unsigned>::const_iterator k = sorted.begin(); k != sorted.end(); ++k)
+    {
+        std::string metakey = metaKey(k->first);
+        it->Seek(metakey);
+        if ( it->Valid() && it->key().ToString() == metakey )
+        {
+            metavalues[k->second] = it->value().ToString();
+            hasMeta[k->second] = true;
+        }
+    }
+
+    unsigned count = 0u;
+    for(std::map<std::string, unsigned>::const_iterator k = sorted.begin(); k != sorted.end(); ++k)
+    {
+        ++_tracker->reads;
+
+        std::string datakey = dataKey(k->first);
+        it->Seek(datakey);
+        if ( it->Valid() && it->key().ToString() == datakey )
+        {
+            unsigned i = k->second;
+            std::string datavalue = it->value().ToString();
+            output[i] = decode(k->first, hasMeta[i] ? &metavalues[i] : 0L, datavalue, reader);
+            if ( output[i].succeeded() )
+                ++count;
+        }
+    }
+
+    delete it;
+    _db->ReleaseSnapshot(ro.snapshot);
+
+    // duplicate keys only got one lookup; copy their results.
+    if ( sorted.size() < keys.size() )
+    {
+        for(unsigned i=0; i<keys.size(); ++i)
+        {
+            unsigned first = sorted[keys[i]];
+            if ( first != i )
+                output[i] = output[first];
+        }
+    }
+
+    return count;
+}
+
 ReadResult
 LevelDBCacheBin::readString(const std::string& key, const osgDB::Options* readOptions)
 {
@@ -333,15 +419,9 @@ LevelDBCacheBin::readString(const std::string& key, const osgDB::Options* readOp
 }
 
 bool
-LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+LevelDBCacheBin::serialize(const osg::Object* object, const osgDB::Options* writeOptions, std::string& data, std::string& message)
 {
-    if ( !binValidForWriting() || !object ) 
-        return false;
-        
     osgDB::ReaderWriter::WriteResult r;
-    bool objWriteOK = false;
-
-    std::string       data;
     std::stringstream datastream;
 
     if ( dynamic_cast<const osg::Image*>(object) )
@@ -352,7 +432,6 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
             return false;
         }
         r = _rw->writeImage( *static_cast<const osg::Image*>(object), datastream, writeOptions );
-        objWriteOK = r.success();
     }
     else if ( dynamic_cast<const osg::Node*>(object) )
     {
@@ -362,7 +441,6 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
             return false;
         }
         r = _rw->writeNode( *static_cast<const osg::Node*>(object), datastream, writeOptions );
-        objWriteOK = r.success();
     }
     else
     {
@@ -372,34 +450,64 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
             return false;
         }
         r = _rw->writeObject( *object, datastream, writeOptions );
-        objWriteOK = r.success();
     }
 
-    if (objWriteOK)
+    if ( !r.success() )
     {
-        DateTime now;
-        leveldb::WriteBatch batch;
+        message = r.message();
+        return false;
+    }
 
-        // write the data:
-        data = datastream.str();
-        if ( _tracker->seed().isSet() )
-            blend(data, _tracker->seed().value());
-        batch.Put( dataKey(key), data );
+    data = datastream.str();
+    if ( _tracker->seed().isSet() )
+        blend(data, _tracker->seed().value());
+
+    return true;
+}
+
+::off_t
+LevelDBCacheBin::addToBatch(leveldb::WriteBatch& batch, const std::string& key, const std::string& data, const Config& meta, const DateTime& now)
+{
+    // write the data:
+    batch.Put( dataKey(key), data );
+
+    // write the timestamp index:
+    std::string timekey = timeKey(now, key);
+    std::string tuple = binDataKeyTuple(key);
+    batch.Put( timekey, tuple );
+
+    // write the metadata:
+    std::string metavalue;
+    Config metadata(meta);
+    metadata.set( TIME_FIELD, now.asCompactISO8601() );
+    metadata.set( SIZE_FIELD, (unsigned)data.size() );
+    encodeMeta( metadata, metavalue );
+    std::string metakey = metaKey(key);
+    batch.Put( metakey, metavalue );
+
+    return Tracker::recordSize( tuple, timekey, metavalue, (unsigned)data.size() );
+}
+
+bool
+LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+{
+    if ( !binValidForWriting() || !object ) 
+        return false;
 
-        // write the timestamp index:
-        batch.Put( timeKey(now, key), binDataKeyTuple(key) );
+    std::string data, message;
+    bool objWriteOK = serialize(object, writeOptions, data, message);
 
-        // write the metadata:
-        Config metadata(meta);
-        metadata.set( TIME_FIELD, now.asCompactISO8601() );
-        encodeMeta( metadata, data );
-        batch.Put( metaKey(key), data );
+    if (objWriteOK)
+    {
+        leveldb::WriteBatch batch;
+        ::off_t bytes = addToBatch(batch, key, data, meta, DateTime());
 
         objWriteOK = _db->Write( leveldb::WriteOptions(), &batch ).ok();
 
         if ( objWriteOK )
         {
             ++_tracker->writes;
+            _tracker->adjustSize( bytes );
             postWrite();
             
             if ( _debug )
@@ -413,16 +521,67 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
     if ( !objWriteOK )
     {
         OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
-            << r.message() << "\"\n";
+            << message << "\"\n";
     }
 
     return objWriteOK;
 }
 
+unsigned
+LevelDBCacheBin::writeMany(const Records& records, const osgDB::Options* writeOptions)
+{
+    if ( !binValidForWriting() || records.empty() )
+        return 0u;
+
+    // serialize everything first, then commit all the records in one batch.
+    DateTime now;
+    leveldb::WriteBatch batch;
+    ::off_t bytes = 0;
+    unsigned count = 0u;
+
+    for(Records::const_iterator i = records.begin(); i != records.end(); ++i)
+    {
+        std::string data, message;
+        if ( i->_object.valid() && serialize(i->_object.get(), writeOptions, data, message) )
+        {
+            bytes += addToBatch(batch, i->_key, data, i->_metadata, now);
+            ++count;
+        }
+        else
+        {
+            OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << i->_key << "); msg = \"" 
+                << message << "\"\n";
+        }
+    }
+
+    if ( count == 0u )
+        return 0u;
+
+    if ( !_db->Write(leveldb::WriteOptions(), &batch).ok() )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write batch of " << count << " record(s)\n";
+        return 0u;
+    }
+
+    for(unsigned i=0; i<count; ++i)
+        ++_tracker->writes;
+
+    _tracker->adjustSize( bytes );
+    postWrite();
+
+    if ( _debug )
+    {
+        OE_NOTICE << LC << "Bin " << getID() << ": wrote batch of " << count << " record(s)\n";
+    }
+
+    return count;
+}
+
 void
 LevelDBCacheBin::postWrite()
 {
-    if ( _tracker->hasSizeLimit() )
+    // In async mode, the tracker wakes up the purger thread when needed.
+    if ( _tracker->hasSizeLimit() && !_tracker->isAsyncPurge() )
     {
         if ( _tracker->isOverLimit() )
         {
@@ -492,10 +651,14 @@ LevelDBCacheBin::remove(const std::string& key)
     decodeMeta(metavalue, metadata);
     DateTime t(metadata.value(TIME_FIELD));
 
+    std::string datakey = dataKey(key);
+    std::string metakey = metaKey(key);
+    std::string timekey = timeKey(t, key);
+
     leveldb::WriteBatch batch;
-    batch.Delete( dataKey(key) );
-    batch.Delete( metaKey(key) );
-    batch.Delete( timeKey(t, key) );
+    batch.Delete( datakey );
+    batch.Delete( metakey );
+    batch.Delete( timekey );
         
     leveldb::Status status = _db->Write(leveldb::WriteOptions(), &batch);
     if ( !status.ok() )
@@ -503,7 +666,11 @@ LevelDBCacheBin::remove(const std::string& key)
         OE_WARN << LC << "Failed to remove (" << key << ") from bin " << getID() << std::endl;
         return false;
     }
-    else if ( _debug )
+
+    _tracker->adjustSize( -Tracker::recordSize(
+        binDataKeyTuple(key), timekey, metavalue, metadata.value<unsigned>(SIZE_FIELD, 0u)) );
+
+    if ( _debug )
     {
         OE_NOTICE << LC << "Removed (" << key << ") from bin " << getID() << std::endl;
     }
@@ -659,35 +826,12 @@ LevelDBCacheBin::purgeOldest(unsigned maxnum)
     if ( !binValidForWriting() )
         return false;
 
-    leveldb::Iterator* it = _db->NewIterator(leveldb::ReadOptions());
-
-    unsigned count = 0;
-    std::string limit = timeEndGlobal();
-
-    // note: this will delete records NOT OF THIS BIN as well!
-    for(it->Seek(timeBeginGlobal());
-        count < maxnum && it->Valid() && it->key().ToString() < limit;
-        it->Next(), ++count )
-    {
-        if ( !it->status().ok() )
-            break;
-
-        std::string tuple = it->value().ToString();
-
-        // doing this in a WriteBatch did not work. The size of the
-        // database would never go down.
-        leveldb::WriteOptions wo;
-        _db->Delete( wo, dataKeyFromTuple(tuple) );
-        _db->Delete( wo, metaKeyFromTuple(tuple) );
-        _db->Delete( wo, it->key() );
-    }
-
-    delete it;
+    unsigned count = Purger::purgeOldest(_db, _tracker.get(), maxnum);
 
     if ( _debug )
     {
         OE_NOTICE << LC << "Purged " << count << " record(s) for "
-            << (_tracker->calcSize()/1048576) << " MB" << std::endl;
+            << (_tracker->getSize()/1048576) << " MB" << std::endl;
     }
 
     return true;
@@ -0,0 +1,190 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "Purger"
+#include <osgEarth/Config>
+#include <osgEarth/DateTime>
+#include <rocksdb/write_batch.h>
+#include <set>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers::RocksDBCache;
+
+#define LC "[RocksDBCache] "
+
+// must match the key layout in RocksDBCacheBin.
+#define SEP        std::string("!")
+#define TIME_FIELD "rocksdb.time"
+#define SIZE_FIELD "rocksdb.size"
+
+//------------------------------------------------------------------------
+
+Purger::Purger(rocksdb::DB* db, Tracker* tracker) :
+_db           ( db ),
+_tracker      ( tracker ),
+_done         ( false ),
+_lastSizeCheck( 0u )
+{
+    //nop
+}
+
+Purger::~Purger()
+{
+    cancel();
+}
+
+int
+Purger::cancel()
+{
+    if ( isRunning() )
+    {
+        _done = true;
+        _tracker->purgeEvent().set();
+        join();
+    }
+    return 0;
+}
+
+void
+Purger::run()
+{
+    while( !_done )
+    {
+        // wake up when the tracker tells us we're over the limit, or periodically
+        // to flush queued touches.
+        _tracker->purgeEvent().wait( 1000u );
+        _tracker->purgeEvent().reset();
+
+        if ( _done )
+            break;
+
+        applyTouches(_db, _tracker.get());
+
+        // every so often, re-sync the running size estimate with the disk.
+        unsigned writes = (unsigned)_tracker->writes;
+        if ( writes - _lastSizeCheck >= _tracker->numToPurge() * 10u )
+        {
+            _lastSizeCheck = writes;
+            _tracker->calcSize();
+        }
+
+        // evict in small batches, yielding in between so we never hog the database.
+        while( !_done && _tracker->isOverLimit() )
+        {
+            if ( purgeOldest(_db, _tracker.get(), _tracker->numToPurge()) == 0u )
+                break;
+
+            OpenThreads::Thread::YieldCurrentThread();
+        }
+    }
+}
+
+void
+Purger::applyTouches(rocksdb::DB* db, Tracker* tracker)
+{
+    std::set<std::string> tuples;
+    tracker->drainTouches( tuples );
+    if ( tuples.empty() )
+        return;
+
+    std::string newtime = DateTime().asCompactISO8601();
+    rocksdb::ReadOptions ro;
+    rocksdb::WriteBatch batch;
+
+    for(std::set<std::string>::const_iterator i = tuples.begin(); i != tuples.end(); ++i)
+    {
+        const std::string& tuple = *i;
+        std::string metakey = "m" + SEP + tuple;
+
+        std::string metavalue;
+        if ( db->Get(ro, metakey, &metavalue).ok() == false )
+            continue;
+
+        Config meta;
+        meta.fromJSON( metavalue );
+        std::string oldtime = meta.value(TIME_FIELD);
+        if ( oldtime == newtime )
+            continue;
+
+        meta.set( TIME_FIELD, newtime );
+        batch.Put( metakey, meta.toJSON(false) );
+        batch.Delete( "t" + SEP + oldtime + SEP + tuple );
+        batch.Put( "t" + SEP + newtime + SEP + tuple, tuple );
+    }
+
+    if ( db->Write(rocksdb::WriteOptions(), &batch).ok() == false )
+    {
+        OE_WARN << LC << "Failed to apply " << tuples.size() << " touch(es)" << std::endl;
+    }
+}
+
+unsigned
+Purger::purgeOldest(rocksdb::DB* db, Tracker* tracker, unsigned maxnum)
+{
+    rocksdb::ReadOptions ro;
+    rocksdb::WriteOptions wo;
+    rocksdb::Iterator* it = db->NewIterator(ro);
+
+    unsigned count = 0;
+    ::off_t  bytes = 0;
+    std::string limit = "t" + SEP + "\xff";
+
+    // The time index is sorted oldest-first, so we just pop records off the front.
+    // note: this will delete records NOT OF THIS BIN as well!
+    for(it->Seek("t" + SEP);
+        count < maxnum && it->Valid() && it->key().ToString() < limit;
+        it->Next(), ++count )
+    {
+        if ( !it->status().ok() )
+            break;
+
+        std::string timekey = it->key().ToString();
+        std::string tuple   = it->value().ToString();
+        std::string metakey = "m" + SEP + tuple;
+
+        std::string metavalue;
+        Config meta;
+        if ( db->Get(ro, metakey, &metavalue).ok() )
+        {
+            meta.fromJSON( metavalue );
+
+            // If the record was touched since this index entry was written, the
+            // entry is stale; drop it but keep the record.
+            std::string timestamp = timekey.substr(2, timekey.size() - tuple.size() - 3);
+            if ( meta.value(TIME_FIELD) != timestamp )
+            {
+                db->Delete( wo, it->key() );
+                continue;
+            }
+        }
+
+        bytes += Tracker::recordSize(tuple, timekey, metavalue, meta.value<unsigned>(SIZE_FIELD, 0u));
+
+        // doing this in a WriteBatch did not work. The size of the
+        // database would never go down.
+        db->Delete( wo, "d" + SEP + tuple );
+        db->Delete( wo, metakey );
+        db->Delete( wo, it->key() );
+    }
+
+    delete it;
+
+    tracker->adjustSize( -bytes );
+
+    return count;
+}
@@ -46,7 +46,9 @@ using namespace osgEarth::Drivers::RocksDBCache;
 RocksDBCacheImpl::RocksDBCacheImpl( const CacheOptions& options ) :
 osgEarth::Cache( options ),
 _options       ( options ),
-_active        ( true )
+_active        ( true ),
+_db            ( 0L ),
+_purger        ( 0L )
 {
     // Force OSG to initialize the image wrapper. Failure to do this can result
     // in a race condition within OSG when the cache is accessed from multiple threads.
@@ -105,6 +107,13 @@ _active        ( true )
 
 RocksDBCacheImpl::~RocksDBCacheImpl()
 {
+    if ( _purger )
+    {
+        _purger->cancel();
+        delete _purger;
+        _purger = 0L;
+    }
+
     if ( _db )
     {
         // problem. This destructor causes a lockup sometimes. Perhaps try
@@ -131,10 +140,17 @@ RocksDBCacheImpl::init()
 
     open();
 
-    // Do an initial size check.
+    // Do an initial size check. After this the tracker maintains the
+    // size incrementally and the purger re-syncs it in the background.
     if ( _db )
     {
         _tracker->calcSize();
+
+        if ( _tracker->hasSizeLimit() && _tracker->isAsyncPurge() )
+        {
+            _purger = new Purger(_db, _tracker.get());
+            _purger->start();
+        }
     }
 
     if ( _active )
@@ -225,7 +241,7 @@ RocksDBCacheImpl::getOrCreateDefaultBin()
 off_t
 RocksDBCacheImpl::getApproximateSize() const
 {
-    return _tracker->calcSize();
+    return _tracker->getSize();
 }
 
 bool
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include "RocksDBCacheBin"
+#include "Purger"
 #include <osgEarth/Cache>
 #include <osgEarth/Registry>
 #include <osgEarth/Random>
@@ -77,6 +78,7 @@ namespace
 #define OE_TEST OE_NOTICE
 
 #define TIME_FIELD "rocksdb.time"
+#define SIZE_FIELD "rocksdb.size"
 
 
 RocksDBCacheBin::RocksDBCacheBin(const std::string& binID,
@@ -247,31 +249,37 @@ RocksDBCacheBin::read(const std::string& key, const Reader& reader)
 
     ++_tracker->reads;
 
-    Config metadata;
     rocksdb::Status status;
     rocksdb::ReadOptions ro;
 
     // first read the metadata record.
     std::string metavalue;
-    status = _db->Get( ro, metaKey(key), &metavalue );
-    TimeStamp lastModified = (TimeStamp)0;
-    if ( status.ok() )
-    {        
-        decodeMeta(metavalue, metadata);
-        DateTime t( metadata.value(TIME_FIELD));
-        lastModified = t.asTimeStamp();
-    }
+    bool hasMeta = _db->Get( ro, metaKey(key), &metavalue ).ok();
         
     // next read the data record.
-    std::string datakey = dataKey(key);
     std::string datavalue;
-    status = _db->Get( ro, datakey, &datavalue );
+    status = _db->Get( ro, dataKey(key), &datavalue );
     if ( !status.ok() )
     {
         // main record not found for some reason.
         return ReadResult(ReadResult::RESULT_NOT_FOUND);
     }
 
+    return decode(key, hasMeta ? &metavalue : 0L, datavalue, reader);
+}
+
+ReadResult
+RocksDBCacheBin::decode(const std::string& key, const std::string* metavalue, std::string& datavalue, const Reader& reader)
+{
+    Config metadata;
+    TimeStamp lastModified = (TimeStamp)0;
+    if ( metavalue )
+    {        
+        decodeMeta(*metavalue, metadata);
+        DateTime t( metadata.value(TIME_FIELD));
+        lastModified = t.asTimeStamp();
+    }
+
     // blend the data string
     if ( _tracker->seed().isSet() )
         unblend(datavalue, _tracker->seed().value());
@@ -295,12 +303,14 @@ RocksDBCacheBin::read(const std::string& key, const Reader& reader)
         OE_NOTICE << LC << "Bin " << getID() << ": read (" << key << ")\n";
     }
 
-    // if there's a size limit, we need to 'touch' the record.
-    if ( _tracker->hasSizeLimit() )
+    // if there's a size limit, we need to 'touch' the record. In async mode
+    // the purger thread applies it later so the read never waits on a write.
+    if ( _tracker->isTouchOnRead() )
     {
-        // Room for optimization here since we already have the 
-        // meta/time records around.
-        touch( key );
+        if ( _tracker->isAsyncPurge() )
+            _tracker->queueTouch( binDataKeyTuple(key) );
+        else
+            touch( key );
     }
 
     ++_tracker->hits;
@@ -309,6 +319,52 @@ RocksDBCacheBin::read(const std::string& key, const Reader& reader)
     return rr;
 }
 
+unsigned
+RocksDBCacheBin::readMany(const std::vector<std::string>& keys,
+                          RecordType                      type,
+                          const osgDB::Options*           readOptions,
+                          ReadResults&                    output)
+{
+    output.assign(keys.size(), ReadResult(ReadResult::RESULT_NOT_FOUND));
+
+    if ( !binValidForReading() || keys.empty() )
+        return 0u;
+
+    ImageReader  imageReader (_rw.get(), readOptions);
+    ObjectReader objectReader(_rw.get(), readOptions);
+    const Reader& reader = type == RECORD_IMAGE ? 
+        static_cast<const Reader&>(imageReader) :
+        static_cast<const Reader&>(objectReader);
+
+    // Fetch all the metadata and data records in one MultiGet call.
+    std::vector<std::string> lookupKeys;
+    lookupKeys.reserve(keys.size()*2);
+    for(unsigned i=0; i<keys.size(); ++i)
+        lookupKeys.push_back(metaKey(keys[i]));
+    for(unsigned i=0; i<keys.size(); ++i)
+        lookupKeys.push_back(dataKey(keys[i]));
+
+    std::vector<rocksdb::Slice> slices(lookupKeys.begin(), lookupKeys.end());
+    std::vector<std::string> values;
+    std::vector<rocksdb::Status> statuses = _db->MultiGet(rocksdb::ReadOptions(), slices, &values);
+
+    unsigned count = 0u;
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        ++_tracker->reads;
+
+        unsigned m = i, d = keys.size() + i;
+        if ( statuses[d].ok() )
+        {
+            output[i] = decode(keys[i], statuses[m].ok() ? &values[m] : 0L, values[d], reader);
+            if ( output[i].succeeded() )
+                ++count;
+        }
+    }
+
+    return count;
+}
+
 ReadResult
 RocksDBCacheBin::readString(const std::string& key, const osgDB::Options* readOptions)
 {
@@ -327,15 +383,9 @@ RocksDBCacheBin::readString(const std::string& key, const osgDB::Options* readOp
 }
 
 bool
-RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+RocksDBCacheBin::serialize(const osg::Object* object, const osgDB::Options* writeOptions, std::string& data, std::string& message)
 {
-    if ( !binValidForWriting() || !object ) 
-        return false;
-        
     osgDB::ReaderWriter::WriteResult r;
-    bool objWriteOK = false;
-
-    std::string       data;
     std::stringstream datastream;
 
     if ( dynamic_cast<const osg::Image*>(object) )
@@ -345,8 +395,7 @@ RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const
             OE_WARN << LC << "Internal: tried to write image to " << _rw->className() << "\n";
             return false;
         }
-        r = _rw->writeImage( *static_cast<const osg::Image*>(object), datastream, writeOptions);
-        objWriteOK = r.success();
+        r = _rw->writeImage( *static_cast<const osg::Image*>(object), datastream, writeOptions );
     }
     else if ( dynamic_cast<const osg::Node*>(object) )
     {
@@ -355,8 +404,7 @@ RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const
             OE_WARN << LC << "Internal: tried to write node to " << _rw->className() << "\n";
             return false;
         }
-        r = _rw->writeNode( *static_cast<const osg::Node*>(object), datastream, writeOptions);
-        objWriteOK = r.success();
+        r = _rw->writeNode( *static_cast<const osg::Node*>(object), datastream, writeOptions );
     }
     else
     {
@@ -366,34 +414,64 @@ RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const
             return false;
         }
         r = _rw->writeObject( *object, datastream, writeOptions );
-        objWriteOK = r.success();
     }
 
-    if (objWriteOK)
+    if ( !r.success() )
     {
-        DateTime now;
-        rocksdb::WriteBatch batch;
+        message = r.message();
+        return false;
+    }
+
+    data = datastream.str();
+    if ( _tracker->seed().isSet() )
+        blend(data, _tracker->seed().value());
+
+    return true;
+}
+
+::off_t
+RocksDBCacheBin::addToBatch(rocksdb::WriteBatch& batch, const std::string& key, const std::string& data, const Config& meta, const DateTime& now)
+{
+    // write the data:
+    batch.Put( dataKey(key), data );
+
+    // write the timestamp index:
+    std::string timekey = timeKey(now, key);
+    std::string tuple = binDataKeyTuple(key);
+    batch.Put( timekey, tuple );
+
+    // write the metadata:
+    std::string metavalue;
+    Config metadata(meta);
+    metadata.set( TIME_FIELD, now.asCompactISO8601() );
+    metadata.set( SIZE_FIELD, (unsigned)data.size() );
+    encodeMeta( metadata, metavalue );
+    std::string metakey = metaKey(key);
+    batch.Put( metakey, metavalue );
 
-        // write the data:
-        data = datastream.str();
-        if ( _tracker->seed().isSet() )
-            blend(data, _tracker->seed().value());
-        batch.Put( dataKey(key), data );
+    return Tracker::recordSize( tuple, timekey, metavalue, (unsigned)data.size() );
+}
 
-        // write the timestamp index:
-        batch.Put( timeKey(now, key), binDataKeyTuple(key) );
+bool
+RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+{
+    if ( !binValidForWriting() || !object ) 
+        return false;
 
-        // write the metadata:
-        Config metadata(meta);
-        metadata.set( TIME_FIELD, now.asCompactISO8601() );
-        encodeMeta( metadata, data );
-        batch.Put( metaKey(key), data );
+    std::string data, message;
+    bool objWriteOK = serialize(object, writeOptions, data, message);
+
+    if (objWriteOK)
+    {
+        rocksdb::WriteBatch batch;
+        ::off_t bytes = addToBatch(batch, key, data, meta, DateTime());
 
         objWriteOK = _db->Write( rocksdb::WriteOptions(), &batch ).ok();
 
         if ( objWriteOK )
         {
             ++_tracker->writes;
+            _tracker->adjustSize( bytes );
             postWrite();
             
             if ( _debug )
@@ -407,16 +485,67 @@ RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const
     if ( !objWriteOK )
     {
         OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
-            << r.message() << "\"\n";
+            << message << "\"\n";
     }
 
     return objWriteOK;
 }
 
+unsigned
+RocksDBCacheBin::writeMany(const Records& records, const osgDB::Options* writeOptions)
+{
+    if ( !binValidForWriting() || records.empty() )
+        return 0u;
+
+    // serialize everything first, then commit all the records in one batch.
+    DateTime now;
+    rocksdb::WriteBatch batch;
+    ::off_t bytes = 0;
+    unsigned count = 0u;
+
+    for(Records::const_iterator i = records.begin(); i != records.end(); ++i)
+    {
+        std::string data, message;
+        if ( i->_object.valid() && serialize(i->_object.get(), writeOptions, data, message) )
+        {
+            bytes += addToBatch(batch, i->_key, data, i->_metadata, now);
+            ++count;
+        }
+        else
+        {
+            OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << i->_key << "); msg = \"" 
+                << message << "\"\n";
+        }
+    }
+
+    if ( count == 0u )
+        return 0u;
+
+    if ( !_db->Write(rocksdb::WriteOptions(), &batch).ok() )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write batch of " << count << " record(s)\n";
+        return 0u;
+    }
+
+    for(unsigned i=0; i<count; ++i)
+        ++_tracker->writes;
+
+    _tracker->adjustSize( bytes );
+    postWrite();
+
+    if ( _debug )
+    {
+        OE_NOTICE << LC << "Bin " << getID() << ": wrote batch of " << count << " record(s)\n";
+    }
+
+    return count;
+}
+
 void
 RocksDBCacheBin::postWrite()
 {
-    if ( _tracker->hasSizeLimit() )
+    // In async mode, the tracker wakes up the purger thread when needed.
+    if ( _tracker->hasSizeLimit() && !_tracker->isAsyncPurge() )
     {
         if ( _tracker->isOverLimit() )
         {
@@ -486,10 +615,14 @@ RocksDBCacheBin::remove(const std::string& key)
     decodeMeta(metavalue, metadata);
     DateTime t(metadata.value(TIME_FIELD));
 
+    std::string datakey = dataKey(key);
+    std::string metakey = metaKey(key);
+    std::string timekey = timeKey(t, key);
+
     rocksdb::WriteBatch batch;
-    batch.Delete( dataKey(key) );
-    batch.Delete( metaKey(key) );
-    batch.Delete( timeKey(t, key) );
+    batch.Delete( datakey );
+    batch.Delete( metakey );
+    batch.Delete( timekey );
         
     rocksdb::Status status = _db->Write(rocksdb::WriteOptions(), &batch);
     if ( !status.ok() )
@@ -497,7 +630,11 @@ RocksDBCacheBin::remove(const std::string& key)
         OE_WARN << LC << "Failed to remove (" << key << ") from bin " << getID() << std::endl;
         return false;
     }
-    else if ( _debug )
+
+    _tracker->adjustSize( -Tracker::recordSize(
+        binDataKeyTuple(key), timekey, metavalue, metadata.value<unsigned>(SIZE_FIELD, 0u)) );
+
+    if ( _debug )
     {
         OE_NOTICE << LC << "Removed (" << key << ") from bin " << getID() << std::endl;
     }
@@ -653,35 +790,12 @@ RocksDBCacheBin::purgeOldest(unsigned maxnum)
     if ( !binValidForWriting() )
         return false;
 
-    rocksdb::Iterator* it = _db->NewIterator(rocksdb::ReadOptions());
-
-    unsigned count = 0;
-    std::string limit = timeEndGlobal();
-
-    // note: this will delete records NOT OF THIS BIN as well!
-    for(it->Seek(timeBeginGlobal());
-        count < maxnum && it->Valid() && it->key().ToString() < limit;
-        it->Next(), ++count )
-    {
-        if ( !it->status().ok() )
-            break;
-
-        std::string tuple = it->value().ToString();
-
-        // doing this in a WriteBatch did not work. The size of the
-        // database would never go down.
-        rocksdb::WriteOptions wo;
-        _db->Delete( wo, dataKeyFromTuple(tuple) );
-        _db->Delete( wo, metaKeyFromTuple(tuple) );
-        _db->Delete( wo, it->key() );
-    }
-
-    delete it;
+    unsigned count = Purger::purgeOldest(_db, _tracker.get(), maxnum);
 
     if ( _debug )
     {
         OE_NOTICE << LC << "Purged " << count << " record(s) for "
-            << (_tracker->calcSize()/1048576) << " MB" << std::endl;
+            << (_tracker->getSize()/1048576) << " MB" << std::endl;
     }
 
     return true;
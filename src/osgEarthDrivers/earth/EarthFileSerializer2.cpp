@@ -331,13 +331,13 @@ namespace
         return 0L;
     }
 
-    bool addLayer(const Config& conf, Map* map)
+    bool addLayer(const Config& conf, LayerVector& layers)
     {
         std::string name = conf.key();
         Layer* layer = Layer::create(name, conf);
         if (layer)
         {
-            map->addLayer(layer);
+            layers.push_back(layer);
         }
         return layer != 0L;
     }
@@ -408,7 +408,13 @@ EarthFileSerializer2::deserialize( const Config& conf, const std::string& referr
     // Start a batch update of the map:
     map->beginUpdate();
 
+    // Collect the layers so the map can open them in one batch (concurrently,
+    // if the layer_open_threads option allows it).
+    LayerVector layers;
+
     // Read all the elevation layers in FIRST so other layers can access them for things like clamping.
+    // (That only holds when layers open one at a time; with layer_open_threads > 1 the other
+    // layers open before any elevation layer is in the map.)
     // TODO: revisit this since we should really be listening for elevation data changes and
     // re-clamping based on that..
     for(ConfigSet::const_iterator i = conf.children().begin(); i != conf.children().end(); ++i)
@@ -418,12 +424,12 @@ EarthFileSerializer2::deserialize( const Config& conf, const std::string& referr
         {
             Config temp = *i;
             temp.key() = "elevation";
-            addLayer(temp, map.get());
+            addLayer(temp, layers);
         }
 
         else if ( i->key() == "elevation" ) // || i->key() == "heightfield" )
         {
-            addLayer(*i, map.get());
+            addLayer(*i, layers);
         }
     }
 
@@ -471,7 +477,7 @@ EarthFileSerializer2::deserialize( const Config& conf, const std::string& referr
         else if ( !isReservedWord(i->key()) ) // plugins/extensions.
         {
             // try to add as a plugin Layer first:
-            bool addedLayer = addLayer(*i, map.get()); 
+            bool addedLayer = addLayer(*i, layers); 
 
             // failing that, try to load as an extension:
             if ( !addedLayer )
@@ -483,6 +489,10 @@ EarthFileSerializer2::deserialize( const Config& conf, const std::string& referr
         }
     }
 
+    // Open the layers and add them in the order declared. With the default of
+    // one open thread, each layer is in the map before the next one opens.
+    map->addLayers(layers);
+
     // Complete the batch update of the map
     map->endUpdate();
 
@@ -228,18 +228,19 @@ class ReaderWriterEarth : public osgDB::ReaderWriter
             // from an "anonymous" stream here)
             URIContext uriContext( readOptions ); 
 
-            osg::ref_ptr<XmlDocument> doc = XmlDocument::load( in, uriContext );
-            if ( !doc.valid() )
+            // parse straight into a config arena and only build the part we use
+            osg::ref_ptr<ConfigArena> arena = XmlDocument::loadConfig( in, uriContext );
+            if ( !arena.valid() )
                 return ReadResult::ERROR_IN_READING_FILE;
 
-            Config docConf = doc->getConfig();
+            ConfigView docConf = arena->root();
 
             // support both "map" and "earth" tag names at the top level
             Config conf;
             if ( docConf.hasChild( "map" ) )
-                conf = docConf.child( "map" );
+                conf = docConf.child( "map" ).toConfig();
             else if ( docConf.hasChild( "earth" ) )
-                conf = docConf.child( "earth" );
+                conf = docConf.child( "earth" ).toConfig();
 
             osg::ref_ptr<osg::Node> node;
 
@@ -138,7 +138,7 @@ DrawTileCommand::draw(osg::RenderInfo& ri, DrawState& dsMaster, osg::Referenced*
         }
         dc.key = _key;
         dc.range = _range;
-        _drawCallback->draw(ri, dc, layerData);
+        _drawCallback->draw(ri, dc, layerData ? layerData : _layerData);
 
         // evaluate this.
         ds._samplerState.clear();
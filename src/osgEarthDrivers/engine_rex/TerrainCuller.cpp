@@ -195,6 +195,7 @@ TerrainCuller::apply(osg::Node& node)
                     {
                         cmd->_drawPatch = true;
                         cmd->_drawCallback = layer->getDrawCallback();
+                        cmd->_layerData = renderModel.getPatchData(layer->getUID());
                     }
                 }
             }
@@ -753,6 +753,11 @@ TileNode::merge(const TerrainTileModel* model, const RenderBindings& bindings)
     for (unsigned i = 0; i < model->patchLayers().size(); ++i)
     {
         TerrainTilePatchLayerModel* layerModel = model->patchLayers()[i].get();
+        const PatchLayer* layer = layerModel->getPatchLayer();
+        if (layer && layerModel->getTileData())
+        {
+            _renderModel.setPatchData(layer->getUID(), layerModel->getTileData());
+        }
     }
 
     if (_childrenReady)
@@ -21,10 +21,133 @@
 #include <osgDB/Registry>
 #include <osg/Notify>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TaskService>
 #include <stdlib.h>
 #include "libdxt.h"
 #include <string.h>
+#include <algorithm>
+#include <vector>
 
+using namespace osgEarth;
+
+// Smallest number of 4x4 block rows worth handing to another thread
+#define MIN_BLOCK_ROWS_PER_CHUNK 16u
+
+namespace
+{
+    // One RGBA mipmap level, padded out to whole 4x4 blocks
+    struct Level
+    {
+        int      _width, _height;          // pixels, before padding
+        int      _blocksWide, _blocksHigh;
+        byte*    _rgba;                    // 16-byte aligned, _blocksWide*4 pixels per row
+        unsigned _offset;                  // bytes from the start of the compressed image
+    };
+
+    Level createLevel(int width, int height)
+    {
+        Level level;
+        level._width      = width;
+        level._height     = height;
+        level._blocksWide = (width + 3) / 4;
+        level._blocksHigh = (height + 3) / 4;
+        level._rgba       = (byte*)memalign(16, level._blocksWide*level._blocksHigh*64);
+        level._offset     = 0u;
+        return level;
+    }
+
+    // Fills the padding to the right of and above the real pixels by
+    // repeating the last column and row, so partial blocks (in mipmaps
+    // smaller than 4x4) don't pick up garbage.
+    void fillPadding(Level& level)
+    {
+        int stride = level._blocksWide * 16;
+        for (int t = 0; t < level._height; ++t)
+        {
+            byte* row = level._rgba + t*stride;
+            for (int s = level._width; s < level._blocksWide*4; ++s)
+                memcpy(row + s*4, row + (level._width-1)*4, 4);
+        }
+        for (int t = level._height; t < level._blocksHigh*4; ++t)
+        {
+            memcpy(level._rgba + t*stride, level._rgba + (level._height-1)*stride, stride);
+        }
+    }
+
+    // Next mipmap level, with a 2x2 box filter
+    Level downsample(const Level& src)
+    {
+        Level dst = createLevel(osg::maximum(src._width/2, 1), osg::maximum(src._height/2, 1));
+        int srcStride = src._blocksWide * 16;
+        int dstStride = dst._blocksWide * 16;
+
+        for (int t = 0; t < dst._height; ++t)
+        {
+            const byte* row0 = src._rgba + osg::minimum(2*t,   src._height-1)*srcStride;
+            const byte* row1 = src._rgba + osg::minimum(2*t+1, src._height-1)*srcStride;
+            byte* out = dst._rgba + t*dstStride;
+
+            for (int s = 0; s < dst._width; ++s)
+            {
+                int s0 = osg::minimum(2*s,   src._width-1) * 4;
+                int s1 = osg::minimum(2*s+1, src._width-1) * 4;
+                for (int c = 0; c < 4; ++c)
+                {
+                    out[s*4+c] = (byte)((row0[s0+c] + row0[s1+c] + row1[s0+c] + row1[s1+c] + 2) >> 2);
+                }
+            }
+        }
+
+        fillPadding(dst);
+        return dst;
+    }
+
+    // Compresses the block rows of all the mipmap levels, numbered
+    // consecutively from the top level down.
+    struct CompressJob : public ParallelRange::Job
+    {
+        const std::vector<Level>* _levels;
+        std::vector<unsigned>     _firstRow;   // per level, plus the total at the end
+        byte*                     _out;
+        int                       _format;
+        int                       _blockSize;
+
+        void run(unsigned begin, unsigned end, unsigned chunk)
+        {
+            unsigned i = std::upper_bound(_firstRow.begin(), _firstRow.end(), begin) - _firstRow.begin() - 1u;
+
+            for (unsigned row = begin; row < end; ++i)
+            {
+                const Level& level = (*_levels)[i];
+                unsigned rowEnd = osg::minimum(end, _firstRow[i+1]);
+                unsigned levelRow = row - _firstRow[i];
+
+                const byte* in = level._rgba + levelRow*level._blocksWide*64;
+                byte* out = _out + level._offset + levelRow*level._blocksWide*_blockSize;
+                int width = level._blocksWide*4;
+                int height = (int)(rowEnd - row)*4;
+
+                int bytes = 0;
+                if (_format == FORMAT_DXT1)
+                    CompressImageDXT1(in, out, width, height, bytes);
+                else
+                    CompressImageDXT5(in, out, width, height, bytes);
+
+                row = rowEnd;
+            }
+        }
+    };
+}
+
+/**
+ * Compresses RGBA imagery to DXT1 or DXT5 on the CPU.
+ *
+ * The image (and all its mipmap levels, when requested) is split into
+ * rows of 4x4 blocks that compress independently, and the rows are
+ * spread across the shared ParallelRange thread pool. Set the
+ * OSGEARTH_FASTDXT_SINGLE_THREADED environment variable to compress
+ * on the calling thread only.
+ */
 class FastDXTProcessor : public osgDB::ImageProcessor
 {
 public:
@@ -42,7 +165,7 @@ public:
 
         //FastDXT only works on RGBA imagery so we must convert it
         osg::ref_ptr< osg::Image > rgba;
-        if (image.getPixelFormat() != GL_RGBA)
+        if (image.getPixelFormat() != GL_RGBA || image.getDataType() != GL_UNSIGNED_BYTE)
         {
             osg::Timer_t start = osg::Timer::instance()->tick();
             rgba = osgEarth::ImageUtils::convertToRGBA8( &image );
@@ -53,16 +176,19 @@ public:
 
         int format;
         GLint pixelFormat;
+        int blockSize;
         switch (compressedFormat)
         {
         case osg::Texture::USE_S3TC_DXT1_COMPRESSION:
             format = FORMAT_DXT1;
             pixelFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            blockSize = 8;
             OE_DEBUG << "FastDXT using dxt1 format" << std::endl;
             break;
         case osg::Texture::USE_S3TC_DXT5_COMPRESSION:
             format = FORMAT_DXT5;
             pixelFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            blockSize = 16;
             OE_DEBUG << "FastDXT dxt5 format" << std::endl;
             break;
         default:
@@ -71,28 +197,60 @@ public:
             break;
         }
 
-        //Copy over the source data to an array
-        unsigned char *in = 0;
-        in = (unsigned char*)memalign(16, sourceImage->getTotalSizeInBytes());
-        memcpy(in, sourceImage->data(0,0), sourceImage->getTotalSizeInBytes());
+        osg::Timer_t start = osg::Timer::instance()->tick();
 
+        // Copy the top level into an aligned, block-padded buffer, then
+        // build the mipmap chain from it.
+        std::vector<Level> levels;
+        levels.push_back( createLevel(sourceImage->s(), sourceImage->t()) );
+        for (int t = 0; t < sourceImage->t(); ++t)
+        {
+            memcpy(levels[0]._rgba + t*levels[0]._blocksWide*16, sourceImage->data(0, t), sourceImage->s()*4);
+        }
+        fillPadding(levels[0]);
 
+        if (generateMipMap)
+        {
+            while (levels.back()._width > 1 || levels.back()._height > 1)
+                levels.push_back( downsample(levels.back()) );
+        }
 
-        //Allocate memory for the output
-        unsigned char* out = (unsigned char*)memalign(16, image.s()*image.t()*4);
-        memset(out, 0, image.s()*image.t()*4);
+        CompressJob job;
+        job._levels = &levels;
+        job._format = format;
+        job._blockSize = blockSize;
 
-        osg::Timer_t start = osg::Timer::instance()->tick();
-        int outputBytes = CompressDXT(in, out, sourceImage->s(), sourceImage->t(), format);
-        osg::Timer_t end = osg::Timer::instance()->tick();
-        OE_DEBUG << "compression took" << osg::Timer::instance()->delta_m(start, end) << std::endl;
+        unsigned outputBytes = 0u;
+        unsigned numRows = 0u;
+        osg::Image::MipmapDataType mipmapOffsets;
+        for (unsigned i = 0; i < levels.size(); ++i)
+        {
+            levels[i]._offset = outputBytes;
+            if (i > 0)
+                mipmapOffsets.push_back(outputBytes);
+            job._firstRow.push_back(numRows);
+            outputBytes += levels[i]._blocksWide * levels[i]._blocksHigh * blockSize;
+            numRows += levels[i]._blocksHigh;
+        }
+        job._firstRow.push_back(numRows);
 
-        //Allocate and copy over the output data to the correct size array.
         unsigned char* data = (unsigned char*)malloc(outputBytes);
-        memcpy(data, out, outputBytes);
-        memfree(out);
-        memfree(in);
-        image.setImage(image.s(), image.t(), image.r(), pixelFormat, pixelFormat, GL_UNSIGNED_BYTE, data, osg::Image::USE_MALLOC_FREE);
+        job._out = data;
+
+        unsigned numChunks = ::getenv("OSGEARTH_FASTDXT_SINGLE_THREADED") ? 1u :
+            ParallelRange::getNumChunks(numRows, MIN_BLOCK_ROWS_PER_CHUNK);
+
+        ParallelRange::run(job, numRows, numChunks);
+
+        for (unsigned i = 0; i < levels.size(); ++i)
+            memfree(levels[i]._rgba);
+
+        osg::Timer_t end = osg::Timer::instance()->tick();
+        OE_DEBUG << "compression of " << levels.size() << " levels in " << numChunks << " chunks took " << osg::Timer::instance()->delta_m(start, end) << std::endl;
+
+        image.setImage(sourceImage->s(), sourceImage->t(), 1, pixelFormat, pixelFormat, GL_UNSIGNED_BYTE, data, osg::Image::USE_MALLOC_FREE);
+        if (!mipmapOffsets.empty())
+            image.setMipmapLevels(mipmapOffsets);
     }
 
     virtual void generateMipMap(osg::Image& image, bool resizeToPowerOfTwo, CompressionMethod method)
@@ -0,0 +1,381 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "KMLFeatureOptions"
+
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarth/URI>
+
+#include <osgEarthFeatures/FeatureSource>
+#include <osgEarthFeatures/FeatureCursor>
+#include <osgEarthFeatures/Filter>
+#include <osgEarthFeatures/FilterContext>
+#include <osgEarthFeatures/KMLFeatureReader>
+
+#include <osg/Timer>
+#include <osgDB/Archive>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+#include <algorithm>
+#include <cmath>
+
+#define LC "[KML FeatureSource] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    /**
+     * Uniform grid over the features' extent. Each cell lists the features
+     * whose bounds overlap it, so a bounds query only touches nearby features.
+     */
+    class FeatureGrid
+    {
+    public:
+        FeatureGrid() : _numCols(0), _numRows(0), _cellWidth(1.0), _cellHeight(1.0) { }
+
+        void build(const FeatureList& features)
+        {
+            _bounds.clear();
+            _cells.clear();
+            _extent = Bounds();
+
+            _bounds.reserve(features.size());
+            for (FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+            {
+                _bounds.push_back(i->get()->getGeometry()->getBounds());
+                _extent.expandBy(_bounds.back());
+            }
+
+            if (features.empty())
+                return;
+
+            // aim for a handful of features per cell:
+            int n = (int)sqrt((double)features.size() / 8.0);
+            _numCols = _numRows = osg::clampBetween(n, 1, 1024);
+            _cellWidth  = _extent.width()  > 0.0 ? _extent.width()  / (double)_numCols : 1.0;
+            _cellHeight = _extent.height() > 0.0 ? _extent.height() / (double)_numRows : 1.0;
+            _cells.resize(_numCols*_numRows);
+
+            for (unsigned f = 0; f < _bounds.size(); ++f)
+            {
+                int c0, c1, r0, r1;
+                getCells(_bounds[f], c0, c1, r0, r1);
+                for (int r = r0; r <= r1; ++r)
+                    for (int c = c0; c <= c1; ++c)
+                        _cells[r*_numCols + c].push_back(f);
+            }
+        }
+
+        // Indices (ascending) of the features whose bounds intersect "b".
+        void query(const Bounds& b, std::vector<unsigned>& output) const
+        {
+            output.clear();
+            if (_cells.empty() ||
+                b.xMax() < _extent.xMin() || b.xMin() > _extent.xMax() ||
+                b.yMax() < _extent.yMin() || b.yMin() > _extent.yMax())
+                return;
+
+            int c0, c1, r0, r1;
+            getCells(b, c0, c1, r0, r1);
+            for (int r = r0; r <= r1; ++r)
+            {
+                for (int c = c0; c <= c1; ++c)
+                {
+                    const std::vector<unsigned>& cell = _cells[r*_numCols + c];
+                    for (unsigned i = 0; i < cell.size(); ++i)
+                    {
+                        const Bounds& fb = _bounds[cell[i]];
+                        if (fb.xMax() >= b.xMin() && fb.xMin() <= b.xMax() &&
+                            fb.yMax() >= b.yMin() && fb.yMin() <= b.yMax())
+                        {
+                            output.push_back(cell[i]);
+                        }
+                    }
+                }
+            }
+
+            // features spanning several cells show up more than once:
+            std::sort(output.begin(), output.end());
+            output.erase(std::unique(output.begin(), output.end()), output.end());
+        }
+
+        const Bounds& getExtent() const { return _extent; }
+
+    private:
+        std::vector<Bounds>                  _bounds;
+        std::vector< std::vector<unsigned> > _cells;
+        Bounds                               _extent;
+        int                                  _numCols, _numRows;
+        double                               _cellWidth, _cellHeight;
+
+        void getCells(const Bounds& b, int& c0, int& c1, int& r0, int& r1) const
+        {
+            c0 = getCell(b.xMin(), _extent.xMin(), _cellWidth,  _numCols);
+            c1 = getCell(b.xMax(), _extent.xMin(), _cellWidth,  _numCols);
+            r0 = getCell(b.yMin(), _extent.yMin(), _cellHeight, _numRows);
+            r1 = getCell(b.yMax(), _extent.yMin(), _cellHeight, _numRows);
+        }
+
+        // Clamps in double precision first; casting an out-of-range double
+        // to int is undefined.
+        static int getCell(double v, double vmin, double cellSize, int numCells)
+        {
+            double c = floor((v - vmin) / cellSize);
+            return !(c > 0.0) ? 0 : c >= (double)(numCells-1) ? numCells-1 : (int)c;
+        }
+    };
+
+    // Collects the reader's batches.
+    struct CollectFeatures : public KMLFeatureReader::Handler
+    {
+        CollectFeatures(FeatureList& output) : _output(output) { }
+
+        bool onFeatures(FeatureList& features)
+        {
+            _output.insert(_output.end(), features.begin(), features.end());
+            return true;
+        }
+
+        FeatureList& _output;
+    };
+
+    // Reads the main document of a KMZ (doc.kml, or else the first .kml file)
+    // through the kml plugin's KMZ archive. The plugin passes the document's
+    // stream to the reader in the options rather than building a scene graph.
+    bool readKMZ(const URI& uri, KMLFeatureReader& reader, KMLFeatureReader::Handler& handler, const osgDB::Options* readOptions)
+    {
+        // The kml plugin registers the archive type, so make sure it's loaded.
+        if (!osgDB::Registry::instance()->getReaderWriterForExtension("kml"))
+        {
+            OE_WARN << LC << "Reading KMZ requires the kml plugin\n";
+            return false;
+        }
+
+        osg::ref_ptr<osgDB::Options> dbOptions = Registry::instance()->cloneOrCreateOptions(readOptions);
+
+        osg::ref_ptr<osgDB::Archive> archive = osgDB::openArchive(uri.full(), osgDB::ReaderWriter::READ, 4096, dbOptions.get());
+        if (!archive.valid())
+            return false;
+
+        std::string docName;
+        osgDB::Archive::FileNameList files;
+        archive->getFileNames(files);
+        for (osgDB::Archive::FileNameList::const_iterator i = files.begin(); i != files.end(); ++i)
+        {
+            if (osgDB::getLowerCaseFileExtension(*i) != "kml")
+                continue;
+
+            if (toLower(osgDB::getSimpleFileName(*i)) == "doc.kml")
+            {
+                docName = *i;
+                break;
+            }
+
+            if (docName.empty())
+                docName = *i;
+        }
+
+        if (docName.empty())
+        {
+            OE_WARN << LC << "No KML document found in \"" << uri.full() << "\"\n";
+            return false;
+        }
+
+        dbOptions->setPluginData("osgEarth::KMLFeatureReader", &reader);
+        dbOptions->setPluginData("osgEarth::KMLFeatureReader::Handler", &handler);
+
+        return archive->readObject(docName, dbOptions.get()).success();
+    }
+}
+
+/**
+ * A FeatureSource that streams the Placemarks of a KML or KMZ file into
+ * features. Use it with a feature model layer (and a paging layout) to
+ * display large KML files without an annotation node per Placemark.
+ */
+class KMLFeatureSource : public FeatureSource
+{
+public:
+    KMLFeatureSource(const KMLFeatureOptions& options) :
+        FeatureSource( options ),
+        _options     ( options )
+    {
+        //nop
+    }
+
+    //override
+    Status initialize(const osgDB::Options* readOptions)
+    {
+        if (!_options.url().isSet())
+        {
+            return Status::Error(Status::ConfigurationError, "KML driver requires a url");
+        }
+
+        const URI& uri = _options.url().get();
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        KMLFeatureReader reader(_options.batchSize().get());
+        CollectFeatures collector(_features);
+
+        bool ok;
+        if (osgDB::getLowerCaseFileExtension(uri.full()) == "kmz")
+        {
+            ok = readKMZ(uri, reader, collector, readOptions);
+        }
+        else
+        {
+            URIStream stream(uri);
+            ok = reader.read(stream, collector);
+        }
+
+        if (!ok)
+        {
+            return Status::Error(Status::ResourceUnavailable, Stringify() << "Failed to read KML from \"" << uri.full() << "\"");
+        }
+
+        _grid.build(_features);
+
+        OE_INFO << LC << "Read " << _features.size() << " features from \"" << uri.base() << "\" in "
+            << osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) << "s\n";
+
+        const SpatialReference* srs = SpatialReference::get("wgs84");
+        GeoExtent extent = _features.empty() ?
+            GeoExtent(srs, -180.0, -90.0, 180.0, 90.0) :
+            GeoExtent(srs, _grid.getExtent());
+
+        FeatureProfile* fp = new FeatureProfile(extent);
+        if (_options.geoInterp().isSet())
+            fp->geoInterp() = _options.geoInterp().get();
+        setFeatureProfile(fp);
+
+        return Status::OK();
+    }
+
+    FeatureCursor* createFeatureCursor(const Symbology::Query& query)
+    {
+        const FeatureProfile* profile = getFeatureProfile();
+        if (!profile)
+            return 0L;
+
+        // Find the region of interest, if there is one:
+        optional<Bounds> bounds;
+        if (query.bounds().isSet())
+        {
+            bounds = query.bounds().get();
+        }
+        else if (query.tileKey().isSet())
+        {
+            bounds = query.tileKey()->getExtent().transform(profile->getSRS()).bounds();
+        }
+
+        FeatureList features;
+        if (bounds.isSet())
+        {
+            std::vector<unsigned> indices;
+            _grid.query(bounds.get(), indices);
+            features.reserve(indices.size());
+            for (unsigned i = 0; i < indices.size(); ++i)
+                features.push_back(new Feature(*_features[indices[i]].get(), osg::CopyOp::DEEP_COPY_ALL));
+        }
+        else
+        {
+            features.reserve(_features.size());
+            for (FeatureList::const_iterator i = _features.begin(); i != _features.end(); ++i)
+                features.push_back(new Feature(*i->get(), osg::CopyOp::DEEP_COPY_ALL));
+        }
+
+        // Filters may modify the features, which is why they are copies.
+        if (getFilters() && !getFilters()->empty() && !features.empty())
+        {
+            FilterContext cx;
+            cx.setProfile(profile);
+            if (bounds.isSet())
+                cx.extent() = GeoExtent(profile->getSRS(), bounds.get());
+
+            for (FeatureFilterChain::const_iterator i = getFilters()->begin(); i != getFilters()->end(); ++i)
+            {
+                cx = i->get()->push(features, cx);
+            }
+        }
+
+        return new FeatureListCursor(features);
+    }
+
+    virtual int getFeatureCount() const
+    {
+        return _features.size();
+    }
+
+    virtual bool supportsGetFeature() const
+    {
+        return true;
+    }
+
+    virtual Feature* getFeature(FeatureID fid)
+    {
+        // FIDs are assigned in document order, starting at 1.
+        if (fid >= 1 && fid <= (FeatureID)_features.size() && _features[fid-1]->getFID() == fid)
+            return _features[fid-1].get();
+        return 0L;
+    }
+
+    virtual bool isWritable() const
+    {
+        return false;
+    }
+
+    virtual Geometry::Type getGeometryType() const
+    {
+        return Geometry::TYPE_UNKNOWN;
+    }
+
+private:
+    const KMLFeatureOptions _options;
+    FeatureList             _features;
+    FeatureGrid             _grid;
+};
+
+
+class KMLFeatureSourceFactory : public FeatureSourceDriver
+{
+public:
+    KMLFeatureSourceFactory()
+    {
+        supportsExtension( "osgearth_feature_kml", "KML feature driver for osgEarth" );
+    }
+
+    virtual const char* className() const
+    {
+        return "KML Feature Reader";
+    }
+
+    virtual ReadResult readObject(const std::string& file_name, const Options* options) const
+    {
+        if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( file_name )))
+            return ReadResult::FILE_NOT_HANDLED;
+
+        return ReadResult( new KMLFeatureSource( getFeatureSourceOptions(options) ) );
+    }
+};
+
+REGISTER_OSGPLUGIN(osgearth_feature_kml, KMLFeatureSourceFactory)
@@ -27,6 +27,7 @@
 #include <osgEarthFeatures/FilterContext>
 
 #include <osgEarthSymbology/Geometry>
+#include <osgEarthSymbology/PreparedGeometrySet>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -45,6 +46,12 @@ class IntersectFeatureFilter : public FeatureFilter, public IntersectFeatureFilt
 private:
     osg::ref_ptr< FeatureSource > _featureSource;
 
+    // Boundaries transformed into each target SRS, loaded and indexed once
+    // and then shared by every tile.
+    typedef std::pair< osg::ref_ptr<const SpatialReference>, osg::ref_ptr<PreparedGeometrySet> > CachedBoundaries;
+    std::vector< CachedBoundaries > _boundaries;
+    Threading::Mutex _boundariesMutex;
+
 public:
     IntersectFeatureFilter(const ConfigOptions& options)
         : FeatureFilter(), IntersectFeatureFilterOptions(options)
@@ -68,96 +75,64 @@ public: // FeatureFilter
     }
 
     /**
-     * Gets all the features that intersect the extent
+     * Gets the boundary geometries in the given SRS, reading and indexing
+     * the whole boundary source the first time an SRS is requested.
      */
-    void getFeatures(const GeoExtent& extent, FeatureList& features)
+    PreparedGeometrySet* getBoundaries(const SpatialReference* srs)
     {
-        GeoExtent localExtent = extent.transform( _featureSource->getFeatureProfile()->getSRS() );
-        Query query;
-        query.bounds() = localExtent.bounds();
-        if (localExtent.intersects( _featureSource->getFeatureProfile()->getExtent()))
+        Threading::ScopedMutexLock lock(_boundariesMutex);
+
+        for (unsigned i = 0; i < _boundaries.size(); ++i)
         {
-            osg::ref_ptr< FeatureCursor > cursor = _featureSource->createFeatureCursor( query );
-            if (cursor)
+            if (_boundaries[i].first->isEquivalentTo(srs))
+                return _boundaries[i].second.get();
+        }
+
+        osg::ref_ptr<PreparedGeometrySet> boundaries = new PreparedGeometrySet();
+
+        osg::ref_ptr< FeatureCursor > cursor = _featureSource->createFeatureCursor();
+        if (cursor.valid())
+        {
+            while (cursor->hasMore())
             {
-                cursor->fill( features );
+                osg::ref_ptr<Feature> feature = cursor->nextFeature();
+                if (feature.valid() && feature->getGeometry())
+                {
+                    feature->transform( srs );
+                    boundaries->add( feature->getGeometry() );
+                }
             }
-        }     
+        }
+        boundaries->build();
+
+        OE_INFO << LC << "Indexed " << boundaries->getNumParts() << " boundary parts for " << srs->getName() << "\n";
+
+        _boundaries.push_back( CachedBoundaries(srs, boundaries.get()) );
+        return boundaries.get();
     }
 
     FilterContext push(FeatureList& input, FilterContext& context)
     {
         if (_featureSource.valid())
         {
-            // Get any features that intersect this query.
-            FeatureList boundaries;
-            getFeatures(context.extent().get(), boundaries );
-            
-            
+            PreparedGeometrySet* boundaries = getBoundaries( context.profile()->getSRS() );
+
             // The list of output features
             FeatureList output;
 
-            if (boundaries.empty())
+            for(FeatureList::const_iterator f = input.begin(); f != input.end(); ++f)
             {
-                // No intersecting features.  If contains is false, then just the output to the input.
-                if (contains() == false)
+                Feature* feature = f->get();
+                if ( feature && feature->getGeometry() )
                 {
-                    output = input;
-                }
-            }
-            else
-            {
-                // Transform the boundaries into the coordinate system of the features
-                for (FeatureList::iterator itr = boundaries.begin(); itr != boundaries.end(); ++itr)
-                {
-                    itr->get()->transform( context.profile()->getSRS() );
-                }
+                    // The set rejects centroids outside the boundaries' bounds,
+                    // then tests only the boundaries whose bounds contain it.
+                    osg::Vec2d c = feature->getGeometry()->getBounds().center2d();
+                    bool contained = boundaries->contains2D(c.x(), c.y());
 
-                for(FeatureList::const_iterator f = input.begin(); f != input.end(); ++f)
-                {
-                    Feature* feature = f->get();
-                    if ( feature && feature->getGeometry() )
+                    if ( contained == contains().get() )
                     {
-                        osg::Vec2d c = feature->getGeometry()->getBounds().center2d();
-
-                        if ( contains() == true )
-                        {
-                            // coarsest:
-                            if (_featureSource->getFeatureProfile()->getExtent().contains(GeoPoint(feature->getSRS(), c.x(), c.y())))
-                            {
-                                for (FeatureList::iterator itr = boundaries.begin(); itr != boundaries.end(); ++itr)
-                                {
-                                    Ring* ring = dynamic_cast< Ring*>(itr->get()->getGeometry());
-                                    if (ring && ring->contains2D(c.x(), c.y()))
-                                    {
-                                        output.push_back( feature );
-                                    }
-                                }                        
-                            }
-                        }
-
-                        else
-                        {    
-                            bool contained = false;
-
-                            // coarsest:
-                            if (_featureSource->getFeatureProfile()->getExtent().contains(GeoPoint(feature->getSRS(), c.x(), c.y())))
-                            {
-                                for (FeatureList::iterator itr = boundaries.begin(); itr != boundaries.end(); ++itr)
-                                {
-                                    Ring* ring = dynamic_cast< Ring*>(itr->get()->getGeometry());
-                                    if (ring && ring->contains2D(c.x(), c.y()))
-                                    {                             
-                                        contained = true;
-                                        break;
-                                    }
-                                }
-                            }
-                            if ( !contained )
-                            {
-                                output.push_back( feature );
-                            }
-                        }
+                        output.push_back( feature );
                     }
                 }
             }
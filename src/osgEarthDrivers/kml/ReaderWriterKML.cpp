@@ -25,6 +25,7 @@
 #include <osgEarth/Containers>
 #include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarthFeatures/KMLFeatureReader>
 
 #include "KMLOptions"
 #include "KMLReader"
@@ -57,6 +58,23 @@ struct ReaderWriterKML : public osgDB::ReaderWriter
 
     osgDB::ReaderWriter::ReadResult readObject(std::istream& in, const osgDB::Options* dbOptions ) const
     {
+        // The KML feature source reads KMZ documents through the archive,
+        // which lands here; stream the features to it instead of building nodes.
+        if ( dbOptions )
+        {
+            Features::KMLFeatureReader* featureReader = const_cast<Features::KMLFeatureReader*>(
+                static_cast<const Features::KMLFeatureReader*>( dbOptions->getPluginData("osgEarth::KMLFeatureReader")) );
+            Features::KMLFeatureReader::Handler* handler = const_cast<Features::KMLFeatureReader::Handler*>(
+                static_cast<const Features::KMLFeatureReader::Handler*>( dbOptions->getPluginData("osgEarth::KMLFeatureReader::Handler")) );
+
+            if ( featureReader && handler )
+            {
+                return featureReader->read(in, *handler) ?
+                    ReadResult(ReadResult::FILE_LOADED) :
+                    ReadResult(ReadResult::ERROR_IN_READING_FILE);
+            }
+        }
+
         return readNode(in, dbOptions);
     }
 
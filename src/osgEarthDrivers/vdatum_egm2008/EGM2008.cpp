@@ -76,6 +76,8 @@ namespace
             _geoid->setUnits( Units::METERS );
             _geoid->setName( "EGM2008" );
         }
+
+        bool usesGeoidHeights() const { return true; }
     };
 }
 
@@ -76,6 +76,8 @@ namespace
             _geoid->setUnits( Units::METERS );
             _geoid->setName( "EGM84" );
         }
+
+        bool usesGeoidHeights() const { return true; }
     };
 }
 
@@ -78,6 +78,8 @@ namespace
             _geoid->setUnits( Units::METERS );
             _geoid->setName( "EGM96" );
         }
+
+        bool usesGeoidHeights() const { return true; }
     };
 }
 
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/CropFilter>
+#include <osgEarthSymbology/PreparedGeometrySet>
 
 #define LC "[CropFilter] "
 
@@ -78,9 +79,12 @@ CropFilter::push( FeatureList& input, FilterContext& context )
     {
 #ifdef OSGEARTH_HAVE_GEOS
 
-        // create the intersection polygon:
-        osg::ref_ptr<Symbology::Polygon> poly;
-        
+        // The crop polygon is imported into GEOS and prepared once, then
+        // reused for every feature that straddles the extent.
+        osg::ref_ptr<PreparedGeometrySet> cropSet;
+
+        const Bounds extentBounds( extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax() );
+
         for( FeatureList::iterator i = input.begin(); i != input.end();  )
         {
             bool keepFeature = false;
@@ -103,20 +107,31 @@ CropFilter::push( FeatureList& input, FilterContext& context )
                     newExtent.expandToInclude( bounds );
                 }
 
+                // trivial rejection, without going to GEOS:
+                else if ( bounds.xMin() > extentBounds.xMax() || bounds.xMax() < extentBounds.xMin() ||
+                          bounds.yMin() > extentBounds.yMax() || bounds.yMax() < extentBounds.yMin() )
+                {
+                    //nop
+                }
+
                 // then move on to the cropping operation:
                 else
                 {
-                    if ( !poly.valid() )
+                    if ( !cropSet.valid() )
                     {
-                        poly = new Symbology::Polygon();
+                        osg::ref_ptr<Symbology::Polygon> poly = new Symbology::Polygon();
                         poly->push_back( osg::Vec3d( extent.xMin(), extent.yMin(), 0 ));
                         poly->push_back( osg::Vec3d( extent.xMax(), extent.yMin(), 0 ));
                         poly->push_back( osg::Vec3d( extent.xMax(), extent.yMax(), 0 ));
                         poly->push_back( osg::Vec3d( extent.xMin(), extent.yMax(), 0 ));
+
+                        cropSet = new PreparedGeometrySet();
+                        cropSet->add( poly.get() );
+                        cropSet->build();
                     }
 
                     osg::ref_ptr<Geometry> croppedGeometry;
-                    if ( featureGeom->crop( poly.get(), croppedGeometry ) )
+                    if ( cropSet->crop( featureGeom, croppedGeometry ) )
                     {
                         if ( croppedGeometry->isValid() )
                         {
@@ -164,12 +164,6 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
     if ( !_features.valid() || !_features->getFeatureProfile() )
         return 0L;
 
-    // style data
-    const StyleSheet* styles = _options.styles().get();
-
-    // implementation-specific data
-    osg::ref_ptr<osg::Referenced> buildData = createBuildData();
-
     // allocate the image.
     osg::ref_ptr<osg::Image> image = allocateImage();
     if ( !image.valid() )
@@ -178,7 +172,24 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
         image->allocateImage( getPixelsPerTile(), getPixelsPerTile(), 1, GL_RGBA, GL_UNSIGNED_BYTE );
     }
 
-    preProcess( image.get(), buildData.get() );
+    renderImage( key, image.get(), progress );
+
+    return image.release();
+}
+
+bool
+FeatureTileSource::renderImage( const TileKey& key, osg::Image* image, ProgressCallback* progress )
+{
+    if ( !_features.valid() || !_features->getFeatureProfile() || !image )
+        return false;
+
+    // style data
+    const StyleSheet* styles = _options.styles().get();
+
+    // implementation-specific data
+    osg::ref_ptr<osg::Referenced> buildData = createBuildData();
+
+    preProcess( image, buildData.get() );
 
     Query defaultQuery;
     defaultQuery.tileKey() = key;
@@ -203,7 +214,7 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
                     list,
                     buildData.get(),
                     key.getExtent(),
-                    image.get() );
+                    image );
             }
         }
     }
@@ -268,7 +279,7 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
                                         list,
                                         buildData.get(),
                                         key.getExtent(),
-                                        image.get() );
+                                        image );
                                 }
                             }
                         }
@@ -279,25 +290,25 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
                     const Style* style = styles->getStyle( sel.getSelectedStyleName() );
                     Query query = sel.query().get();
                     query.tileKey() = key;
-                    queryAndRenderFeaturesForStyle( *style, query, buildData.get(), key.getExtent(), image.get() );
+                    queryAndRenderFeaturesForStyle( *style, query, buildData.get(), key.getExtent(), image );
                 }
             }
         }
         else
         {
             const Style* style = styles->getDefaultStyle();
-            queryAndRenderFeaturesForStyle( *style, defaultQuery, buildData.get(), key.getExtent(), image.get() );
+            queryAndRenderFeaturesForStyle( *style, defaultQuery, buildData.get(), key.getExtent(), image );
         }
     }
     else
     {
-        queryAndRenderFeaturesForStyle( Style(), defaultQuery, buildData.get(), key.getExtent(), image.get() );
+        queryAndRenderFeaturesForStyle( Style(), defaultQuery, buildData.get(), key.getExtent(), image );
     }
 
     // final tile processing after all styles are done
-    postProcess( image.get(), buildData.get() );
+    postProcess( image, buildData.get() );
 
-    return image.release();
+    return true;
 }
 
 
@@ -0,0 +1,639 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/KMLFeatureReader>
+
+#include <osgEarth/StringUtils>
+#include <osgEarth/SpatialReference>
+#include <osgEarthSymbology/Geometry>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define LC "[KMLFeatureReader] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    /**
+     * Minimal pull parser for XML. Reads the stream a block at a time and
+     * returns one start tag, end tag or run of text per call. Comments,
+     * processing instructions and DOCTYPEs are skipped; CDATA is returned
+     * as text. Element and attribute names have any namespace prefix removed.
+     */
+    class XmlPullParser
+    {
+    public:
+        enum Token { END_OF_INPUT, START_TAG, END_TAG, TEXT };
+
+        XmlPullParser(std::istream& in) :
+            _in(in), _pos(0), _len(0), _captureText(false), _selfClosing(false), _last(-1)
+        {
+            _buf.resize(65536);
+        }
+
+        // Whether the next TEXT tokens should collect their content.
+        // (Text is still skipped over when this is off, just not stored.)
+        void setCaptureText(bool value) { _captureText = value; }
+
+        Token next()
+        {
+            _name.clear();
+            _text.clear();
+            _attrs.clear();
+            _selfClosing = false;
+
+            for(;;)
+            {
+                int c = get();
+                if (c < 0)
+                    return END_OF_INPUT;
+
+                if (c != '<')
+                {
+                    readText(c);
+                    return TEXT;
+                }
+
+                c = get();
+                if (c == '/')
+                {
+                    readName(get());
+                    if (_last != '>')
+                        skipTo('>');
+                    return END_TAG;
+                }
+                else if (c == '?')
+                {
+                    skipTo("?>");
+                }
+                else if (c == '!')
+                {
+                    if (match("--"))
+                        skipTo("-->");
+                    else if (match("[CDATA["))
+                    {
+                        readCData();
+                        return TEXT;
+                    }
+                    else
+                        skipDeclaration();
+                }
+                else if (c >= 0)
+                {
+                    readName(c);
+                    readAttributes();
+                    return START_TAG;
+                }
+            }
+        }
+
+        const std::string& name() const { return _name; }
+        const std::string& text() const { return _text; }
+        bool isSelfClosing() const { return _selfClosing; }
+
+        std::string attr(const std::string& name) const
+        {
+            for (unsigned i = 0; i + 1 < _attrs.size(); i += 2)
+                if (_attrs[i] == name)
+                    return _attrs[i+1];
+            return std::string();
+        }
+
+    private:
+        std::istream&            _in;
+        std::vector<char>        _buf;
+        std::size_t              _pos, _len;
+        bool                     _captureText;
+        std::string              _name;
+        std::string              _text;
+        std::vector<std::string> _attrs;
+        bool                     _selfClosing;
+        int                      _last;
+
+        int get()
+        {
+            if (_pos == _len)
+            {
+                if (!_in.good())
+                    return -1;
+                _in.read(&_buf[0], _buf.size());
+                _len = (std::size_t)_in.gcount();
+                _pos = 0;
+                if (_len == 0)
+                    return -1;
+            }
+            return (unsigned char)_buf[_pos++];
+        }
+
+        // Consumes "s" if it comes next. Only used right after "<!", so a
+        // mismatch just means a DOCTYPE or similar, which gets skipped anyway.
+        bool match(const char* s)
+        {
+            for (; *s; ++s)
+            {
+                if (_pos == _len && get() >= 0)
+                    --_pos;
+                if (_pos == _len || _buf[_pos] != *s)
+                    return false;
+                ++_pos;
+            }
+            return true;
+        }
+
+        void skipTo(char end)
+        {
+            int c;
+            while ((c = get()) >= 0 && c != end);
+        }
+
+        void skipTo(const char* end)
+        {
+            std::size_t n = strlen(end), matched = 0;
+            int c;
+            while (matched < n && (c = get()) >= 0)
+            {
+                if (c == end[matched])
+                    ++matched;
+                else
+                    matched = (c == end[0]) ? 1 : 0;
+            }
+        }
+
+        void skipDeclaration()
+        {
+            // DOCTYPE may contain an internal subset in brackets
+            int depth = 0, c;
+            while ((c = get()) >= 0)
+            {
+                if (c == '[') ++depth;
+                else if (c == ']') --depth;
+                else if (c == '>' && depth <= 0) return;
+            }
+        }
+
+        static bool isSpace(int c)
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        void readName(int c)
+        {
+            while (c >= 0 && !isSpace(c) && c != '>' && c != '/' && c != '=')
+            {
+                if (c == ':')
+                    _name.clear();
+                else
+                    _name.push_back((char)c);
+                c = get();
+            }
+            _last = c;
+        }
+
+        void readAttributes()
+        {
+            int c = _last;
+            for(;;)
+            {
+                while (c >= 0 && isSpace(c))
+                    c = get();
+
+                if (c < 0 || c == '>')
+                    return;
+
+                if (c == '/')
+                {
+                    _selfClosing = true;
+                    c = get();
+                    continue;
+                }
+
+                // attribute name:
+                std::string name;
+                while (c >= 0 && !isSpace(c) && c != '=' && c != '>' && c != '/')
+                {
+                    if (c == ':')
+                        name.clear();
+                    else
+                        name.push_back((char)c);
+                    c = get();
+                }
+                while (c >= 0 && isSpace(c))
+                    c = get();
+
+                std::string value;
+                if (c == '=')
+                {
+                    c = get();
+                    while (c >= 0 && isSpace(c))
+                        c = get();
+                    if (c == '"' || c == '\'')
+                    {
+                        int quote = c;
+                        while ((c = get()) >= 0 && c != quote)
+                            value.push_back((char)c);
+                        c = get();
+                    }
+                }
+
+                _attrs.push_back(name);
+                _attrs.push_back(decode(value));
+            }
+        }
+
+        void readText(int c)
+        {
+            while (c >= 0 && c != '<')
+            {
+                if (_captureText)
+                    _text.push_back((char)c);
+                c = get();
+            }
+            // put back the '<' for the next token.
+            if (c == '<')
+                --_pos;
+            if (_captureText)
+                _text = decode(_text);
+        }
+
+        void readCData()
+        {
+            if (!_captureText)
+            {
+                skipTo("]]>");
+                return;
+            }
+
+            int c;
+            while ((c = get()) >= 0)
+            {
+                _text.push_back((char)c);
+                std::size_t n = _text.size();
+                if (n >= 3 && _text[n-1] == '>' && _text[n-2] == ']' && _text[n-3] == ']')
+                {
+                    _text.resize(n-3);
+                    break;
+                }
+            }
+        }
+
+        // Replaces the predefined and numeric character entities.
+        static std::string decode(const std::string& in)
+        {
+            if (in.find('&') == std::string::npos)
+                return in;
+
+            std::string out;
+            out.reserve(in.size());
+            for (std::size_t i = 0; i < in.size(); ++i)
+            {
+                if (in[i] == '&')
+                {
+                    std::size_t semi = in.find(';', i);
+                    if (semi != std::string::npos && semi - i <= 10)
+                    {
+                        std::string e = in.substr(i+1, semi-i-1);
+                        unsigned long code = 0;
+                        bool ok = true;
+                        if      (e == "amp")  code = '&';
+                        else if (e == "lt")   code = '<';
+                        else if (e == "gt")   code = '>';
+                        else if (e == "quot") code = '"';
+                        else if (e == "apos") code = '\'';
+                        else if (e.size() > 1 && e[0] == '#')
+                            code = (e[1] == 'x' || e[1] == 'X') ? strtoul(e.c_str()+2, 0L, 16) : strtoul(e.c_str()+1, 0L, 10);
+                        else
+                            ok = false;
+
+                        if (ok)
+                        {
+                            appendUTF8(out, code);
+                            i = semi;
+                            continue;
+                        }
+                    }
+                }
+                out.push_back(in[i]);
+            }
+            return out;
+        }
+
+        static void appendUTF8(std::string& out, unsigned long code)
+        {
+            if (code < 0x80) {
+                out.push_back((char)code);
+            }
+            else if (code < 0x800) {
+                out.push_back((char)(0xC0 | (code >> 6)));
+                out.push_back((char)(0x80 | (code & 0x3F)));
+            }
+            else if (code < 0x10000) {
+                out.push_back((char)(0xE0 | (code >> 12)));
+                out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (code & 0x3F)));
+            }
+            else {
+                out.push_back((char)(0xF0 | (code >> 18)));
+                out.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+                out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (code & 0x3F)));
+            }
+        }
+    };
+
+
+    /**
+     * Collects the parts of one Placemark as its elements stream past.
+     */
+    class PlacemarkBuilder
+    {
+    public:
+        PlacemarkBuilder(const SpatialReference* srs) : _srs(srs), _active(false) { }
+
+        bool isActive() const { return _active; }
+
+        void begin()
+        {
+            _active = true;
+            _geoms.clear();
+            _geom = 0L;
+            _attrs.clear();
+        }
+
+        // Called for each start tag inside the Placemark.
+        void startElement(const XmlPullParser& p)
+        {
+            const std::string& name = p.name();
+
+            if      (name == "Point")         _geoms.push_back(new PointSet());
+            else if (name == "LineString")    _geoms.push_back(new LineString());
+            else if (name == "LinearRing")    _geoms.push_back(new Ring());
+            else if (name == "Polygon")       _geoms.push_back(new Polygon());
+            else if (name == "MultiGeometry") _geoms.push_back(new MultiGeometry());
+            else if (name == "Data" || name == "SimpleData")
+                _dataName = p.attr("name");
+        }
+
+        // Called for each end tag inside the Placemark, with the text content
+        // of the element (if it was captured) and the name of its parent.
+        void endElement(const std::string& name, const std::string& text, const std::string& parent)
+        {
+            if (name == "coordinates")
+            {
+                if (!_geoms.empty())
+                    parseCoordinates(text, _geoms.back().get());
+            }
+            else if (name == "Point" || name == "LineString" || name == "LinearRing" || name == "Polygon" || name == "MultiGeometry")
+            {
+                if (_geoms.empty())
+                    return;
+
+                osg::ref_ptr<Geometry> geom = _geoms.back();
+                _geoms.pop_back();
+
+                // boundary rings of a Polygon:
+                if (name == "LinearRing" && !_geoms.empty() && _geoms.back()->getType() == Geometry::TYPE_POLYGON)
+                {
+                    Polygon* poly = static_cast<Polygon*>(_geoms.back().get());
+                    if (parent == "outerBoundaryIs")
+                        poly->insert(poly->end(), geom->begin(), geom->end());
+                    else if (parent == "innerBoundaryIs")
+                        poly->getHoles().push_back(static_cast<Ring*>(geom.get()));
+                }
+                else if (!_geoms.empty() && _geoms.back()->getType() == Geometry::TYPE_MULTI)
+                {
+                    static_cast<MultiGeometry*>(_geoms.back().get())->getComponents().push_back(geom.get());
+                }
+                else if (_geoms.empty() && !_geom.valid())
+                {
+                    _geom = geom.get();
+                }
+            }
+            else if (name == "value" && parent == "Data")
+            {
+                if (!_dataName.empty())
+                    _attrs.push_back(std::make_pair(_dataName, trim(text)));
+            }
+            else if (name == "SimpleData")
+            {
+                if (!_dataName.empty())
+                    _attrs.push_back(std::make_pair(_dataName, trim(text)));
+            }
+            else if (parent == "Placemark" && (name == "name" || name == "description" || name == "styleUrl"))
+            {
+                _attrs.push_back(std::make_pair(name, trim(text)));
+            }
+            else if (name == "altitudeMode")
+            {
+                _attrs.push_back(std::make_pair(name, trim(text)));
+            }
+        }
+
+        // Whether the text of an element is worth keeping.
+        static bool wantsText(const std::string& name)
+        {
+            return
+                name == "coordinates" || name == "name" || name == "description" ||
+                name == "styleUrl" || name == "value" || name == "SimpleData" ||
+                name == "altitudeMode";
+        }
+
+        // Finishes the Placemark; returns NULL if it had no usable geometry.
+        Feature* end(FeatureID fid)
+        {
+            _active = false;
+
+            if (!_geom.valid() || !_geom->isValid())
+                return 0L;
+
+            Feature* feature = new Feature(_geom.get(), _srs.get(), Style(), fid);
+            for (unsigned i = 0; i < _attrs.size(); ++i)
+                feature->set(_attrs[i].first, _attrs[i].second);
+
+            _geom = 0L;
+            return feature;
+        }
+
+    private:
+        osg::ref_ptr<const SpatialReference>            _srs;
+        bool                                            _active;
+        std::vector< osg::ref_ptr<Geometry> >           _geoms;
+        osg::ref_ptr<Geometry>                          _geom;
+        std::vector< std::pair<std::string,std::string> > _attrs;
+        std::string                                     _dataName;
+
+        // "lon,lat[,alt]" tuples separated by whitespace
+        static void parseCoordinates(const std::string& text, Geometry* geom)
+        {
+            const char* s = text.c_str();
+            for(;;)
+            {
+                while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r' || *s == ',')
+                    ++s;
+                if (*s == 0)
+                    break;
+
+                double v[3] = { 0.0, 0.0, 0.0 };
+                int n = 0;
+                char* next;
+                for (; n < 3; ++n)
+                {
+                    v[n] = strtod(s, &next);
+                    if (next == s)
+                        break;
+                    s = next;
+                    if (*s != ',')
+                    {
+                        ++n;
+                        break;
+                    }
+                    ++s;
+                }
+
+                if (n >= 2)
+                    geom->push_back(osg::Vec3d(v[0], v[1], n > 2 ? v[2] : 0.0));
+
+                // skip anything unparseable up to the next tuple
+                while (*s && *s != ' ' && *s != '\t' && *s != '\n' && *s != '\r')
+                    ++s;
+            }
+        }
+    };
+}
+
+//........................................................................
+
+KMLFeatureReader::KMLFeatureReader(unsigned batchSize) :
+_batchSize  ( batchSize > 0u ? batchSize : 1u ),
+_numFeatures( 0u )
+{
+    //nop
+}
+
+bool
+KMLFeatureReader::read(std::istream& in, Handler& handler)
+{
+    _numFeatures = 0u;
+
+    osg::ref_ptr<const SpatialReference> srs = SpatialReference::get("wgs84");
+
+    XmlPullParser parser(in);
+    PlacemarkBuilder placemark(srs.get());
+
+    // names of the open elements; the text of the innermost one.
+    std::vector<std::string> stack;
+    std::string text;
+    bool isKML = false;
+
+    FeatureList batch;
+
+    for(;;)
+    {
+        XmlPullParser::Token token = parser.next();
+
+        if (token == XmlPullParser::END_OF_INPUT)
+        {
+            break;
+        }
+
+        else if (token == XmlPullParser::START_TAG)
+        {
+            const std::string& name = parser.name();
+
+            if (!isKML)
+            {
+                isKML = (name == "kml");
+                if (!isKML)
+                {
+                    OE_WARN << LC << "Not a KML document (root element is \"" << name << "\")\n";
+                    return false;
+                }
+            }
+
+            if (name == "Placemark")
+                placemark.begin();
+            else if (placemark.isActive())
+                placemark.startElement(parser);
+
+            text.clear();
+
+            if (parser.isSelfClosing())
+            {
+                if (placemark.isActive() && name != "Placemark")
+                    placemark.endElement(name, text, stack.empty() ? std::string() : stack.back());
+            }
+            else
+            {
+                stack.push_back(name);
+                parser.setCaptureText(placemark.isActive() && PlacemarkBuilder::wantsText(name));
+            }
+        }
+
+        else if (token == XmlPullParser::TEXT)
+        {
+            text += parser.text();
+        }
+
+        else if (token == XmlPullParser::END_TAG)
+        {
+            // An end tag that matches no open element is ignored; one that
+            // matches an outer element also closes the elements inside it.
+            std::vector<std::string>::reverse_iterator open = std::find(stack.rbegin(), stack.rend(), parser.name());
+            if (open == stack.rend())
+                continue;
+
+            stack.erase(open.base() - 1, stack.end());
+            const std::string name = parser.name();
+
+            if (name == "Placemark" && placemark.isActive())
+            {
+                osg::ref_ptr<Feature> feature = placemark.end(_numFeatures + 1);
+                if (feature.valid())
+                {
+                    ++_numFeatures;
+                    batch.push_back(feature.get());
+
+                    if (batch.size() >= _batchSize)
+                    {
+                        bool keepGoing = handler.onFeatures(batch);
+                        batch.clear();
+                        if (!keepGoing)
+                            return true;
+                    }
+                }
+            }
+            else if (placemark.isActive())
+            {
+                placemark.endElement(name, text, stack.empty() ? std::string() : stack.back());
+            }
+
+            text.clear();
+            parser.setCaptureText(false);
+        }
+    }
+
+    if (!batch.empty())
+        handler.onFeatures(batch);
+
+    return isKML;
+}
@@ -77,10 +77,10 @@ Session::init()
 {
     setStyles(_styles.get());
 
-    // A new cache to optimize state changes. Since the cache lives in the Session, any
-    // geometry created under this session takes advantage of it. That's reasonable since
-    // tiles in a particular "layer" will tend to share state.
-    _stateSetCache = new StateSetCache();
+    // Cache to optimize state changes. The cache is thread-safe, so by default every
+    // Session shares the global one; that way tiles from different layers and
+    // different pager threads all share the same state.
+    _stateSetCache = Registry::stateSetCache();
 
     _name = "Session (unnamed)";
 }
@@ -134,6 +134,12 @@ Session::getStateSetCache()
     return _stateSetCache.get();
 }
 
+void
+Session::setStateSetCache(StateSetCache* cache)
+{
+    _stateSetCache = cache ? cache : Registry::stateSetCache();
+}
+
 void
 Session::setStyles( StyleSheet* value )
 {
@@ -487,7 +487,7 @@ SubstituteModelFilter::push(FeatureList& features, FilterContext& context)
         osg::ref_ptr< osg::Node > unclusterables = extractUnclusterables(attachPoint.get());
 
         // We run on the attachPoint instead of the main group so that we don't lose the double precision declocalizer transform.
-        MeshFlattener::run(attachPoint.get());
+        MeshFlattener::runParallel(attachPoint.get());
 
         // Add the unclusterables back to the attach point after the rest of the graph was flattened.
         if (unclusterables.valid())
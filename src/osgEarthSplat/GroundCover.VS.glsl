@@ -0,0 +1,93 @@
+#version $GLSL_VERSION_STR
+$GLSL_DEFAULT_PRECISION_FLOAT
+#pragma vp_name       GroundCover instanced vertex shader
+#pragma vp_entryPoint oe_GroundCover_instance
+#pragma vp_location   vertex_view
+#pragma vp_order      0.9
+
+// Renders one billboard per instance (6 vertices, 2 triangles) from the
+// per-tile instance buffer computed on the CPU (see GroundCoverPlacer).
+
+uniform samplerBuffer oe_GroundCover_instances; // 3 texels per instance
+
+uniform float osg_FrameTime;
+uniform float oe_GroundCover_ao;
+uniform float oe_GroundCover_windFactor;
+uniform float oe_GroundCover_maxDistance;
+uniform float oe_GroundCover_contrast;
+uniform float oe_GroundCover_brightness;
+
+// Stage globals
+vec4 oe_layer_tilec;
+vec3 oe_UpVectorView;
+
+out vec4 vp_Color;
+out vec3 vp_Normal;
+
+// Output to the fragment shader
+out vec2 oe_GroundCover_texCoord;
+flat out float oe_GroundCover_arrayIndex;
+
+struct oe_GroundCover_Billboard {
+    int arrayIndex;
+    float width;
+    float height;
+};
+void oe_GroundCover_getBillboard(in int billboardIndex, out oe_GroundCover_Billboard bb);
+
+// SDK import
+float oe_terrain_getElevation(in vec2);
+
+// corner of the billboard for each of the 6 vertices (LL, LR, UL, UL, LR, UR)
+const vec2 oe_GroundCover_corners[6] = vec2[6](
+    vec2(0,0), vec2(1,0), vec2(0,1),
+    vec2(0,1), vec2(1,0), vec2(1,1) );
+
+void oe_GroundCover_instance(inout vec4 vertexView)
+{
+    int i = gl_InstanceID * 3;
+    vec4 posScale  = texelFetch(oe_GroundCover_instances, i);     // tile-local position, size scale
+    vec4 upIndex   = texelFetch(oe_GroundCover_instances, i+1);   // tile-local up vector, billboard index
+    vec4 uvNoise   = texelFetch(oe_GroundCover_instances, i+2);   // tile coords, smooth noise, random noise
+
+    oe_layer_tilec = vec4(uvNoise.st, 0, 1);
+    oe_UpVectorView = normalize(gl_NormalMatrix * upIndex.xyz);
+
+    // clamp the anchor point to the terrain:
+    vec4 center_view = gl_ModelViewMatrix * vec4(posScale.xyz, 1.0);
+    center_view.xyz += oe_UpVectorView * oe_terrain_getElevation(uvNoise.st);
+
+    // push the falloff closer to the max distance.
+    float nRange = clamp(-center_view.z/oe_GroundCover_maxDistance, 0.0, 1.0);
+    float falloff = 1.0-(nRange*nRange*nRange);
+
+    oe_GroundCover_Billboard billboard;
+    oe_GroundCover_getBillboard(int(upIndex.w), billboard);
+    oe_GroundCover_arrayIndex = float(billboard.arrayIndex);
+
+    float width  = billboard.width  * falloff * posScale.w;
+    float height = billboard.height * falloff * posScale.w;
+
+    vec3 tangentVector = normalize(cross(vec3(0,0,-1), oe_UpVectorView));
+    vec2 corner = oe_GroundCover_corners[gl_VertexID];
+
+    vertexView = center_view;
+    vertexView.xyz += tangentVector * (corner.x - 0.5) * width;
+    vertexView.xyz += oe_UpVectorView * corner.y * height;
+
+    // wind moves the top of the billboard only
+    float nw = uvNoise.z;
+    float wind = width*oe_GroundCover_windFactor*nw;
+    vertexView.x += corner.y * sin(osg_FrameTime*(1.0+nw) + vertexView.x) * wind;
+
+    // color variation, brightness, and contrast:
+    vec3 color = vec3(uvNoise.w);
+    color = ((color - 0.5) * oe_GroundCover_contrast + 0.5) * oe_GroundCover_brightness;
+    vp_Color = vec4(corner.y > 0.0 ? color : color*oe_GroundCover_ao, nRange < 1.0 ? falloff : 0.0);
+
+    vec3 faceNormalVector = normalize(cross(tangentVector, oe_UpVectorView));
+    float blend = 0.25 + (uvNoise.w*0.25);
+    vp_Normal = mix(corner.x > 0.5 ? tangentVector : -tangentVector, faceNormalVector, blend);
+
+    oe_GroundCover_texCoord = corner;
+}
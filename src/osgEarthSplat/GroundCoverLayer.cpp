@@ -30,12 +30,14 @@
 #include <osg/BlendFunc>
 #include <osg/Multisample>
 #include <osg/Texture2D>
+#include <osg/TextureBuffer>
 #include <cstdlib> // getenv
 
 #define LC "[GroundCoverLayer] " << getName() << ": "
 
 #define GCTEX_SAMPLER "oe_GroundCover_billboardTex"
 #define NOISE_SAMPLER "oe_GroundCover_noiseTex"
+#define INSTANCES_SAMPLER "oe_GroundCover_instances"
 
 using namespace osgEarth::Splat;
 
@@ -54,6 +56,7 @@ GroundCoverLayerOptions::getConfig() const
     conf.set("mask_layer", _maskLayerName);
     conf.set("lod", _lod);
     conf.set("cast_shadows", _castShadows);
+    conf.set("cpu_placement", _cpuPlacement);
 
     Config zones("zones");
     for (int i = 0; i < _zones.size(); ++i) {
@@ -73,6 +76,7 @@ GroundCoverLayerOptions::fromConfig(const Config& conf)
     conf.getIfSet("mask_layer", _maskLayerName);
     conf.getIfSet("lod", _lod);
     conf.getIfSet("cast_shadows", _castShadows);
+    conf.getIfSet("cpu_placement", _cpuPlacement);
 
     const Config* zones = conf.child_ptr("zones");
     if (zones) {
@@ -118,6 +122,60 @@ namespace
         }
 
     };
+
+    // Instances computed for one tile when using CPU placement.
+    struct GroundCoverTileData : public PatchLayer::TileData
+    {
+        GroundCoverTileData() : _numInstances(0u) { }
+        unsigned _numInstances;
+    };
+
+    // Draws a tile's instances: one 6-vertex billboard per instance,
+    // built in GroundCover.VS.glsl from the instance buffer.
+    struct GroundCoverDrawCallback : public PatchLayer::DrawCallback
+    {
+        const TextureImageUnitReservation& _binding;
+
+        GroundCoverDrawCallback(const TextureImageUnitReservation& binding) : _binding(binding) { }
+
+        void draw(osg::RenderInfo& ri, const PatchLayer::DrawContext& dc, osg::Referenced* data)
+        {
+            const GroundCoverTileData* tileData = dynamic_cast<const GroundCoverTileData*>(data);
+            if (!tileData || tileData->_numInstances == 0u || !tileData->_texture.valid() || !_binding.valid())
+                return;
+
+            osg::State& state = *ri.getState();
+
+            state.setActiveTextureUnit(_binding.unit());
+            tileData->_texture->apply(state);
+
+            // no vertex attributes; the shader generates everything.
+            state.lazyDisablingOfVertexAttributes();
+            state.applyDisablingOfVertexAttributes();
+
+            state.glDrawArraysInstanced(GL_TRIANGLES, 0, 6, tileData->_numInstances);
+        }
+    };
+
+    // Gets an image from a layer for a key, falling back on ancestor keys;
+    // the matrix maps the key's tile coordinates into the returned image.
+    osg::Image* createImageForKey(ImageLayer* layer, const TileKey& key, osg::Matrixf& scaleBias)
+    {
+        scaleBias.makeIdentity();
+
+        for (TileKey k = key; k.valid(); k = k.createParentKey())
+        {
+            GeoImage image = layer->createImage(k);
+            if (image.valid())
+            {
+                osg::Matrix m;
+                key.getExtent().createScaleBias(image.getExtent(), m);
+                scaleBias = m;
+                return image.takeImage();
+            }
+        }
+        return 0L;
+    }
 }
 
 //........................................................................
@@ -154,6 +212,11 @@ GroundCoverLayer::init()
     }
 
     setAcceptCallback(new GroundCoverLayerAcceptor(this));
+
+    if (options().cpuPlacement() == true)
+    {
+        setDrawCallback(new GroundCoverDrawCallback(_instancesBinding));
+    }
 }
 
 const Status&
@@ -252,6 +315,14 @@ GroundCoverLayer::setTerrainResources(TerrainResources* res)
             }
         }
 
+        if (options().cpuPlacement() == true && _instancesBinding.valid() == false)
+        {
+            if (res->reserveTextureImageUnitForLayer(_instancesBinding, this, "Ground cover instances") == false)
+            {
+                OE_WARN << LC << "No texture unit available for ground cover instances\n";
+            }
+        }
+
         if (_groundCoverTexBinding.valid())
         {
             buildStateSets();
@@ -268,16 +339,7 @@ GroundCoverLayer::cull(const osgUtil::CullVisitor* cv, osg::State::StateSetStack
     // If we have zones, select the current one and apply its state set.
     if (_zones.size() > 0)
     {
-        int zoneIndex = 0;
-        osg::Vec3d vp = cv->getViewPoint();
-
-        for(int z=_zones.size()-1; z > 0 && zoneIndex == 0; --z)
-        {
-            if ( _zones[z]->contains(vp) )
-            {
-                zoneIndex = z;
-            }
-        }
+        int zoneIndex = getZoneIndex(cv->getViewPoint());
 
         osg::StateSet* zoneStateSet = 0L;
         GroundCover* gc = _zones[zoneIndex]->getGroundCover();
@@ -360,10 +422,18 @@ GroundCoverLayer::buildStateSets()
         new osg::BlendFunc(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO),
         osg::StateAttribute::OVERRIDE);
 
+    bool cpuPlacement = (options().cpuPlacement() == true);
+    if (cpuPlacement && _instancesBinding.valid())
+    {
+        stateset->addUniform(new osg::Uniform(INSTANCES_SAMPLER, _instancesBinding.unit()));
+    }
+
+    std::vector< osg::ref_ptr<GroundCoverPlacer> > placers(_zones.size());
 
-    for (Zones::iterator z = _zones.begin(); z != _zones.end(); ++z)
+
+    for (unsigned zi = 0; zi < _zones.size(); ++zi)
     {
-        Zone* zone = z->get();
+        Zone* zone = _zones[zi].get();
         GroundCover* groundCover = zone->getGroundCover();
         if (groundCover)
         {
@@ -374,22 +444,45 @@ GroundCoverLayer::buildStateSets()
                 // Install the land cover shaders on the state set
                 VirtualProgram* vp = VirtualProgram::getOrCreate(zoneStateSet);
                 vp->setName("Ground cover (" + groundCover->getName() + ")");
-                shaders.loadAll(vp, getReadOptions());
-
-                // Generate the coverage acceptor shader
-                osg::Shader* covTest = groundCover->createPredicateShader(_landCoverDict.get(), _landCoverLayer.get());
-                covTest->setName(covTest->getName() + "_GEOMETRY");
-                covTest->setType(osg::Shader::GEOMETRY);
-                vp->setShader(covTest);
-
-                osg::Shader* covTest2 = groundCover->createPredicateShader(_landCoverDict.get(), _landCoverLayer.get());
-                covTest->setName(covTest->getName() + "_TESSCONTROL");
-                covTest2->setType(osg::Shader::TESSCONTROL);
-                vp->setShader(covTest2);
 
                 osg::ref_ptr<osg::Shader> layerShader = groundCover->createShader();
-                layerShader->setType(osg::Shader::GEOMETRY);
-                vp->setShader(layerShader.get());
+
+                if (cpuPlacement)
+                {
+                    // Instances come from createTileData; the vertex shader
+                    // expands each one into a billboard.
+                    shaders.load(vp, shaders.GroundCover_VS, getReadOptions());
+                    shaders.load(vp, shaders.GroundCover_FS, getReadOptions());
+
+                    layerShader->setType(osg::Shader::VERTEX);
+                    vp->setShader(layerShader.get());
+
+                    GroundCoverPlacer* placer = new GroundCoverPlacer();
+                    placer->configure(groundCover, landCoverDict.get());
+                    placer->setNoiseImage(noiseTexture->getImage(0));
+                    placers[zi] = placer;
+                }
+                else
+                {
+                    shaders.load(vp, shaders.GroundCover_TCS, getReadOptions());
+                    shaders.load(vp, shaders.GroundCover_TES, getReadOptions());
+                    shaders.load(vp, shaders.GroundCover_GS, getReadOptions());
+                    shaders.load(vp, shaders.GroundCover_FS, getReadOptions());
+
+                    // Generate the coverage acceptor shader
+                    osg::Shader* covTest = groundCover->createPredicateShader(_landCoverDict.get(), _landCoverLayer.get());
+                    covTest->setName(covTest->getName() + "_GEOMETRY");
+                    covTest->setType(osg::Shader::GEOMETRY);
+                    vp->setShader(covTest);
+
+                    osg::Shader* covTest2 = groundCover->createPredicateShader(_landCoverDict.get(), _landCoverLayer.get());
+                    covTest->setName(covTest->getName() + "_TESSCONTROL");
+                    covTest2->setType(osg::Shader::TESSCONTROL);
+                    vp->setShader(covTest2);
+
+                    layerShader->setType(osg::Shader::GEOMETRY);
+                    vp->setShader(layerShader.get());
+                }
 
                 OE_INFO << LC << "Established zone \"" << zone->getName() << "\" at LOD " << getLOD() << "\n";
 
@@ -411,4 +504,110 @@ GroundCoverLayer::buildStateSets()
             OE_DEBUG << LC << "zone contains no ground cover information\n";
         }
     }
+
+    if (cpuPlacement)
+    {
+        Threading::ScopedMutexLock lock(_placersMutex);
+        _placers.swap(placers);
+    }
+}
+
+int
+GroundCoverLayer::getZoneIndex(const osg::Vec3d& world) const
+{
+    int zoneIndex = 0;
+
+    for(int z=_zones.size()-1; z > 0 && zoneIndex == 0; --z)
+    {
+        if ( _zones[z]->contains(world) )
+        {
+            zoneIndex = z;
+        }
+    }
+    return zoneIndex;
+}
+
+PatchLayer::TileData*
+GroundCoverLayer::createTileData(const TileKey& key)
+{
+    if (options().cpuPlacement() != true || _zones.empty())
+        return 0L;
+
+    osg::ref_ptr<LandCoverLayer> landCoverLayer;
+    if (_landCoverLayer.lock(landCoverLayer) == false)
+        return 0L;
+
+    // Same local reference frame the terrain engine uses for the tile geometry:
+    GeoPoint centroid;
+    key.getExtent().getCentroid(centroid);
+    osg::Vec3d centerWorld;
+    centroid.toWorld(centerWorld);
+    osg::Matrixd world2local;
+    centroid.createWorldToLocal(world2local);
+
+    osg::ref_ptr<GroundCoverPlacer> placer;
+    {
+        Threading::ScopedMutexLock lock(_placersMutex);
+        int zoneIndex = getZoneIndex(centerWorld);
+        if (zoneIndex < (int)_placers.size())
+            placer = _placers[zoneIndex].get();
+    }
+    if (!placer.valid())
+        return 0L;
+
+    osg::Matrixf landCoverMatrix;
+    osg::ref_ptr<osg::Image> landCover = createImageForKey(landCoverLayer.get(), key, landCoverMatrix);
+    if (!landCover.valid())
+        return 0L;
+
+    osg::Matrixf maskMatrix;
+    osg::ref_ptr<osg::Image> mask;
+    osg::ref_ptr<ImageLayer> maskLayer;
+    if (_maskLayer.lock(maskLayer))
+        mask = createImageForKey(maskLayer.get(), key, maskMatrix);
+
+    GroundCoverPlacer::Instances instances;
+    placer->place(GroundCoverPlacer::getSeed(key), landCover.get(), landCoverMatrix, mask.get(), maskMatrix, instances);
+    if (instances.empty())
+        return 0L;
+
+    // Three texels per instance; see GroundCover.VS.glsl.
+    osg::Image* image = new osg::Image();
+    image->allocateImage(instances.size()*3, 1, 1, GL_RGBA, GL_FLOAT);
+    image->setInternalTextureFormat(GL_RGBA32F_ARB);
+    osg::Vec4f* ptr = reinterpret_cast<osg::Vec4f*>(image->data());
+
+    const GeoExtent& extent = key.getExtent();
+
+    for (GroundCoverPlacer::Instances::const_iterator i = instances.begin(); i != instances.end(); ++i)
+    {
+        GeoPoint point(
+            extent.getSRS(),
+            extent.xMin() + i->_u * extent.width(),
+            extent.yMin() + i->_v * extent.height(),
+            0.0,
+            ALTMODE_ABSOLUTE);
+
+        osg::Vec3d world, up;
+        point.toWorld(world);
+        point.createWorldUpVector(up);
+
+        osg::Vec3d local = world * world2local;
+        osg::Vec3d localUp = osg::Matrixd::transform3x3(up, world2local);
+        localUp.normalize();
+
+        *ptr++ = osg::Vec4f(local.x(), local.y(), local.z(), i->_scale);
+        *ptr++ = osg::Vec4f(localUp.x(), localUp.y(), localUp.z(), (float)i->_billboard);
+        *ptr++ = osg::Vec4f(i->_u, i->_v, i->_smooth, i->_random);
+    }
+
+    osg::TextureBuffer* tbo = new osg::TextureBuffer();
+    tbo->setImage(image);
+    tbo->setInternalFormat(GL_RGBA32F_ARB);
+    tbo->setUnRefImageDataAfterApply(true);
+
+    GroundCoverTileData* data = new GroundCoverTileData();
+    data->_texture = tbo;
+    data->_numInstances = instances.size();
+    return data;
 }
@@ -0,0 +1,245 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "GroundCoverPlacer"
+#include "GroundCover"
+#include <osgEarth/LandCover>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/StringUtils>
+#include <cmath>
+
+#define LC "[GroundCoverPlacer] "
+
+using namespace osgEarth;
+using namespace osgEarth::Splat;
+
+// noise channels; must match the ground cover shaders
+#define NOISE_SMOOTH   0
+#define NOISE_RANDOM   1
+#define NOISE_RANDOM_2 2
+
+// upper limit on candidate points per tile side
+#define MAX_CELLS_PER_SIDE 256u
+
+namespace
+{
+    // Integer hash with good avalanche behavior, used as a stateless RNG
+    // so the result for a cell never depends on evaluation order.
+    inline unsigned hash32(unsigned x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    inline float unitRand(unsigned h)
+    {
+        return (float)(h >> 8) / 16777216.0f; // [0..1)
+    }
+
+    // Clamps in float first; casting an out-of-range float to int is undefined.
+    inline int clampIndex(float t, int size)
+    {
+        float i = floorf(t * (float)(size-1) + 0.5f);
+        return !(i > 0.0f) ? 0 : i >= (float)(size-1) ? size-1 : (int)i;
+    }
+
+    inline int wrapIndex(int i, int size)
+    {
+        i %= size;
+        return i < 0 ? i + size : i;
+    }
+
+    // Bilinear sample with REPEAT wrapping, like the noise texture's sampler.
+    osg::Vec4 sampleWrapped(const ImageUtils::PixelReader& read, const osg::Image* image, float u, float v)
+    {
+        int w = image->s(), h = image->t();
+        float s = u * (float)w - 0.5f;
+        float t = v * (float)h - 0.5f;
+        float s0f = floorf(s), t0f = floorf(t);
+        float smix = s - s0f, tmix = t - t0f;
+        int s0 = wrapIndex((int)s0f, w), s1 = wrapIndex((int)s0f + 1, w);
+        int t0 = wrapIndex((int)t0f, h), t1 = wrapIndex((int)t0f + 1, h);
+
+        osg::Vec4 bottom = read(s0, t0)*(1.0f-smix) + read(s1, t0)*smix;
+        osg::Vec4 top    = read(s0, t1)*(1.0f-smix) + read(s1, t1)*smix;
+        return bottom*(1.0f-tmix) + top*tmix;
+    }
+}
+
+//........................................................................
+
+GroundCoverPlacer::GroundCoverPlacer() :
+_fill(1.0f),
+_cellsPerSide(32u)
+{
+    //nop
+}
+
+void
+GroundCoverPlacer::setBiome(int landCoverValue, int firstBillboard, int numBillboards)
+{
+    Biome& biome = _biomes[landCoverValue];
+    biome._first = firstBillboard;
+    biome._count = numBillboards;
+}
+
+void
+GroundCoverPlacer::setNumCellsPerSide(unsigned value)
+{
+    _cellsPerSide = osg::clampBetween(value, 1u, MAX_CELLS_PER_SIDE);
+}
+
+void
+GroundCoverPlacer::configure(const GroundCover* groundCover, const LandCoverDictionary* dict)
+{
+    _biomes.clear();
+
+    if (!groundCover || !dict)
+        return;
+
+    int first = 0;
+    for (unsigned b = 0; b < groundCover->getBiomes().size(); ++b)
+    {
+        const GroundCoverBiome* biome = groundCover->getBiomes()[b].get();
+        int count = biome->getBillboards().size();
+
+        StringVector classes;
+        StringTokenizer(biome->getClasses(), classes, " ", "\"", false);
+        for (unsigned i = 0; i < classes.size(); ++i)
+        {
+            const LandCoverClass* lcClass = dict->getClassByName(classes[i]);
+            if (lcClass)
+            {
+                // first match wins, as in the generated predicate shader
+                if (_biomes.find(lcClass->getValue()) == _biomes.end())
+                    setBiome(lcClass->getValue(), first, count);
+            }
+            else
+            {
+                OE_WARN << LC << "Land cover class \"" << classes[i] << "\" was not found in the dictionary!\n";
+            }
+        }
+
+        first += count;
+    }
+
+    setFill(groundCover->options().fill().get());
+
+    // The GPU path emits one candidate per tessellated triangle. A tile has
+    // 16x16 quads (512 triangles), each tessellated to about density^2
+    // triangles, so match that number of candidates.
+    float perSide = ceilf(sqrtf(512.0f) * groundCover->options().density().get());
+    setNumCellsPerSide(perSide > 1.0f ? (unsigned)perSide : 1u);
+}
+
+unsigned
+GroundCoverPlacer::getSeed(const TileKey& key)
+{
+    unsigned h = hash32(key.getLOD() + 0x9e3779b9u);
+    h = hash32(h ^ key.getTileX());
+    h = hash32(h ^ key.getTileY());
+    return h;
+}
+
+unsigned
+GroundCoverPlacer::place(unsigned            seed,
+                         const osg::Image*   landCover,
+                         const osg::Matrixf& lcScaleBias,
+                         const osg::Image*   mask,
+                         const osg::Matrixf& maskScaleBias,
+                         Instances&          output) const
+{
+    output.clear();
+
+    if (!landCover || _biomes.empty() || _fill <= 0.0f)
+        return 0u;
+
+    ImageUtils::PixelReader readLandCover(landCover);
+
+    ImageUtils::PixelReader readMask(mask);
+    ImageUtils::PixelReader readNoise(_noise.get());
+
+    const float cellSize = 1.0f / (float)_cellsPerSide;
+
+    for (unsigned row = 0; row < _cellsPerSide; ++row)
+    {
+        for (unsigned col = 0; col < _cellsPerSide; ++col)
+        {
+            unsigned h = hash32(seed ^ hash32(row * _cellsPerSide + col));
+            float u = ((float)col + unitRand(h)) * cellSize;
+            h = hash32(h);
+            float v = ((float)row + unitRand(h)) * cellSize;
+
+            // land cover class at this point (nearest sample; classes don't interpolate):
+            float lcu = u * lcScaleBias(0,0) + lcScaleBias(3,0);
+            float lcv = v * lcScaleBias(1,1) + lcScaleBias(3,1);
+            int value = (int)readLandCover(
+                clampIndex(lcu, landCover->s()),
+                clampIndex(lcv, landCover->t())).r();
+
+            BiomeTable::const_iterator biome = _biomes.find(value);
+            if (biome == _biomes.end() || biome->second._count <= 0)
+                continue;
+
+            if (mask)
+            {
+                float mu = u * maskScaleBias(0,0) + maskScaleBias(3,0);
+                float mv = v * maskScaleBias(1,1) + maskScaleBias(3,1);
+                float alpha = readMask(
+                    clampIndex(mu, mask->s()),
+                    clampIndex(mv, mask->t())).a();
+                if (alpha > 0.0f)
+                    continue;
+            }
+
+            osg::Vec4 noise;
+            if (_noise.valid())
+            {
+                noise = sampleWrapped(readNoise, _noise.get(), u, v);
+            }
+            else
+            {
+                for (unsigned c = 0; c < 3; ++c) {
+                    h = hash32(h);
+                    noise[c] = unitRand(h);
+                }
+            }
+
+            if (noise[NOISE_SMOOTH] > _fill)
+                continue;
+
+            Instance instance;
+            instance._u = u;
+            instance._v = v;
+            instance._scale = fabs(1.0f + noise[NOISE_RANDOM_2]);
+            instance._billboard = osg::minimum(
+                biome->second._first + (int)floorf(noise[NOISE_RANDOM] * (float)biome->second._count),
+                biome->second._first + biome->second._count - 1);
+            instance._smooth = noise[NOISE_SMOOTH] / _fill;
+            instance._random = noise[NOISE_RANDOM_2];
+
+            output.push_back(instance);
+        }
+    }
+
+    return output.size();
+}
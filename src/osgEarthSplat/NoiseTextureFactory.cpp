@@ -31,6 +31,24 @@ using namespace osgEarth::Splat;
 
 osg::Texture*
 NoiseTextureFactory::create(unsigned dim, unsigned chans) const
+{
+    osg::Image* image = createImage(dim, chans);
+
+    // make a texture:
+    osg::Texture2D* tex = new osg::Texture2D( image );
+    tex->setWrap(tex->WRAP_S, tex->REPEAT);
+    tex->setWrap(tex->WRAP_T, tex->REPEAT);
+    tex->setFilter(tex->MIN_FILTER, tex->LINEAR_MIPMAP_LINEAR);
+    tex->setFilter(tex->MAG_FILTER, tex->LINEAR);
+    tex->setMaxAnisotropy( 4.0f );
+    tex->setUnRefImageDataAfterApply( true );
+    ImageUtils::activateMipMaps(tex);
+
+    return tex;
+}
+
+osg::Image*
+NoiseTextureFactory::createImage(unsigned dim, unsigned chans) const
 {
     chans = osg::clampBetween(chans, 1u, 4u);
 
@@ -106,15 +124,5 @@ NoiseTextureFactory::create(unsigned dim, unsigned chans) const
         }
     }
 
-    // make a texture:
-    osg::Texture2D* tex = new osg::Texture2D( image );
-    tex->setWrap(tex->WRAP_S, tex->REPEAT);
-    tex->setWrap(tex->WRAP_T, tex->REPEAT);
-    tex->setFilter(tex->MIN_FILTER, tex->LINEAR_MIPMAP_LINEAR);
-    tex->setFilter(tex->MAG_FILTER, tex->LINEAR);
-    tex->setMaxAnisotropy( 4.0f );
-    tex->setUnRefImageDataAfterApply( true );
-    ImageUtils::activateMipMaps(tex);
-
-    return tex;
+    return image;
 }
@@ -152,7 +152,7 @@ SplatCatalog::fromConfig(const Config& conf)
     conf.getIfSet("name",        _name);
     conf.getIfSet("description", _description);
 
-    Config classesConf = conf.child("classes");
+    const Config& classesConf = conf.child("classes");
     if ( !classesConf.empty() )
     {
         for(ConfigSet::const_iterator i = classesConf.children().begin(); i != classesConf.children().end(); ++i)
@@ -22,6 +22,7 @@
 
 #include <osgEarthSymbology/MeshConsolidator>
 #include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
 #include <osg/TriangleFunctor>
 #include <osg/TriangleIndexFunctor>
 #include <osg/Version>
@@ -29,7 +30,9 @@
 #include <osgUtil/MeshOptimizers>
 #include <limits>
 #include <map>
+#include <set>
 #include <iterator>
+#include <algorithm>
 
 using namespace osgEarth::Symbology;
 
@@ -722,3 +725,497 @@ MeshConsolidator::run( osg::Geode& geode )
     for( DrawableList::iterator i = dontConsolidate.begin(); i != dontConsolidate.end(); ++i )
         geode.addDrawable( i->get() );
 }
+
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    typedef MeshConsolidator::GeometryList GeometryList;
+
+    // A run of geometries [_begin, _end) in one group, merged into one output geometry.
+    struct Cluster
+    {
+        unsigned _group;
+        unsigned _begin, _end;
+        unsigned _numVerts;
+    };
+
+    // A run of primitive sets that share a mode and user data and merge into
+    // one DrawElements. Strip, loop and fan modes cannot be concatenated, so
+    // each of those gets a run of its own.
+    struct PrimRun
+    {
+        GLenum           _mode;
+        osg::Referenced* _userData;
+        unsigned         _count;
+    };
+
+    inline bool isListMode(GLenum mode)
+    {
+        return
+            mode == GL_POINTS ||
+            mode == GL_LINES ||
+            mode == GL_TRIANGLES ||
+            mode == GL_QUADS;
+    }
+
+    // Spreads the low 10 bits of x so there are two zero bits between each.
+    inline unsigned spreadBits(unsigned x)
+    {
+        x &= 0x3ff;
+        x = (x | (x << 16)) & 0x030000ff;
+        x = (x | (x <<  8)) & 0x0300f00f;
+        x = (x | (x <<  4)) & 0x030c30c3;
+        x = (x | (x <<  2)) & 0x09249249;
+        return x;
+    }
+
+    struct SortEntry
+    {
+        unsigned _code;
+        unsigned _index;
+        bool operator < (const SortEntry& rhs) const {
+            return _code < rhs._code || (_code == rhs._code && _index < rhs._index);
+        }
+    };
+
+    // Orders a group along a Z-order curve through the centers of its geometries,
+    // so that consecutive geometries (and therefore clusters) are close together.
+    void sortSpatially(GeometryList& geoms)
+    {
+        if ( geoms.size() < 2 )
+            return;
+
+        osg::BoundingBox box;
+        std::vector<osg::Vec3> centers(geoms.size());
+        for( unsigned i=0; i<geoms.size(); ++i )
+        {
+            const osg::Vec3Array* verts = static_cast<const osg::Vec3Array*>(geoms[i]->getVertexArray());
+            osg::BoundingBox gbox;
+            for( osg::Vec3Array::const_iterator v = verts->begin(); v != verts->end(); ++v )
+                gbox.expandBy( *v );
+            centers[i] = gbox.valid() ? gbox.center() : osg::Vec3();
+            box.expandBy( centers[i] );
+        }
+
+        osg::Vec3 size = box._max - box._min;
+        osg::Vec3 scale(
+            size.x() > 0.0f ? 1023.0f/size.x() : 0.0f,
+            size.y() > 0.0f ? 1023.0f/size.y() : 0.0f,
+            size.z() > 0.0f ? 1023.0f/size.z() : 0.0f );
+
+        std::vector<SortEntry> entries(geoms.size());
+        for( unsigned i=0; i<geoms.size(); ++i )
+        {
+            osg::Vec3 n = centers[i] - box._min;
+            entries[i]._code =
+                 spreadBits((unsigned)(n.x()*scale.x())) |
+                (spreadBits((unsigned)(n.y()*scale.y())) << 1) |
+                (spreadBits((unsigned)(n.z()*scale.z())) << 2);
+            entries[i]._index = i;
+        }
+        std::sort( entries.begin(), entries.end() );
+
+        GeometryList sorted(geoms.size());
+        for( unsigned i=0; i<entries.size(); ++i )
+            sorted[i] = geoms[entries[i]._index];
+        geoms.swap( sorted );
+    }
+
+    template<typename DE, typename FROM>
+    void copyIndices(DE* dst, unsigned pos, const FROM* src, unsigned offset)
+    {
+        for( typename FROM::const_iterator i = src->begin(); i != src->end(); ++i )
+            (*dst)[pos++] = (*i) + offset;
+    }
+
+    // Builds the merged primitive sets of a cluster with index type DE.
+    template<typename DE>
+    void mergePrimSets(
+        const GeometryList&             geoms,
+        const Cluster&                  cluster,
+        const std::vector<PrimRun>&     runs,
+        const std::vector<unsigned>&    psetRuns,
+        osg::Geometry::PrimitiveSetList& output)
+    {
+        std::vector<DE*> elements(runs.size());
+        std::vector<unsigned> positions(runs.size(), 0u);
+        for( unsigned r=0; r<runs.size(); ++r )
+        {
+            elements[r] = new DE( runs[r]._mode, runs[r]._count );
+            elements[r]->setUserData( runs[r]._userData );
+            output.push_back( elements[r] );
+        }
+
+        unsigned offset = 0, p = 0;
+        for( unsigned g=cluster._begin; g<cluster._end; ++g )
+        {
+            const osg::Geometry* geom = geoms[g].get();
+            for( unsigned j=0; j<geom->getNumPrimitiveSets(); ++j )
+            {
+                const osg::PrimitiveSet* pset = geom->getPrimitiveSet(j);
+                unsigned r = psetRuns[p++];
+                if ( r >= runs.size() )
+                    continue;
+
+                DE* de = elements[r];
+                unsigned& pos = positions[r];
+
+                if ( dynamic_cast<const osg::DrawElementsUByte*>(pset) )
+                    copyIndices( de, pos, static_cast<const osg::DrawElementsUByte*>(pset), offset );
+                else if ( dynamic_cast<const osg::DrawElementsUShort*>(pset) )
+                    copyIndices( de, pos, static_cast<const osg::DrawElementsUShort*>(pset), offset );
+                else if ( dynamic_cast<const osg::DrawElementsUInt*>(pset) )
+                    copyIndices( de, pos, static_cast<const osg::DrawElementsUInt*>(pset), offset );
+                else
+                {
+                    const osg::DrawArrays* da = static_cast<const osg::DrawArrays*>(pset);
+                    for( GLsizei i=0; i<da->getCount(); ++i )
+                        (*de)[pos+i] = offset + da->getFirst() + i;
+                }
+                pos += pset->getNumIndices();
+            }
+            offset += geom->getVertexArray()->getNumElements();
+        }
+    }
+
+    // Merges one cluster into a new geometry. Every array is allocated at its
+    // final size up front and filled in place.
+    osg::Geometry* mergeCluster(const GeometryList& geoms, const Cluster& cluster)
+    {
+        const unsigned numVerts = cluster._numVerts;
+
+        // what the output needs to hold:
+        bool hasColors = false, hasNormals = false, useVBOs = false;
+        unsigned texUnits = 0u, texUnits3D = 0u;
+        for( unsigned g=cluster._begin; g<cluster._end; ++g )
+        {
+            const osg::Geometry* geom = geoms[g].get();
+            hasColors  = hasColors  || dynamic_cast<const osg::Vec4Array*>(geom->getColorArray()) != 0L;
+            hasNormals = hasNormals || dynamic_cast<const osg::Vec3Array*>(geom->getNormalArray()) != 0L;
+            useVBOs    = useVBOs    || geom->getUseVertexBufferObjects();
+            for( unsigned u=0; u<32; ++u )
+            {
+                const osg::Array* tc = geom->getTexCoordArray(u);
+                if ( dynamic_cast<const osg::Vec2Array*>(tc) )
+                {
+                    texUnits |= (1u << u);
+                }
+                else if ( dynamic_cast<const osg::Vec3Array*>(tc) )
+                {
+                    texUnits   |= (1u << u);
+                    texUnits3D |= (1u << u);
+                }
+            }
+        }
+
+        osg::ref_ptr<osg::Geometry> newGeom = new osg::Geometry();
+
+        osg::Vec3Array* newVerts = new osg::Vec3Array( numVerts );
+        newGeom->setVertexArray( newVerts );
+
+        osg::Vec4Array* newColors = 0L;
+        if ( hasColors )
+        {
+            newColors = new osg::Vec4Array( numVerts );
+            newGeom->setColorArray( newColors );
+            newGeom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+        }
+
+        osg::Vec3Array* newNormals = 0L;
+        if ( hasNormals )
+        {
+            newNormals = new osg::Vec3Array( numVerts );
+            newGeom->setNormalArray( newNormals );
+            newGeom->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+        }
+
+        for( unsigned u=0; u<32; ++u )
+        {
+            if ( texUnits3D & (1u << u) )
+                newGeom->setTexCoordArray( u, new osg::Vec3Array( numVerts ) );
+            else if ( texUnits & (1u << u) )
+                newGeom->setTexCoordArray( u, new osg::Vec2Array( numVerts ) );
+        }
+
+        // vertex data; geometries lacking an array get white colors,
+        // up normals and zero texture coordinates.
+        unsigned offset = 0;
+        std::vector<PrimRun>  runs;
+        std::vector<unsigned> psetRuns;
+
+        for( unsigned g=cluster._begin; g<cluster._end; ++g )
+        {
+            const osg::Geometry* geom = geoms[g].get();
+            const osg::Vec3Array* verts = static_cast<const osg::Vec3Array*>(geom->getVertexArray());
+            const unsigned n = verts->size();
+
+            std::copy( verts->begin(), verts->end(), newVerts->begin() + offset );
+
+            if ( newColors )
+            {
+                const osg::Vec4Array* colors = dynamic_cast<const osg::Vec4Array*>(geom->getColorArray());
+                if ( colors && colors->size() == n )
+                    std::copy( colors->begin(), colors->end(), newColors->begin() + offset );
+                else
+                    std::fill( newColors->begin() + offset, newColors->begin() + offset + n, osg::Vec4(1,1,1,1) );
+            }
+
+            if ( newNormals )
+            {
+                const osg::Vec3Array* normals = dynamic_cast<const osg::Vec3Array*>(geom->getNormalArray());
+                if ( normals && normals->size() == n )
+                    std::copy( normals->begin(), normals->end(), newNormals->begin() + offset );
+                else
+                    std::fill( newNormals->begin() + offset, newNormals->begin() + offset + n, osg::Vec3(0,0,1) );
+            }
+
+            for( unsigned u=0; u<32; ++u )
+            {
+                if ( texUnits3D & (1u << u) )
+                {
+                    osg::Vec3Array* dst = static_cast<osg::Vec3Array*>(newGeom->getTexCoordArray(u));
+                    const osg::Vec3Array* tc3 = dynamic_cast<const osg::Vec3Array*>(geom->getTexCoordArray(u));
+                    const osg::Vec2Array* tc2 = dynamic_cast<const osg::Vec2Array*>(geom->getTexCoordArray(u));
+                    if ( tc3 && tc3->size() == n )
+                        std::copy( tc3->begin(), tc3->end(), dst->begin() + offset );
+                    else if ( tc2 && tc2->size() == n )
+                        for( unsigned i=0; i<n; ++i )
+                            (*dst)[offset+i].set( (*tc2)[i].x(), (*tc2)[i].y(), 0.0f );
+                }
+                else if ( texUnits & (1u << u) )
+                {
+                    osg::Vec2Array* dst = static_cast<osg::Vec2Array*>(newGeom->getTexCoordArray(u));
+                    const osg::Vec2Array* tc2 = dynamic_cast<const osg::Vec2Array*>(geom->getTexCoordArray(u));
+                    if ( tc2 && tc2->size() == n )
+                        std::copy( tc2->begin(), tc2->end(), dst->begin() + offset );
+                }
+            }
+
+            // assign each primitive set to a run.
+            for( unsigned j=0; j<geom->getNumPrimitiveSets(); ++j )
+            {
+                const osg::PrimitiveSet* pset = geom->getPrimitiveSet(j);
+                bool supported =
+                    dynamic_cast<const osg::DrawElements*>(pset) != 0L ||
+                    dynamic_cast<const osg::DrawArrays*>(pset) != 0L;
+
+                if ( !supported || pset->getNumIndices() == 0 )
+                {
+                    psetRuns.push_back( ~0u );
+                    continue;
+                }
+
+                GLenum mode = pset->getMode();
+                osg::Referenced* userData = const_cast<osg::Referenced*>(pset->getUserData());
+
+                if ( runs.empty() || !isListMode(mode) || runs.back()._mode != mode || runs.back()._userData != userData )
+                {
+                    PrimRun run;
+                    run._mode = mode;
+                    run._userData = userData;
+                    run._count = 0u;
+                    runs.push_back( run );
+                }
+                runs.back()._count += pset->getNumIndices();
+                psetRuns.push_back( runs.size()-1 );
+            }
+
+            offset += n;
+        }
+
+        // primitive sets, with the smallest index type that fits:
+        osg::Geometry::PrimitiveSetList newPrimSets;
+        if ( numVerts <= 0x100 )
+            mergePrimSets<osg::DrawElementsUByte>( geoms, cluster, runs, psetRuns, newPrimSets );
+        else if ( numVerts <= 0x10000 )
+            mergePrimSets<osg::DrawElementsUShort>( geoms, cluster, runs, psetRuns, newPrimSets );
+        else
+            mergePrimSets<osg::DrawElementsUInt>( geoms, cluster, runs, psetRuns, newPrimSets );
+
+        newGeom->setPrimitiveSetList( newPrimSets );
+        newGeom->setStateSet( geoms[cluster._begin]->getStateSet() );
+        newGeom->setUseVertexBufferObjects( useVBOs );
+        newGeom->setUseDisplayList( !useVBOs );
+
+        return newGeom.release();
+    }
+
+    struct ConvertJob : public ParallelRange::Job
+    {
+        const GeometryList* _geoms;
+
+        void run(unsigned begin, unsigned end, unsigned chunk)
+        {
+            for( unsigned i=begin; i<end; ++i )
+                MeshConsolidator::convertToTriangles( *(*_geoms)[i].get(), true );
+        }
+    };
+
+    struct SortJob : public ParallelRange::Job
+    {
+        std::vector<GeometryList>* _groups;
+
+        void run(unsigned begin, unsigned end, unsigned chunk)
+        {
+            for( unsigned i=begin; i<end; ++i )
+                sortSpatially( (*_groups)[i] );
+        }
+    };
+
+    struct MergeJob : public ParallelRange::Job
+    {
+        const std::vector<GeometryList>* _groups;
+        const std::vector<Cluster>*      _clusters;
+        GeometryList*                    _results;
+
+        void run(unsigned begin, unsigned end, unsigned chunk)
+        {
+            for( unsigned i=begin; i<end; ++i )
+            {
+                const Cluster& cluster = (*_clusters)[i];
+                const GeometryList& geoms = (*_groups)[cluster._group];
+
+                // a cluster of one needs no merging.
+                if ( cluster._end - cluster._begin == 1u )
+                    (*_results)[i] = geoms[cluster._begin].get();
+                else
+                    (*_results)[i] = mergeCluster( geoms, cluster );
+            }
+        }
+    };
+}
+
+void
+MeshConsolidator::runParallel( std::vector<GeometryList>& groups, unsigned maxVertsPerCluster )
+{
+#if defined(OSG_GLES2_AVAILABLE) || defined(OSG_GLES3_AVAILABLE)
+    // GLES only supports UShort, not UInt
+    maxVertsPerCluster = osg::minimum( maxVertsPerCluster, 0x10000u );
+#endif
+    maxVertsPerCluster = osg::maximum( maxVertsPerCluster, 1u );
+
+    // Split each group into the geometries we can consolidate and the rest.
+    // canOptimize() may rewrite bindings, so it runs serially, once per geometry.
+    std::vector<GeometryList> others( groups.size() );
+    GeometryList all;
+    std::set<osg::Geometry*> seen;
+
+    for( unsigned g=0; g<groups.size(); ++g )
+    {
+        GeometryList consolidate;
+        for( GeometryList::iterator i = groups[g].begin(); i != groups[g].end(); ++i )
+        {
+            osg::Geometry* geom = i->get();
+            if ( geom && seen.insert(geom).second && canOptimize(*geom) && geom->getVertexArray()->getNumElements() > 0 )
+            {
+                consolidate.push_back( geom );
+                all.push_back( geom );
+            }
+            else if ( geom )
+            {
+                others[g].push_back( geom );
+            }
+        }
+        groups[g].swap( consolidate );
+    }
+
+    // convert every surface primitive to triangles.
+    ConvertJob convert;
+    convert._geoms = &all;
+    ParallelRange::run( convert, all.size(), ParallelRange::getNumChunks(all.size(), 64u) );
+
+    // order each group spatially.
+    SortJob sort;
+    sort._groups = &groups;
+    ParallelRange::run( sort, groups.size(), ParallelRange::getNumChunks(groups.size(), 1u) );
+
+    // cut the groups into clusters.
+    std::vector<Cluster> clusters;
+    for( unsigned g=0; g<groups.size(); ++g )
+    {
+        const GeometryList& geoms = groups[g];
+        unsigned i = 0;
+        while( i < geoms.size() )
+        {
+            Cluster cluster;
+            cluster._group    = g;
+            cluster._begin    = i;
+            cluster._numVerts = geoms[i]->getVertexArray()->getNumElements();
+            for( ++i; i < geoms.size(); ++i )
+            {
+                unsigned n = geoms[i]->getVertexArray()->getNumElements();
+                if ( cluster._numVerts + n > maxVertsPerCluster )
+                    break;
+                cluster._numVerts += n;
+            }
+            cluster._end = i;
+            clusters.push_back( cluster );
+        }
+    }
+
+    OE_DEBUG << LC << "Merging " << all.size() << " geometries from " << groups.size()
+        << " groups into " << clusters.size() << " clusters" << std::endl;
+
+    // merge the clusters concurrently, each into its own slot.
+    GeometryList results( clusters.size() );
+    MergeJob merge;
+    merge._groups   = &groups;
+    merge._clusters = &clusters;
+    merge._results  = &results;
+    ParallelRange::run( merge, clusters.size(), ParallelRange::getNumChunks(clusters.size(), 1u) );
+
+    // re-assemble the groups.
+    for( unsigned g=0; g<groups.size(); ++g )
+        groups[g].clear();
+
+    for( unsigned c=0; c<clusters.size(); ++c )
+        groups[clusters[c]._group].push_back( results[c].get() );
+
+    for( unsigned g=0; g<groups.size(); ++g )
+        groups[g].insert( groups[g].end(), others[g].begin(), others[g].end() );
+}
+
+void
+MeshConsolidator::runParallel( osg::Geode& geode, unsigned maxVertsPerCluster )
+{
+    if ( geode.getNumDrawables() <= 1 )
+        return;
+
+    // partition the geometries by state set; keep everything else as is.
+    std::vector<GeometryList> groups;
+    std::map<osg::StateSet*, unsigned> groupIndex;
+    DrawableList others;
+
+    for( unsigned i=0; i<geode.getNumDrawables(); ++i )
+    {
+        osg::Drawable* drawable = geode.getDrawable(i);
+        osg::Geometry* geom = drawable->asGeometry();
+        if ( geom )
+        {
+            std::map<osg::StateSet*, unsigned>::iterator k = groupIndex.find( geom->getStateSet() );
+            if ( k == groupIndex.end() )
+            {
+                k = groupIndex.insert( std::make_pair(geom->getStateSet(), (unsigned)groups.size()) ).first;
+                groups.push_back( GeometryList() );
+            }
+            groups[k->second].push_back( geom );
+        }
+        else
+        {
+            others.push_back( drawable );
+        }
+    }
+
+    runParallel( groups, maxVertsPerCluster );
+
+    geode.removeDrawables( 0, geode.getNumDrawables() );
+
+    for( unsigned g=0; g<groups.size(); ++g )
+        for( GeometryList::iterator i = groups[g].begin(); i != groups[g].end(); ++i )
+            geode.addDrawable( i->get() );
+
+    for( DrawableList::iterator i = others.begin(); i != others.end(); ++i )
+        geode.addDrawable( i->get() );
+}
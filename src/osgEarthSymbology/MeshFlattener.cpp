@@ -84,6 +84,7 @@ osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
     setNodeMaskOverride(~0);
     _mergeGeometry = true;
     _maxVertsPerCluster = 250000u;
+    _parallel = false;
 }
 
     void FlattenSceneGraphVisitor::apply(osg::Node& node)
@@ -162,6 +163,41 @@ osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
 
         OE_DEBUG << "We have " << _geometries.size() << " stateset stacks" << std::endl;
 
+        if (_parallel)
+        {
+            // One geometry list per stateset stack, consolidated all at once.
+            std::vector< MeshConsolidator::GeometryList > groups;
+            groups.reserve(_geometries.size());
+            for (StateSetStackToGeometryMap::iterator itr = _geometries.begin(); itr != _geometries.end(); ++itr)
+            {
+                groups.push_back(itr->second);
+                for (GeometryVector::iterator gItr = groups.back().begin(); gItr != groups.back().end(); ++gItr)
+                    gItr->get()->setStateSet(0);
+            }
+
+            MeshConsolidator::runParallel(groups, std::max(_maxVertsPerCluster, 1000u));
+
+            unsigned g = 0;
+            for (StateSetStackToGeometryMap::iterator itr = _geometries.begin(); itr != _geometries.end(); ++itr, ++g)
+            {
+                osg::StateSet* ss = new osg::StateSet();
+                for (StateSetStack::const_iterator ssItr = itr->first.begin(); ssItr != itr->first.end(); ++ssItr)
+                {
+                    ss->merge(*(ssItr->get()));
+                }
+
+                osg::Geode* geode = new osg::Geode;
+                geode->setStateSet(ss);
+                for (GeometryVector::iterator gItr = groups[g].begin(); gItr != groups[g].end(); ++gItr)
+                {
+                    geode->addDrawable(gItr->get());
+                }
+                result->addChild(geode);
+            }
+
+            return result;
+        }
+
         unsigned int i = 0;
         for (StateSetStackToGeometryMap::iterator itr = _geometries.begin(); itr != _geometries.end(); ++itr)
         {
@@ -239,4 +275,24 @@ void MeshFlattener::run(osg::Group* group, unsigned maxVertsPerCluster)
 void MeshFlattener::run(osg::Group* group)
 {
     run(group, 250000u);
+}
+
+void MeshFlattener::runParallel(osg::Group* group, unsigned maxVertsPerCluster)
+{
+    PrepareForOptimizationVisitor v;
+    group->accept(v);
+
+    osgUtil::Optimizer optimizer;
+    optimizer.optimize(group, osgUtil::Optimizer::FLATTEN_STATIC_TRANSFORMS_DUPLICATING_SHARED_SUBGRAPHS);
+
+    osg::ref_ptr< StateSetCache > sscache = new StateSetCache();
+    sscache->optimize( group );
+
+    FlattenSceneGraphVisitor flatten;
+    flatten._maxVertsPerCluster = maxVertsPerCluster;
+    flatten._parallel = true;
+    group->accept(flatten);
+
+    group->removeChildren(0, group->getNumChildren());
+    group->addChild(flatten.build());
 }
\ No newline at end of file
@@ -0,0 +1,510 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthSymbology/PreparedGeometrySet>
+#include <osgEarthSymbology/GEOS>
+#include <algorithm>
+#include <cmath>
+
+#ifdef OSGEARTH_HAVE_GEOS
+#  include <geos/geom/prep/PreparedGeometry.h>
+#  include <geos/geom/prep/PreparedGeometryFactory.h>
+#  include <geos/operation/overlay/OverlayOp.h>
+#  include <geos/util/GEOSException.h>
+#  if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 8)
+#    define PREPARE_RETURNS_UNIQUE_PTR 1
+#  endif
+#endif
+
+#define LC "[PreparedGeometrySet] "
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+// maximum number of children per index node
+#define NODE_CAPACITY 8u
+
+//------------------------------------------------------------------------
+
+struct PreparedGeometrySet::Part : public osg::Referenced
+{
+    osg::ref_ptr<const Geometry> _geometry;
+    Bounds                       _bounds;
+};
+
+// GEOS copies of every part, prepared for queries. Prepared geometries
+// build internal indexes lazily and are not safe to query concurrently, so
+// each query checks out a copy for its own use.
+struct PreparedGeometrySet::Context : public osg::Referenced
+{
+#ifdef OSGEARTH_HAVE_GEOS
+    GEOSContext                                               _gc;
+    std::vector<geos::geom::Geometry*>                        _geoms;
+    std::vector<const geos::geom::prep::PreparedGeometry*>    _prepared;
+
+    void prepare(const std::vector< osg::ref_ptr<Part> >& parts)
+    {
+        _geoms.resize( parts.size(), 0L );
+        _prepared.resize( parts.size(), 0L );
+
+        for(unsigned i=0; i<parts.size(); ++i)
+        {
+            try
+            {
+                _geoms[i] = _gc.importGeometry( parts[i]->_geometry.get() );
+                if ( _geoms[i] )
+                {
+#ifdef PREPARE_RETURNS_UNIQUE_PTR
+                    _prepared[i] = geos::geom::prep::PreparedGeometryFactory::prepare( _geoms[i] ).release();
+#else
+                    _prepared[i] = geos::geom::prep::PreparedGeometryFactory::prepare( _geoms[i] );
+#endif
+                }
+            }
+            catch(const geos::util::GEOSException& ex)
+            {
+                OE_INFO << LC << "Failed to prepare geometry: "
+                    << (ex.what()? ex.what() : " no error message")
+                    << std::endl;
+            }
+        }
+    }
+
+    ~Context()
+    {
+        for(unsigned i=0; i<_prepared.size(); ++i)
+        {
+            if ( _prepared[i] )
+            {
+#ifdef PREPARE_RETURNS_UNIQUE_PTR
+                delete _prepared[i];
+#else
+                geos::geom::prep::PreparedGeometryFactory::destroy( _prepared[i] );
+#endif
+            }
+        }
+        for(unsigned i=0; i<_geoms.size(); ++i)
+        {
+            if ( _geoms[i] )
+                _gc.disposeGeometry( _geoms[i] );
+        }
+    }
+#endif
+};
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    inline bool overlaps2D(const Bounds& a, const Bounds& b)
+    {
+        return
+            a.xMin() <= b.xMax() && b.xMin() <= a.xMax() &&
+            a.yMin() <= b.yMax() && b.yMin() <= a.yMax();
+    }
+
+    struct Item
+    {
+        Bounds   _bounds;
+        unsigned _index;
+    };
+
+    struct LessX {
+        bool operator()(const Item& lhs, const Item& rhs) const {
+            return lhs._bounds.center().x() < rhs._bounds.center().x();
+        }
+    };
+
+    struct LessY {
+        bool operator()(const Item& lhs, const Item& rhs) const {
+            return lhs._bounds.center().y() < rhs._bounds.center().y();
+        }
+    };
+
+    // Sort-tile-recursive packing: sorts the items into vertical slices by X,
+    // each slice by Y, and groups every NODE_CAPACITY items into a parent.
+    template<typename NODE>
+    void pack(std::vector<Item>& items, std::vector<NODE>& parents)
+    {
+        unsigned numParents = (items.size() + NODE_CAPACITY - 1) / NODE_CAPACITY;
+        unsigned numSlices  = (unsigned)ceil(sqrt((double)numParents));
+        unsigned sliceSize  = numSlices * NODE_CAPACITY;
+
+        std::sort( items.begin(), items.end(), LessX() );
+
+        parents.clear();
+        parents.reserve( numParents );
+
+        for(unsigned s=0; s<items.size(); s += sliceSize)
+        {
+            unsigned sliceEnd = osg::minimum( s + sliceSize, (unsigned)items.size() );
+            std::sort( items.begin() + s, items.begin() + sliceEnd, LessY() );
+
+            for(unsigned first=s; first<sliceEnd; first += NODE_CAPACITY)
+            {
+                NODE node;
+                node._first = first;
+                node._count = osg::minimum( NODE_CAPACITY, sliceEnd - first );
+                for(unsigned i=first; i<first+node._count; ++i)
+                    node._bounds.expandBy( items[i]._bounds );
+                parents.push_back( node );
+            }
+        }
+    }
+}
+
+PreparedGeometrySet::PreparedGeometrySet() :
+_built( false )
+{
+    //nop
+}
+
+PreparedGeometrySet::~PreparedGeometrySet()
+{
+    //nop
+}
+
+void
+PreparedGeometrySet::add(const Geometry* geometry)
+{
+    if ( !geometry )
+        return;
+
+    const MultiGeometry* multi = dynamic_cast<const MultiGeometry*>(geometry);
+    if ( multi )
+    {
+        for(GeometryCollection::const_iterator i = multi->getComponents().begin(); i != multi->getComponents().end(); ++i)
+            add( i->get() );
+    }
+    else
+    {
+        addPart( geometry );
+    }
+}
+
+void
+PreparedGeometrySet::addPart(const Geometry* geometry)
+{
+    Bounds bounds = geometry->getBounds();
+    if ( !geometry->isValid() || !bounds.isValid() )
+        return;
+
+    Part* part = new Part();
+    part->_geometry = geometry;
+    part->_bounds = bounds;
+    _parts.push_back( part );
+
+    _bounds.expandBy( bounds );
+    _built = false;
+}
+
+unsigned
+PreparedGeometrySet::getNumParts() const
+{
+    return _parts.size();
+}
+
+void
+PreparedGeometrySet::build()
+{
+    _order.clear();
+    _levels.clear();
+    _contexts.clear();
+    _built = true;
+
+    if ( _parts.empty() )
+        return;
+
+#ifdef OSGEARTH_HAVE_GEOS
+    // prepare the first copy now, so single-threaded use never pays for it
+    // during a query.
+    osg::ref_ptr<Context> context = new Context();
+    context->prepare( _parts );
+    _contexts.push_back( context.get() );
+#endif
+
+    std::vector<Item> items( _parts.size() );
+    for(unsigned i=0; i<_parts.size(); ++i)
+    {
+        items[i]._bounds = _parts[i]->_bounds;
+        items[i]._index  = i;
+    }
+
+    _levels.push_back( std::vector<Node>() );
+    pack( items, _levels.back() );
+
+    _order.resize( items.size() );
+    for(unsigned i=0; i<items.size(); ++i)
+        _order[i] = items[i]._index;
+
+    // pack each level into the one above until the top fits in a node.
+    while( _levels.back().size() > NODE_CAPACITY )
+    {
+        std::vector<Node> below;
+        below.swap( _levels.back() );
+
+        items.resize( below.size() );
+        for(unsigned i=0; i<below.size(); ++i)
+        {
+            items[i]._bounds = below[i]._bounds;
+            items[i]._index  = i;
+        }
+
+        std::vector<Node> parents;
+        pack( items, parents );
+
+        // store the level below in its packed order.
+        std::vector<Node>& sorted = _levels.back();
+        sorted.resize( below.size() );
+        for(unsigned i=0; i<items.size(); ++i)
+            sorted[i] = below[items[i]._index];
+
+        _levels.push_back( parents );
+    }
+
+    OE_DEBUG << LC << "Indexed " << _parts.size() << " parts in " << _levels.size() << " levels" << std::endl;
+}
+
+void
+PreparedGeometrySet::takeContext(osg::ref_ptr<Context>& context) const
+{
+    {
+        Threading::ScopedMutexLock lock( _contextsMutex );
+        if ( !_contexts.empty() )
+        {
+            context = _contexts.back().get();
+            _contexts.pop_back();
+            return;
+        }
+    }
+
+    // more queries are running than there are copies; make another.
+    context = new Context();
+#ifdef OSGEARTH_HAVE_GEOS
+    context->prepare( _parts );
+#endif
+}
+
+void
+PreparedGeometrySet::returnContext(Context* context) const
+{
+    Threading::ScopedMutexLock lock( _contextsMutex );
+    _contexts.push_back( context );
+}
+
+void
+PreparedGeometrySet::query(const Bounds& bounds, std::vector<unsigned>& output) const
+{
+    output.clear();
+
+    if ( _levels.empty() || !overlaps2D(_bounds, bounds) )
+        return;
+
+    // (level, node) pairs left to visit
+    std::vector< std::pair<unsigned, unsigned> > stack;
+
+    const unsigned top = _levels.size() - 1;
+    for(unsigned i=0; i<_levels[top].size(); ++i)
+        stack.push_back( std::make_pair(top, i) );
+
+    while( !stack.empty() )
+    {
+        std::pair<unsigned, unsigned> next = stack.back();
+        stack.pop_back();
+
+        const Node& node = _levels[next.first][next.second];
+        if ( !overlaps2D(node._bounds, bounds) )
+            continue;
+
+        for(unsigned i=node._first; i<node._first+node._count; ++i)
+        {
+            if ( next.first > 0 )
+            {
+                stack.push_back( std::make_pair(next.first-1, i) );
+            }
+            else if ( overlaps2D(_parts[_order[i]]->_bounds, bounds) )
+            {
+                output.push_back( _order[i] );
+            }
+        }
+    }
+
+    // visit candidates in the order they were added.
+    std::sort( output.begin(), output.end() );
+}
+
+bool
+PreparedGeometrySet::contains2D(double x, double y) const
+{
+    if ( !_built || !_bounds.contains(x, y) )
+        return false;
+
+    std::vector<unsigned> candidates;
+    query( Bounds(x, y, x, y), candidates );
+
+    for(unsigned i=0; i<candidates.size(); ++i)
+    {
+        // Polygon overrides this to exclude its holes.
+        const Ring* ring = dynamic_cast<const Ring*>( _parts[candidates[i]]->_geometry.get() );
+        if ( ring && ring->contains2D(x, y) )
+            return true;
+    }
+    return false;
+}
+
+bool
+PreparedGeometrySet::intersects(const Geometry* input) const
+{
+    if ( !_built || !input )
+        return false;
+
+    Bounds bounds = input->getBounds();
+    if ( !bounds.isValid() )
+        return false;
+
+    std::vector<unsigned> candidates;
+    query( bounds, candidates );
+    if ( candidates.empty() )
+        return false;
+
+#ifdef OSGEARTH_HAVE_GEOS
+
+    osg::ref_ptr<Context> context;
+    takeContext( context );
+
+    geos::geom::Geometry* inGeom = context->_gc.importGeometry( input );
+    bool result = false;
+
+    if ( inGeom )
+    {
+        try
+        {
+            for(unsigned i=0; i<candidates.size() && !result; ++i)
+            {
+                const geos::geom::prep::PreparedGeometry* prepared = context->_prepared[candidates[i]];
+                result = prepared && prepared->intersects( inGeom );
+            }
+        }
+        catch(const geos::util::GEOSException& ex)
+        {
+            OE_INFO << LC << "Intersects(GEOS): "
+                << (ex.what()? ex.what() : " no error message")
+                << std::endl;
+        }
+
+        context->_gc.disposeGeometry( inGeom );
+    }
+
+    returnContext( context.get() );
+    return result;
+
+#else // OSGEARTH_HAVE_GEOS
+
+    // bounds only
+    return true;
+
+#endif // OSGEARTH_HAVE_GEOS
+}
+
+bool
+PreparedGeometrySet::crop(Geometry* input, osg::ref_ptr<Geometry>& output) const
+{
+    output = 0L;
+
+    if ( !_built || !input )
+        return false;
+
+    Bounds bounds = input->getBounds();
+    if ( !bounds.isValid() )
+        return false;
+
+    std::vector<unsigned> candidates;
+    query( bounds, candidates );
+    if ( candidates.empty() )
+        return false;
+
+#ifdef OSGEARTH_HAVE_GEOS
+
+    osg::ref_ptr<Context> context;
+    takeContext( context );
+    GEOSContext& gc = context->_gc;
+
+    geos::geom::Geometry* inGeom = gc.importGeometry( input );
+    if ( !inGeom )
+    {
+        returnContext( context.get() );
+        return false;
+    }
+
+    GeometryCollection pieces;
+    bool contained = false;
+
+    for(unsigned i=0; i<candidates.size() && !contained; ++i)
+    {
+        try
+        {
+            const geos::geom::prep::PreparedGeometry* prepared = context->_prepared[candidates[i]];
+            if ( !prepared || !prepared->intersects(inGeom) )
+                continue;
+
+            if ( prepared->contains(inGeom) )
+            {
+                contained = true;
+                break;
+            }
+
+            geos::geom::Geometry* outGeom = geos::operation::overlay::OverlayOp::overlayOp(
+                inGeom,
+                context->_geoms[candidates[i]],
+                geos::operation::overlay::OverlayOp::opINTERSECTION );
+
+            if ( outGeom )
+            {
+                osg::ref_ptr<Geometry> piece = gc.exportGeometry( outGeom );
+                if ( piece.valid() && piece->isValid() )
+                    pieces.push_back( piece.get() );
+                gc.disposeGeometry( outGeom );
+            }
+        }
+        catch(const geos::util::GEOSException& ex)
+        {
+            OE_INFO << LC << "Crop(GEOS): "
+                << (ex.what()? ex.what() : " no error message")
+                << std::endl;
+        }
+    }
+
+    gc.disposeGeometry( inGeom );
+    returnContext( context.get() );
+
+    if ( contained )
+        output = input;
+    else if ( pieces.size() == 1 )
+        output = pieces.front().get();
+    else if ( pieces.size() > 1 )
+        output = new MultiGeometry( pieces );
+
+    return output.valid();
+
+#else // OSGEARTH_HAVE_GEOS
+
+    OE_WARN << LC << "Crop failed - GEOS not available" << std::endl;
+    return false;
+
+#endif // OSGEARTH_HAVE_GEOS
+}
@@ -170,7 +170,7 @@ Style::mergeConfig( const Config& conf )
     }
     else
     {
-        Config symbolConf = conf.child( "symbols" );
+        const Config& symbolConf = conf.child( "symbols" );
         if ( !symbolConf.empty() )
         {
             for( ConfigSet::const_iterator i = symbolConf.children().begin(); i != symbolConf.children().end(); ++i )
@@ -193,6 +193,159 @@ namespace
     };
 
     typedef std::vector<Widths> WidthsList;
+
+    // Locations of all the heightfield posts, transformed into the geometry SRS
+    // in a single batch. Points are stored column-major (col*numRows + row), the
+    // order in which the integrators visit them. Also returns their bounds.
+    void getSamplePoints(const GeoExtent& ex, const osg::HeightField* hf, const SpatialReference* geomSRS,
+                         std::vector<osg::Vec3d>& points, Bounds& bounds)
+    {
+        unsigned numCols = hf->getNumColumns();
+        unsigned numRows = hf->getNumRows();
+
+        double col_interval = ex.width() / (double)(numCols-1);
+        double row_interval = ex.height() / (double)(numRows-1);
+
+        points.resize(numCols*numRows);
+        for (unsigned col = 0; col < numCols; ++col)
+        {
+            double x = ex.xMin() + (double)col * col_interval;
+            for (unsigned row = 0; row < numRows; ++row)
+            {
+                points[col*numRows + row].set(x, ex.yMin() + (double)row * row_interval, 0.0);
+            }
+        }
+
+        if (ex.getSRS() != geomSRS)
+            ex.getSRS()->transform(points, geomSRS);
+
+        for (unsigned i = 0; i < points.size(); ++i)
+            bounds.expandBy(points[i].x(), points[i].y());
+    }
+
+    // Squared 2D distance from P to a bounding box (zero if P is inside it).
+    double inline getDistanceSquaredToBounds(const osg::Vec3d& P, const Bounds& b)
+    {
+        double dx = std::max(std::max(b.xMin() - P.x(), P.x() - b.xMax()), 0.0);
+        double dy = std::max(std::max(b.yMin() - P.y(), P.y() - b.yMax()), 0.0);
+        return dx*dx + dy*dy;
+    }
+
+    // Maps a coordinate to a cell of a uniform grid, clamped to the grid.
+    // The clamp is done on the double so the int conversion cannot overflow.
+    int inline getCell(double v, double vmin, double cellSize, int numCells)
+    {
+        double c = floor((v - vmin) / cellSize);
+        return !(c > 0.0) ? 0 : c >= (double)(numCells-1) ? numCells-1 : (int)c;
+    }
+
+    // One line segment, tagged with the flattening radii of its feature.
+    struct IndexedSegment
+    {
+        osg::Vec3d A, B;
+        double innerRadius;
+        double outerRadius;
+    };
+
+    // Uniform bucket grid over a tile's sample area. Each cell lists every segment
+    // whose outer flattening radius reaches into the cell, in the same order in
+    // which the segments appear in the geometry, so a post only has to visit the
+    // segments in its own cell and still sees them in the original order.
+    class SegmentIndex
+    {
+    public:
+        SegmentIndex(const MultiGeometry* geom, const WidthsList& widths, const Bounds& bounds, int numCells) :
+            _xmin(bounds.xMin()),
+            _ymin(bounds.yMin()),
+            _numCells(numCells)
+        {
+            _cellWidth  = bounds.width()  > 0.0 ? bounds.width()  / (double)numCells : 1.0;
+            _cellHeight = bounds.height() > 0.0 ? bounds.height() / (double)numCells : 1.0;
+            _cells.resize(numCells*numCells);
+
+            for (unsigned int geomIndex = 0; geomIndex < geom->getNumComponents(); geomIndex++)
+            {
+                const Widths& w = widths[geomIndex];
+                double innerRadius = w.lineWidth * 0.5;
+                double outerRadius = innerRadius + w.bufferWidth;
+
+                ConstGeometryIterator giter(geom->getComponents()[geomIndex].get());
+                while (giter.hasMore())
+                {
+                    const Geometry* part = giter.next();
+
+                    for (unsigned i = 0; i+1 < part->size(); ++i)
+                    {
+                        const osg::Vec3d& A = (*part)[i];
+                        const osg::Vec3d& B = (*part)[i+1];
+
+                        double xmin = std::min(A.x(), B.x()) - outerRadius;
+                        double xmax = std::max(A.x(), B.x()) + outerRadius;
+                        double ymin = std::min(A.y(), B.y()) - outerRadius;
+                        double ymax = std::max(A.y(), B.y()) + outerRadius;
+
+                        // cannot reach any post in this tile:
+                        if (xmax < bounds.xMin() || xmin > bounds.xMax() ||
+                            ymax < bounds.yMin() || ymin > bounds.yMax())
+                            continue;
+
+                        unsigned index = _segments.size();
+                        _segments.push_back(IndexedSegment());
+                        IndexedSegment& s = _segments.back();
+                        s.A = A;
+                        s.B = B;
+                        s.innerRadius = innerRadius;
+                        s.outerRadius = outerRadius;
+
+                        int c0 = getCell(xmin, _xmin, _cellWidth,  _numCells);
+                        int c1 = getCell(xmax, _xmin, _cellWidth,  _numCells);
+                        int r0 = getCell(ymin, _ymin, _cellHeight, _numCells);
+                        int r1 = getCell(ymax, _ymin, _cellHeight, _numCells);
+
+                        for (int r = r0; r <= r1; ++r)
+                            for (int c = c0; c <= c1; ++c)
+                                _cells[r*_numCells + c].push_back(index);
+                    }
+                }
+            }
+        }
+
+        bool empty() const { return _segments.empty(); }
+
+        // Indices of the segments that might lie within flattening distance of P.
+        const std::vector<unsigned>& getCandidates(const osg::Vec3d& P) const
+        {
+            int c = getCell(P.x(), _xmin, _cellWidth,  _numCells);
+            int r = getCell(P.y(), _ymin, _cellHeight, _numCells);
+            return _cells[r*_numCells + c];
+        }
+
+        const IndexedSegment& operator[](unsigned i) const { return _segments[i]; }
+
+    private:
+        std::vector<IndexedSegment>          _segments;
+        std::vector< std::vector<unsigned> > _cells;
+        double _xmin, _ymin;
+        double _cellWidth, _cellHeight;
+        int _numCells;
+    };
+
+    // Number of index cells along each axis for a heightfield.
+    int getNumIndexCells(const osg::HeightField* hf)
+    {
+        return (int)osg::clampBetween(hf->getNumColumns()/8u, 1u, 32u);
+    }
+
+    // A polygon along with its bounds, buffer width, and (computed on demand)
+    // the elevation of a point inside it.
+    struct IndexedPolygon
+    {
+        const Polygon* polygon;
+        Bounds         bounds;
+        double         bufferWidth;
+        bool           hasElevInternal;
+        float          elevInternal;
+    };
     
     // Creates a heightfield that flattens an area intersecting the input polygon geometry.
     // The height of the area is found by sampling a point internal to the polygon.
@@ -205,77 +358,85 @@ namespace
 
         const GeoExtent& ex = key.getExtent();
 
-        double col_interval = ex.width() / (double)(hf->getNumColumns()-1);
-        double row_interval = ex.height() / (double)(hf->getNumRows()-1);
+        std::vector<osg::Vec3d> points;
+        Bounds pointBounds;
+        getSamplePoints(ex, hf, geomSRS, points, pointBounds);
 
-        POINT Pex, P, internalP;
+        // Flatten the polygon list once instead of iterating the geometry per post.
+        std::vector<IndexedPolygon> polygons;
+        for (unsigned int geomIndex = 0; geomIndex < geom->getNumComponents(); geomIndex++)
+        {
+            ConstGeometryIterator giter(geom->getComponents()[geomIndex].get(), false);
+            while (giter.hasMore())
+            {
+                const Polygon* polygon = dynamic_cast<const Polygon*>(giter.next());
+                if (polygon)
+                {
+                    polygons.push_back(IndexedPolygon());
+                    IndexedPolygon& ip = polygons.back();
+                    ip.polygon = polygon;
+                    ip.bounds = polygon->getBounds();
+                    ip.bufferWidth = widths[geomIndex].bufferWidth;
+                    ip.hasElevInternal = false;
+                    ip.elevInternal = 0.0f;
+                }
+            }
+        }
 
-        bool needsTransform = ex.getSRS() != geomSRS;
+        unsigned numRows = hf->getNumRows();
         
         for (unsigned col = 0; col < hf->getNumColumns(); ++col)
         {
-            Pex.x() = ex.xMin() + (double)col * col_interval;
-
-            for (unsigned row = 0; row < hf->getNumRows(); ++row)
+            for (unsigned row = 0; row < numRows; ++row)
             {
-                // check for cancelation periodically
-                //if (progress && progress->isCanceled())
-                //    return false;
-
-                Pex.y() = ex.yMin() + (double)row * row_interval;
-
-                if (needsTransform)
-                    ex.getSRS()->transform(Pex, geomSRS, P);
-                else
-                    P = Pex;
+                const POINT& P = points[col*numRows + row];
                 
-                bool done = false;
                 double minD2 = DBL_MAX;//bufferWidth * bufferWidth; // minimum distance(squared) to closest polygon edge
-                double bufferWidth = 0.0;
 
-                const Polygon* bestPoly = 0L;
+                IndexedPolygon* bestPoly = 0L;
 
-                for (unsigned int geomIndex = 0; geomIndex < geom->getNumComponents(); geomIndex++)
+                for (unsigned p = 0; p < polygons.size(); ++p)
                 {
-                    Geometry* component = geom->getComponents()[geomIndex].get();
-                    Widths width = widths[geomIndex];
-                    ConstGeometryIterator giter(component, false);
-                    while (giter.hasMore() && !done)
+                    IndexedPolygon& ip = polygons[p];
+
+                    // Neither containment nor a closer edge is possible if P is
+                    // outside the polygon's bounds by at least the best distance so far.
+                    double boundsD2 = getDistanceSquaredToBounds(P, ip.bounds);
+                    if (boundsD2 > 0.0 && boundsD2 >= minD2)
+                        continue;
+
+                    // Does the point P fall within the polygon?
+                    if (boundsD2 == 0.0 && ip.polygon->contains2D(P.x(), P.y()))
+                    {
+                        // yes, flatten it to the polygon's centroid elevation;
+                        // and we're dont with this point.
+                        bestPoly = &ip;
+                        minD2 = -1.0;
+                        break;
+                    }
+
+                    // If not in the polygon, how far to the closest edge?
+                    else
                     {
-                        const Polygon* polygon = dynamic_cast<const Polygon*>(giter.next());
-                        if (polygon)
+                        double D2 = getDistanceSquaredToClosestEdge(P, ip.polygon);
+                        if (D2 < minD2)
                         {
-                            // Does the point P fall within the polygon?
-                            if (polygon->contains2D(P.x(), P.y()))
-                            {
-                                // yes, flatten it to the polygon's centroid elevation;
-                                // and we're dont with this point.
-                                done = true;
-                                bestPoly = polygon;
-                                minD2 = -1.0;
-                                bufferWidth = width.bufferWidth;
-                            }
-
-                            // If not in the polygon, how far to the closest edge?
-                            else
-                            {
-                                double D2 = getDistanceSquaredToClosestEdge(P, polygon);
-                                if (D2 < minD2)
-                                {
-                                    minD2 = D2;
-                                    bestPoly = polygon;
-                                    bufferWidth = width.bufferWidth;
-                                }
-                            }
-                        }                    
+                            minD2 = D2;
+                            bestPoly = &ip;
+                        }
                     }
                 }
 
                 if (bestPoly && minD2 != 0.0)
                 {
                     float h;
-                    POINT internalP = getInternalPoint(bestPoly);
-                    float elevInternal = envelope->getElevation(internalP.x(), internalP.y());
+                    if (!bestPoly->hasElevInternal)
+                    {
+                        POINT internalP = getInternalPoint(bestPoly->polygon);
+                        bestPoly->elevInternal = envelope->getElevation(internalP.x(), internalP.y());
+                        bestPoly->hasElevInternal = true;
+                    }
+                    float elevInternal = bestPoly->elevInternal;
 
                     if (minD2 < 0.0)
                     {
@@ -284,7 +445,7 @@ namespace
                     else
                     {
                         float elevNatural = envelope->getElevation(P.x(), P.y());
-                        double blend = clamp(sqrt(minD2)/bufferWidth, 0.0, 1.0); // [0..1] 0=internal, 1=natural
+                        double blend = clamp(sqrt(minD2)/bestPoly->bufferWidth, 0.0, 1.0); // [0..1] 0=internal, 1=natural
                         h = smootherstep(elevInternal, elevNatural, blend);
                     }
 
@@ -400,31 +561,31 @@ namespace
 
         const GeoExtent& ex = key.getExtent();
 
-        double col_interval = ex.width() / (double)(hf->getNumColumns()-1);
-        double row_interval = ex.height() / (double)(hf->getNumRows()-1);
+        // Transform all the posts at once, then bucket the segments over them.
+        std::vector<osg::Vec3d> points;
+        Bounds pointBounds;
+        getSamplePoints(ex, hf, geomSRS, points, pointBounds);
+
+        SegmentIndex index(geom, widths, pointBounds, getNumIndexCells(hf));
+
+        // No segment comes close enough to this tile to affect it.
+        if (index.empty() && !fillAllPixels)
+            return false;
 
-        osg::Vec3d Pex, P, PROJ;
+        osg::Vec3d PROJ;
 
-        bool needsTransform = ex.getSRS() != geomSRS;
+        unsigned numRows = hf->getNumRows();
         
         // Loop over the new heightfield.
         for (unsigned col = 0; col < hf->getNumColumns(); ++col)
         {
-            Pex.x() = ex.xMin() + (double)col * col_interval;
-
-            for (unsigned row = 0; row < hf->getNumRows(); ++row)
+            for (unsigned row = 0; row < numRows; ++row)
             {
                 // check for cancelation periodically
                 //if (progress && progress->isCanceled())
                 //    return false;
 
-                Pex.y() = ex.yMin() + (double)row * row_interval;
-
-                // Move the point into the working SRS if necessary
-                if (needsTransform)
-                    ex.getSRS()->transform(Pex, geomSRS, P);
-                else
-                    P = Pex;
+                const osg::Vec3d& P = points[col*numRows + row];
 
                 // For each point, we need to find the closest line segments to that point
                 // because the elevation values on these line segments will be the flattening
@@ -433,90 +594,80 @@ namespace
                 static const unsigned Maxsamples = 4;
                 Samples samples;
 
-                for (unsigned int geomIndex = 0; geomIndex < geom->getNumComponents(); geomIndex++)
+                // Only the segments bucketed with this post can be within range.
+                const std::vector<unsigned>& candidates = index.getCandidates(P);
+
+                for (unsigned c = 0; c < candidates.size(); ++c)
                 {
-                    Widths w = widths[geomIndex];
-                    double innerRadius = w.lineWidth * 0.5;
-                    double outerRadius = innerRadius + w.bufferWidth;
-                    double outerRadius2 = outerRadius * outerRadius;
-
-                    Geometry* component = geom->getComponents()[geomIndex].get();
-                    // Search for line segments.
-                    ConstGeometryIterator giter(component);
-                    while (giter.hasMore())
+                    const IndexedSegment& segment = index[candidates[c]];
+
+                    // AB is a candidate line segment:
+                    const osg::Vec3d& A = segment.A;
+                    const osg::Vec3d& B = segment.B;
+                    double outerRadius2 = segment.outerRadius * segment.outerRadius;
+
+                    osg::Vec3d AB = B - A;    // current segment AB
+
+                    double t;                 // parameter [0..1] on segment AB
+                    double D2;                // shortest distance from point P to segment AB, squared
+                    double L2 = AB.length2(); // length (squared) of segment AB
+                    osg::Vec3d AP = P - A;    // vector from endpoint A to point P
+
+                    if (L2 == 0.0)
+                    {
+                        // trivial case: zero-length segment
+                        t = 0.0;
+                        D2 = AP.length2();
+                    }
+                    else
                     {
-                        const Geometry* part = giter.next();                        
+                        // Calculate parameter "t" [0..1] which will yield the closest point on AB to P.
+                        // Clamping it means the closest point won't be beyond the endpoints of the segment.
+                        t = clamp((AP * AB)/L2, 0.0, 1.0);
+
+                        // project our point P onto segment AB:
+                        PROJ.set( A + AB*t );
+
+                        // measure the distance (squared) from P to the projected point on AB:
+                        D2 = (P - PROJ).length2();
+                    }
+
+                    // If the distance from our point to the line segment falls within
+                    // the maximum flattening distance, store it.
+                    if (D2 <= outerRadius2)
+                    {
+                        // see if P is a new sample.
+                        Sample* b;
+                        if (samples.size() < Maxsamples)
+                        {
+                            // If we haven't collected the maximum number of samples yet,
+                            // just add this to the list:
+                            samples.push_back(Sample());
+                            b = &samples.back();
+                        }
+                        else
+                        {
+                            // If we are maxed out on samples, find the farthest one we have so far
+                            // and replace it if the new point is closer:
+                            unsigned max_i = 0;
+                            for (unsigned i=1; i<samples.size(); ++i)
+                                if (samples[i].D2 > samples[max_i].D2)
+                                    max_i = i;
+
+                            b = &samples[max_i];
+
+                            if (b->D2 < D2)
+                                b = 0L;
+                        }
 
-                        for (int i = 0; i < part->size()-1; ++i)
+                        if (b)
                         {
-                            // AB is a candidate line segment:
-                            const osg::Vec3d& A = (*part)[i];
-                            const osg::Vec3d& B = (*part)[i+1];
-
-                            osg::Vec3d AB = B - A;    // current segment AB
-
-                            double t;                 // parameter [0..1] on segment AB
-                            double D2;                // shortest distance from point P to segment AB, squared
-                            double L2 = AB.length2(); // length (squared) of segment AB
-                            osg::Vec3d AP = P - A;    // vector from endpoint A to point P
-
-                            if (L2 == 0.0)
-                            {
-                                // trivial case: zero-length segment
-                                t = 0.0;
-                                D2 = AP.length2();
-                            }
-                            else
-                            {
-                                // Calculate parameter "t" [0..1] which will yield the closest point on AB to P.
-                                // Clamping it means the closest point won't be beyond the endpoints of the segment.
-                                t = clamp((AP * AB)/L2, 0.0, 1.0);
-
-                                // project our point P onto segment AB:
-                                PROJ.set( A + AB*t );
-
-                                // measure the distance (squared) from P to the projected point on AB:
-                                D2 = (P - PROJ).length2();
-                            }
-
-                            // If the distance from our point to the line segment falls within
-                            // the maximum flattening distance, store it.
-                            if (D2 <= outerRadius2)
-                            {
-                                // see if P is a new sample.
-                                Sample* b;
-                                if (samples.size() < Maxsamples)
-                                {
-                                    // If we haven't collected the maximum number of samples yet,
-                                    // just add this to the list:
-                                    samples.push_back(Sample());
-                                    b = &samples.back();
-                                }
-                                else
-                                {
-                                    // If we are maxed out on samples, find the farthest one we have so far
-                                    // and replace it if the new point is closer:
-                                    unsigned max_i = 0;
-                                    for (unsigned i=1; i<samples.size(); ++i)
-                                        if (samples[i].D2 > samples[max_i].D2)
-                                            max_i = i;
-
-                                    b = &samples[max_i];
-
-                                    if (b->D2 < D2)
-                                        b = 0L;
-                                }
-
-                                if (b)
-                                {
-                                    b->D2 = D2;
-                                    b->A = A;
-                                    b->B = B;
-                                    b->T = t;
-                                    b->innerRadius = innerRadius;
-                                    b->outerRadius = outerRadius;
-                                }
-                            }
+                            b->D2 = D2;
+                            b->A = A;
+                            b->B = B;
+                            b->T = t;
+                            b->innerRadius = segment.innerRadius;
+                            b->outerRadius = segment.outerRadius;
                         }
                     }
                 }
@@ -27,6 +27,8 @@
 #include <osg/Geometry>
 #include <osgText/Text>
 #include <osgEarth/DrapeableNode>
+#include <algorithm>
+#include <cfloat>
 
 using namespace osgEarth;
 using namespace osgEarth::Util;
@@ -37,6 +39,110 @@ using namespace osgEarth::Annotation;
 #undef  LC
 #define LC "[HTMGroup] "
 
+// Depth of the cell IDs used to sort objects for bulk loading. At this
+// depth the cells are about 10m across; each level takes two bits.
+#define HTM_ID_DEPTH 20u
+
+namespace
+{
+    // The base octahedron: 6 vertices and 8 CCW triangles.
+    const double baseVerts[6][3] = {
+        { 0,  0,  1},    // lat= 90  long=  0
+        { 1,  0,  0},    // lat=  0  long=  0
+        { 0,  1,  0},    // lat=  0  long= 90
+        {-1,  0,  0},    // lat=  0  long=180
+        { 0, -1,  0},    // lat=  0  long=-90
+        { 0,  0, -1} };  // lat=-90  long=  0
+
+    const unsigned baseTris[8][3] = {
+        {0, 1, 2}, {0, 2, 3}, {0, 3, 4}, {0, 4, 1},
+        {5, 1, 4}, {5, 4, 3}, {5, 3, 2}, {5, 2, 1} };
+
+    inline osg::Vec3d baseVert(unsigned i)
+    {
+        return osg::Vec3d(baseVerts[i][0], baseVerts[i][1], baseVerts[i][2]);
+    }
+
+    // Which side of the great circle through a and b the point is on.
+    inline double side(const osg::Vec3d& a, const osg::Vec3d& b, const osg::Vec3d& p)
+    {
+        return (a ^ b) * p;
+    }
+
+    // ID of the cell at HTM_ID_DEPTH that contains a unit vector: the base
+    // triangle index followed by one 2-bit subcell digit per level, using
+    // the same subcell order as HTMNode::split().
+    unsigned long long computeID(const osg::Vec3d& p)
+    {
+        // base triangle: the one whose edges the point is least outside of.
+        unsigned base = 0u;
+        double best = -DBL_MAX;
+        for (unsigned t = 0; t < 8u; ++t)
+        {
+            osg::Vec3d a = baseVert(baseTris[t][0]), b = baseVert(baseTris[t][1]), c = baseVert(baseTris[t][2]);
+            double d = osg::minimum(side(a, b, p), osg::minimum(side(b, c, p), side(c, a, p)));
+            if (d > best)
+            {
+                best = d;
+                base = t;
+                if (d >= 0.0) break;
+            }
+        }
+
+        osg::Vec3d v0 = baseVert(baseTris[base][0]);
+        osg::Vec3d v1 = baseVert(baseTris[base][1]);
+        osg::Vec3d v2 = baseVert(baseTris[base][2]);
+        unsigned long long id = base;
+
+        for (unsigned depth = 0; depth < HTM_ID_DEPTH; ++depth)
+        {
+            osg::Vec3d w0 = v0 + v1; w0.normalize();
+            osg::Vec3d w1 = v1 + v2; w1.normalize();
+            osg::Vec3d w2 = v2 + v0; w2.normalize();
+
+            // the point is inside the parent, so only the inner edge of each
+            // corner subcell needs testing.
+            unsigned digit;
+            if      (side(w0, w2, p) >= 0.0) { digit = 0u; v1 = w0; v2 = w2; }
+            else if (side(w1, w0, p) >= 0.0) { digit = 1u; v0 = v1; v1 = w1; v2 = w0; }
+            else if (side(w2, w1, p) >= 0.0) { digit = 2u; v0 = v2; v1 = w2; v2 = w1; }
+            else                             { digit = 3u; v0 = w0; v1 = w1; v2 = w2; }
+
+            id = (id << 2) | digit;
+        }
+
+        return id;
+    }
+
+    inline unsigned digitAt(unsigned long long id, unsigned depth)
+    {
+        return (unsigned)(id >> (2u*(HTM_ID_DEPTH-1u-depth))) & 3u;
+    }
+
+    inline unsigned baseOf(unsigned long long id)
+    {
+        return (unsigned)(id >> (2u*HTM_ID_DEPTH));
+    }
+
+    void makeObjects(const osg::NodeList& nodes, std::vector<HTMObject>& objects)
+    {
+        objects.reserve(objects.size() + nodes.size());
+        for (osg::NodeList::const_iterator i = nodes.begin(); i != nodes.end(); ++i)
+        {
+            if (!i->valid())
+                continue;
+
+            osg::Vec3d p = (*i)->getBound().center();
+            p.normalize();
+
+            HTMObject object;
+            object._id = computeID(p);
+            object._node = i->get();
+            objects.push_back(object);
+        }
+    }
+}
+
 bool
 HTMNode::PolytopeDP::contains(const osg::Vec3d& p) const
 {
@@ -102,6 +208,12 @@ _settings(settings)
     _isLeaf = true;
     _tri.set( v0, v1, v2 );
 
+    osg::BoundingSphered bs;
+    bs.expandBy(v0);
+    bs.expandBy(v1);
+    bs.expandBy(v2);
+    _size = bs.radius() * 2.0 * SpatialReference::get("wgs84")->getEllipsoid()->getRadiusEquator();
+
     if (settings._debugGeom)
     {
         const double R = SpatialReference::get("wgs84")->getEllipsoid()->getRadiusEquator();
@@ -244,17 +356,9 @@ HTMNode::split()
 {
     OE_DEBUG << LC << "Splitting htmid:" << getName() << std::endl;
 
-    // find the midpoints of each side of the triangle
-    osg::Vec3d w[3];
-    _tri.getMidpoints( w );
-
-    // split into four children, each wound CCW
     HTMNode* c[4];
-    c[0] = new HTMNode(_settings, _tri._v[0], w[0], w[2], Stringify()<< getName() << "0");
-    c[1] = new HTMNode(_settings, _tri._v[1], w[1], w[0], Stringify() << getName() << "1");
-    c[2] = new HTMNode(_settings, _tri._v[2], w[2], w[1], Stringify() << getName() << "2");
-    c[3] = new HTMNode(_settings, w[0], w[1], w[2], Stringify() << getName() << "3");
-    
+    createSubcells( c );
+
     if (_settings._storeObjectsInLeavesOnly == true)
     {
         // distibute the data amongst the children
@@ -286,6 +390,132 @@ HTMNode::split()
     _isLeaf = false;
 }
 
+void
+HTMNode::createSubcells(HTMNode** c)
+{
+    // find the midpoints of each side of the triangle
+    osg::Vec3d w[3];
+    _tri.getMidpoints( w );
+
+    // split into four children, each wound CCW
+    c[0] = new HTMNode(_settings, _tri._v[0], w[0], w[2], Stringify()<< getName() << "0");
+    c[1] = new HTMNode(_settings, _tri._v[1], w[1], w[0], Stringify() << getName() << "1");
+    c[2] = new HTMNode(_settings, _tri._v[2], w[2], w[1], Stringify() << getName() << "2");
+    c[3] = new HTMNode(_settings, w[0], w[1], w[2], Stringify() << getName() << "3");
+}
+
+void
+HTMNode::build(const HTMObject* begin, const HTMObject* end, unsigned depth)
+{
+    unsigned count = end - begin;
+
+    bool roomForAllObjects = count <= _settings._maxObjectsPerCell;
+    bool underMaxCellSize = _size < _settings._maxCellSize;
+    bool reachedMinCellSize = _size <= _settings._minCellSize;
+
+    if ((underMaxCellSize && roomForAllObjects) || reachedMinCellSize || depth >= HTM_ID_DEPTH)
+    {
+        for (const HTMObject* i = begin; i != end; ++i)
+            osg::Group::addChild( i->_node );
+        return;
+    }
+
+    // When objects may live in inner cells, keep an evenly spaced sample
+    // here. The objects are in HTM order, so a stride through them samples
+    // the whole cell.
+    std::vector<HTMObject> rest;
+    if (_settings._storeObjectsInLeavesOnly == false && underMaxCellSize)
+    {
+        unsigned stride = osg::maximum(count / _settings._maxObjectsPerCell, 1u);
+        unsigned kept = 0u;
+        rest.reserve(count);
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (i % stride == 0u && kept < _settings._maxObjectsPerCell)
+            {
+                osg::Group::addChild( begin[i]._node );
+                ++kept;
+            }
+            else
+            {
+                rest.push_back( begin[i] );
+            }
+        }
+
+        begin = rest.empty() ? 0L : &rest.front();
+        end = begin + rest.size();
+    }
+
+    HTMNode* c[4];
+    createSubcells( c );
+
+    // the objects are sorted, so each subcell's objects are contiguous.
+    const HTMObject* first = begin;
+    for (unsigned j = 0; j < 4; ++j)
+    {
+        const HTMObject* last = first;
+        while (last != end && digitAt(last->_id, depth) == j)
+            ++last;
+
+        c[j]->build( first, last, depth+1 );
+        osg::Group::addChild( c[j] );
+        first = last;
+    }
+
+    _isLeaf = false;
+}
+
+HTMNode*
+HTMNode::getSubcell(unsigned digit) const
+{
+    if ( _isLeaf || _children.size() < 4 )
+        return 0L;
+
+    // last four children are the subcells
+    return static_cast<HTMNode*>(_children[_children.size()-4+digit].get());
+}
+
+void
+HTMNode::collect(osg::NodeList& objects) const
+{
+    unsigned numObjects = _isLeaf ? _children.size() : _children.size()-4;
+    for (unsigned i = 0; i < numObjects; ++i)
+        objects.push_back( _children[i] );
+
+    if ( !_isLeaf )
+    {
+        for (unsigned j = 0; j < 4; ++j)
+            getSubcell(j)->collect( objects );
+    }
+}
+
+unsigned
+HTMNode::remove(const std::set<osg::Node*>& nodes)
+{
+    unsigned numObjects = _isLeaf ? _children.size() : _children.size()-4;
+    unsigned removed = 0u;
+
+    // remove runs of matching objects, back to front so the indices hold.
+    for (int i = (int)numObjects-1; i >= 0; )
+    {
+        if ( nodes.find(_children[i].get()) == nodes.end() )
+        {
+            --i;
+            continue;
+        }
+
+        int first = i;
+        while ( first > 0 && nodes.find(_children[first-1].get()) != nodes.end() )
+            --first;
+
+        osg::Group::removeChildren( first, i-first+1 );
+        removed += i-first+1;
+        i = first-1;
+    }
+
+    return removed;
+}
+
 //-----------------------------------------------------------------------
 
 HTMGroup::HTMGroup()
@@ -306,29 +536,124 @@ HTMGroup::HTMGroup()
 void
 HTMGroup::reinitialize()
 {
-    _children.clear();
-
-    double rx = 1.0;
-    double ry = 1.0;
-    double rz = 1.0;
-
-    // assemble the base manifold of 8 triangles.
-    osg::Vec3d v0( 0,   0,   rz);     // lat= 90  long=  0
-    osg::Vec3d v1( rx,  0,   0);      // lat=  0  long=  0
-    osg::Vec3d v2( 0,   ry,  0);      // lat=  0  long= 90
-    osg::Vec3d v3(-rx,  0,   0);      // lat=  0  long=180
-    osg::Vec3d v4( 0,  -ry,  0);      // lat=  0  long=-90
-    osg::Vec3d v5( 0,   0,  -rz);     // lat=-90  long=  0
-
-    // CCW triangles.
-    osg::Group::addChild( new HTMNode(_settings, v0, v1, v2, "0") );
-    osg::Group::addChild( new HTMNode(_settings, v0, v2, v3, "1") );
-    osg::Group::addChild( new HTMNode(_settings, v0, v3, v4, "2") );
-    osg::Group::addChild( new HTMNode(_settings, v0, v4, v1, "3") );
-    osg::Group::addChild( new HTMNode(_settings, v5, v1, v4, "4") );
-    osg::Group::addChild( new HTMNode(_settings, v5, v4, v3, "5") );
-    osg::Group::addChild( new HTMNode(_settings, v5, v3, v2, "6") );
-    osg::Group::addChild( new HTMNode(_settings, v5, v2, v1, "7") );
+    osg::Group::removeChildren( 0, getNumChildren() );
+
+    // assemble the base manifold of 8 CCW triangles.
+    for (unsigned t = 0; t < 8u; ++t)
+    {
+        osg::Group::addChild( new HTMNode(
+            _settings,
+            baseVert(baseTris[t][0]), baseVert(baseTris[t][1]), baseVert(baseTris[t][2]),
+            Stringify() << t) );
+    }
+}
+
+void
+HTMGroup::collect(osg::NodeList& objects) const
+{
+    for (unsigned i = 0; i < _children.size(); ++i)
+        static_cast<const HTMNode*>(_children[i].get())->collect( objects );
+}
+
+void
+HTMGroup::build(std::vector<HTMObject>& objects)
+{
+    std::sort( objects.begin(), objects.end() );
+
+    reinitialize();
+
+    const HTMObject* first = objects.empty() ? 0L : &objects.front();
+    const HTMObject* end = first + objects.size();
+    for (unsigned t = 0; t < 8u; ++t)
+    {
+        const HTMObject* last = first;
+        while (last != end && baseOf(last->_id) == t)
+            ++last;
+
+        static_cast<HTMNode*>(_children[t].get())->build( first, last, 0u );
+        first = last;
+    }
+}
+
+void
+HTMGroup::addChildren(const osg::NodeList& nodes)
+{
+    // hold references while the old tree is torn down.
+    osg::NodeList all;
+    collect( all );
+    all.insert( all.end(), nodes.begin(), nodes.end() );
+
+    std::vector<HTMObject> objects;
+    makeObjects( all, objects );
+    build( objects );
+
+    OE_DEBUG << LC << "Bulk loaded " << nodes.size() << " objects (" << objects.size() << " total)" << std::endl;
+}
+
+void
+HTMGroup::rebalance()
+{
+    addChildren( osg::NodeList() );
+}
+
+unsigned
+HTMGroup::removeChildren(const osg::NodeList& nodes)
+{
+    std::set<osg::Node*> remaining;
+    for (osg::NodeList::const_iterator i = nodes.begin(); i != nodes.end(); ++i)
+        remaining.insert( i->get() );
+
+    // An object lives in one of the cells on the path to the cell
+    // containing its center; visit each of those cells only once.
+    std::vector<HTMObject> objects;
+    makeObjects( nodes, objects );
+
+    std::set<HTMNode*> cells;
+    for (unsigned i = 0; i < objects.size(); ++i)
+    {
+        unsigned long long id = objects[i]._id;
+        HTMNode* cell = static_cast<HTMNode*>(_children[baseOf(id)].get());
+        for (unsigned depth = 0; cell; ++depth)
+        {
+            cells.insert( cell );
+            cell = depth < HTM_ID_DEPTH ? cell->getSubcell( digitAt(id, depth) ) : 0L;
+        }
+    }
+
+    unsigned removed = 0u;
+    for (std::set<HTMNode*>::iterator i = cells.begin(); i != cells.end(); ++i)
+        removed += (*i)->remove( remaining );
+
+    // Objects inserted one at a time near a cell boundary can land in a
+    // neighboring cell; sweep the whole tree for any stragglers.
+    if ( removed < remaining.size() )
+    {
+        std::vector<HTMNode*> stack;
+        for (unsigned i = 0; i < _children.size(); ++i)
+            stack.push_back( static_cast<HTMNode*>(_children[i].get()) );
+
+        unsigned found = 0u;
+        while ( !stack.empty() && removed + found < remaining.size() )
+        {
+            HTMNode* cell = stack.back();
+            stack.pop_back();
+            if ( cells.find(cell) == cells.end() )
+                found += cell->remove( remaining );
+            for (unsigned j = 0; j < 4 && !cell->isLeaf(); ++j)
+                stack.push_back( cell->getSubcell(j) );
+        }
+        removed += found;
+    }
+
+    return removed;
+}
+
+unsigned
+HTMGroup::getNumObjects() const
+{
+    osg::NodeList objects;
+    collect( objects );
+    return objects.size();
 }
 
 bool
@@ -1,6 +1,9 @@
 #include <osgEarthUtil/SimplePager> 
 #include <osgEarth/TileKey>
 #include <osgEarth/Utils>
+#include <osgEarth/NodeUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/TaskService>
 #include <osgDB/Registry>
 #include <osgDB/FileNameUtils>
 #include <osgDB/Options>
@@ -8,6 +11,7 @@
 #include <osg/ShapeDrawable>
 #include <osg/MatrixTransform>
 #include <osg/Geode>
+#include <algorithm>
 
 using namespace osgEarth::Util;
 
@@ -109,6 +113,152 @@ namespace
     };
 
     REGISTER_OSGPLUGIN(osgearth_pseudo_simple, SimplePagerPseudoLoader);
+
+
+    Threading::Mutex s_schedulerMutex;
+    UID              s_schedulerUID = -1;
+
+    /**
+     * Job scheduler shared by all the asynchronous pagers. It draws its
+     * threads from the registry's task service manager.
+     */
+    TaskService* getScheduler()
+    {
+        TaskServiceManager* manager = Registry::instance()->getTaskServiceManager();
+        Threading::ScopedMutexLock lock( s_schedulerMutex );
+        if ( s_schedulerUID < 0 )
+        {
+            s_schedulerUID = Registry::instance()->createUID();
+            manager->add( s_schedulerUID )->setName( "SimplePager" );
+        }
+        return manager->get( s_schedulerUID );
+    }
+}
+
+//........................................................................
+
+/**
+ * Replaces the PagedLOD in asynchronous mode. Child 0 holds the tile's own
+ * data; the rest, once loaded, hold the paged nodes of the child tiles.
+ */
+class SimplePager::AsyncNode : public osg::Group
+{
+public:
+    AsyncNode(SimplePager* pager, const TileKey& key, const osg::BoundingSphere& bounds, float range, bool hasChildren, bool additive) :
+        _pager(pager),
+        _key(key),
+        _center(bounds.center()),
+        _range(range),
+        _hasChildren(hasChildren),
+        _additive(additive),
+        _lastChildFrame(0u)
+    {
+        setInitialBound( bounds );
+    }
+
+    void traverse(osg::NodeVisitor& nv)
+    {
+        if ( !_hasChildren || getNumChildren() == 0 ||
+             (nv.getTraversalMode() == nv.TRAVERSE_ALL_CHILDREN && nv.getVisitorType() != nv.CULL_VISITOR) )
+        {
+            osg::Group::traverse( nv );
+            return;
+        }
+
+        float distance = nv.getDistanceToViewPoint( _center, true );
+        if ( distance < _range )
+        {
+            if ( getNumChildren() > 1 )
+            {
+                if ( nv.getFrameStamp() )
+                    _lastChildFrame = nv.getFrameStamp()->getFrameNumber();
+
+                for (unsigned i = _additive ? 0u : 1u; i < getNumChildren(); ++i)
+                    _children[i]->accept( nv );
+                return;
+            }
+
+            // The tile's screen-space error grows with the ratio of its
+            // switch range to the distance from the eye.
+            osg::ref_ptr<SimplePager> pager;
+            if ( nv.getVisitorType() == nv.CULL_VISITOR && nv.getFrameStamp() && _pager.lock(pager) )
+            {
+                float priority = pager->_priorityOffset +
+                    pager->_priorityScale * (_range / osg::maximum(distance, 1.0f));
+
+                pager->requestChildren( this, priority, nv.getFrameStamp()->getFrameNumber() );
+            }
+        }
+
+        _children[0]->accept( nv );
+    }
+
+    void mergeChildren(osg::Node* node)
+    {
+        if ( getNumChildren() == 1 )
+            addChild( node );
+    }
+
+    void unloadChildren()
+    {
+        if ( getNumChildren() > 1 )
+            removeChildren( 1, getNumChildren()-1 );
+    }
+
+    // A node can outlive its pager (in a cache, or a graph still being culled).
+    osg::observer_ptr<SimplePager> _pager;
+    TileKey                        _key;
+    osg::Vec3d                     _center;
+    float                          _range;
+    bool                           _hasChildren;
+    bool                           _additive;
+    unsigned                       _lastChildFrame;
+
+    // Outstanding request for the child tiles; guarded by the pager's request mutex.
+    osg::ref_ptr<AsyncRequest> _request;
+};
+
+/**
+ * Request to load the child tiles of an AsyncNode. Runs on the shared scheduler.
+ */
+class SimplePager::AsyncRequest : public TaskRequest
+{
+public:
+    AsyncRequest(SimplePager* pager, AsyncNode* node, const TileKey& key) :
+        _pager(pager),
+        _node(node),
+        _key(key),
+        _requestPriority(0.0f),
+        _lastFrame(0u)
+    {
+        setName( key.str() );
+    }
+
+    void operator()(ProgressCallback* progress)
+    {
+        osg::ref_ptr<SimplePager> pager;
+        if ( _pager.lock(pager) )
+            pager->runRequest( this );
+    }
+
+    osg::observer_ptr<SimplePager> _pager;
+    osg::observer_ptr<AsyncNode>   _node;
+    TileKey                        _key;
+    float                          _requestPriority;
+    unsigned                       _lastFrame;
+    osg::ref_ptr<osg::Node>        _result;
+};
+
+namespace
+{
+    template<typename T>
+    struct HigherPriority
+    {
+        bool operator()(const osg::ref_ptr<T>& lhs, const osg::ref_ptr<T>& rhs) const
+        {
+            return lhs->_requestPriority > rhs->_requestPriority;
+        }
+    };
 }
 
 
@@ -135,7 +285,11 @@ _minLevel(0),
 _maxLevel(30),
 _priorityScale(1.0f),
 _priorityOffset(0.0f),
-_canCancel(true)
+_canCancel(true),
+_async(false),
+_updateTraversal(false),
+_maxConcurrentJobs(4u),
+_expirationFrames(120u)
 {
     // required in order to pass our "this" pointer to the pseudo loader:
     this->setName( "osgEarth::Util::SimplerPager::this" );
@@ -145,6 +299,13 @@ _canCancel(true)
     addCullCallback( _progressMaster.get() );
 }
 
+SimplePager::~SimplePager()
+{
+    Threading::ScopedMutexLock lock(_requestMutex);
+    for (AsyncRequests::iterator i = _active.begin(); i != _active.end(); ++i)
+        i->get()->cancel();
+}
+
 void SimplePager::setEnableCancelation(bool value)
 {
     static_cast<ProgressMaster*>(_progressMaster.get())->_canCancel = value;
@@ -155,8 +316,35 @@ bool SimplePager::getEnableCancalation() const
     return static_cast<ProgressMaster*>(_progressMaster.get())->_canCancel;
 }
 
+void SimplePager::setMaxConcurrentJobs(unsigned value)
+{
+    _maxConcurrentJobs = osg::maximum(value, 1u);
+}
+
+void SimplePager::setAsynchronous(bool value)
+{
+    _async = value;
+
+    if ( _async && getNumChildren() > 0 )
+        requireUpdateTraversal();
+}
+
+// Asynchronous mode merges and dispatches requests in the update traversal.
+// Once on, it stays on, so requests issued before a switch back still finish.
+void SimplePager::requireUpdateTraversal()
+{
+    if ( !_updateTraversal )
+    {
+        ADJUST_UPDATE_TRAV_COUNT( this, +1 );
+        _updateTraversal = true;
+    }
+}
+
 void SimplePager::build()
 {
+    if ( _async )
+        requireUpdateTraversal();
+
     addChild( buildRootNode() );
 }
 
@@ -254,6 +442,20 @@ osg::Node* SimplePager::createPagedNode(const TileKey& key, ProgressCallback* pr
 
     tileRadius = std::max(tileBounds.radius(), tileRadius);
 
+    if ( _async )
+    {
+        AsyncNode* anode = new AsyncNode(
+            this,
+            key,
+            osg::BoundingSphere(tileBounds.center(), tileRadius),
+            (float)(tileRadius * _rangeFactor),
+            hasChildren,
+            _additive );
+
+        anode->addChild( node.get() );
+        return anode;
+    }
+
     osg::PagedLOD* plod = new osg::PagedLOD;
     plod->setCenter( tileBounds.center() ); 
     plod->setRadius( tileRadius );
@@ -338,6 +540,24 @@ osg::Node* SimplePager::loadKey(const TileKey& key, ProgressTracker* tracker)
     return 0;
 }
 
+osg::Node* SimplePager::loadChildren(const TileKey& key, ProgressCallback* progress)
+{
+    osg::ref_ptr< osg::Group > group = new osg::Group;
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        if ( progress && progress->isCanceled() )
+            return 0L;
+
+        osg::Node* node = createPagedNode( key.createChildKey(i), progress );
+        if ( node )
+        {
+            group->addChild( node );
+        }
+    }
+    return group->getNumChildren() > 0 ? group.release() : 0L;
+}
+
 const osgEarth::Profile* SimplePager::getProfile() const
 {
     return _profile.get();
@@ -373,4 +593,170 @@ void SimplePager::fire_onCreateNode(const TileKey& key, osg::Node* node)
     Threading::ScopedMutexLock lock(_mutex);
     for (Callbacks::iterator i = _callbacks.begin(); i != _callbacks.end(); ++i)
         i->get()->onCreateNode(key, node);
-}
\ No newline at end of file
+}
+
+unsigned SimplePager::getNumPendingRequests() const
+{
+    Threading::ScopedMutexLock lock(_requestMutex);
+    return _pending.size();
+}
+
+unsigned SimplePager::getNumActiveRequests() const
+{
+    Threading::ScopedMutexLock lock(_requestMutex);
+    return _active.size();
+}
+
+void SimplePager::traverse(osg::NodeVisitor& nv)
+{
+    if ( _updateTraversal && nv.getVisitorType() == nv.UPDATE_VISITOR && nv.getFrameStamp() )
+    {
+        updateRequests( nv.getFrameStamp()->getFrameNumber() );
+    }
+
+    osg::Group::traverse( nv );
+}
+
+// Called by the cull traversal for each tile that wants its children.
+// With several cameras, a tile keeps the highest priority of the frame.
+void SimplePager::requestChildren(AsyncNode* node, float priority, unsigned frame)
+{
+    Threading::ScopedMutexLock lock(_requestMutex);
+
+    AsyncRequest* request = node->_request.get();
+    if ( !request )
+    {
+        request = new AsyncRequest( this, node, node->_key );
+        node->_request = request;
+        _pending.push_back( request );
+    }
+    else if ( request->_lastFrame == frame )
+    {
+        priority = osg::maximum( priority, request->_requestPriority );
+    }
+
+    request->_requestPriority = priority;
+    request->_lastFrame = frame;
+}
+
+// Called by a scheduler thread.
+void SimplePager::runRequest(AsyncRequest* request)
+{
+    ProgressCallback* progress = request->getProgressCallback();
+
+    osg::ref_ptr<osg::Node> result;
+    if ( !progress->isCanceled() )
+        result = loadChildren( request->_key, progress );
+
+    Threading::ScopedMutexLock lock(_requestMutex);
+
+    // a canceled request is no longer in the active list; discard its result.
+    AsyncRequests::iterator i = std::find( _active.begin(), _active.end(), request );
+    if ( i != _active.end() )
+    {
+        request->_result = result.get();
+        _completed.push_back( request );
+        _active.erase( i );
+    }
+}
+
+// Called by the update traversal.
+void SimplePager::updateRequests(unsigned frame)
+{
+    Threading::ScopedMutexLock lock(_requestMutex);
+
+    // merge completed requests into the scene graph.
+    for (AsyncRequests::iterator i = _completed.begin(); i != _completed.end(); ++i)
+    {
+        AsyncRequest* request = i->get();
+        osg::ref_ptr<AsyncNode> node;
+        if ( request->_node.lock(node) )
+        {
+            node->_request = 0L;
+            if ( request->_result.valid() )
+            {
+                node->mergeChildren( request->_result.get() );
+                node->_lastChildFrame = frame;
+                _resident.push_back( node.get() );
+            }
+        }
+    }
+    _completed.clear();
+
+    // drop waiting requests whose tiles were not traversed last frame.
+    unsigned k = 0;
+    for (unsigned i = 0; i < _pending.size(); ++i)
+    {
+        AsyncRequest* request = _pending[i].get();
+        osg::ref_ptr<AsyncNode> node;
+        bool hasNode = request->_node.lock(node);
+        if ( hasNode && frame - request->_lastFrame <= 1u )
+        {
+            _pending[k++] = request;
+        }
+        else if ( hasNode )
+        {
+            node->_request = 0L;
+        }
+    }
+    _pending.resize( k );
+
+    // cancel running requests the same way, unless cancelation is disabled.
+    bool canCancel = getEnableCancalation();
+    k = 0;
+    for (unsigned i = 0; i < _active.size(); ++i)
+    {
+        AsyncRequest* request = _active[i].get();
+        osg::ref_ptr<AsyncNode> node;
+        bool hasNode = request->_node.lock(node);
+        if ( hasNode && (!canCancel || frame - request->_lastFrame <= 1u) )
+        {
+            _active[k++] = request;
+        }
+        else
+        {
+            request->cancel();
+            if ( hasNode )
+                node->_request = 0L;
+        }
+    }
+    _active.resize( k );
+
+    // start the most important requests, up to this pager's job limit.
+    if ( !_pending.empty() && _active.size() < _maxConcurrentJobs )
+    {
+        unsigned numToStart = osg::minimum( (unsigned)_pending.size(), _maxConcurrentJobs - (unsigned)_active.size() );
+
+        std::partial_sort(
+            _pending.begin(), _pending.begin() + numToStart, _pending.end(),
+            HigherPriority<AsyncRequest>() );
+
+        TaskService* scheduler = getScheduler();
+        for (unsigned i = 0; i < numToStart; ++i)
+        {
+            AsyncRequest* request = _pending[i].get();
+
+            // the task queue runs the lowest value first.
+            request->setPriority( -request->_requestPriority );
+
+            _active.push_back( request );
+            scheduler->add( request );
+        }
+        _pending.erase( _pending.begin(), _pending.begin() + numToStart );
+    }
+
+    // unload children that have not been traversed for a while.
+    k = 0;
+    for (unsigned i = 0; i < _resident.size(); ++i)
+    {
+        osg::ref_ptr<AsyncNode> node;
+        if ( _resident[i].lock(node) )
+        {
+            if ( frame - node->_lastChildFrame > _expirationFrames )
+                node->unloadChildren();
+            else
+                _resident[k++] = _resident[i];
+        }
+    }
+    _resident.resize( k );
+}
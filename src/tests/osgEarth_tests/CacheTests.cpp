@@ -0,0 +1,113 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/Cache>
+#include <osgEarth/CacheBin>
+#include <osgEarthDrivers/cache_leveldb/LevelDBCacheOptions>
+#include <osgEarthDrivers/cache_rocksdb/RocksDBCacheOptions>
+#include <osg/Image>
+#include <cstring>
+
+using namespace osgEarth;
+
+namespace
+{
+    osg::Image* createImage(unsigned char value)
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage(16, 16, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        memset(image->data(), value, image->getTotalSizeInBytes());
+        return image;
+    }
+
+    // Every record written and then purged or removed must come back
+    // out of the cache's size estimate.
+    template<typename OPTIONS>
+    void testSizeTracking(const std::string& path)
+    {
+        OPTIONS options;
+        options.rootPath() = path;
+        options.maxSizeMB() = 0u;          // always over the limit
+        options.asyncPurge() = false;      // purge on the writing thread
+        options.sizePurgePeriod() = 6u;    // after the 1st and 6th writes
+        options.sizeCheckPeriod() = 1000u;
+
+        osg::ref_ptr<Cache> cache = CacheFactory::create(options);
+        if ( !cache.valid() || !cache->isOK() )
+        {
+            WARN( "Cache driver \"" << options.getDriver() << "\" is not available" );
+            return;
+        }
+
+        CacheBin* bin = cache->addBin("size_tracking");
+        REQUIRE( bin != 0L );
+        cache->clear();
+        off_t base = cache->getApproximateSize();
+
+        // the first write is purged right away
+        osg::ref_ptr<osg::Image> image = createImage(1);
+        REQUIRE( bin->write("single", image.get(), 0L) );
+        REQUIRE( bin->getRecordStatus("single") == CacheBin::STATUS_NOT_FOUND );
+        REQUIRE( cache->getApproximateSize() == base );
+
+        // and a batch once it brings the count to the purge period
+        CacheBin::Records records;
+        for (unsigned i = 0; i < 5; ++i)
+            records.push_back(CacheBin::Record(Stringify() << "batch" << i, createImage(i)));
+        REQUIRE( bin->writeMany(records, 0L) == 5u );
+        REQUIRE( bin->getRecordStatus("batch0") == CacheBin::STATUS_NOT_FOUND );
+        REQUIRE( cache->getApproximateSize() == base );
+    }
+
+    template<typename OPTIONS>
+    void testRemove(const std::string& path)
+    {
+        OPTIONS options;
+        options.rootPath() = path;
+
+        osg::ref_ptr<Cache> cache = CacheFactory::create(options);
+        if ( !cache.valid() || !cache->isOK() )
+            return;
+
+        CacheBin* bin = cache->addBin("remove");
+        REQUIRE( bin != 0L );
+        off_t base = cache->getApproximateSize();
+
+        osg::ref_ptr<osg::Image> image = createImage(2);
+        REQUIRE( bin->write("record", image.get(), 0L) );
+        REQUIRE( cache->getApproximateSize() > base );
+        REQUIRE( bin->remove("record") );
+        REQUIRE( cache->getApproximateSize() == base );
+    }
+}
+
+TEST_CASE( "LevelDB cache size tracking" ) {
+    testSizeTracking<Drivers::LevelDBCache::LevelDBCacheOptions>("osgEarth_tests_leveldb_purge.tmp");
+    testRemove<Drivers::LevelDBCache::LevelDBCacheOptions>("osgEarth_tests_leveldb_remove.tmp");
+}
+
+TEST_CASE( "RocksDB cache size tracking" ) {
+    testSizeTracking<Drivers::RocksDBCache::RocksDBCacheOptions>("osgEarth_tests_rocksdb_purge.tmp");
+    testRemove<Drivers::RocksDBCache::RocksDBCacheOptions>("osgEarth_tests_rocksdb_remove.tmp");
+}
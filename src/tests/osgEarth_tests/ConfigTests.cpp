@@ -0,0 +1,122 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/Config>
+#include <osgEarth/XmlUtils>
+#include <sstream>
+
+using namespace osgEarth;
+
+TEST_CASE( "Config copies are independent" ) {
+
+    Config a("map");
+    a.add("name", "one");
+    a.add("layer", "two");
+
+    Config b = a;
+    REQUIRE(b.value("name") == "one");
+
+    SECTION("Changing a copy leaves the original alone") {
+        b.set("name", "three");
+        REQUIRE(a.value("name") == "one");
+        REQUIRE(b.value("name") == "three");
+        REQUIRE(a.value("layer") == "two");
+    }
+
+    SECTION("Mutable references do not leak across copies") {
+        Config& name = *a.mutable_child("name");
+        Config c = a;
+        name.value() = "four";
+        REQUIRE(a.value("name") == "four");
+        REQUIRE(c.value("name") == "one");
+        REQUIRE(b.value("name") == "one");
+    }
+
+    SECTION("Reading children keeps copies shared") {
+        const Config& ca = a;
+        const Config& cb = b;
+        unsigned count = 0u;
+        for (ConfigSet::const_iterator i = ca.children().begin(); i != ca.children().end(); ++i)
+            ++count;
+        REQUIRE(count == 2u);
+        REQUIRE(ca.hasChild("layer"));
+        REQUIRE(ca.child("layer").value() == "two");
+        REQUIRE(ca.find("name") != 0L);
+        REQUIRE(&ca.children() == &cb.children());
+
+        a.add("style", "five");
+        REQUIRE(&ca.children() != &cb.children());
+        REQUIRE(cb.children().size() == 2u);
+        REQUIRE(b.hasChild("style") == false);
+    }
+}
+
+TEST_CASE( "ConfigArena" ) {
+
+    SECTION("JSON round trip") {
+        Config a("map");
+        a.add("name", "test");
+        Config layer("image");
+        layer.add("driver", "gdal");
+        a.add(layer);
+        a.add(layer);
+
+        osg::ref_ptr<ConfigArena> arena = ConfigArena::readJSON(a.toJSON());
+        REQUIRE(arena.valid());
+
+        ConfigView root = arena->root();
+        REQUIRE(root.key() == "map");
+        REQUIRE(root.value("name") == "test");
+        REQUIRE(root.children("image").size() == 2u);
+        REQUIRE(root.child("image").value("driver") == "gdal");
+
+        Config b;
+        b.fromJSON(a.toJSON());
+        REQUIRE(b.toJSON() == a.toJSON());
+    }
+
+    SECTION("XML") {
+        std::stringstream in(
+            "<map name=\"test\" version=\"2\">"
+            "  <image name=\"world\" driver=\"gdal\"><url>world.tif</url></image>"
+            "  <options>  text  </options>"
+            "</map>");
+
+        osg::ref_ptr<ConfigArena> arena = XmlDocument::loadConfig(in);
+        REQUIRE(arena.valid());
+
+        ConfigView map = arena->root().child("map");
+        REQUIRE(map.valid());
+        REQUIRE(map.value("version") == "2");
+        REQUIRE(map.child("image").value("url") == "world.tif");
+        REQUIRE(map.value("options") == "text");
+
+        // interned strings: "map", "image" etc. are stored once each
+        REQUIRE(arena->getNumStrings() < arena->getNumNodes() * 2u);
+
+        const Config conf = map.toConfig();
+        REQUIRE(conf.key() == "map");
+        REQUIRE(conf.child("image").value("driver") == "gdal");
+        REQUIRE(conf.children().size() == 4u);
+    }
+}
@@ -0,0 +1,123 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
+
+using namespace osgEarth;
+
+namespace
+{
+    // Procedural elevation; optionally with square holes of NO_DATA.
+    class SyntheticElevationSource : public TileSource
+    {
+    public:
+        SyntheticElevationSource(double scale, bool holes) :
+            TileSource(TileSourceOptions()), _scale(scale), _holes(holes) { }
+
+        Status initialize(const osgDB::Options* dbOptions)
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            return STATUS_OK;
+        }
+
+        CachePolicy getCachePolicyHint(const Profile* profile) const
+        {
+            return CachePolicy::NO_CACHE;
+        }
+
+        osg::HeightField* createHeightField(const TileKey& key, ProgressCallback* progress)
+        {
+            const GeoExtent& ex = key.getExtent();
+            unsigned size = 33;
+            osg::HeightField* hf = HeightFieldUtils::createReferenceHeightField(ex, size, size, 0u);
+            for (unsigned r = 0; r < size; ++r)
+            {
+                double lat = ex.yMin() + ex.height() * (double)r / (double)(size-1);
+                for (unsigned c = 0; c < size; ++c)
+                {
+                    double lon = ex.xMin() + ex.width() * (double)c / (double)(size-1);
+                    bool hole = _holes && ((c/4 + r/4) % 3 == 0);
+                    hf->setHeight(c, r, hole ? NO_DATA_VALUE : (float)(_scale * (sin(lon*0.7) + cos(lat*1.3))));
+                }
+            }
+            return hf;
+        }
+
+    private:
+        double _scale;
+        bool   _holes;
+    };
+
+    ElevationLayer* createLayer(const std::string& name, double scale, bool holes, bool offset)
+    {
+        ElevationLayerOptions options(name);
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        options.offset() = offset;
+        SyntheticElevationSource* source = new SyntheticElevationSource(scale, holes);
+        source->open();
+        ElevationLayer* layer = new ElevationLayer(options, source);
+        layer->open();
+        return layer;
+    }
+}
+
+TEST_CASE( "ElevationLayerVector samples the grid the same way it samples each post" ) {
+
+    ElevationLayerVector layers;
+    layers.push_back( createLayer("base",    1000.0, false, false) );
+    layers.push_back( createLayer("detail",   250.0, true,  false) );
+    layers.push_back( createLayer("offset",    10.0, true,  true) );
+
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    TileKey key(7, 200, 40, profile);
+
+    ElevationInterpolation interps[2] = { INTERP_BILINEAR, INTERP_NEAREST };
+
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        osg::ref_ptr<osg::HeightField> grid = HeightFieldUtils::createReferenceHeightField(key.getExtent(), 257, 257, 0u);
+        osg::ref_ptr<osg::HeightField> post = HeightFieldUtils::createReferenceHeightField(key.getExtent(), 257, 257, 0u);
+        osg::ref_ptr<NormalMap> gridNormals = new NormalMap(257, 257);
+        osg::ref_ptr<NormalMap> postNormals = new NormalMap(257, 257);
+
+        bool gridOK = layers.populateHeightFieldAndNormalMap(grid.get(), gridNormals.get(), key, 0L, interps[i], 0L);
+        bool postOK = layers.populateHeightFieldAndNormalMapPerPost(post.get(), postNormals.get(), key, 0L, interps[i], 0L);
+        REQUIRE( gridOK == postOK );
+        REQUIRE( gridOK );
+
+        float maxError = 0.0f, maxNormalError = 0.0f;
+        for (unsigned r = 0; r < 257; ++r)
+        {
+            for (unsigned c = 0; c < 257; ++c)
+            {
+                maxError = osg::maximum(maxError, fabsf(grid->getHeight(c, r) - post->getHeight(c, r)));
+                maxNormalError = osg::maximum(maxNormalError, (gridNormals->getNormal(c, r) - postNormals->getNormal(c, r)).length());
+            }
+        }
+        REQUIRE( maxError < 0.001f );
+        REQUIRE( maxNormalError < 0.001f );
+    }
+}
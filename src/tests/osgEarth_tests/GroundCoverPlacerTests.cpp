@@ -0,0 +1,128 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/Profile>
+#include <osgEarthSplat/GroundCoverPlacer>
+#include <osg/Image>
+
+using namespace osgEarth;
+using namespace osgEarth::Splat;
+
+namespace
+{
+    // 8x8 land cover raster: class 1 in the west half, class 2 in the east half.
+    osg::Image* createLandCover()
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage(8, 8, 1, GL_LUMINANCE, GL_FLOAT);
+        for (int t = 0; t < 8; ++t)
+            for (int s = 0; s < 8; ++s)
+                *(float*)image->data(s, t) = s < 4 ? 1.0f : 2.0f;
+        return image;
+    }
+
+    // 8x8 mask raster, opaque (masked out) in the south half.
+    osg::Image* createMask()
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage(8, 8, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        for (int t = 0; t < 8; ++t)
+            for (int s = 0; s < 8; ++s)
+            {
+                unsigned char* p = image->data(s, t);
+                p[0] = p[1] = p[2] = 255;
+                p[3] = t < 4 ? 255 : 0;
+            }
+        return image;
+    }
+
+    bool same(const GroundCoverPlacer::Instances& a, const GroundCoverPlacer::Instances& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (unsigned i = 0; i < a.size(); ++i)
+            if (a[i]._u != b[i]._u || a[i]._v != b[i]._v || a[i]._scale != b[i]._scale || a[i]._billboard != b[i]._billboard)
+                return false;
+        return true;
+    }
+}
+
+TEST_CASE( "GroundCoverPlacer" ) {
+
+    osg::ref_ptr<osg::Image> landCover = createLandCover();
+    osg::Matrixf identity;
+
+    osg::ref_ptr<GroundCoverPlacer> placer = new GroundCoverPlacer();
+    placer->setBiome(1, 3, 2);
+    placer->setNumCellsPerSide(16u);
+
+    GroundCoverPlacer::Instances a, b;
+
+    SECTION("Placement is deterministic") {
+        placer->place(42u, landCover.get(), identity, 0L, identity, a);
+        placer->place(42u, landCover.get(), identity, 0L, identity, b);
+        REQUIRE(a.size() > 0u);
+        REQUIRE(same(a, b));
+
+        placer->place(43u, landCover.get(), identity, 0L, identity, b);
+        REQUIRE(!same(a, b));
+
+        TileKey key(12, 100, 200, Profile::create("global-geodetic"));
+        REQUIRE(GroundCoverPlacer::getSeed(key) == GroundCoverPlacer::getSeed(key));
+    }
+
+    SECTION("Only mapped land cover classes get instances") {
+        placer->place(42u, landCover.get(), identity, 0L, identity, a);
+        REQUIRE(a.size() > 0u);
+        for (unsigned i = 0; i < a.size(); ++i) {
+            REQUIRE(a[i]._u < 0.5f);
+            REQUIRE(a[i]._billboard >= 3);
+            REQUIRE(a[i]._billboard <= 4);
+            REQUIRE(a[i]._scale >= 1.0f);
+        }
+
+        placer->setBiome(2, 0, 1);
+        placer->place(42u, landCover.get(), identity, 0L, identity, b);
+        REQUIRE(b.size() == 16u*16u);
+    }
+
+    SECTION("Masked areas are empty") {
+        osg::ref_ptr<osg::Image> mask = createMask();
+        placer->place(42u, landCover.get(), identity, mask.get(), identity, a);
+        REQUIRE(a.size() > 0u);
+        for (unsigned i = 0; i < a.size(); ++i) {
+            REQUIRE(a[i]._v >= 0.5f);
+        }
+    }
+
+    SECTION("Fill thins out the instances") {
+        placer->place(42u, landCover.get(), identity, 0L, identity, a);
+        placer->setFill(0.25f);
+        placer->place(42u, landCover.get(), identity, 0L, identity, b);
+        REQUIRE(b.size() < a.size());
+
+        placer->setFill(0.0f);
+        placer->place(42u, landCover.get(), identity, 0L, identity, b);
+        REQUIRE(b.empty());
+    }
+}
@@ -0,0 +1,109 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarthUtil/HTM>
+#include <osg/NodeVisitor>
+#include <cstdlib>
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+namespace
+{
+    // Point objects scattered over the globe
+    void makeObjects(unsigned count, osg::NodeList& nodes)
+    {
+        srand(42);
+        for (unsigned i = 0; i < count; ++i)
+        {
+            osg::Vec3d p(
+                (double)(rand() % 2001 - 1000),
+                (double)(rand() % 2001 - 1000),
+                (double)(rand() % 2001 - 1000));
+            if (p.normalize() == 0.0)
+                p.set(0, 0, 1);
+
+            osg::Node* node = new osg::Node();
+            node->setInitialBound(osg::BoundingSphere(p * 6378137.0, 1.0f));
+            nodes.push_back(node);
+        }
+    }
+
+    // Largest number of objects in a leaf cell
+    struct MaxLeafObjects : public osg::NodeVisitor
+    {
+        MaxLeafObjects() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _max(0u) { }
+
+        void apply(osg::Group& group)
+        {
+            HTMNode* cell = dynamic_cast<HTMNode*>(&group);
+            if (cell && cell->isLeaf())
+                _max = osg::maximum(_max, cell->getNumChildren());
+            traverse(group);
+        }
+
+        unsigned _max;
+    };
+}
+
+TEST_CASE( "HTMGroup" ) {
+
+    osg::ref_ptr<HTMGroup> htm = new HTMGroup();
+    htm->setDebug(false);
+    htm->setMaximumObjectsPerCell(8);
+    htm->setMinimumCellSize(1.0);
+    htm->setStoreObjectsInLeavesOnly(true);
+
+    osg::NodeList nodes;
+    makeObjects(1000, nodes);
+
+    htm->addChildren(nodes);
+    REQUIRE(htm->getNumObjects() == 1000u);
+
+    SECTION("Bulk load respects the cell capacity") {
+        MaxLeafObjects visitor;
+        htm->accept(visitor);
+        REQUIRE(visitor._max <= 8u);
+    }
+
+    SECTION("Batch removal") {
+        osg::NodeList half(nodes.begin(), nodes.begin() + 500);
+        REQUIRE(htm->removeChildren(half) == 500u);
+        REQUIRE(htm->getNumObjects() == 500u);
+
+        // removing them again does nothing
+        REQUIRE(htm->removeChildren(half) == 0u);
+
+        htm->rebalance();
+        REQUIRE(htm->getNumObjects() == 500u);
+    }
+
+    SECTION("Single insertion after a bulk load") {
+        osg::NodeList more;
+        makeObjects(1, more);
+        REQUIRE(htm->addChild(more[0].get()));
+        REQUIRE(htm->getNumObjects() == 1001u);
+        REQUIRE(htm->removeChildren(more) == 1u);
+    }
+}
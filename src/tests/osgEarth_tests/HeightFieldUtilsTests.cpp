@@ -0,0 +1,134 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
+
+using namespace osgEarth;
+
+namespace
+{
+    // Smooth terrain for a tile, with square NO_DATA holes.
+    osg::HeightField* createHeightField(const TileKey& key, unsigned size)
+    {
+        const GeoExtent& ex = key.getExtent();
+        osg::HeightField* hf = HeightFieldUtils::createReferenceHeightField(ex, size, size, 0u);
+        for (unsigned r = 0; r < size; ++r)
+        {
+            double lat = ex.yMin() + ex.height() * (double)r / (double)(size-1);
+            for (unsigned c = 0; c < size; ++c)
+            {
+                double lon = ex.xMin() + ex.width() * (double)c / (double)(size-1);
+                bool hole = ((c/8 + r/8) % 5 == 0);
+                hf->setHeight(c, r, hole ? NO_DATA_VALUE : (float)(800.0 * (sin(lon*40.0) + cos(lat*30.0))));
+            }
+        }
+        return hf;
+    }
+
+    // Largest difference between two heightfields, or -1 if they differ in
+    // size or in where they have NO_DATA.
+    float compare(const osg::HeightField* a, const osg::HeightField* b)
+    {
+        if (a->getNumColumns() != b->getNumColumns() || a->getNumRows() != b->getNumRows())
+            return -1.0f;
+
+        float maxError = 0.0f;
+        for (unsigned r = 0; r < a->getNumRows(); ++r)
+        {
+            for (unsigned c = 0; c < a->getNumColumns(); ++c)
+            {
+                float ha = a->getHeight(c, r), hb = b->getHeight(c, r);
+                if ((ha == NO_DATA_VALUE) != (hb == NO_DATA_VALUE))
+                    return -1.0f;
+                if (ha != NO_DATA_VALUE)
+                    maxError = osg::maximum(maxError, fabsf(ha - hb));
+            }
+        }
+        return maxError;
+    }
+}
+
+TEST_CASE( "HeightFieldUtils grid kernels match the per-post functions" ) {
+
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    TileKey key(9, 300, 100, profile);
+    osg::ref_ptr<osg::HeightField> input = createHeightField(key, 65);
+
+    ElevationInterpolation interps[2] = { INTERP_BILINEAR, INTERP_NEAREST };
+
+    SECTION( "resampleHeightField" ) {
+        unsigned sizes[3] = { 17, 100, 257 };
+        for (unsigned i = 0; i < 2; ++i)
+        {
+            for (unsigned s = 0; s < 3; ++s)
+            {
+                osg::ref_ptr<osg::HeightField> grid = HeightFieldUtils::resampleHeightField(input.get(), key.getExtent(), sizes[s], sizes[s], interps[i]);
+                osg::ref_ptr<osg::HeightField> post = HeightFieldUtils::resampleHeightFieldPerPost(input.get(), key.getExtent(), sizes[s], sizes[s], interps[i]);
+                float error = compare(grid.get(), post.get());
+                REQUIRE( error >= 0.0f );
+                REQUIRE( error < 0.001f );
+            }
+        }
+    }
+
+    SECTION( "createSubSample" ) {
+        TileKey child = key.createChildKey(2).createChildKey(1);
+        for (unsigned i = 0; i < 2; ++i)
+        {
+            osg::ref_ptr<osg::HeightField> grid = HeightFieldUtils::createSubSample(input.get(), key.getExtent(), child.getExtent(), interps[i]);
+            osg::ref_ptr<osg::HeightField> post = HeightFieldUtils::createSubSamplePerPost(input.get(), key.getExtent(), child.getExtent(), interps[i]);
+            float error = compare(grid.get(), post.get());
+            REQUIRE( error >= 0.0f );
+            REQUIRE( error < 0.001f );
+        }
+    }
+
+    SECTION( "convertToNormalMap" ) {
+        HeightFieldNeighborhood hood;
+        hood.setNeighbor(0, 0, input.get());
+        hood.setNeighbor(-1, 0, createHeightField(key.createNeighborKey(-1, 0), 65));
+        hood.setNeighbor( 1, 1, createHeightField(key.createNeighborKey( 1, 1), 65));
+        hood.setNeighbor( 0, 1, createHeightField(key.createNeighborKey( 0, 1), 65));
+
+        osg::ref_ptr<NormalMap> grid = HeightFieldUtils::convertToNormalMap(hood, profile->getSRS());
+        osg::ref_ptr<NormalMap> post = HeightFieldUtils::convertToNormalMapPerPost(hood, profile->getSRS());
+
+        float maxNormalError = 0.0f, maxCurvatureError = 0.0f;
+        for (unsigned t = 0; t < 65; ++t)
+        {
+            for (unsigned s = 0; s < 65; ++s)
+            {
+                // normals in the holes themselves are meaningless
+                if (input->getHeight(s, t) == NO_DATA_VALUE)
+                    continue;
+
+                maxNormalError = osg::maximum(maxNormalError, (grid->getNormal(s, t) - post->getNormal(s, t)).length());
+                maxCurvatureError = osg::maximum(maxCurvatureError, fabsf(grid->getCurvature(s, t) - post->getCurvature(s, t)));
+            }
+        }
+        REQUIRE( maxNormalError < 0.01f );
+        REQUIRE( maxCurvatureError < 0.01f );
+    }
+}
@@ -0,0 +1,312 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarthFeatures/KMLFeatureReader>
+#include <osgEarthSymbology/Geometry>
+#include <osgEarthDrivers/feature_kml/KMLFeatureOptions>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    // Keeps every feature and the size of each batch. Asks the reader to
+    // stop once it has seen "stopAfter" batches.
+    struct Collect : public KMLFeatureReader::Handler
+    {
+        std::vector< osg::ref_ptr<Feature> > features;
+        std::vector<unsigned> batches;
+        unsigned stopAfter;
+
+        Collect(unsigned stopAfterBatches =~0u) : stopAfter(stopAfterBatches) { }
+
+        bool onFeatures(FeatureList& batch)
+        {
+            batches.push_back(batch.size());
+            features.insert(features.end(), batch.begin(), batch.end());
+            return batches.size() < stopAfter;
+        }
+    };
+
+    bool readKML(const std::string& kml, Collect& out, unsigned batchSize =1000u)
+    {
+        std::istringstream in(kml);
+        KMLFeatureReader reader(batchSize);
+        return reader.read(in, out);
+    }
+
+    std::string makePlacemarks(unsigned count)
+    {
+        std::stringstream buf;
+        buf << "<kml><Document>";
+        for (unsigned i = 0; i < count; ++i)
+            buf << "<Placemark><name>" << i << "</name><Point><coordinates>" << i << ",0</coordinates></Point></Placemark>";
+        buf << "</Document></kml>";
+        return buf.str();
+    }
+}
+
+TEST_CASE( "KMLFeatureReader geometry and attributes" ) {
+
+    const char* kml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n"
+        "<!-- <Placemark> in a comment is not a feature -->\n"
+        "<Document>\n"
+        "  <name>not a feature attribute</name>\n"
+        "  <Placemark>\n"
+        "    <name>point</name>\n"
+        "    <styleUrl>#red</styleUrl>\n"
+        "    <ExtendedData>\n"
+        "      <Data name=\"height\"><value> 12 </value></Data>\n"
+        "      <SchemaData schemaUrl=\"#s\"><SimpleData name=\"kind\">tower</SimpleData></SchemaData>\n"
+        "    </ExtendedData>\n"
+        "    <Point><altitudeMode>absolute</altitudeMode><coordinates>-80.5,35.25,100</coordinates></Point>\n"
+        "  </Placemark>\n"
+        "  <Placemark>\n"
+        "    <name>line</name>\n"
+        "    <LineString><coordinates>\n"
+        "      0,0 1,1,5\n"
+        "      2,2\n"
+        "    </coordinates></LineString>\n"
+        "  </Placemark>\n"
+        "  <Placemark>\n"
+        "    <name>polygon</name>\n"
+        "    <Polygon>\n"
+        "      <outerBoundaryIs><LinearRing><coordinates>0,0 10,0 10,10 0,10 0,0</coordinates></LinearRing></outerBoundaryIs>\n"
+        "      <innerBoundaryIs><LinearRing><coordinates>2,2 4,2 4,4 2,2</coordinates></LinearRing></innerBoundaryIs>\n"
+        "      <innerBoundaryIs><LinearRing><coordinates>6,6 8,6 8,8 6,6</coordinates></LinearRing></innerBoundaryIs>\n"
+        "    </Polygon>\n"
+        "  </Placemark>\n"
+        "  <Placemark>\n"
+        "    <name>multi</name>\n"
+        "    <MultiGeometry>\n"
+        "      <Point><coordinates>1,2</coordinates></Point>\n"
+        "      <LineString><coordinates>3,4 5,6</coordinates></LineString>\n"
+        "    </MultiGeometry>\n"
+        "  </Placemark>\n"
+        "  <Placemark><name>no geometry</name></Placemark>\n"
+        "</Document>\n"
+        "</kml>\n";
+
+    std::istringstream in(kml);
+    KMLFeatureReader reader;
+    Collect out;
+    REQUIRE( reader.read(in, out) );
+    REQUIRE( reader.getNumFeatures() == 4u );
+    REQUIRE( out.features.size() == 4u );
+
+    SECTION( "Point" ) {
+        const Feature* f = out.features[0].get();
+        REQUIRE( f->getFID() == 1 );
+        REQUIRE( f->getSRS() != 0L );
+        REQUIRE( f->getSRS()->isGeographic() );
+        REQUIRE( f->getString("name") == "point" );
+        REQUIRE( f->getString("styleUrl") == "#red" );
+        REQUIRE( f->getString("altitudeMode") == "absolute" );
+        REQUIRE( f->getString("height") == "12" );
+        REQUIRE( f->getString("kind") == "tower" );
+        REQUIRE_FALSE( f->hasAttr("description") );
+
+        const Geometry* g = f->getGeometry();
+        REQUIRE( g->getType() == Geometry::TYPE_POINTSET );
+        REQUIRE( g->size() == 1u );
+        REQUIRE( (*g)[0] == osg::Vec3d(-80.5, 35.25, 100.0) );
+    }
+
+    SECTION( "LineString" ) {
+        const Feature* f = out.features[1].get();
+        REQUIRE( f->getFID() == 2 );
+        REQUIRE( f->getString("name") == "line" );
+
+        const Geometry* g = f->getGeometry();
+        REQUIRE( g->getType() == Geometry::TYPE_LINESTRING );
+        REQUIRE( g->size() == 3u );
+        REQUIRE( (*g)[0] == osg::Vec3d(0, 0, 0) );
+        REQUIRE( (*g)[1] == osg::Vec3d(1, 1, 5) );
+        REQUIRE( (*g)[2] == osg::Vec3d(2, 2, 0) );
+    }
+
+    SECTION( "Polygon with holes" ) {
+        const Feature* f = out.features[2].get();
+        REQUIRE( f->getString("name") == "polygon" );
+
+        const Geometry* g = f->getGeometry();
+        REQUIRE( g->getType() == Geometry::TYPE_POLYGON );
+        REQUIRE( g->size() == 5u );
+
+        const Polygon* poly = static_cast<const Polygon*>(g);
+        REQUIRE( poly->getHoles().size() == 2u );
+        REQUIRE( poly->getHoles()[0]->size() == 4u );
+        REQUIRE( (*poly->getHoles()[1])[2] == osg::Vec3d(8, 8, 0) );
+    }
+
+    SECTION( "MultiGeometry" ) {
+        const Feature* f = out.features[3].get();
+        REQUIRE( f->getString("name") == "multi" );
+
+        const Geometry* g = f->getGeometry();
+        REQUIRE( g->getType() == Geometry::TYPE_MULTI );
+
+        const GeometryCollection& parts = static_cast<const MultiGeometry*>(g)->getComponents();
+        REQUIRE( parts.size() == 2u );
+        REQUIRE( parts[0]->getType() == Geometry::TYPE_POINTSET );
+        REQUIRE( parts[1]->getType() == Geometry::TYPE_LINESTRING );
+        REQUIRE( parts[1]->size() == 2u );
+    }
+}
+
+TEST_CASE( "KMLFeatureReader entities" ) {
+
+    const char* kml =
+        "<kml><Placemark>"
+        "<name>Fish &amp; Chips &lt;&#65;&#x42;&gt; &quot;&apos;</name>"
+        "<description><![CDATA[<b>&amp; stays</b>]]></description>"
+        "<styleUrl>a &nbsp; b & c</styleUrl>"
+        "<ExtendedData><Data name=\"caf&#233;\"><value>&#xE9;&#x20AC;&#x1F600;</value></Data></ExtendedData>"
+        "<Point><coordinates>0,0</coordinates></Point>"
+        "</Placemark></kml>";
+
+    Collect out;
+    REQUIRE( readKML(kml, out) );
+    REQUIRE( out.features.size() == 1u );
+
+    const Feature* f = out.features[0].get();
+
+    // predefined and numeric entities
+    REQUIRE( f->getString("name") == "Fish & Chips <AB> \"'" );
+
+    // CDATA is taken literally
+    REQUIRE( f->getString("description") == "<b>&amp; stays</b>" );
+
+    // unknown entities and stray ampersands are left alone
+    REQUIRE( f->getString("styleUrl") == "a &nbsp; b & c" );
+
+    // attribute values are decoded, and code points become UTF-8
+    REQUIRE( f->getString("caf\xC3\xA9") == "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80" );
+}
+
+TEST_CASE( "KMLFeatureReader batches" ) {
+
+    SECTION( "Partial last batch" ) {
+        Collect out;
+        REQUIRE( readKML(makePlacemarks(5), out, 2u) );
+        REQUIRE( out.batches.size() == 3u );
+        REQUIRE( out.batches[0] == 2u );
+        REQUIRE( out.batches[1] == 2u );
+        REQUIRE( out.batches[2] == 1u );
+        REQUIRE( out.features.size() == 5u );
+        REQUIRE( out.features[4]->getString("name") == "4" );
+    }
+
+    SECTION( "Exact multiple of the batch size" ) {
+        Collect out;
+        REQUIRE( readKML(makePlacemarks(4), out, 2u) );
+        REQUIRE( out.batches.size() == 2u );
+        REQUIRE( out.features.size() == 4u );
+    }
+
+    SECTION( "Zero batch size means one feature per batch" ) {
+        Collect out;
+        REQUIRE( readKML(makePlacemarks(3), out, 0u) );
+        REQUIRE( out.batches.size() == 3u );
+    }
+
+    SECTION( "Handler stops the read" ) {
+        std::istringstream in(makePlacemarks(5));
+        KMLFeatureReader reader(2u);
+        Collect out(1u);
+        REQUIRE( reader.read(in, out) );
+        REQUIRE( out.batches.size() == 1u );
+        REQUIRE( out.features.size() == 2u );
+        REQUIRE( reader.getNumFeatures() == 2u );
+    }
+}
+
+TEST_CASE( "KMLFeatureReader malformed input" ) {
+
+    SECTION( "Empty input" ) {
+        Collect out;
+        REQUIRE_FALSE( readKML("", out) );
+        REQUIRE( out.batches.empty() );
+    }
+
+    SECTION( "Not KML" ) {
+        Collect out;
+        REQUIRE_FALSE( readKML("<gpx><Placemark><Point><coordinates>1,2</coordinates></Point></Placemark></gpx>", out) );
+        REQUIRE_FALSE( readKML("just some text", out) );
+        REQUIRE( out.batches.empty() );
+    }
+
+    SECTION( "Truncated inside a Placemark" ) {
+        Collect out;
+        REQUIRE( readKML("<kml><Placemark><name>a</name><Point><coordinates>1,2", out) );
+        REQUIRE( readKML("<kml><Placemark><Point><coord", out) );
+        REQUIRE( readKML("<kml><Placemark><name attr=\"unterminated", out) );
+        REQUIRE( out.features.empty() );
+    }
+
+    SECTION( "Truncated after a Placemark" ) {
+        Collect out;
+        REQUIRE( readKML("<kml><Placemark><Point><coordinates>1,2</coordinates></Point></Placemark><Placemark><Po", out) );
+        REQUIRE( out.features.size() == 1u );
+    }
+
+    SECTION( "Unterminated comment and CDATA" ) {
+        Collect out;
+        REQUIRE( readKML("<kml><!-- never closed <Placemark><Point><coordinates>1,2</coordinates></Point></Placemark>", out) );
+        REQUIRE( readKML("<kml><Placemark><name><![CDATA[never closed", out) );
+        REQUIRE( out.features.empty() );
+    }
+
+    SECTION( "Stray end tags and bad coordinates" ) {
+        Collect out;
+        REQUIRE( readKML("</stray><kml></also-stray><Placemark><Point><coordinates>a,b 1,2 3</coordinates></Point></Placemark></kml>", out) );
+        REQUIRE( out.features.size() == 1u );
+        REQUIRE( out.features[0]->getGeometry()->size() == 1u );
+        REQUIRE( (*out.features[0]->getGeometry())[0] == osg::Vec3d(1, 2, 0) );
+
+        // elements after the root are not mistaken for a new root
+        REQUIRE( readKML("<kml><Placemark><Point><coordinates>1,2</coordinates></Point></Placemark></kml><trailing/>", out) );
+        REQUIRE( out.features.size() == 2u );
+    }
+}
+
+TEST_CASE( "KML feature driver" ) {
+
+    KMLFeatureOptions opt;
+    opt.url() = "../data/KML_Samples.kml";
+    osg::ref_ptr<FeatureSource> source = FeatureSourceFactory::create(opt);
+    REQUIRE( source.valid() );
+    REQUIRE( source->open().isOK() );
+    REQUIRE( source->getFeatureCount() > 0 );
+
+    osg::ref_ptr<Feature> first = source->getFeature(1);
+    REQUIRE( first.valid() );
+    REQUIRE( first->getGeometry() != 0L );
+}
@@ -0,0 +1,92 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/LandCover>
+#include <osgEarth/GeoCommon>
+#include <osg/Image>
+
+using namespace osgEarth;
+
+TEST_CASE( "LandCoverLookupTable" ) {
+
+    osg::ref_ptr<LandCoverDictionary> dict = new LandCoverDictionary();
+    dict->addClass("forest", 1);
+    dict->addClass("water", 2);
+
+    LandCoverCoverageLayerOptions options;
+    options.map(11, "water");
+    options.map(41, "forest");
+    options.map(42, "forest");
+    options.map(90, "unknown");
+
+    osg::ref_ptr<LandCoverCoverageLayer> coverage = new LandCoverCoverageLayer(options);
+    coverage->setDictionary(dict.get());
+
+    osg::ref_ptr<LandCoverLookupTable> table = new LandCoverLookupTable();
+    table->compile(coverage.get());
+
+    SECTION("Compiled mappings") {
+        REQUIRE(table->size() == 91u);
+        REQUIRE(table->lookup(11) == 2);
+        REQUIRE(table->lookup(41) == 1);
+        REQUIRE(table->lookup(42) == 1);
+        REQUIRE(table->lookup(90) == -1);
+        REQUIRE(table->lookup(12) == -1);
+        REQUIRE(table->lookup(-1) == -1);
+        REQUIRE(table->lookup(1000) == -1);
+    }
+
+    SECTION("Row reclassification") {
+        int codes[6] = { 11, 41, -1, 500, 42, 0 };
+        int classes[6];
+        table->reclassify(codes, 6, classes);
+        REQUIRE(classes[0] == 2);
+        REQUIRE(classes[1] == 1);
+        REQUIRE(classes[2] == -1);
+        REQUIRE(classes[3] == -1);
+        REQUIRE(classes[4] == 1);
+        REQUIRE(classes[5] == -1);
+    }
+
+    SECTION("Reading codes from byte and float rasters") {
+        osg::ref_ptr<osg::Image> bytes = new osg::Image();
+        bytes->allocateImage(3, 1, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE);
+        bytes->data()[0] = 11; bytes->data()[1] = 255; bytes->data()[2] = 0;
+
+        int codes[3];
+        LandCoverLookupTable::readCodes(bytes.get(), 0, codes);
+        REQUIRE(codes[0] == 11);
+        REQUIRE(codes[1] == 255);
+        REQUIRE(codes[2] == 0);
+
+        osg::ref_ptr<osg::Image> floats = new osg::Image();
+        floats->allocateImage(3, 1, 1, GL_LUMINANCE, GL_FLOAT);
+        float* f = reinterpret_cast<float*>(floats->data());
+        f[0] = 41.0f; f[1] = NO_DATA_VALUE; f[2] = 0.5f;
+
+        LandCoverLookupTable::readCodes(floats.get(), 0, codes);
+        REQUIRE(codes[0] == 41);
+        REQUIRE(codes[1] == -1);
+        REQUIRE(codes[2] == 127); // normalized byte code
+    }
+}
@@ -0,0 +1,128 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/Map>
+#include <osgEarth/MapOptions>
+#include <OpenThreads/Thread>
+
+using namespace osgEarth;
+
+namespace
+{
+    // Layer that takes a while to open, like one that waits on a server.
+    struct SlowLayer : public Layer
+    {
+        SlowLayer(const std::string& name, unsigned delayMs) : _delayMs(delayMs)
+        {
+            setName(name);
+        }
+
+        const Status& open()
+        {
+            OpenThreads::Thread::microSleep(_delayMs * 1000u);
+            return Layer::open();
+        }
+
+        unsigned _delayMs;
+    };
+
+    // Records the order in which layers arrive.
+    struct RecordLayers : public Map::AddLayersCallback
+    {
+        RecordLayers() : _complete(false) { }
+
+        void onLayerAdded(Layer* layer, unsigned index)
+        {
+            _names.push_back(layer->getName());
+        }
+
+        void onComplete(Map* map)
+        {
+            _complete = true;
+        }
+
+        std::vector<std::string> _names;
+        bool                     _complete;
+    };
+
+    // Layers that finish opening in the reverse of their declared order.
+    void createLayers(LayerVector& layers)
+    {
+        layers.push_back(new SlowLayer("a", 60));
+        layers.push_back(new SlowLayer("b", 40));
+        layers.push_back(new SlowLayer("c", 20));
+        layers.push_back(new SlowLayer("d", 0));
+    }
+}
+
+TEST_CASE( "Map::addLayers adds layers in declared order" ) {
+    unsigned threads[2] = { 1u, 4u };
+
+    for (unsigned t = 0; t < 2; ++t)
+    {
+        MapOptions options;
+        options.layerOpenThreads() = threads[t];
+        osg::ref_ptr<Map> map = new Map(options);
+        LayerVector layers;
+        createLayers(layers);
+
+        map->addLayers(layers);
+
+        REQUIRE(map->getNumLayers() == 4u);
+        REQUIRE(map->getLayerAt(0)->getName() == "a");
+        REQUIRE(map->getLayerAt(1)->getName() == "b");
+        REQUIRE(map->getLayerAt(2)->getName() == "c");
+        REQUIRE(map->getLayerAt(3)->getName() == "d");
+    }
+}
+
+TEST_CASE( "Map::addLayersAsync publishes layers in declared order" ) {
+    MapOptions options;
+    options.layerOpenThreads() = 4u;
+    osg::ref_ptr<Map> map = new Map(options);
+    LayerVector layers;
+    createLayers(layers);
+
+    osg::ref_ptr<RecordLayers> callback = new RecordLayers();
+    map->addLayersAsync(layers, callback.get());
+
+    // nothing is added until the owning thread asks for it
+    REQUIRE(map->getNumLayers() == 0u);
+
+    for (unsigned i = 0; i < 5000u && !callback->_complete; ++i)
+    {
+        map->addPendingLayers();
+        OpenThreads::Thread::microSleep(1000u);
+    }
+
+    REQUIRE(callback->_complete);
+    REQUIRE(callback->_names.size() == 4u);
+    REQUIRE(callback->_names[0] == "a");
+    REQUIRE(callback->_names[3] == "d");
+
+    REQUIRE(map->getNumLayers() == 4u);
+    REQUIRE(map->getLayerAt(0)->getName() == "a");
+    REQUIRE(map->getLayerAt(3)->getName() == "d");
+    REQUIRE(map->addPendingLayers() == 0u);
+}
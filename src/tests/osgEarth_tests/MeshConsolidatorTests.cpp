@@ -0,0 +1,147 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarthSymbology/MeshConsolidator>
+#include <osg/TriangleFunctor>
+#include <set>
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    // A grid of colored quads, alternately drawn as strips and as triangles,
+    // each with its own user data on the primitive set (like a feature index).
+    osg::Geode* makeGeode(unsigned side)
+    {
+        osg::Geode* geode = new osg::Geode();
+        for (unsigned y = 0; y < side; ++y)
+        {
+            for (unsigned x = 0; x < side; ++x)
+            {
+                osg::Geometry* geom = new osg::Geometry();
+                osg::Vec3Array* verts = new osg::Vec3Array();
+                verts->push_back(osg::Vec3(x,   y,   0));
+                verts->push_back(osg::Vec3(x+1, y,   0));
+                verts->push_back(osg::Vec3(x,   y+1, 0));
+                verts->push_back(osg::Vec3(x+1, y+1, 0));
+                geom->setVertexArray(verts);
+
+                osg::Vec4Array* colors = new osg::Vec4Array();
+                colors->push_back(osg::Vec4((float)x/side, (float)y/side, 0, 1));
+                geom->setColorArray(colors);
+                geom->setColorBinding(osg::Geometry::BIND_OVERALL);
+
+                osg::PrimitiveSet* pset;
+                if ((x + y) % 2 == 0)
+                {
+                    pset = new osg::DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+                }
+                else
+                {
+                    osg::DrawElementsUShort* de = new osg::DrawElementsUShort(GL_TRIANGLES);
+                    de->push_back(0); de->push_back(1); de->push_back(2);
+                    de->push_back(2); de->push_back(1); de->push_back(3);
+                    pset = de;
+                }
+                pset->setUserData(new osg::Referenced());
+                geom->addPrimitiveSet(pset);
+                geode->addDrawable(geom);
+            }
+        }
+        return geode;
+    }
+
+    struct TriangleArea
+    {
+        double _area;
+        unsigned _count;
+        TriangleArea() : _area(0.0), _count(0u) { }
+        void operator()(const osg::Vec3& v0, const osg::Vec3& v1, const osg::Vec3& v2, bool) {
+            _area += 0.5 * ((v1-v0) ^ (v2-v0)).length();
+            ++_count;
+        }
+    };
+
+    void measure(osg::Geode* geode, unsigned& triangles, double& area, std::set<const osg::Referenced*>& userData)
+    {
+        osg::TriangleFunctor<TriangleArea> functor;
+        for (unsigned i = 0; i < geode->getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = geode->getDrawable(i)->asGeometry();
+            geom->accept(functor);
+            for (unsigned j = 0; j < geom->getNumPrimitiveSets(); ++j)
+                userData.insert(geom->getPrimitiveSet(j)->getUserData());
+        }
+        triangles = functor._count;
+        area = functor._area;
+    }
+}
+
+TEST_CASE( "MeshConsolidator::runParallel" ) {
+
+    const unsigned side = 32u;
+    const unsigned maxVerts = 256u;
+
+    osg::ref_ptr<osg::Geode> before = makeGeode(side);
+    unsigned trianglesBefore;
+    double areaBefore;
+    std::set<const osg::Referenced*> userDataBefore;
+    measure(before.get(), trianglesBefore, areaBefore, userDataBefore);
+
+    osg::ref_ptr<osg::Geode> geode = makeGeode(side);
+    MeshConsolidator::runParallel(*geode.get(), maxVerts);
+
+    SECTION("Geometry is preserved") {
+        unsigned triangles;
+        double area;
+        std::set<const osg::Referenced*> userData;
+        measure(geode.get(), triangles, area, userData);
+        REQUIRE(triangles == trianglesBefore);
+        REQUIRE(area == Approx(areaBefore));
+        REQUIRE(userData.size() == userDataBefore.size());
+    }
+
+    SECTION("Clusters respect the vertex limit") {
+        REQUIRE(geode->getNumDrawables() >= (side*side*4u) / maxVerts);
+        for (unsigned i = 0; i < geode->getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = geode->getDrawable(i)->asGeometry();
+            REQUIRE(geom->getVertexArray()->getNumElements() <= maxVerts);
+            REQUIRE(geom->getColorArray()->getNumElements() == geom->getVertexArray()->getNumElements());
+        }
+    }
+
+    SECTION("Output is deterministic") {
+        osg::ref_ptr<osg::Geode> again = makeGeode(side);
+        MeshConsolidator::runParallel(*again.get(), maxVerts);
+        REQUIRE(again->getNumDrawables() == geode->getNumDrawables());
+        for (unsigned i = 0; i < geode->getNumDrawables(); ++i)
+        {
+            const osg::Vec3Array* a = static_cast<const osg::Vec3Array*>(geode->getDrawable(i)->asGeometry()->getVertexArray());
+            const osg::Vec3Array* b = static_cast<const osg::Vec3Array*>(again->getDrawable(i)->asGeometry()->getVertexArray());
+            REQUIRE(a->asVector() == b->asVector());
+        }
+    }
+}
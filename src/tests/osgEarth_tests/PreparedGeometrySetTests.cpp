@@ -0,0 +1,102 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarthSymbology/PreparedGeometrySet>
+#include <cstdlib>
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    // A square with a square hole in the middle
+    Polygon* makeParcel(double x, double y, double size)
+    {
+        Polygon* p = new Polygon();
+        p->push_back(osg::Vec3d(x,      y,      0));
+        p->push_back(osg::Vec3d(x+size, y,      0));
+        p->push_back(osg::Vec3d(x+size, y+size, 0));
+        p->push_back(osg::Vec3d(x,      y+size, 0));
+
+        Ring* hole = new Ring();
+        hole->push_back(osg::Vec3d(x+0.4*size, y+0.4*size, 0));
+        hole->push_back(osg::Vec3d(x+0.6*size, y+0.4*size, 0));
+        hole->push_back(osg::Vec3d(x+0.6*size, y+0.6*size, 0));
+        hole->push_back(osg::Vec3d(x+0.4*size, y+0.6*size, 0));
+        p->getHoles().push_back(hole);
+        return p;
+    }
+}
+
+TEST_CASE( "PreparedGeometrySet" ) {
+
+    // a 30x30 grid of parcels with gaps between them, every other row
+    // of which is added as one multi-part geometry.
+    std::vector< osg::ref_ptr<Geometry> > parcels;
+    osg::ref_ptr<PreparedGeometrySet> set = new PreparedGeometrySet();
+    for (int row = 0; row < 30; ++row)
+    {
+        osg::ref_ptr<MultiGeometry> multi = new MultiGeometry();
+        for (int col = 0; col < 30; ++col)
+        {
+            Polygon* parcel = makeParcel(col*10.0, row*10.0, 8.0);
+            parcels.push_back(parcel);
+            if (row % 2 == 0)
+                set->add(parcel);
+            else
+                multi->add(parcel);
+        }
+        if (row % 2 == 1)
+            set->add(multi.get());
+    }
+    set->build();
+
+    SECTION("Parts and bounds") {
+        REQUIRE(set->getNumParts() == 900u);
+        REQUIRE(set->getBounds().xMin() == Approx(0.0));
+        REQUIRE(set->getBounds().xMax() == Approx(298.0));
+    }
+
+    SECTION("Point containment matches a brute-force test") {
+        srand(7);
+        for (unsigned i = 0; i < 2000; ++i)
+        {
+            double x = (double)(rand() % 32000) / 100.0 - 10.0;
+            double y = (double)(rand() % 32000) / 100.0 - 10.0;
+
+            bool expected = false;
+            for (unsigned p = 0; p < parcels.size() && !expected; ++p)
+                expected = static_cast<Polygon*>(parcels[p].get())->contains2D(x, y);
+
+            REQUIRE(set->contains2D(x, y) == expected);
+        }
+    }
+
+    SECTION("Holes and gaps are outside") {
+        REQUIRE(set->contains2D(1.0, 1.0) == true);
+        REQUIRE(set->contains2D(4.0, 4.0) == false);
+        REQUIRE(set->contains2D(9.0, 1.0) == false);
+        REQUIRE(set->contains2D(-1.0, -1.0) == false);
+    }
+}
@@ -0,0 +1,116 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/ShaderGenerator>
+#include <osgEarth/VirtualProgram>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/TexEnv>
+#include <osg/TexGen>
+#include <osg/Texture2D>
+
+using namespace osgEarth;
+
+namespace
+{
+    // Geodes with a spread of texture state, most of it repeated.
+    osg::Group* createGraph()
+    {
+        const osg::TexEnv::Mode modes[4] = {
+            osg::TexEnv::MODULATE, osg::TexEnv::REPLACE, osg::TexEnv::DECAL, osg::TexEnv::ADD };
+
+        osg::Group* root = new osg::Group();
+        for (unsigned i = 0; i < 24; ++i)
+        {
+            osg::Vec3Array* verts = new osg::Vec3Array();
+            verts->push_back(osg::Vec3(0, 0, 0));
+            verts->push_back(osg::Vec3(1, 0, 0));
+            verts->push_back(osg::Vec3(0, 1, 0));
+
+            osg::Geometry* geom = new osg::Geometry();
+            geom->setVertexArray(verts);
+            geom->addPrimitiveSet(new osg::DrawArrays(GL_TRIANGLES, 0, 3));
+
+            unsigned unit = i % 2;
+            osg::StateSet* ss = geom->getOrCreateStateSet();
+            ss->setTextureAttributeAndModes(unit, new osg::Texture2D(), osg::StateAttribute::ON);
+            ss->setTextureAttribute(unit, new osg::TexEnv(modes[i % 4]));
+            if (i % 3 == 0)
+                ss->setTextureAttributeAndModes(unit, new osg::TexGen(), osg::StateAttribute::ON);
+
+            osg::Geode* geode = new osg::Geode();
+            geode->addDrawable(geom);
+            root->addChild(geode);
+        }
+        return root;
+    }
+
+    // The shader source generated for each drawable, in graph order.
+    std::vector<std::string> getPrograms(osg::Group* root)
+    {
+        std::vector<std::string> programs;
+        for (unsigned i = 0; i < root->getNumChildren(); ++i)
+        {
+            osg::Drawable* drawable = root->getChild(i)->asGeode()->getDrawable(0);
+            std::string source;
+            VirtualProgram* vp = VirtualProgram::get(drawable->getStateSet());
+            if (vp)
+            {
+                VirtualProgram::ShaderMap shaders;
+                vp->getShaderMap(shaders);
+                for (VirtualProgram::ShaderMap::const_iterator s = shaders.begin(); s != shaders.end(); ++s)
+                    source += s->data()._shader->getShaderSource();
+            }
+            programs.push_back(source);
+        }
+        return programs;
+    }
+
+    std::vector<std::string> generate(bool parallel)
+    {
+        osg::ref_ptr<osg::Group> root = createGraph();
+        osg::ref_ptr<ShaderGenerator> gen = new ShaderGenerator();
+        gen->setUseProgramCache(true);
+        gen->setParallelGeneration(parallel);
+        gen->run(root.get(), "test", 0L);
+        return getPrograms(root.get());
+    }
+}
+
+TEST_CASE( "ShaderGenerator program cache" ) {
+
+    std::vector<std::string> parallel = generate(true);
+    std::vector<std::string> serial   = generate(false);
+
+    REQUIRE(parallel.size() == 24u);
+
+    SECTION("Parallel and serial generation give the same programs") {
+        REQUIRE(parallel == serial);
+    }
+
+    SECTION("Drawables with the same state get the same program") {
+        // the state repeats every 12 drawables
+        for (unsigned i = 0; i < 12; ++i)
+            REQUIRE(parallel[i] == parallel[i+12]);
+    }
+}
@@ -0,0 +1,156 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/StateSetCache>
+#include <osg/Material>
+#include <osg/LineWidth>
+#include <OpenThreads/Barrier>
+#include <OpenThreads/Thread>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    osg::StateSet* makeStateSet(const osg::Vec4& color, float width)
+    {
+        osg::Material* m = new osg::Material();
+        m->setDiffuse(osg::Material::FRONT_AND_BACK, color);
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttributeAndModes(m, 1);
+        ss->setAttributeAndModes(new osg::LineWidth(width), 1);
+        return ss;
+    }
+
+    typedef std::vector< osg::ref_ptr<osg::StateSet> > StateSets;
+
+    // Shares its own copies of the statesets, starting with the others.
+    class ShareThread : public OpenThreads::Thread
+    {
+    public:
+        ShareThread(StateSetCache* cache, OpenThreads::Barrier& start, unsigned count) :
+            _cache(cache), _start(start)
+        {
+            for (unsigned i = 0; i < count; ++i)
+                _input.push_back(makeStateSet(osg::Vec4((float)i, 0, 0, 1), 1.0f + (float)(i % 3)));
+        }
+
+        void run()
+        {
+            _start.block();
+            _output.resize(_input.size());
+            for (unsigned i = 0; i < _input.size(); ++i)
+                _cache->share(_input[i], _output[i]);
+        }
+
+        StateSetCache*        _cache;
+        OpenThreads::Barrier& _start;
+        StateSets             _input, _output;
+    };
+}
+
+TEST_CASE( "StateSetCache shares equivalent state" ) {
+
+    osg::ref_ptr<StateSetCache> cache = new StateSetCache();
+
+    osg::ref_ptr<osg::StateSet> a = makeStateSet(osg::Vec4(1,0,0,1), 2.0f);
+    osg::ref_ptr<osg::StateSet> b = makeStateSet(osg::Vec4(1,0,0,1), 2.0f);
+    osg::ref_ptr<osg::StateSet> c = makeStateSet(osg::Vec4(0,1,0,1), 2.0f);
+
+    SECTION("Equal objects hash the same") {
+        REQUIRE(StateSetCache::hash(a.get()) == StateSetCache::hash(b.get()));
+        REQUIRE(StateSetCache::hash(a->getAttribute(osg::StateAttribute::MATERIAL)) ==
+                StateSetCache::hash(b->getAttribute(osg::StateAttribute::MATERIAL)));
+        REQUIRE(StateSetCache::hash(a.get()) != StateSetCache::hash(c.get()));
+    }
+
+    SECTION("Statesets") {
+        osg::ref_ptr<osg::StateSet> out;
+        REQUIRE(cache->share(a, out) == false);
+        REQUIRE(out.get() == a.get());
+        REQUIRE(cache->share(b, out) == true);
+        REQUIRE(out.get() == a.get());
+        REQUIRE(cache->share(c, out) == false);
+        REQUIRE(out.get() == c.get());
+
+        StateSetCache::Stats stats = cache->getStats();
+        REQUIRE(stats._stateSetHits == 1u);
+        REQUIRE(stats._stateSetMisses == 2u);
+        REQUIRE(stats._uniqueStateSets == 2u);
+        REQUIRE(cache->size() == 2u);
+    }
+
+    SECTION("Attributes") {
+        osg::ref_ptr<osg::StateAttribute> in, out;
+        in = a->getAttribute(osg::StateAttribute::LINEWIDTH);
+        REQUIRE(cache->share(in, out) == false);
+        in = b->getAttribute(osg::StateAttribute::LINEWIDTH);
+        REQUIRE(cache->share(in, out) == true);
+        REQUIRE(out.get() == a->getAttribute(osg::StateAttribute::LINEWIDTH));
+
+        in = new osg::LineWidth(2.0f);
+        in->setDataVariance(osg::Object::DYNAMIC);
+        REQUIRE(cache->share(in, out) == false);
+        REQUIRE(out.get() == in.get());
+
+        StateSetCache::Stats stats = cache->getStats();
+        REQUIRE(stats._attrHits == 1u);
+        REQUIRE(stats._attrMisses == 1u);
+        REQUIRE(stats._attrsIneligible == 1u);
+        REQUIRE(stats._uniqueAttrs == 1u);
+    }
+}
+
+TEST_CASE( "StateSetCache shares state across threads" ) {
+
+    const unsigned numThreads = 8u, numStateSets = 64u;
+
+    osg::ref_ptr<StateSetCache> cache = new StateSetCache();
+    OpenThreads::Barrier start(numThreads);
+
+    std::vector<ShareThread*> threads;
+    for (unsigned t = 0; t < numThreads; ++t)
+        threads.push_back(new ShareThread(cache.get(), start, numStateSets));
+    for (unsigned t = 0; t < numThreads; ++t)
+        threads[t]->start();
+    for (unsigned t = 0; t < numThreads; ++t)
+        threads[t]->join();
+
+    // every thread ends up with the same instance for each state
+    for (unsigned i = 0; i < numStateSets; ++i)
+    {
+        osg::StateSet* shared = threads[0]->_output[i].get();
+        REQUIRE(shared != 0L);
+        for (unsigned t = 1; t < numThreads; ++t)
+            REQUIRE(threads[t]->_output[i].get() == shared);
+    }
+
+    StateSetCache::Stats stats = cache->getStats();
+    REQUIRE(stats._stateSetMisses == numStateSets);
+    REQUIRE(stats._stateSetHits == numStateSets * (numThreads - 1u));
+    REQUIRE(stats._uniqueStateSets == numStateSets);
+    REQUIRE(cache->size() == numStateSets);
+
+    for (unsigned t = 0; t < numThreads; ++t)
+        delete threads[t];
+}
@@ -0,0 +1,125 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/TileArchive>
+#include <cstdio>
+#include <cstring>
+
+using namespace osgEarth;
+
+namespace
+{
+    const char* ARCHIVE_FILE = "osgEarth_tests_archive.tmp";
+
+    bool recordIs(const TileArchive::Record& r, const std::string& value)
+    {
+        return r._size == value.size() && ::memcmp(r._data, value.data(), value.size()) == 0;
+    }
+}
+
+TEST_CASE( "TileArchive sort keys" ) {
+    REQUIRE(TileArchive::morton(0, 0) == 0u);
+    REQUIRE(TileArchive::morton(1, 0) == 1u);
+    REQUIRE(TileArchive::morton(0, 1) == 2u);
+    REQUIRE(TileArchive::morton(3, 3) == 15u);
+
+    // tiles sort by LOD, then in Morton order within the LOD
+    REQUIRE(TileArchive::getSortKey("1/1/1_sig") < TileArchive::getSortKey("2/0/0_sig"));
+    REQUIRE(TileArchive::getSortKey("5/2/3_sig") < TileArchive::getSortKey("5/3/3_sig"));
+    REQUIRE(TileArchive::getSortKey("5/2/3_a") == TileArchive::getSortKey("5/2/3_b"));
+
+    // non-tile keys sort after all tiles
+    REQUIRE(TileArchive::getSortKey("_metadata") > TileArchive::getSortKey("30/1000/1000"));
+    REQUIRE(TileArchive::getSortKey("5/2/34x") != TileArchive::getSortKey("5/2/3_x"));
+}
+
+TEST_CASE( "TileArchive round trip" ) {
+    {
+        TileArchiveWriter writer(ARCHIVE_FILE, 512u);
+        REQUIRE(writer.isOpen());
+
+        Config binMeta("meta");
+        binMeta.add("name", "imagery");
+        unsigned imagery = writer.addBin("imagery", binMeta);
+        unsigned elevation = writer.addBin("elevation");
+        REQUIRE(writer.addBin("imagery") == imagery);
+
+        std::string a("tile a"), b("tile b"), c("some metadata"), d("replaced");
+        REQUIRE(writer.addRecord(imagery, "1/0/0_sig", d.data(), d.size(), Config(), 10));
+        REQUIRE(writer.addRecord(imagery, "1/0/0_sig", a.data(), a.size(), Config(), 20));
+        REQUIRE(writer.addRecord(imagery, "1/1/0_sig", b.data(), b.size(), Config(), 30));
+        REQUIRE(writer.addRecord(imagery, "_metadata", c.data(), c.size(), Config(), 40));
+        REQUIRE(writer.addRecord(elevation, "1/0/0_sig", b.data(), b.size(), Config(), 50));
+        REQUIRE(writer.finish());
+    }
+
+    osg::ref_ptr<TileArchive> archive = TileArchive::open(ARCHIVE_FILE);
+    REQUIRE(archive.valid());
+    REQUIRE(archive->getNumBins() == 2u);
+
+    int imagery = archive->findBin("imagery");
+    int elevation = archive->findBin("elevation");
+    REQUIRE(imagery >= 0);
+    REQUIRE(elevation >= 0);
+    REQUIRE(archive->findBin("nope") < 0);
+    REQUIRE(archive->getBinMetadata(imagery).value("name") == "imagery");
+
+    // the duplicate key was replaced by the newer record
+    REQUIRE(archive->getNumRecords(imagery) == 3u);
+
+    TileArchive::Record r;
+    REQUIRE(archive->find(imagery, "1/0/0_sig", r));
+    REQUIRE(recordIs(r, "tile a"));
+    REQUIRE(r._lastModified == 20);
+    REQUIRE(((size_t)r._data) % 512u == 0u);
+
+    REQUIRE(archive->find(imagery, "1/1/0_sig", r));
+    REQUIRE(recordIs(r, "tile b"));
+
+    REQUIRE(archive->find(imagery, "_metadata", r));
+    REQUIRE(recordIs(r, "some metadata"));
+
+    REQUIRE(archive->find(elevation, "1/0/0_sig", r));
+    REQUIRE(r._lastModified == 50);
+
+    REQUIRE_FALSE(archive->find(imagery, "1/1/1_sig", r));
+    REQUIRE_FALSE(archive->find(imagery, "1/0/0_other", r));
+    REQUIRE_FALSE(archive->find(elevation, "1/1/0_sig", r));
+
+    archive = 0L;
+    ::remove(ARCHIVE_FILE);
+}
+
+TEST_CASE( "TileArchive rejects unfinished files" ) {
+    {
+        TileArchiveWriter writer(ARCHIVE_FILE);
+        unsigned bin = writer.addBin("bin");
+        std::string a("data");
+        writer.addRecord(bin, "0/0/0", a.data(), a.size(), Config(), 0);
+        // no finish()
+    }
+
+    osg::ref_ptr<TileArchive> archive = TileArchive::open(ARCHIVE_FILE);
+    REQUIRE_FALSE(archive.valid());
+    ::remove(ARCHIVE_FILE);
+}
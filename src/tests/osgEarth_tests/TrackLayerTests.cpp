@@ -0,0 +1,86 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarthAnnotation/TrackLayer>
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+
+TEST_CASE( "TrackLayer" ) {
+
+    osg::ref_ptr<TrackLayer> layer = new TrackLayer();
+
+    unsigned a = layer->addTrack(-1);
+    unsigned b = layer->addTrack(-1);
+    unsigned c = layer->addTrack(-1);
+    REQUIRE(layer->getNumTracks() == 3u);
+
+    SECTION("Batch updates convert to ECEF") {
+        std::vector<TrackLayer::Update> updates(2);
+        updates[0]._track = a;
+        updates[0]._lon = 0.0;
+        updates[0]._lat = 0.0;
+        updates[0]._alt = 0.0;
+        updates[0]._heading = 0.0f;
+        updates[1]._track = c;
+        updates[1]._lon = 0.0;
+        updates[1]._lat = 90.0;
+        updates[1]._alt = 100.0;
+        updates[1]._heading = 0.0f;
+        layer->update(updates);
+
+        osg::Vec3d world;
+        REQUIRE(layer->getWorldPosition(a, world));
+        REQUIRE(world.x() == Approx(6378137.0));
+        REQUIRE(world.y() == Approx(0.0));
+        REQUIRE(world.z() == Approx(0.0));
+
+        REQUIRE(layer->getWorldPosition(c, world));
+        REQUIRE(world.z() == Approx(6356752.314245 + 100.0));
+    }
+
+    SECTION("IDs survive removal") {
+        osg::Vec3d world;
+        TrackLayer::Update update;
+        update._track = c;
+        update._lon = 90.0;
+        update._lat = 0.0;
+        update._alt = 0.0;
+        update._heading = 0.0f;
+        layer->update(&update, 1);
+
+        layer->removeTrack(a);
+        REQUIRE(layer->getNumTracks() == 2u);
+        REQUIRE(layer->getWorldPosition(a, world) == false);
+
+        // c moved into a's slot but keeps its ID and position:
+        REQUIRE(layer->getWorldPosition(c, world));
+        REQUIRE(world.y() == Approx(6378137.0));
+        REQUIRE(layer->getWorldPosition(b, world));
+
+        // removed IDs are reused:
+        REQUIRE(layer->addTrack(-1) == a);
+        REQUIRE(layer->getNumTracks() == 3u);
+    }
+}
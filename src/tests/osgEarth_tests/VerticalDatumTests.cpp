@@ -0,0 +1,171 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2016 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/VerticalDatum>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
+
+using namespace osgEarth;
+
+namespace
+{
+    // A coarse global geoid with a smooth, made-up surface.
+    Geoid* createGeoid()
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate(73, 37);
+        hf->setOrigin(osg::Vec3d(-180.0, -90.0, 0.0));
+        hf->setXInterval(5.0);
+        hf->setYInterval(5.0);
+        for (unsigned r = 0; r < hf->getNumRows(); ++r)
+            for (unsigned c = 0; c < hf->getNumColumns(); ++c)
+                hf->setHeight(c, r, (float)(60.0 * sin(c*0.4) + 40.0 * cos(r*0.7)));
+
+        Geoid* geoid = new Geoid();
+        geoid->setName("test");
+        geoid->setHeightField(hf);
+        return geoid;
+    }
+
+    VerticalDatum* createDatum()
+    {
+        return new VerticalDatum("test", "test", createGeoid());
+    }
+
+    // A datum whose MSL is a fixed distance above its geoid.
+    class OffsetDatum : public VerticalDatum
+    {
+    public:
+        OffsetDatum(Geoid* geoid) : VerticalDatum("offset", "offset", geoid) { }
+
+        double msl2hae(double lat_deg, double lon_deg, double msl) const {
+            return VerticalDatum::msl2hae(lat_deg, lon_deg, msl) + 100.0;
+        }
+
+        double hae2msl(double lat_deg, double lon_deg, double hae) const {
+            return VerticalDatum::hae2msl(lat_deg, lon_deg, hae) - 100.0;
+        }
+    };
+
+    osg::HeightField* createHeightField(unsigned size)
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate(size, size);
+        for (unsigned r = 0; r < size; ++r)
+            for (unsigned c = 0; c < size; ++c)
+                hf->setHeight(c, r, ((c/4 + r/4) % 3 == 0) ? NO_DATA_VALUE : (float)(c*10 + r));
+        return hf;
+    }
+
+    float compare(const osg::HeightField* a, const osg::HeightField* b)
+    {
+        float maxError = 0.0f;
+        for (unsigned r = 0; r < a->getNumRows(); ++r)
+        {
+            for (unsigned c = 0; c < a->getNumColumns(); ++c)
+            {
+                float ha = a->getHeight(c, r), hb = b->getHeight(c, r);
+                if ((ha == NO_DATA_VALUE) != (hb == NO_DATA_VALUE))
+                    return -1.0f;
+                if (ha != NO_DATA_VALUE)
+                    maxError = osg::maximum(maxError, fabsf(ha - hb));
+            }
+        }
+        return maxError;
+    }
+}
+
+TEST_CASE( "VerticalDatum grid transform matches the per-post transform" ) {
+
+    osg::ref_ptr<VerticalDatum> datum = createDatum();
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+
+    // one tile inside the geoid, and one on its east edge
+    TileKey keys[2] = { TileKey(3, 5, 2, profile), TileKey(2, 7, 1, profile) };
+
+    for (unsigned k = 0; k < 2; ++k)
+    {
+        const GeoExtent& extent = keys[k].getExtent();
+
+        SECTION( "MSL to HAE, extent " + keys[k].str() ) {
+            osg::ref_ptr<osg::HeightField> expected = createHeightField(33);
+            osg::ref_ptr<osg::HeightField> actual = createHeightField(33);
+            VerticalDatum::transformPerPost(datum.get(), 0L, extent, expected.get());
+            VerticalDatum::transform(datum.get(), 0L, extent, actual.get());
+            REQUIRE(compare(expected.get(), actual.get()) >= 0.0f);
+            REQUIRE(compare(expected.get(), actual.get()) < 1e-3f);
+        }
+
+        SECTION( "HAE to MSL, tile key " + keys[k].str() ) {
+            osg::ref_ptr<osg::HeightField> expected = createHeightField(33);
+            VerticalDatum::transformPerPost(0L, datum.get(), extent, expected.get());
+
+            // the second pass comes from the cached geoid heights
+            for (unsigned pass = 0; pass < 2; ++pass)
+            {
+                osg::ref_ptr<osg::HeightField> actual = createHeightField(33);
+                VerticalDatum::transform(0L, datum.get(), keys[k], actual.get());
+                REQUIRE(compare(expected.get(), actual.get()) >= 0.0f);
+                REQUIRE(compare(expected.get(), actual.get()) < 1e-3f);
+            }
+        }
+    }
+
+    SECTION( "Cached geoid heights depend on the grid size" ) {
+        osg::ref_ptr<osg::FloatArray> small, large;
+        REQUIRE(datum->getGeoidHeights(keys[0], 9, 9, small));
+        REQUIRE(datum->getGeoidHeights(keys[0], 17, 17, large));
+        REQUIRE(small->size() == 81u);
+        REQUIRE(large->size() == 289u);
+        REQUIRE((*small)[80] == (*large)[288]);
+    }
+}
+
+TEST_CASE( "VerticalDatum grid transform honors msl2hae and hae2msl overrides" ) {
+
+    osg::ref_ptr<VerticalDatum> plain = createDatum();
+    osg::ref_ptr<VerticalDatum> offset = new OffsetDatum(createGeoid());
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    TileKey key(3, 5, 2, profile);
+
+    // subclasses get the per-post transforms unless they opt in
+    REQUIRE(plain->usesGeoidHeights());
+    REQUIRE_FALSE(offset->usesGeoidHeights());
+
+    osg::ref_ptr<osg::HeightField> expected = createHeightField(17);
+    VerticalDatum::transformPerPost(offset.get(), 0L, key.getExtent(), expected.get());
+
+    osg::ref_ptr<osg::HeightField> viaExtent = createHeightField(17);
+    VerticalDatum::transform(offset.get(), 0L, key.getExtent(), viaExtent.get());
+    REQUIRE(compare(expected.get(), viaExtent.get()) == 0.0f);
+
+    osg::ref_ptr<osg::HeightField> viaKey = createHeightField(17);
+    VerticalDatum::transform(offset.get(), 0L, key, viaKey.get());
+    REQUIRE(compare(expected.get(), viaKey.get()) == 0.0f);
+
+    // and the offset really was applied
+    osg::ref_ptr<osg::HeightField> viaPlain = createHeightField(17);
+    VerticalDatum::transform(plain.get(), 0L, key, viaPlain.get());
+    REQUIRE(compare(viaPlain.get(), viaKey.get()) > 99.0f);
+}